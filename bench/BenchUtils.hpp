@@ -0,0 +1,40 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#pragma once
+
+
+/**
+ * @brief Time a function and print the throughput
+ *
+ * Runs the function a few times and keeps the fastest run. Anything that has
+ * to be put back before a run goes in reset, which isn't timed.
+ *
+ * @param name The name to print
+ * @param amount How much work one run does, in the units of the throughput
+ * @param unit The units of the throughput, per second
+ * @param function The function to time
+ * @param runs The number of runs
+ * @param reset Called before every run, if set
+ *
+ * @return double The fastest run in seconds
+ *
+*/
+inline double timeit(const std::string &name, double amount, const std::string &unit, const std::function<void()> &function,
+                     int runs = 5, const std::function<void()> &reset = nullptr) {
+    double best = 1e30;
+    for (int run = 0; run < runs; run++) {
+        if (reset) {
+            reset();
+        }
+        auto start = std::chrono::steady_clock::now();
+        function();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    std::cout << "  " << name << ": " << best*1e3 << " ms, " << amount/best << " " << unit << std::endl;
+    return best;
+}
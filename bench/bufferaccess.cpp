@@ -0,0 +1,66 @@
+#include "MTLCompute.hpp"
+#include "BenchUtils.hpp"
+
+int main() {
+
+    const size_t length = 1 << 24;
+
+    // Create a GPU device
+    MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+    // Fill a plain vector and a buffer with the same data
+    std::vector<float> array(length, 1.0);
+    MTLCompute::Buffer<float> buffer(gpu, length, MTLCompute::ResourceStorage::Shared);
+    buffer = array;
+    double elements = length/1e9;
+
+    // Sum a plain array
+    float expected = 0;
+    timeit("std::vector", elements, "G elements/s", [&]() {
+        expected = 0;
+        for (size_t i = 0; i < length; i++) {
+            expected += array[i];
+        }
+    }, 10);
+
+    // Sum with the [] operator (checked unless built with MTLCOMPUTE_UNCHECKED_ACCESS)
+    const MTLCompute::Buffer<float> &constbuffer = buffer;
+    float indexed = 0;
+    timeit("Buffer [] operator", elements, "G elements/s", [&]() {
+        indexed = 0;
+        for (size_t i = 0; i < length; i++) {
+            indexed += constbuffer[i];
+        }
+    }, 10);
+
+    // Sum through a pointer taken once before the loop
+    float pointer = 0;
+    timeit("Buffer data() pointer", elements, "G elements/s", [&]() {
+        const float *values = constbuffer.data();
+        pointer = 0;
+        for (size_t i = 0; i < length; i++) {
+            pointer += values[i];
+        }
+    }, 10);
+
+    // Scale in place, the vector and the buffer get the same number of runs
+    timeit("std::vector write", elements, "G elements/s", [&]() {
+        for (size_t i = 0; i < length; i++) {
+            array[i] *= 1.0001f;
+        }
+    }, 10);
+    timeit("Buffer contents() write", elements, "G elements/s", [&]() {
+        float *values = buffer.contents();
+        for (size_t i = 0; i < length; i++) {
+            values[i] *= 1.0001f;
+        }
+    }, 10);
+
+    // Every way of getting at the data has to see the same data
+    if (indexed != expected || pointer != expected || !std::equal(array.begin(), array.end(), constbuffer.begin())) {
+        std::cerr << "Buffer access doesn't match std::vector" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "MTLCompute.hpp"
+#include "BenchUtils.hpp"
+
+int main() {
+
+    // Create a GPU device
+    MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+    MTLCompute::Elementwise<float> elementwise(gpu, 0);
+
+    for (size_t length : {size_t(1) << 14, size_t(1) << 20, size_t(1) << 24, size_t(1) << 26}) {
+        std::cout << length << " elements, d = sqrt(a*a + b*b)*0.5 + c:" << std::endl;
+        MTLCompute::Buffer<float> a(gpu, length, MTLCompute::ResourceStorage::Shared);
+        MTLCompute::Buffer<float> b(gpu, length, MTLCompute::ResourceStorage::Shared);
+        MTLCompute::Buffer<float> c(gpu, length, MTLCompute::ResourceStorage::Shared);
+        MTLCompute::Buffer<float> d(gpu, length, MTLCompute::ResourceStorage::Shared);
+        MTLCompute::Buffer<float> temp(gpu, length, MTLCompute::ResourceStorage::Shared);
+        std::fill(a.begin(), a.end(), 3.0f);
+        std::fill(b.begin(), b.end(), 4.0f);
+        std::fill(c.begin(), c.end(), 1.0f);
+        // Three reads and one write, the least any version can move
+        double gigabytes = 4*length*sizeof(float)/1e9;
+
+        timeit("host::evaluate", gigabytes, "GB/s", [&]() {
+            MTLCompute::host::evaluate(MTLCompute::sqrt(a*a + b*b)*0.5f + c, d.contents(), length);
+        });
+
+        // One dispatch per operator with an intermediate buffer, like separate kernels would do
+        timeit("Elementwise, one dispatch per operator", gigabytes, "GB/s", [&]() {
+            elementwise.assign(temp, a*a);
+            elementwise.assign(d, b*b);
+            elementwise.assign(temp, temp + d);
+            elementwise.assign(temp, MTLCompute::sqrt(temp));
+            elementwise.assign(temp, temp*0.5f);
+            elementwise.assign(d, temp + c);
+        });
+        timeit("Elementwise, fused", gigabytes, "GB/s", [&]() {
+            elementwise.assign(d, MTLCompute::sqrt(a*a + b*b)*0.5f + c);
+        });
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "MTLCompute.hpp"
+#include "BenchUtils.hpp"
+
+/**
+ * @brief Time every way of multiplying square matrices of one type
+ *
+ * @param gpu The Metal device object
+ * @param type The name of the element type to print
+ *
+*/
+template<typename T>
+void bench(MTL::Device *gpu, const std::string &type) {
+    MTLCompute::Gemm<T> gemm(gpu);
+    bool simd = gemm.getSimdgroupMatrix();
+
+    for (size_t size : {128, 512, 1024, 2048, 4096}) {
+        std::cout << type << ", " << size << "x" << size << ":" << std::endl;
+        MTLCompute::GemmShape shape;
+        shape.m = size;
+        shape.n = size;
+        shape.k = size;
+        double gigaflops = 2.0*size*size*size/1e9;
+        MTLCompute::Buffer<T> a(gpu, size*size, MTLCompute::ResourceStorage::Shared);
+        MTLCompute::Buffer<T> b(gpu, size*size, MTLCompute::ResourceStorage::Shared);
+        MTLCompute::Buffer<T> c(gpu, size*size, MTLCompute::ResourceStorage::Shared);
+        std::fill(a.begin(), a.end(), T(1.0f));
+        std::fill(b.begin(), b.end(), T(0.5f));
+
+        // The host is slow enough that the biggest sizes aren't worth waiting for
+        if (size <= 1024) {
+            std::vector<T> hostC(size*size);
+            timeit("host::gemm", gigaflops, "GFLOP/s", [&]() {
+                MTLCompute::host::gemm(std::as_const(a).data(), std::as_const(b).data(), hostC.data(), shape);
+            });
+        }
+        gemm.setSimdgroupMatrix(false);
+        timeit("Gemm, tiled", gigaflops, "GFLOP/s", [&]() {
+            gemm.multiply(a, b, c, shape);
+        });
+        if (simd) {
+            gemm.setSimdgroupMatrix(true);
+            timeit("Gemm, simdgroup matrix", gigaflops, "GFLOP/s", [&]() {
+                gemm.multiply(a, b, c, shape);
+            });
+        }
+
+        // The same work split into a batch of 16 smaller multiplications
+        MTLCompute::GemmShape batched = shape;
+        batched.m = size/4;
+        batched.n = size/4;
+        batched.k = size/4;
+        batched.batch = 16;
+        batched.strideA = batched.m*batched.k;
+        batched.strideB = batched.k*batched.n;
+        batched.strideC = batched.m*batched.n;
+        timeit("Gemm, batch of 16", 16*2.0*batched.m*batched.n*batched.k/1e9, "GFLOP/s", [&]() {
+            gemm.multiply(a, b, c, batched);
+        });
+    }
+}
+
+int main() {
+
+    // Create a GPU device
+    MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+    bench<float>(gpu, "float");
+    bench<MTLCompute::half>(gpu, "half");
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "MTLCompute.hpp"
+#include "BenchUtils.hpp"
+
+int main() {
+
+    // Create a GPU device
+    MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+    for (size_t length : {size_t(1) << 16, size_t(1) << 20, size_t(1) << 24}) {
+        std::cout << length << " floats:" << std::endl;
+        MTLCompute::Buffer<float> buffer(gpu, length, MTLCompute::ResourceStorage::Shared);
+        for (size_t i = 0; i < length; i++) {
+            buffer[i] = float(i % 1000)/1000;
+        }
+        // Few bins is the worst case for contention, lots of bins don't fit in threadgroup memory
+        for (size_t bins : {16, 256, 100000}) {
+            MTLCompute::Histogram<float> histogram(gpu, bins, 0, 1, 0);
+            std::vector<uint32_t> counts(bins);
+            timeit(std::to_string(bins) + " bins, host::histogram", length*sizeof(float)/1e9, "GB/s", [&]() {
+                MTLCompute::host::histogram(std::as_const(buffer).data(), length, bins, 0, 1, counts.data());
+            });
+            timeit(std::to_string(bins) + " bins, Histogram", length*sizeof(float)/1e9, "GB/s", [&]() {
+                histogram.count(buffer);
+            });
+        }
+    }
+
+    // A 4K RGBA image, one bin per value
+    using Pixel = std::array<uint8_t, 4>;
+    int width = 3840, height = 2160;
+    std::vector<Pixel> pixels((size_t)width*height);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = {uint8_t(i), uint8_t(i >> 8), uint8_t(i >> 16), 255};
+    }
+    MTLCompute::Texture<Pixel> image(gpu, width, height);
+    image.writeRegion(0, 0, width, height, pixels.data());
+    MTLCompute::Histogram<Pixel> histogram(gpu, 256, 0, 256);
+    std::vector<uint32_t> counts(4*256);
+    std::cout << width << "x" << height << " RGBA8 image:" << std::endl;
+    timeit("host::histogram", pixels.size()*sizeof(Pixel)/1e9, "GB/s", [&]() {
+        MTLCompute::host::histogram(pixels.data(), pixels.size(), 256, 0, 256, counts.data());
+    });
+    timeit("Histogram", pixels.size()*sizeof(Pixel)/1e9, "GB/s", [&]() {
+        histogram.count(image);
+    });
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "MTLCompute.hpp"
+#include <chrono>
+
+// Makes a library with a lot of small kernels, SEED keeps the two runs from sharing Metal's shader cache
+std::string makeSource(int kernels) {
+    std::string source = "#include <metal_stdlib>\nusing namespace metal;\n";
+    for (int k = 0; k < kernels; k++) {
+        source += "kernel void k" + std::to_string(k) + "(device float *a [[buffer(0)]], uint i [[thread_position_in_grid]]) {\n"
+                  "    float x = a[i];\n"
+                  "    for (int j = 0; j < " + std::to_string(8 + k) + "; j++) { x = fma(x, SEED, float(j)); }\n"
+                  "    a[i] = x;\n}\n";
+    }
+    return source;
+}
+
+int main() {
+
+    const int kernels = 40;
+
+    // Create a GPU device
+    MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+    std::string source = makeSource(kernels);
+
+    // No disk cache, so both ways compile every pipeline
+    MTLCompute::LibraryCache::setDirectory("");
+
+    // One useFunction after another
+    std::vector<MTLCompute::Kernel> serial;
+    serial.reserve(kernels);
+    for (int k = 0; k < kernels; k++) {
+        serial.emplace_back(gpu, MTLCompute::KernelSource{source, {{"SEED", "1.5f"}}});
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int k = 0; k < kernels; k++) {
+        serial[k].useFunction("k" + std::to_string(k));
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "one at a time: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+    // Every compile started at once
+    std::vector<MTLCompute::Kernel> batched;
+    batched.reserve(kernels);
+    for (int k = 0; k < kernels; k++) {
+        batched.emplace_back(gpu, MTLCompute::KernelSource{source, {{"SEED", "2.5f"}}});
+    }
+    MTLCompute::PipelineBatch batch;
+    for (int k = 0; k < kernels; k++) {
+        batch.add(batched[k], "k" + std::to_string(k));
+    }
+    batch.wait();
+    std::cout << "batch: " << batch.getMilliseconds() << " ms" << std::endl;
+
+    double slowest = 0;
+    for (const MTLCompute::PipelineTiming &timing : batch.getTimings()) {
+        slowest = std::max(slowest, timing.milliseconds);
+    }
+    std::cout << "slowest kernel: " << slowest << " ms" << std::endl;
+
+    return 0;
+}
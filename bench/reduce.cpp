@@ -0,0 +1,41 @@
+#include "MTLCompute.hpp"
+#include "BenchUtils.hpp"
+#include <numeric>
+
+int main() {
+
+    // Create a GPU device
+    MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+    MTLCompute::Reducer<float> reducer(gpu, 0);
+
+    for (size_t length : {size_t(1) << 10, size_t(1) << 14, size_t(1) << 20, size_t(1) << 24, size_t(1) << 28, size_t(1000000000)}) {
+        if (length*sizeof(float) > gpu->maxBufferLength()) {
+            std::cout << length << " elements: too big for this GPU" << std::endl;
+            continue;
+        }
+        std::cout << length << " elements:" << std::endl;
+        MTLCompute::Buffer<float> buffer(gpu, length, MTLCompute::ResourceStorage::Shared);
+        std::fill(buffer.begin(), buffer.end(), 1.0f);
+        double gigabytes = length*sizeof(float)/1e9;
+        // Every result goes in here so none of the work can be skipped
+        float sink = 0;
+
+        // Copy everything to the host and add it up there, what people do now
+        timeit("getData + accumulate", gigabytes, "GB/s", [&]() {
+            std::vector<float> data = buffer.getData();
+            sink += std::accumulate(data.begin(), data.end(), 0.0f);
+        });
+        timeit("host::sum", gigabytes, "GB/s", [&]() {
+            sink += MTLCompute::host::sum(std::as_const(buffer).data(), length);
+        });
+        timeit("Reducer::sum", gigabytes, "GB/s", [&]() {
+            sink += reducer.sum(buffer);
+        });
+        timeit("Reducer::argmax", gigabytes, "GB/s", [&]() {
+            sink += (float)reducer.argmax(buffer);
+        });
+        std::cout << "  (" << sink << ")" << std::endl;
+    }
+
+    return 0;
+}
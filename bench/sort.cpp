@@ -0,0 +1,64 @@
+#include "MTLCompute.hpp"
+#include "BenchUtils.hpp"
+#include <random>
+
+/**
+ * @brief Time every way of sorting one key type
+ *
+ * @param gpu The Metal device object
+ * @param type The name of the key type to print
+ *
+*/
+template<typename K>
+void bench(MTL::Device *gpu, const std::string &type) {
+    MTLCompute::RadixSorter<K> sorter(gpu, 0);
+    std::mt19937_64 rng(42);
+
+    for (size_t length : {size_t(1) << 16, size_t(1) << 20, size_t(10000000), size_t(50000000)}) {
+        if (length*sizeof(K) > gpu->maxBufferLength()) {
+            std::cout << type << ", " << length << " keys: too big for this GPU" << std::endl;
+            continue;
+        }
+        std::cout << type << ", " << length << " keys:" << std::endl;
+        std::vector<K> keys(length);
+        for (K &key : keys) {
+            key = K(rng() >> 8);
+        }
+        std::vector<uint32_t> indices(length);
+        MTLCompute::Buffer<K> buffer(gpu, length, MTLCompute::ResourceStorage::Shared);
+        MTLCompute::Buffer<uint32_t> values(gpu, length, MTLCompute::ResourceStorage::Shared);
+        std::vector<K> data;
+        double millions = length/1e6;
+
+        // Copy everything to the host, sort it there and copy it back, what people do now
+        timeit("getData + std::sort + upload", millions, "Mkeys/s", [&]() {
+            data = buffer.getData();
+            std::sort(data.begin(), data.end());
+            buffer = data;
+        }, 3, [&]() { buffer = keys; });
+        timeit("host::radixSort", millions, "Mkeys/s", [&]() {
+            MTLCompute::host::radixSort(data.data(), length);
+        }, 3, [&]() { data = keys; });
+        timeit("RadixSorter::sort", millions, "Mkeys/s", [&]() {
+            sorter.sort(buffer);
+        }, 3, [&]() { buffer = keys; });
+        timeit("host::radixSort, key-value", millions, "Mkeys/s", [&]() {
+            MTLCompute::host::radixSort(data.data(), indices.data(), length);
+        }, 3, [&]() { data = keys; });
+        timeit("RadixSorter::sort, key-value", millions, "Mkeys/s", [&]() {
+            sorter.sort(buffer, values);
+        }, 3, [&]() { buffer = keys; });
+    }
+}
+
+int main() {
+
+    // Create a GPU device
+    MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+    bench<uint32_t>(gpu, "uint32_t");
+    bench<float>(gpu, "float");
+    bench<uint64_t>(gpu, "uint64_t");
+
+    return 0;
+}
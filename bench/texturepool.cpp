@@ -0,0 +1,34 @@
+#include "MTLCompute.hpp"
+#include <chrono>
+
+int main() {
+
+    const int frames = 1000;
+
+    // Create a GPU device
+    MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+    std::vector<float> frame(1920*1080, 1.0);
+
+    // Make a new texture every frame
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        MTLCompute::Texture<float> texture(gpu, 1920, 1080);
+        texture.writeRegion(0, 0, 1920, 1080, frame.data());
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "new texture: " << std::chrono::duration<double, std::micro>(end - start).count()/frames << " us/frame" << std::endl;
+
+    // Reuse a texture from the pool every frame
+    MTLCompute::TexturePool pool(gpu);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++) {
+        MTLCompute::Texture<float> texture = pool.acquire<float>(1920, 1080);
+        texture.writeRegion(0, 0, 1920, 1080, frame.data());
+        pool.recycle(texture);
+    }
+    end = std::chrono::steady_clock::now();
+    std::cout << "pooled texture: " << std::chrono::duration<double, std::micro>(end - start).count()/frames << " us/frame";
+    std::cout << " (hit rate " << pool.getStats().hitRate() << ")" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+# Embeds a compiled .metallib into a target as a byte array, so the kernels can be
+# loaded with MTLCompute::Kernel(gpu, data, size) without reading a file at runtime.
+#
+#   mtlcompute_embed_metallib(TARGET mytarget METALLIB path/to/default.metallib NAME default_metallib [DEPENDS metal])
+#
+# Adds ${NAME}.hpp to the target's include path. It defines ${NAME} (the bytes) and
+# ${NAME}_size. DEPENDS names the targets that build the metallib.
+
+if (CMAKE_SCRIPT_MODE_FILE)
+
+    # Script mode, called at build time to write the header
+    file(READ ${METALLIB} HEXBYTES HEX)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," HEXBYTES "${HEXBYTES}")
+    # CMake regexes have no {n}, so spell out 16 bytes per line
+    string(REPEAT "0x[0-9a-f][0-9a-f]," 16 LINE)
+    string(REGEX REPLACE "(${LINE})" "\\1\n    " HEXBYTES "${HEXBYTES}")
+    set(CONTENTS "#include <cstddef>\n\n#pragma once\n\n")
+    string(APPEND CONTENTS "alignas(16) inline constexpr unsigned char ${NAME}[] = {\n    ${HEXBYTES}\n};\n")
+    string(APPEND CONTENTS "inline constexpr size_t ${NAME}_size = sizeof(${NAME});\n")
+
+    # Only touch the header when the metallib changed so dependents don't rebuild
+    set(OLDCONTENTS "")
+    if (EXISTS ${HEADER})
+        file(READ ${HEADER} OLDCONTENTS)
+    endif()
+    if (NOT CONTENTS STREQUAL OLDCONTENTS)
+        file(WRITE ${HEADER} "${CONTENTS}")
+    endif()
+    return()
+
+endif()
+
+set(MTLCOMPUTE_EMBED_SCRIPT ${CMAKE_CURRENT_LIST_FILE})
+
+function(mtlcompute_embed_metallib)
+    cmake_parse_arguments(EMBED "" "TARGET;METALLIB;NAME" "DEPENDS" ${ARGN})
+    if (NOT EMBED_TARGET OR NOT EMBED_METALLIB OR NOT EMBED_NAME)
+        message(FATAL_ERROR "mtlcompute_embed_metallib needs TARGET, METALLIB and NAME")
+    endif()
+
+    set(EMBED_DIR ${CMAKE_CURRENT_BINARY_DIR}/embedded)
+    set(EMBED_HEADER ${EMBED_DIR}/${EMBED_NAME}.hpp)
+
+    # One generator target per metallib, shared by every target that embeds it
+    if (NOT TARGET embed_${EMBED_NAME})
+        add_custom_target(embed_${EMBED_NAME}
+            COMMAND ${CMAKE_COMMAND} -DMETALLIB=${EMBED_METALLIB} -DHEADER=${EMBED_HEADER} -DNAME=${EMBED_NAME} -P ${MTLCOMPUTE_EMBED_SCRIPT}
+            BYPRODUCTS ${EMBED_HEADER}
+            COMMENT "Embedding ${EMBED_METALLIB}"
+            VERBATIM
+        )
+        if (EMBED_DEPENDS)
+            add_dependencies(embed_${EMBED_NAME} ${EMBED_DEPENDS})
+        endif()
+    endif()
+
+    add_dependencies(${EMBED_TARGET} embed_${EMBED_NAME})
+    target_include_directories(${EMBED_TARGET} PRIVATE ${EMBED_DIR})
+endfunction()
@@ -1,8 +1,21 @@
 #include "MTLComputeGlobals.hpp"
+#include "MTLComputeTypes.hpp"
 #include "MTLComputeBuffer.hpp"
 #include "MTLComputeKernel.hpp"
+#include "MTLComputeKernelFn.hpp"
+#include "MTLComputePipelineBatch.hpp"
 #include "MTLComputeCommandManager.hpp"
 #include "MTLComputeTexture.hpp"
+#include "MTLComputeTiledImage.hpp"
+#include "MTLComputeTexturePool.hpp"
+#include "MTLComputeMipmap.hpp"
+#include "MTLComputeReduce.hpp"
+#include "MTLComputeScan.hpp"
+#include "MTLComputeSort.hpp"
+#include "MTLComputeGemm.hpp"
+#include "MTLComputeStencil.hpp"
+#include "MTLComputeElementwise.hpp"
+#include "MTLComputeHistogram.hpp"
 
 #pragma once
 
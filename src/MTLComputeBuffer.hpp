@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <iostream>
+#include <span>
 #include <vector>
 #include "MTLComputeGlobals.hpp"
 
@@ -6,6 +8,97 @@
 
 namespace MTLCompute {
 
+    /**
+     * @brief A reference counted set of coalesced byte ranges
+     *
+     * Keeps the [begin, end) byte ranges of a buffer that were written on the host
+     * and haven't been sent to the GPU yet. Overlapping and touching ranges are merged
+     * so the set always holds the minimal number of intervals. It's shared between
+     * every copy of a Buffer so that writes through any copy get flushed.
+     *
+    */
+    class DirtyRanges {
+        private:
+            std::vector<std::pair<size_t, size_t>> ranges; ///< The sorted, non-overlapping ranges
+            int references = 1; ///< The number of buffers using this object
+
+        public:
+            /**
+             * @brief Add a range to the set
+             *
+             * Merges the range with any range it overlaps or touches
+             *
+             * @param begin The first byte of the range
+             * @param end One past the last byte of the range
+             *
+            */
+            void add(size_t begin, size_t end) {
+                if (begin >= end) {
+                    return;
+                }
+                // first range that ends at or after the new one starts
+                auto first = std::lower_bound(this->ranges.begin(), this->ranges.end(), begin,
+                        [](const std::pair<size_t, size_t> &range, size_t value) { return range.second < value; });
+                auto last = first;
+                while (last != this->ranges.end() && last->first <= end) {
+                    begin = std::min(begin, last->first);
+                    end = std::max(end, last->second);
+                    last++;
+                }
+                first = this->ranges.erase(first, last);
+                this->ranges.insert(first, {begin, end});
+            }
+
+            /**
+             * @brief Remove every range from the set
+             *
+            */
+            void clear() {
+                this->ranges.clear();
+            }
+
+            /**
+             * @brief Check if the set has no ranges
+             *
+             * @return bool Whether the set is empty
+             *
+            */
+            bool empty() const {
+                return this->ranges.empty();
+            }
+
+            /**
+             * @brief Get the ranges in the set
+             *
+             * @return const std::vector<std::pair<size_t, size_t>>& The sorted [begin, end) byte ranges
+             *
+            */
+            const std::vector<std::pair<size_t, size_t>> &get() const {
+                return this->ranges;
+            }
+
+            /**
+             * @brief Add a reference to the object
+             *
+            */
+            void retain() {
+                this->references++;
+            }
+
+            /**
+             * @brief Remove a reference from the object
+             *
+             * @return bool Whether that was the last reference and the object should be deleted
+             *
+            */
+            bool release() {
+                return --this->references == 0;
+            }
+    };
+
+    template<typename T>
+    class BufferView;
+
     template<typename T>
     class Buffer {
         private:
@@ -13,6 +106,8 @@ namespace MTLCompute {
             MTL::Buffer *buffer; ///< The Metal buffer object
             bool freed = false; ///< Whether the buffer has been freed
             MTLCompute::ResourceStorage storageMode; ///< The storage mode of the buffer
+            DirtyRanges *dirty; ///< The host writes that haven't been flushed (Managed only)
+            T *pointer; ///< The contents of the buffer, cached so element access skips the Metal call
 
             void swap(Buffer &buffer) noexcept {
                 using std::swap;
@@ -21,6 +116,39 @@ namespace MTLCompute {
                 swap(this->length, buffer.length);
                 swap(this->itemsize, buffer.itemsize);
                 swap(this->storageMode, buffer.storageMode);
+                swap(this->dirty, buffer.dirty);
+                swap(this->pointer, buffer.pointer);
+            }
+
+            /**
+             * @brief Record a host write to a range of elements
+             *
+             * Does nothing unless the buffer is Managed, since Shared buffers
+             * don't need to be synchronized
+             *
+             * @param offset The first element written
+             * @param count The number of elements written
+             *
+            */
+            void track(size_t offset, size_t count) {
+                if (this->storageMode == MTLCompute::ResourceStorage::Managed) {
+                    this->dirty->add(offset*this->itemsize, (offset + count)*this->itemsize);
+                }
+            }
+
+            /**
+             * @brief Throw if the buffer is freed or an index is out of bounds
+             *
+             * @param index The index to check
+             *
+            */
+            void check(size_t index) const {
+                if (this->freed) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (index >= this->length) {
+                    throw std::out_of_range("Index out of bounds");
+                }
             }
             
         public:
@@ -42,6 +170,8 @@ namespace MTLCompute {
                 this->storageMode = storageMode;
                 this->buffer = gpu->newBuffer(length*itemsize, static_cast<MTL::ResourceOptions>(storageMode));
                 this->buffer->retain();
+                this->dirty = new DirtyRanges();
+                this->pointer = (T *)this->buffer->contents();
             }
 
 
@@ -59,6 +189,11 @@ namespace MTLCompute {
                 this->itemsize = other.itemsize;
                 this->storageMode = other.storageMode;
                 this->buffer = other.buffer;
+                this->dirty = other.dirty;
+                this->pointer = other.pointer;
+                if (this->dirty != nullptr) {
+                    this->dirty->retain();
+                }
             }
 
 
@@ -74,24 +209,35 @@ namespace MTLCompute {
                 this->itemsize = -1;
                 this->storageMode = MTLCompute::ResourceStorage::Shared;
                 this->buffer = nullptr;
+                this->dirty = nullptr;
+                this->pointer = nullptr;
             }
 
             /**
              * @brief Destructor for the Buffer class
              *
-             * Calls autorelease on the buffer object
+             * Calls autorelease on the buffer object, releases the dirty ranges
              * and sets the freed flag to true
              *
             */
             ~Buffer() {
                 if (!this->freed) {
                     this->buffer->autorelease();
+                    if (this->dirty != nullptr && this->dirty->release()) {
+                        delete this->dirty;
+                    }
+                    this->dirty = nullptr;
                     this->freed = true;
                 }
             }
 
             /**
              * @brief Get the contents of the buffer
+             *
+             * The pointer can be written through, so for Managed buffers
+             * the whole buffer is marked dirty. Use Buffer::span or Buffer::markDirty
+             * if you only change part of it. Get the pointer once before a loop
+             * instead of indexing the buffer for the fastest host access.
              * 
              * @return T* The contents of the buffer
              *
@@ -100,41 +246,263 @@ namespace MTLCompute {
                 if (this->freed) {
                     throw std::runtime_error("Buffer already freed");
                 }
-                return (T *)this->buffer->contents();
+                this->track(0, this->length);
+                return this->pointer;
+            }
+
+            /**
+             * @brief Get a pointer to the contents of the buffer
+             *
+             * Doesn't mark anything dirty, so it's free to read through. After writing
+             * through it, call Buffer::markDirty on what changed, or use Buffer::span
+             * or Buffer::contents instead.
+             *
+             * @return T* The contents of the buffer
+             *
+            */
+            T *data() {
+                if (this->freed) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                return this->pointer;
+            }
+
+            /**
+             * @brief Get a read only pointer to the contents of the buffer
+             *
+             * Doesn't mark anything dirty
+             *
+             * @return const T* The contents of the buffer
+             *
+            */
+            const T *data() const {
+                if (this->freed) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                return this->pointer;
+            }
+
+            /**
+             * @brief Get an iterator to the first element
+             *
+             * Buffers are contiguous, so the iterators are plain pointers and work with
+             * every standard algorithm and with std::ranges.
+             * Like Buffer::contents, this marks a Managed buffer dirty.
+             *
+             * @return T* The first element
+             *
+            */
+            T *begin() {
+                return this->contents();
+            }
+
+            /**
+             * @brief Get an iterator past the last element
+             *
+             * @return T* One past the last element
+             *
+            */
+            T *end() {
+                return this->contents() + this->length;
+            }
+
+            /**
+             * @brief Get a read only iterator to the first element
+             *
+             * @return const T* The first element
+             *
+            */
+            const T *begin() const {
+                return this->data();
+            }
+
+            /**
+             * @brief Get a read only iterator past the last element
+             *
+             * @return const T* One past the last element
+             *
+            */
+            const T *end() const {
+                return this->data() + this->length;
+            }
+
+            /**
+             * @brief Get a read only iterator to the first element
+             *
+             * @return const T* The first element
+             *
+            */
+            const T *cbegin() const {
+                return this->begin();
+            }
+
+            /**
+             * @brief Get a read only iterator past the last element
+             *
+             * @return const T* One past the last element
+             *
+            */
+            const T *cend() const {
+                return this->end();
+            }
+
+            /**
+             * @brief Get the number of elements in the buffer
+             *
+             * @return size_t The length of the buffer
+             *
+            */
+            size_t size() const {
+                return this->length;
+            }
+
+            /**
+             * @brief Get a writable view of part of the buffer
+             *
+             * Marks only the viewed elements as dirty
+             *
+             * @param offset The first element of the view
+             * @param count The number of elements in the view
+             *
+             * @return std::span<T> The view
+             *
+            */
+            std::span<T> span(size_t offset, size_t count) {
+                if (this->freed) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (offset > this->length || count > this->length - offset) {
+                    throw std::out_of_range("Span out of bounds");
+                }
+                this->track(offset, count);
+                return std::span<T>(this->pointer + offset, count);
+            }
+
+            /**
+             * @brief Get a view of part of the buffer
+             *
+             * The view shares memory with the buffer and can be loaded
+             * into a CommandManager on its own
+             *
+             * @param offset The first element of the view
+             * @param count The number of elements in the view
+             *
+             * @return BufferView<T> The view
+             *
+            */
+            BufferView<T> view(size_t offset, size_t count) {
+                return BufferView<T>(*this, offset, count);
+            }
+
+            /**
+             * @brief Mark a range of elements as written on the host
+             *
+             * Only needed after writing through a pointer from Buffer::getBuffer.
+             * Does nothing for Shared buffers.
+             *
+             * @param offset The first element written
+             * @param count The number of elements written
+             *
+            */
+            void markDirty(size_t offset, size_t count) {
+                if (this->freed) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (offset > this->length || count > this->length - offset) {
+                    throw std::out_of_range("Range out of bounds");
+                }
+                this->track(offset, count);
+            }
+
+            /**
+             * @brief Send the dirty ranges to the GPU
+             *
+             * Calls didModifyRange once for every coalesced range and clears them.
+             * CommandManager::dispatch calls this for every loaded buffer.
+             *
+            */
+            void flush() const {
+                if (this->freed || this->dirty == nullptr || this->dirty->empty()) {
+                    return;
+                }
+                for (const auto &range : this->dirty->get()) {
+                    this->buffer->didModifyRange(NS::Range(range.first, range.second - range.first));
+                }
+                this->dirty->clear();
+            }
+
+            /**
+             * @brief Get the ranges waiting to be flushed
+             *
+             * @return std::vector<std::pair<size_t, size_t>> The [begin, end) byte ranges
+             *
+            */
+            std::vector<std::pair<size_t, size_t>> getDirtyRanges() const {
+                if (this->dirty == nullptr) {
+                    return {};
+                }
+                return this->dirty->get();
             }
 
             /**
              * @brief Overload the [] operator to get the value at an index
              *
+             * The index is only checked if MTLCOMPUTE_UNCHECKED_ACCESS isn't defined
+             *
              * @param index The index to get the value from
              * @return T The value at the index
              *
             */
             T operator[](size_t index) const {
-                if (this->freed) {
-                    throw std::runtime_error("Buffer already freed");
+                if constexpr (CHECKED_ACCESS) {
+                    this->check(index);
                 }
-                if (index >= this->length) {
-                    throw std::out_of_range("Index out of bounds");
-                }
-                return ((T *)this->buffer->contents())[index];
+                return this->pointer[index];
             }
 
             /**
              * @brief Overload the [] operator to set the value at an index
              *
+             * For Managed buffers the element is marked dirty. The index is
+             * only checked if MTLCOMPUTE_UNCHECKED_ACCESS isn't defined
+             *
              * @param index The index to set the value at
              * @return T The value to set at the index
              *
             */
             T& operator[](size_t index) {
-                if (this->freed) {
-                    throw std::runtime_error("Buffer already freed");
+                if constexpr (CHECKED_ACCESS) {
+                    this->check(index);
                 }
-                if (index >= this->length) {
-                    throw std::out_of_range("Index out of bounds");
-                }
-                return ((T *)this->buffer->contents())[index];
+                this->track(index, 1);
+                return this->pointer[index];
+            }
+
+            /**
+             * @brief Get the value at an index, always checking the index
+             *
+             * Same as the [] operator when MTLCOMPUTE_UNCHECKED_ACCESS isn't defined
+             *
+             * @param index The index to get the value from
+             * @return T The value at the index
+             *
+            */
+            T at(size_t index) const {
+                this->check(index);
+                return this->pointer[index];
+            }
+
+            /**
+             * @brief Get a reference to the value at an index, always checking the index
+             *
+             * @param index The index to set the value at
+             * @return T& The value at the index
+             *
+            */
+            T& at(size_t index) {
+                this->check(index);
+                this->track(index, 1);
+                return this->pointer[index];
             }
 
             /**
@@ -150,11 +518,8 @@ namespace MTLCompute {
                 if (data.size() != this->length) {
                     throw std::invalid_argument("Data size does not match buffer size");
                 }
-                memcpy(this->buffer->contents(), data.data(), this->length*this->itemsize);
-
-                if (this->storageMode == MTLCompute::ResourceStorage::Managed) {
-                    this->buffer->didModifyRange(NS::Range(0, this->length*this->itemsize));
-                }
+                memcpy(this->pointer, data.data(), this->length*this->itemsize);
+                this->track(0, this->length);
             }
 
             /**
@@ -186,17 +551,82 @@ namespace MTLCompute {
                     throw std::runtime_error("Buffer not initialized");
                 }
                 std::vector<T> data(this->length);
-                memcpy(data.data(), this->buffer->contents(), this->length*this->itemsize);
+                memcpy(data.data(), this->pointer, this->length*this->itemsize);
                 return data;
             }
 
+            /**
+             * @brief Copy part of the buffer into host memory
+             *
+             * @param offset The first element to read
+             * @param count The number of elements to read
+             * @param dst Where to put the elements, must hold at least count elements
+             *
+            */
+            void read(size_t offset, size_t count, T *dst) {
+                if (this->freed) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (offset > this->length || count > this->length - offset) {
+                    throw std::out_of_range("Read out of bounds");
+                }
+                memcpy(dst, this->pointer + offset, count*this->itemsize);
+            }
+
+            /**
+             * @brief Get part of the buffer as a vector
+             *
+             * @param offset The first element to read
+             * @param count The number of elements to read
+             *
+             * @return std::vector<T> The elements
+             *
+            */
+            std::vector<T> read(size_t offset, size_t count) {
+                std::vector<T> data(count);
+                this->read(offset, count, data.data());
+                return data;
+            }
+
+            /**
+             * @brief Copy host memory into part of the buffer
+             *
+             * Only the written range is marked dirty
+             *
+             * @param offset The first element to write
+             * @param src The elements to write
+             * @param count The number of elements to write
+             *
+            */
+            void write(size_t offset, const T *src, size_t count) {
+                if (this->freed) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (offset > this->length || count > this->length - offset) {
+                    throw std::out_of_range("Write out of bounds");
+                }
+                memcpy(this->pointer + offset, src, count*this->itemsize);
+                this->track(offset, count);
+            }
+
+            /**
+             * @brief Copy a vector into part of the buffer
+             *
+             * @param offset The first element to write
+             * @param src The elements to write
+             *
+            */
+            void write(size_t offset, const std::vector<T> &src) {
+                this->write(offset, src.data(), src.size());
+            }
+
             /**
              * @brief Get the MTL::Buffer object
              *
              * @return MTL::Buffer* The MTL::Buffer object
              *
             */
-            MTL::Buffer *getBuffer() {
+            MTL::Buffer *getBuffer() const {
                 return this->buffer;
             }
 
@@ -216,7 +646,7 @@ namespace MTLCompute {
              * @return bool Whether the buffer has been freed
              *
             */
-            bool getFreed() {
+            bool getFreed() const {
                 return this->freed;
             }
 
@@ -226,7 +656,7 @@ namespace MTLCompute {
              * @return MTLCompute::ResourceStorage The storage mode of the buffer
              *
             */
-            MTLCompute::ResourceStorage getStorageMode() {
+            MTLCompute::ResourceStorage getStorageMode() const {
                 return this->storageMode;
             }
 
@@ -234,5 +664,209 @@ namespace MTLCompute {
             size_t itemsize; ///< The size of each item in the buffer
     };
 
-}
+    /**
+     * @brief A range of elements inside a Buffer
+     *
+     * Lets one big allocation hold many smaller arrays. The view doesn't copy anything,
+     * and a CommandManager binds it with an offset into the parent buffer.
+     *
+    */
+    template<typename T>
+    class BufferView {
+        private:
+            Buffer<T> buffer; ///< The buffer the view is in
+            size_t offset; ///< The first element of the view
+
+        public:
+            /**
+             * @brief Constructor for the BufferView class
+             *
+             * @param buffer The buffer to view
+             * @param offset The first element of the view
+             * @param count The number of elements in the view
+             *
+            */
+            BufferView(Buffer<T> &buffer, size_t offset, size_t count) : buffer(buffer) {
+                if (buffer.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (offset > buffer.length || count > buffer.length - offset) {
+                    throw std::out_of_range("View out of bounds");
+                }
+                this->offset = offset;
+                this->length = count;
+            }
+
+            /**
+             * @brief Default constructor for the BufferView class
+             *
+             * Creates a new empty view
+             *
+            */
+            BufferView() {
+                this->offset = 0;
+                this->length = -1;
+            }
 
+            /**
+             * @brief Overload the [] operator to get the value at an index
+             *
+             * @param index The index in the view to get the value from
+             * @return T The value at the index
+             *
+            */
+            T operator[](size_t index) const {
+                if (index >= this->length) {
+                    throw std::out_of_range("Index out of bounds");
+                }
+                return this->buffer[this->offset + index];
+            }
+
+            /**
+             * @brief Overload the [] operator to set the value at an index
+             *
+             * @param index The index in the view to set the value at
+             * @return T The value to set at the index
+             *
+            */
+            T& operator[](size_t index) {
+                if (index >= this->length) {
+                    throw std::out_of_range("Index out of bounds");
+                }
+                return this->buffer[this->offset + index];
+            }
+
+            /**
+             * @brief Overload the = operator to set the view contents from a vector
+             *
+             * @param data The data to set the view contents to
+             *
+            */
+            void operator=(std::vector<T> data) {
+                if (data.size() != this->length) {
+                    throw std::invalid_argument("Data size does not match view size");
+                }
+                std::copy(data.begin(), data.end(), this->span().begin());
+            }
+
+            /**
+             * @brief Get a writable span over the view
+             *
+             * @return std::span<T> The span
+             *
+            */
+            std::span<T> span() {
+                return this->buffer.span(this->offset, this->length);
+            }
+
+            /**
+             * @brief Get an iterator to the first element of the view
+             *
+             * @return T* The first element
+             *
+            */
+            T *begin() {
+                return this->span().data();
+            }
+
+            /**
+             * @brief Get an iterator past the last element of the view
+             *
+             * @return T* One past the last element
+             *
+            */
+            T *end() {
+                return this->begin() + this->length;
+            }
+
+            /**
+             * @brief Get a read only iterator to the first element of the view
+             *
+             * @return const T* The first element
+             *
+            */
+            const T *begin() const {
+                return this->buffer.data() + this->offset;
+            }
+
+            /**
+             * @brief Get a read only iterator past the last element of the view
+             *
+             * @return const T* One past the last element
+             *
+            */
+            const T *end() const {
+                return this->begin() + this->length;
+            }
+
+            /**
+             * @brief Get the number of elements in the view
+             *
+             * @return size_t The length of the view
+             *
+            */
+            size_t size() const {
+                return this->length;
+            }
+
+            /**
+             * @brief Get the data from the view as a vector
+             *
+             * @return std::vector<T> The data from the view
+             *
+            */
+            std::vector<T> getData() {
+                if (this->buffer.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (this->length == (size_t)-1) {
+                    throw std::runtime_error("View not initialized");
+                }
+                const T *start = this->buffer.data() + this->offset;
+                return std::vector<T>(start, start + this->length);
+            }
+
+            /**
+             * @brief Get the buffer the view is in
+             *
+             * @return Buffer<T>& The parent buffer
+             *
+            */
+            Buffer<T> &getParent() {
+                return this->buffer;
+            }
+
+            /**
+             * @brief Get the buffer the view is in
+             *
+             * @return const Buffer<T>& The parent buffer
+             *
+            */
+            const Buffer<T> &getParent() const {
+                return this->buffer;
+            }
+
+            /**
+             * @brief Get the offset of the view in elements
+             *
+             * @return size_t The offset of the view
+             *
+            */
+            size_t getOffset() const {
+                return this->offset;
+            }
+
+            /**
+             * @brief Get the MTL::Buffer object of the parent buffer
+             *
+             * @return MTL::Buffer* The MTL::Buffer object
+             *
+            */
+            MTL::Buffer *getBuffer() const {
+                return this->buffer.getBuffer();
+            }
+
+            size_t length; ///< The number of elements in the view
+    };
+
+}
@@ -21,10 +21,35 @@ namespace MTLCompute {
             MTL::ComputeCommandEncoder *commandEncoder; ///< The Metal compute command encoder object
 
             std::vector<Buffer<T>> buffers = std::vector<Buffer<T>>(MAX_BUFFERS); ///< The buffers
+            std::vector<BufferAccess> access = std::vector<BufferAccess>(MAX_BUFFERS, BufferAccess::ReadWrite); ///< How the kernel uses each buffer
+            std::vector<size_t> offsets = std::vector<size_t>(MAX_BUFFERS, 0); ///< The byte offset each buffer is bound at
             std::vector<Texture<T>> textures = std::vector<Texture<T>>(MAX_TEXTURES); ///< The textures
             int bufferlength = -1; ///< The length of the buffers
             int texwidth = -1; ///< The width of the textures
             int texheight = -1; ///< The height of the textures
+            int texdepth = -1; ///< The number of slices in the textures
+
+            /**
+             * @brief Store a buffer in a slot
+             *
+             * @param buffer The buffer to store
+             * @param offset The byte offset to bind the buffer at
+             * @param length The number of elements the kernel will see
+             * @param index The index to load the buffer into
+             * @param access Whether the kernel writes to the buffer
+             *
+            */
+            void storeBuffer(Buffer<T> &buffer, size_t offset, size_t length, int index, BufferAccess access) {
+                if (this->bufferlength == -1) {
+                    this->bufferlength = length;
+                } else if ((size_t)this->bufferlength != length) {
+                    throw std::invalid_argument("Buffer lengths do not match");
+                }
+
+                this->buffers[index] = buffer;
+                this->access[index] = access;
+                this->offsets[index] = offset;
+            }
 
         public:
 
@@ -66,27 +91,40 @@ namespace MTLCompute {
             /**
              * @brief Load a buffer into the CommandManager
              *
-             * Takes in a buffer and an index and adds the buffer to an internal array
+             * Takes in a buffer and an index and adds the buffer to an internal array.
+             * Managed buffers loaded as BufferAccess::ReadOnly aren't synchronized back
+             * to the host after a dispatch.
              *
              * @param buffer The buffer to load
              * @param index The index to load the buffer into
+             * @param access Whether the kernel writes to the buffer
              *
             */
-            void loadBuffer(Buffer<T> buffer, int index) {
-                if (this->bufferlength == -1) {
-                    this->bufferlength = buffer.length;
-                } else if (this->bufferlength != buffer.length) {
-                    throw std::invalid_argument("Buffer lengths do not match");
-                }
+            void loadBuffer(Buffer<T> buffer, int index, BufferAccess access = BufferAccess::ReadWrite) {
+                this->storeBuffer(buffer, 0, buffer.length, index, access);
+            }
 
-                this->buffers[index] = buffer;
+            /**
+             * @brief Load a view of a buffer into the CommandManager
+             *
+             * The parent buffer is bound with the view's offset, so the kernel
+             * sees the view as starting at element 0
+             *
+             * @param view The view to load
+             * @param index The index to load the view into
+             * @param access Whether the kernel writes to the view
+             *
+            */
+            void loadBuffer(BufferView<T> view, int index, BufferAccess access = BufferAccess::ReadWrite) {
+                this->storeBuffer(view.getParent(), view.getOffset()*sizeof(T), view.length, index, access);
             }
 
 
             /**
              * @brief Load a texture into the CommandManager
              *
-             * Takes in a texture and an index and adds the texture to an internal array
+             * Takes in a texture and an index and adds the texture to an internal array.
+             * 3D textures and texture arrays make the dispatch grid 3D, with one layer per slice.
              *
              * @param texture The texture to load
              * @param index The index to load the texture into
@@ -96,10 +134,12 @@ namespace MTLCompute {
                 if (this->texwidth == -1 && this->texheight == -1) {
                     this->texwidth = texture.getWidth();
                     this->texheight = texture.getHeight();
+                    this->texdepth = texture.getSlices();
                     if (this->texwidth > MAX_TEXTURE_SIZE || this->texheight > MAX_TEXTURE_SIZE) {
                         throw std::invalid_argument("Texture size too large, max size is 16384");
                     }
-                } else if (this->texwidth != texture.getWidth() || this->texheight != texture.getHeight()) {
+                } else if (this->texwidth != texture.getWidth() || this->texheight != texture.getHeight()
+                        || this->texdepth != texture.getSlices()) {
                     std::cout << this->texwidth << " " << this->texheight << std::endl;
                     std::cout << texture.getTexture()->width() << " " << texture.getTexture()->height() << std::endl;
                     throw std::invalid_argument("Texture sizes do not match");
@@ -112,7 +152,9 @@ namespace MTLCompute {
              * @brief Dispatch the kernel
              *
              * Creates new command buffer and command encoder objects,
-             * adds the specified buffers at the correct positons, and dispatches the kernel
+             * adds the specified buffers at the correct positons, and dispatches the kernel.
+             * Dirty ranges of Managed buffers are flushed first, and Managed buffers the kernel
+             * can write to are synchronized back to the host afterwards.
              *
             */
             void dispatch() {
@@ -127,12 +169,18 @@ namespace MTLCompute {
                 this->commandEncoder->setComputePipelineState(this->pipeline);
                 bool usingbuffers = false;
                 bool usingtextures = false;
+                std::vector<MTL::Buffer *> written;
 
                 // Load the buffers and textures into the commandEncoder
                 for (int i = 0; i < MAX_BUFFERS; i++) {
-                    if (buffers[i].length == this->bufferlength && buffers[i].getBuffer() != nullptr) {
-                        this->commandEncoder->setBuffer(buffers[i].getBuffer(), 0, i);
+                    if (buffers[i].getBuffer() != nullptr) {
+                        buffers[i].flush();
+                        this->commandEncoder->setBuffer(buffers[i].getBuffer(), this->offsets[i], i);
                         usingbuffers = true;
+                        if (buffers[i].getStorageMode() == ResourceStorage::Managed
+                                && this->access[i] == BufferAccess::ReadWrite) {
+                            written.push_back(buffers[i].getBuffer());
+                        }
                     }
                     if (textures[i].getWidth() == this->texwidth && textures[i].getHeight() == this->texheight
                             && textures[i].getTexture() != nullptr) {
@@ -157,15 +205,15 @@ namespace MTLCompute {
                 MTL::Size threadsPerGrid;
                 if (usingbuffers && usingtextures) {
                     if (this->bufferlength > this->texwidth)
-                        threadsPerGrid = MTL::Size::Make(this->bufferlength, this->texheight, 1);
+                        threadsPerGrid = MTL::Size::Make(this->bufferlength, this->texheight, this->texdepth);
                     else
-                        threadsPerGrid = MTL::Size::Make(this->texwidth, this->texheight, 1);
+                        threadsPerGrid = MTL::Size::Make(this->texwidth, this->texheight, this->texdepth);
                 } else if (usingbuffers && !usingtextures) {
                     threadsPerGrid = MTL::Size::Make(this->bufferlength, 1, 1);
 
                 } else if (!usingbuffers && usingtextures) {
-                    threadsPerGrid = MTL::Size::Make(this->texwidth, this->texheight, 1);
-                    
+                    threadsPerGrid = MTL::Size::Make(this->texwidth, this->texheight, this->texdepth);
+
                 } else {
                     throw std::invalid_argument("No buffers or textures loaded");
                 }
@@ -173,6 +221,16 @@ namespace MTLCompute {
                 // Use dispatchThreads NOT dispatchThreadgroups
                 this->commandEncoder->dispatchThreads(threadsPerGrid, threadsPerThreadgroup);
                 this->commandEncoder->endEncoding();
+
+                // Copy what the kernel wrote back to the host copy of Managed buffers
+                if (!written.empty()) {
+                    MTL::BlitCommandEncoder *blitEncoder = this->commandBuffer->blitCommandEncoder();
+                    for (MTL::Buffer *buffer : written) {
+                        blitEncoder->synchronizeResource(buffer);
+                    }
+                    blitEncoder->endEncoding();
+                }
+
                 this->commandBuffer->commit();
                 this->commandBuffer->waitUntilCompleted();
 
@@ -188,6 +246,8 @@ namespace MTLCompute {
             void resetBuffers() {
                 this->buffers.clear();
                 this->buffers = std::vector<Buffer<T>>(MAX_BUFFERS);
+                this->access = std::vector<BufferAccess>(MAX_BUFFERS, BufferAccess::ReadWrite);
+                this->offsets = std::vector<size_t>(MAX_BUFFERS, 0);
                 this->bufferlength = -1;
             }
 
@@ -200,6 +260,7 @@ namespace MTLCompute {
                 this->textures = std::vector<Texture<T>>(MAX_TEXTURES);
                 this->texwidth = -1;
                 this->texheight = -1;
+                this->texdepth = -1;
             }
 
             /**
@@ -0,0 +1,884 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeBuffer.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source for fused elementwise expressions
+     *
+     * Generated per expression shape: INPUTS declares the input buffers, EXPR
+     * is the whole expression for element i, reading the inputs as in0[i],
+     * in1[i], ... and the scalars as scalars[0], scalars[1], ... OUT_INDEX,
+     * SCALAR_INDEX and COUNT_INDEX are the buffer indices after the inputs.
+     * Scalars are uniforms instead of constants in the source, so changing a
+     * value doesn't compile a new kernel.
+     *
+    */
+    inline constexpr const char *ELEMENTWISE_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+kernel void elementwise(INPUTS
+                        device T *out [[buffer(OUT_INDEX)]],
+                        constant T *scalars [[buffer(SCALAR_INDEX)]],
+                        constant uint &count [[buffer(COUNT_INDEX)]],
+                        uint i [[thread_position_in_grid]]) {
+  if (i < count) {
+    out[i] = T(EXPR);
+  }
+}
+)";
+
+    inline constexpr size_t EXPRESSION_BLOCK = 256; ///< Elements each expression node works on at a time on the CPU
+
+    /**
+     * @brief The operators an elementwise expression can use
+     *
+     * Each one has how to apply it on the CPU and how to write it in Metal.
+     * The float only ones don't compile for integer expressions.
+     *
+    */
+    struct ExprNegate {
+        static constexpr bool floatOnly = false; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a) { return T(-a); }
+        template<typename T> static std::string source(const std::string &a) { return "(-" + a + ")"; }
+    };
+
+    struct ExprAbs {
+        static constexpr bool floatOnly = false; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a) {
+            if constexpr (std::is_unsigned_v<T>) {
+                return a;
+            } else if constexpr (std::is_integral_v<T>) {
+                return a < 0 ? T(-a) : a;
+            } else {
+                return T(std::abs(a));
+            }
+        }
+        template<typename T> static std::string source(const std::string &a) { return std::is_unsigned_v<T> ? a : "abs(" + a + ")"; }
+    };
+
+    struct ExprSqrt {
+        static constexpr bool floatOnly = true; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a) { return T(std::sqrt(a)); }
+        template<typename T> static std::string source(const std::string &a) { return "sqrt(" + a + ")"; }
+    };
+
+    struct ExprExp {
+        static constexpr bool floatOnly = true; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a) { return T(std::exp(a)); }
+        template<typename T> static std::string source(const std::string &a) { return "exp(" + a + ")"; }
+    };
+
+    struct ExprLog {
+        static constexpr bool floatOnly = true; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a) { return T(std::log(a)); }
+        template<typename T> static std::string source(const std::string &a) { return "log(" + a + ")"; }
+    };
+
+    struct ExprSin {
+        static constexpr bool floatOnly = true; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a) { return T(std::sin(a)); }
+        template<typename T> static std::string source(const std::string &a) { return "sin(" + a + ")"; }
+    };
+
+    struct ExprCos {
+        static constexpr bool floatOnly = true; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a) { return T(std::cos(a)); }
+        template<typename T> static std::string source(const std::string &a) { return "cos(" + a + ")"; }
+    };
+
+    struct ExprTanh {
+        static constexpr bool floatOnly = true; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a) { return T(std::tanh(a)); }
+        template<typename T> static std::string source(const std::string &a) { return "tanh(" + a + ")"; }
+    };
+
+    struct ExprAdd {
+        static constexpr bool floatOnly = false; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a, T b) { return T(a + b); }
+        template<typename T> static std::string source(const std::string &a, const std::string &b) { return "(" + a + " + " + b + ")"; }
+    };
+
+    struct ExprSubtract {
+        static constexpr bool floatOnly = false; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a, T b) { return T(a - b); }
+        template<typename T> static std::string source(const std::string &a, const std::string &b) { return "(" + a + " - " + b + ")"; }
+    };
+
+    struct ExprMultiply {
+        static constexpr bool floatOnly = false; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a, T b) { return T(a*b); }
+        template<typename T> static std::string source(const std::string &a, const std::string &b) { return "(" + a + " * " + b + ")"; }
+    };
+
+    struct ExprDivide {
+        static constexpr bool floatOnly = false; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a, T b) { return T(a/b); }
+        template<typename T> static std::string source(const std::string &a, const std::string &b) { return "(" + a + " / " + b + ")"; }
+    };
+
+    struct ExprMin {
+        static constexpr bool floatOnly = false; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a, T b) { return b < a ? b : a; }
+        template<typename T> static std::string source(const std::string &a, const std::string &b) { return "min(" + a + ", " + b + ")"; }
+    };
+
+    struct ExprMax {
+        static constexpr bool floatOnly = false; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a, T b) { return a < b ? b : a; }
+        template<typename T> static std::string source(const std::string &a, const std::string &b) { return "max(" + a + ", " + b + ")"; }
+    };
+
+    struct ExprPow {
+        static constexpr bool floatOnly = true; ///< Whether integer expressions can use it
+        template<typename T> static T apply(T a, T b) { return T(std::pow(a, b)); }
+        template<typename T> static std::string source(const std::string &a, const std::string &b) { return "pow(" + a + ", " + b + ")"; }
+    };
+
+    /**
+     * @brief A Buffer read in an elementwise expression
+     *
+     * Every node in an expression has the same members: the element type, how
+     * many buffers and scalars it reads, its Metal source, the buffers and
+     * scalars to bind in the same order as the source numbers them, and a way
+     * to evaluate a block of elements on the CPU.
+     *
+     * @tparam T The element type
+     *
+    */
+    template<typename T>
+    class ExprBuffer {
+        private:
+            const Buffer<T> *buffer; ///< The buffer, which has to outlive the expression
+
+        public:
+            using value_type = T; ///< The element type
+            static constexpr int buffers = 1; ///< The number of buffers read
+            static constexpr int scalars = 0; ///< The number of scalars read
+
+            /**
+             * @brief Constructor for the ExprBuffer class
+             *
+             * @param buffer The buffer
+             *
+            */
+            ExprBuffer(const Buffer<T> &buffer) {
+                this->buffer = &buffer;
+            }
+
+            /**
+             * @brief Get the Metal source for this node
+             *
+             * @param buffers The next input number, advanced past the ones used here
+             * @param scalars The next scalar number, advanced past the ones used here
+             *
+             * @return std::string The Metal expression
+             *
+            */
+            static std::string source(int &buffers, int &) {
+                return "in" + std::to_string(buffers++) + "[i]";
+            }
+
+            /**
+             * @brief Collect the buffers and scalars, in the order the source numbers them
+             *
+             * @param buffers The buffers, appended to
+             * @param scalars The scalars, appended to
+             *
+            */
+            void bind(std::vector<const Buffer<T> *> &buffers, std::vector<T> &) const {
+                buffers.push_back(this->buffer);
+            }
+
+            /**
+             * @brief Evaluate a block of elements on the CPU
+             *
+             * @param begin The first element
+             * @param count The number of elements, at most EXPRESSION_BLOCK
+             * @param scratch Space for count results
+             *
+             * @return const T* The results, in scratch or straight from the buffer
+             *
+            */
+            const T *block(size_t begin, size_t, T *) const {
+                return this->buffer->data() + begin;
+            }
+    };
+
+    /**
+     * @brief A constant in an elementwise expression
+     *
+     * @tparam T The element type
+     *
+    */
+    template<typename T>
+    class ExprScalar {
+        private:
+            T value; ///< The constant
+
+        public:
+            using value_type = T; ///< The element type
+            static constexpr int buffers = 0; ///< The number of buffers read
+            static constexpr int scalars = 1; ///< The number of scalars read
+
+            /**
+             * @brief Constructor for the ExprScalar class
+             *
+             * @param value The constant
+             *
+            */
+            ExprScalar(T value) {
+                this->value = value;
+            }
+
+            /**
+             * @brief Get the Metal source for this node
+             *
+             * @param buffers The next input number, advanced past the ones used here
+             * @param scalars The next scalar number, advanced past the ones used here
+             *
+             * @return std::string The Metal expression
+             *
+            */
+            static std::string source(int &, int &scalars) {
+                return "scalars[" + std::to_string(scalars++) + "]";
+            }
+
+            /**
+             * @brief Collect the buffers and scalars, in the order the source numbers them
+             *
+             * @param buffers The buffers, appended to
+             * @param scalars The scalars, appended to
+             *
+            */
+            void bind(std::vector<const Buffer<T> *> &, std::vector<T> &scalars) const {
+                scalars.push_back(this->value);
+            }
+
+            /**
+             * @brief Evaluate a block of elements on the CPU
+             *
+             * @param begin The first element
+             * @param count The number of elements, at most EXPRESSION_BLOCK
+             * @param scratch Space for count results
+             *
+             * @return const T* The results
+             *
+            */
+            const T *block(size_t, size_t count, T *scratch) const {
+                std::fill(scratch, scratch + count, this->value);
+                return scratch;
+            }
+    };
+
+    /**
+     * @brief A function of one expression
+     *
+     * @tparam Op The operator
+     * @tparam A The operand node
+     *
+    */
+    template<typename Op, typename A>
+    class ExprUnary {
+        private:
+            A a; ///< The operand
+
+        public:
+            using value_type = typename A::value_type; ///< The element type
+            static constexpr int buffers = A::buffers; ///< The number of buffers read
+            static constexpr int scalars = A::scalars; ///< The number of scalars read
+
+            /**
+             * @brief Constructor for the ExprUnary class
+             *
+             * @param a The operand
+             *
+            */
+            ExprUnary(const A &a) : a(a) {}
+
+            /**
+             * @brief Get the Metal source for this node
+             *
+             * @param buffers The next input number, advanced past the ones used here
+             * @param scalars The next scalar number, advanced past the ones used here
+             *
+             * @return std::string The Metal expression
+             *
+            */
+            static std::string source(int &buffers, int &scalars) {
+                return Op::template source<value_type>(A::source(buffers, scalars));
+            }
+
+            /**
+             * @brief Collect the buffers and scalars, in the order the source numbers them
+             *
+             * @param buffers The buffers, appended to
+             * @param scalars The scalars, appended to
+             *
+            */
+            void bind(std::vector<const Buffer<value_type> *> &buffers, std::vector<value_type> &scalars) const {
+                this->a.bind(buffers, scalars);
+            }
+
+            /**
+             * @brief Evaluate a block of elements on the CPU
+             *
+             * @param begin The first element
+             * @param count The number of elements, at most EXPRESSION_BLOCK
+             * @param scratch Space for count results
+             *
+             * @return const T* The results
+             *
+            */
+            const value_type *block(size_t begin, size_t count, value_type *scratch) const {
+                value_type in[EXPRESSION_BLOCK];
+                const value_type *x = this->a.block(begin, count, in);
+                for (size_t i = 0; i < count; i++) {
+                    scratch[i] = Op::apply(x[i]);
+                }
+                return scratch;
+            }
+    };
+
+    /**
+     * @brief A function of two expressions
+     *
+     * @tparam Op The operator
+     * @tparam A The left operand node
+     * @tparam B The right operand node
+     *
+    */
+    template<typename Op, typename A, typename B>
+    class ExprBinary {
+        static_assert(std::is_same_v<typename A::value_type, typename B::value_type>, "Both sides of an expression need the same element type");
+
+        private:
+            A a; ///< The left operand
+            B b; ///< The right operand
+
+        public:
+            using value_type = typename A::value_type; ///< The element type
+            static constexpr int buffers = A::buffers + B::buffers; ///< The number of buffers read
+            static constexpr int scalars = A::scalars + B::scalars; ///< The number of scalars read
+
+            /**
+             * @brief Constructor for the ExprBinary class
+             *
+             * @param a The left operand
+             * @param b The right operand
+             *
+            */
+            ExprBinary(const A &a, const B &b) : a(a), b(b) {}
+
+            /**
+             * @brief Get the Metal source for this node
+             *
+             * @param buffers The next input number, advanced past the ones used here
+             * @param scalars The next scalar number, advanced past the ones used here
+             *
+             * @return std::string The Metal expression
+             *
+            */
+            static std::string source(int &buffers, int &scalars) {
+                // Separate statements, so the left side is always numbered first
+                std::string left = A::source(buffers, scalars);
+                std::string right = B::source(buffers, scalars);
+                return Op::template source<value_type>(left, right);
+            }
+
+            /**
+             * @brief Collect the buffers and scalars, in the order the source numbers them
+             *
+             * @param buffers The buffers, appended to
+             * @param scalars The scalars, appended to
+             *
+            */
+            void bind(std::vector<const Buffer<value_type> *> &buffers, std::vector<value_type> &scalars) const {
+                this->a.bind(buffers, scalars);
+                this->b.bind(buffers, scalars);
+            }
+
+            /**
+             * @brief Evaluate a block of elements on the CPU
+             *
+             * @param begin The first element
+             * @param count The number of elements, at most EXPRESSION_BLOCK
+             * @param scratch Space for count results
+             *
+             * @return const T* The results
+             *
+            */
+            const value_type *block(size_t begin, size_t count, value_type *scratch) const {
+                value_type left[EXPRESSION_BLOCK];
+                value_type right[EXPRESSION_BLOCK];
+                const value_type *x = this->a.block(begin, count, left);
+                const value_type *y = this->b.block(begin, count, right);
+                for (size_t i = 0; i < count; i++) {
+                    scratch[i] = Op::apply(x[i], y[i]);
+                }
+                return scratch;
+            }
+    };
+
+    /**
+     * @brief What can be an operand of an elementwise expression
+     *
+     * Buffers become ExprBuffer nodes and expression nodes stay as they are
+     *
+    */
+    template<typename X>
+    struct ExpressionOperand {
+        static constexpr bool supported = false; ///< Whether the type is an operand
+    };
+
+    template<typename T>
+    struct ExpressionOperand<Buffer<T>> {
+        static constexpr bool supported = true; ///< Whether the type is an operand
+        using type = ExprBuffer<T>; ///< The node type
+    };
+
+    template<typename T>
+    struct ExpressionOperand<ExprBuffer<T>> {
+        static constexpr bool supported = true; ///< Whether the type is an operand
+        using type = ExprBuffer<T>; ///< The node type
+    };
+
+    template<typename T>
+    struct ExpressionOperand<ExprScalar<T>> {
+        static constexpr bool supported = true; ///< Whether the type is an operand
+        using type = ExprScalar<T>; ///< The node type
+    };
+
+    template<typename Op, typename A>
+    struct ExpressionOperand<ExprUnary<Op, A>> {
+        static constexpr bool supported = true; ///< Whether the type is an operand
+        using type = ExprUnary<Op, A>; ///< The node type
+    };
+
+    template<typename Op, typename A, typename B>
+    struct ExpressionOperand<ExprBinary<Op, A, B>> {
+        static constexpr bool supported = true; ///< Whether the type is an operand
+        using type = ExprBinary<Op, A, B>; ///< The node type
+    };
+
+    /**
+     * @brief Whether a type can be either side of a binary expression, an operand or a plain number
+     *
+    */
+    template<typename X>
+    inline constexpr bool isExpressionArgument = ExpressionOperand<X>::supported || std::is_arithmetic_v<X>;
+
+    /**
+     * @brief Whether a plain number of type X can be used in an expression of element type T
+     *
+     * Integers are fine in any expression, but a floating point number in an
+     * integer expression would be silently truncated, so an int buffer times 0.5
+     * would be times 0
+     *
+    */
+    template<typename T, typename X>
+    inline constexpr bool isScalarConvertible = std::is_same_v<T, X> || !(std::is_integral_v<T> && std::is_floating_point_v<X>);
+
+    /**
+     * @brief Turn an operand or a number into a node
+     *
+     * @tparam T The element type of the expression
+     * @param x The operand or number
+     *
+     * @return The node, with numbers converted to T
+     *
+    */
+    template<typename T, typename X>
+    auto toExpression(const X &x) {
+        if constexpr (std::is_arithmetic_v<X>) {
+            static_assert(isScalarConvertible<T, X>, "A floating point number would be truncated in an integer expression");
+            return ExprScalar<T>(T(x));
+        } else {
+            return typename ExpressionOperand<X>::type(x);
+        }
+    }
+
+    /**
+     * @brief Make a unary node
+     *
+     * @tparam Op The operator
+     * @param a The operand
+     *
+     * @return ExprUnary The node
+     *
+    */
+    template<typename Op, typename A>
+    auto makeUnary(const A &a) {
+        using Node = typename ExpressionOperand<A>::type;
+        static_assert(!Op::floatOnly || !std::is_integral_v<typename Node::value_type>, "This function only works on floating point expressions");
+        return ExprUnary<Op, Node>(Node(a));
+    }
+
+    /**
+     * @brief Make a binary node
+     *
+     * One side can be a plain number, which is converted to the other side's element type.
+     * Floating point numbers can't be used with integer element types.
+     *
+     * @tparam Op The operator
+     * @param a The left side
+     * @param b The right side
+     *
+     * @return ExprBinary The node
+     *
+    */
+    template<typename Op, typename A, typename B>
+    auto makeBinary(const A &a, const B &b) {
+        using T = typename std::conditional_t<ExpressionOperand<A>::supported, ExpressionOperand<A>, ExpressionOperand<B>>::type::value_type;
+        static_assert(!Op::floatOnly || !std::is_integral_v<T>, "This function only works on floating point expressions");
+        auto left = toExpression<T>(a);
+        auto right = toExpression<T>(b);
+        return ExprBinary<Op, decltype(left), decltype(right)>(left, right);
+    }
+
+    template<typename A>
+        requires ExpressionOperand<A>::supported
+    auto operator-(const A &a) {
+        return makeUnary<ExprNegate>(a);
+    }
+
+    template<typename A, typename B>
+        requires ((ExpressionOperand<A>::supported || ExpressionOperand<B>::supported) && isExpressionArgument<A> && isExpressionArgument<B>)
+    auto operator+(const A &a, const B &b) {
+        return makeBinary<ExprAdd>(a, b);
+    }
+
+    template<typename A, typename B>
+        requires ((ExpressionOperand<A>::supported || ExpressionOperand<B>::supported) && isExpressionArgument<A> && isExpressionArgument<B>)
+    auto operator-(const A &a, const B &b) {
+        return makeBinary<ExprSubtract>(a, b);
+    }
+
+    template<typename A, typename B>
+        requires ((ExpressionOperand<A>::supported || ExpressionOperand<B>::supported) && isExpressionArgument<A> && isExpressionArgument<B>)
+    auto operator*(const A &a, const B &b) {
+        return makeBinary<ExprMultiply>(a, b);
+    }
+
+    template<typename A, typename B>
+        requires ((ExpressionOperand<A>::supported || ExpressionOperand<B>::supported) && isExpressionArgument<A> && isExpressionArgument<B>)
+    auto operator/(const A &a, const B &b) {
+        return makeBinary<ExprDivide>(a, b);
+    }
+
+    template<typename A, typename B>
+        requires ((ExpressionOperand<A>::supported || ExpressionOperand<B>::supported) && isExpressionArgument<A> && isExpressionArgument<B>)
+    auto min(const A &a, const B &b) {
+        return makeBinary<ExprMin>(a, b);
+    }
+
+    template<typename A, typename B>
+        requires ((ExpressionOperand<A>::supported || ExpressionOperand<B>::supported) && isExpressionArgument<A> && isExpressionArgument<B>)
+    auto max(const A &a, const B &b) {
+        return makeBinary<ExprMax>(a, b);
+    }
+
+    template<typename A, typename B>
+        requires ((ExpressionOperand<A>::supported || ExpressionOperand<B>::supported) && isExpressionArgument<A> && isExpressionArgument<B>)
+    auto pow(const A &a, const B &b) {
+        return makeBinary<ExprPow>(a, b);
+    }
+
+    template<typename A>
+        requires ExpressionOperand<A>::supported
+    auto abs(const A &a) {
+        return makeUnary<ExprAbs>(a);
+    }
+
+    template<typename A>
+        requires ExpressionOperand<A>::supported
+    auto sqrt(const A &a) {
+        return makeUnary<ExprSqrt>(a);
+    }
+
+    template<typename A>
+        requires ExpressionOperand<A>::supported
+    auto exp(const A &a) {
+        return makeUnary<ExprExp>(a);
+    }
+
+    template<typename A>
+        requires ExpressionOperand<A>::supported
+    auto log(const A &a) {
+        return makeUnary<ExprLog>(a);
+    }
+
+    template<typename A>
+        requires ExpressionOperand<A>::supported
+    auto sin(const A &a) {
+        return makeUnary<ExprSin>(a);
+    }
+
+    template<typename A>
+        requires ExpressionOperand<A>::supported
+    auto cos(const A &a) {
+        return makeUnary<ExprCos>(a);
+    }
+
+    template<typename A>
+        requires ExpressionOperand<A>::supported
+    auto tanh(const A &a) {
+        return makeUnary<ExprTanh>(a);
+    }
+
+    namespace host {
+
+        /**
+         * @brief Evaluate an elementwise expression on every CPU thread
+         *
+         * Each node works on blocks of EXPRESSION_BLOCK elements, in plain loops
+         * over small arrays that the compiler turns into vector instructions.
+         * The output can be one of the buffers in the expression.
+         *
+         * @param expression The expression, or a Buffer to copy
+         * @param out Where to put the results
+         * @param count The number of elements, no more than any buffer in the expression
+         *
+        */
+        template<typename E, typename T>
+        void evaluate(const E &expression, T *out, size_t count) {
+            using Node = typename ExpressionOperand<E>::type;
+            static_assert(std::is_same_v<typename Node::value_type, T>, "The output type doesn't match the expression");
+            Node node(expression);
+            size_t chunks = chunkCount(count, 1 << 16);
+            parallelChunks(count, chunks, [&](size_t, size_t begin, size_t end) {
+                T scratch[EXPRESSION_BLOCK];
+                for (size_t i = begin; i < end; i += EXPRESSION_BLOCK) {
+                    size_t n = std::min(EXPRESSION_BLOCK, end - i);
+                    const T *result = node.block(i, n, scratch);
+                    std::copy(result, result + n, out + i);
+                }
+            });
+        }
+
+    }
+
+    /**
+     * @brief Evaluates elementwise expressions over Buffers in one kernel
+     *
+     * Arithmetic on Buffers builds an expression instead of computing anything,
+     * so `elementwise.assign(c, a*x + b)` reads a and b once and writes c once,
+     * with no metallib to write and no temporary buffers in between. Each shape
+     * of expression generates its own kernel the first time it's used, cached
+     * by its source, and scalars are passed in at run time so new values don't
+     * recompile anything. Small buffers are evaluated on the CPU, like Reducer
+     * does, and so are element types the GPU can't use.
+     *
+     * @tparam T The element type
+     *
+    */
+    template<typename T>
+    class Elementwise {
+        private:
+            MTL::Device *gpu; ///< The Metal device object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+            size_t hostThreshold; ///< Buffers with fewer elements are evaluated on the CPU
+
+            /**
+             * @brief Get the kernel source for an expression shape
+             *
+             * Built once per node type
+             *
+             * @tparam Node The expression node type
+             *
+             * @return const KernelSource& The source and macros
+             *
+            */
+            template<typename Node>
+            static const KernelSource &kernelSource() {
+                static const KernelSource source = []() {
+                    int buffers = 0, scalars = 0;
+                    std::string expression = Node::source(buffers, scalars);
+                    std::string inputs;
+                    for (int b = 0; b < Node::buffers; b++) {
+                        inputs += "device const T *in" + std::to_string(b) + " [[buffer(" + std::to_string(b) + ")]],";
+                    }
+                    return KernelSource{ELEMENTWISE_SOURCE, {{"T", ShaderTypeTraits<T>::name}, {"INPUTS", inputs}, {"EXPR", expression},
+                                                             {"OUT_INDEX", std::to_string(Node::buffers)},
+                                                             {"SCALAR_INDEX", std::to_string(Node::buffers + 1)},
+                                                             {"COUNT_INDEX", std::to_string(Node::buffers + 2)}}};
+                }();
+                return source;
+            }
+
+            /**
+             * @brief Evaluate an expression on the GPU and wait for it
+             *
+             * @param source The kernel source for the expression
+             * @param out The output buffer
+             * @param buffers The input buffers, in binding order
+             * @param scalars The scalars, in binding order
+             *
+            */
+            void run(const KernelSource &source, Buffer<T> &out, const std::vector<const Buffer<T> *> &buffers, std::vector<T> scalars) {
+                if (out.size() > std::numeric_limits<uint32_t>::max()) {
+                    throw std::invalid_argument("Buffer too large to evaluate, max is 2^32 - 1 elements");
+                }
+                MTL::ComputePipelineState *pipeline = LibraryCache::getPipeline(this->gpu, source, "elementwise");
+                for (const Buffer<T> *buffer : buffers) {
+                    buffer->flush();
+                }
+                out.flush();
+                // setBytes can't send nothing, so an expression without scalars still gets one
+                if (scalars.empty()) {
+                    scalars.push_back(T(0));
+                }
+                uint32_t count = (uint32_t)out.size();
+                size_t threads = std::min<size_t>(pipeline->maxTotalThreadsPerThreadgroup(), 256);
+
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                commandEncoder->setComputePipelineState(pipeline);
+                for (size_t b = 0; b < buffers.size(); b++) {
+                    commandEncoder->setBuffer(buffers[b]->getBuffer(), 0, b);
+                }
+                commandEncoder->setBuffer(out.getBuffer(), 0, buffers.size());
+                commandEncoder->setBytes(scalars.data(), scalars.size()*sizeof(T), buffers.size() + 1);
+                commandEncoder->setBytes(&count, sizeof(count), buffers.size() + 2);
+                commandEncoder->dispatchThreadgroups(MTL::Size::Make((count + threads - 1)/threads, 1, 1), MTL::Size::Make(threads, 1, 1));
+                commandEncoder->endEncoding();
+
+                if (out.getStorageMode() == ResourceStorage::Managed) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->synchronizeResource(out.getBuffer());
+                    blitEncoder->endEncoding();
+                }
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the Elementwise class
+             *
+             * @param gpu The Metal device object
+             * @param hostThreshold Buffers with fewer elements are evaluated on the CPU
+             *
+            */
+            Elementwise(MTL::Device *gpu, size_t hostThreshold = 1 << 16) {
+                this->gpu = gpu;
+                this->hostThreshold = hostThreshold;
+                this->commandQueue = gpu->newCommandQueue();
+            }
+
+            Elementwise(const Elementwise &) = delete;
+            Elementwise & operator=(const Elementwise &) = delete;
+
+            /**
+             * @brief Destructor for the Elementwise class
+             *
+             * Releases the command queue
+             *
+            */
+            ~Elementwise() {
+                this->commandQueue->autorelease();
+            }
+
+            /**
+             * @brief Evaluate an expression into a buffer
+             *
+             * Every buffer in the expression has to be the same size as the output.
+             * The output can also be in the expression, like `assign(a, a*2)`.
+             * Float results can differ from host::evaluate in the last few bits,
+             * since the kernels are compiled with fast math.
+             *
+             * @param out Where to put the results
+             * @param expression The expression, or a Buffer to copy
+             *
+            */
+            template<typename E>
+            void assign(Buffer<T> &out, const E &expression) {
+                using Node = typename ExpressionOperand<E>::type;
+                static_assert(std::is_same_v<typename Node::value_type, T>, "The expression's element type doesn't match the Elementwise");
+                static_assert(Node::buffers + 3 <= 31, "Too many buffers in one expression, Metal can only bind 31");
+                static_assert(Node::scalars*sizeof(T) <= 4096, "Too many scalars in one expression");
+
+                Node node(expression);
+                std::vector<const Buffer<T> *> buffers;
+                std::vector<T> scalars;
+                node.bind(buffers, scalars);
+                if (out.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                bool gpuOnly = out.getStorageMode() == ResourceStorage::Private;
+                for (const Buffer<T> *buffer : buffers) {
+                    if (buffer->getFreed()) {
+                        throw std::runtime_error("Buffer already freed");
+                    }
+                    if (buffer->size() != out.size()) {
+                        throw std::invalid_argument("Buffer sizes don't match in the expression");
+                    }
+                    gpuOnly = gpuOnly || buffer->getStorageMode() == ResourceStorage::Private;
+                }
+                if (out.size() == 0) {
+                    return;
+                }
+
+                if constexpr (ShaderTypeTraits<T>::supported) {
+                    if (gpuOnly || out.size() >= this->hostThreshold) {
+                        this->run(kernelSource<Node>(), out, buffers, scalars);
+                        return;
+                    }
+                }
+                if (gpuOnly) {
+                    throw std::invalid_argument("Private buffers of this type can't be evaluated");
+                }
+                host::evaluate(node, out.contents(), out.size());
+            }
+
+            /**
+             * @brief Get the Metal source generated for an expression
+             *
+             * For seeing what actually runs, the kernel is named elementwise
+             *
+             * @param expression The expression
+             *
+             * @return std::string The source with its macros
+             *
+            */
+            template<typename E>
+            static std::string source(const E &) {
+                return kernelSource<typename ExpressionOperand<E>::type>().text();
+            }
+
+            /**
+             * @brief Set the size below which buffers are evaluated on the CPU
+             *
+             * @param hostThreshold The number of elements, 0 to always use the GPU
+             *
+            */
+            void setHostThreshold(size_t hostThreshold) {
+                this->hostThreshold = hostThreshold;
+            }
+
+            /**
+             * @brief Get the size below which buffers are evaluated on the CPU
+             *
+             * @return size_t The number of elements
+             *
+            */
+            size_t getHostThreshold() {
+                return this->hostThreshold;
+            }
+
+    };
+
+}
@@ -1,8 +1,21 @@
 #include "MTLComputeGlobals.hpp"
+#include "MTLComputeTypes.hpp"
 #include "MTLComputeBuffer.hpp"
 #include "MTLComputeKernel.hpp"
+#include "MTLComputeKernelFn.hpp"
+#include "MTLComputePipelineBatch.hpp"
 #include "MTLComputeCommandManager.hpp"
 #include "MTLComputeTexture.hpp"
+#include "MTLComputeTiledImage.hpp"
+#include "MTLComputeTexturePool.hpp"
+#include "MTLComputeMipmap.hpp"
+#include "MTLComputeReduce.hpp"
+#include "MTLComputeScan.hpp"
+#include "MTLComputeSort.hpp"
+#include "MTLComputeGemm.hpp"
+#include "MTLComputeStencil.hpp"
+#include "MTLComputeElementwise.hpp"
+#include "MTLComputeHistogram.hpp"
 
 #pragma once
 
@@ -19,9 +32,14 @@ namespace MTLCompute {
 
         private:
             MTL::Device *gpu; ///< The Metal device object
+            MTLCompute::TexturePool pool; ///< Reuses the textures made by loadMatrix
             MTLCompute::Kernel kernel; ///< The MetalCompute kernel object
             bool kernelLoaded = false; ///< Whether the kernel has been loaded
             MTLCompute::CommandManager<T> commandManager; ///< The MetalCompute command manager object
+            std::vector<MTLCompute::Buffer<T>> arrays = std::vector<MTLCompute::Buffer<T>>(MAX_BUFFERS); ///< The resident buffer for each array slot
+            std::vector<size_t> arraylengths = std::vector<size_t>(MAX_BUFFERS, 0); ///< The length of the array loaded in each slot
+            std::vector<MTLCompute::Texture<T>> matrices = std::vector<MTLCompute::Texture<T>>(MAX_TEXTURES); ///< The resident texture for each matrix slot
+            std::vector<T> staging; ///< Contiguous rows for copying a whole matrix in one call, kept to avoid allocating every time
 
             /**
              * @brief Check if the kernel has been loaded
@@ -35,6 +53,36 @@ namespace MTLCompute {
                 }
             }
 
+            /**
+             * @brief Check that an array slot has something loaded
+             *
+             * @param index The index of the slot
+             *
+            */
+            void checkarray(int index) {
+                if (index < 0 || index >= MAX_BUFFERS) {
+                    throw std::out_of_range("Index out of bounds");
+                }
+                if (this->arrays[index].getBuffer() == nullptr) {
+                    throw std::runtime_error("No array loaded at index");
+                }
+            }
+
+            /**
+             * @brief Check that a matrix slot has something loaded
+             *
+             * @param index The index of the slot
+             *
+            */
+            void checkmatrix(int index) {
+                if (index < 0 || index >= MAX_TEXTURES) {
+                    throw std::out_of_range("Index out of bounds");
+                }
+                if (this->matrices[index].getTexture() == nullptr) {
+                    throw std::runtime_error("No matrix loaded at index");
+                }
+            }
+
         public:
 
             /**
@@ -47,8 +95,8 @@ namespace MTLCompute {
              * @param functionName The name of the function
              *
             */
-            GPU(std::string libname, std::string functionName) : kernel(), commandManager() {
-                this->gpu = MTL::CreateSystemDefaultDevice();
+            GPU(std::string libname, std::string functionName)
+                : gpu(MTL::CreateSystemDefaultDevice()), pool(this->gpu), kernel(), commandManager() {
                 this->kernel = MTLCompute::Kernel(this->gpu, libname+".metallib");
                 this->kernel.useFunction(functionName);
                 this->commandManager = MTLCompute::CommandManager<T>(this->gpu, &this->kernel);
@@ -61,9 +109,7 @@ namespace MTLCompute {
              * Creates a new GPU object, MTLCompute::Kernel object, and MTLCompute::CommandManager object
              *
             */
-            GPU() : kernel(), commandManager() {
-                this->gpu = MTL::CreateSystemDefaultDevice();
-            };
+            GPU() : gpu(MTL::CreateSystemDefaultDevice()), pool(this->gpu), kernel(), commandManager() {};
 
             /**
              * @brief Destructor for the GPU class
@@ -96,33 +142,72 @@ namespace MTLCompute {
              * @brief Load an array into the GPU
              *
              * Takes in a vector of type T and an index and loads the array into the GPU
-             * at that index
+             * at that index. Each slot keeps its buffer, so loading again only copies the
+             * data. A new buffer is only made when the array is longer than any before it.
              *
              * @param array The array to load
              * @param index The index to load the array into
              *
             */
-            void loadArray(std::vector<T> &array, int index) {
+            void loadArray(const std::vector<T> &array, int index) {
                 this->checkloaded();
-                MTLCompute::Buffer<T> buffer(gpu, array.size(), MTLCompute::ResourceStorage::Shared);
-                buffer = array;
-                this->commandManager.loadBuffer(buffer, index);
+                if (index < 0 || index >= MAX_BUFFERS) {
+                    throw std::out_of_range("Index out of bounds");
+                }
+                if (array.empty()) {
+                    throw std::invalid_argument("Array is empty");
+                }
+                MTLCompute::Buffer<T> &buffer = this->arrays[index];
+                if (buffer.getBuffer() == nullptr || buffer.length < array.size()) {
+                    buffer = MTLCompute::Buffer<T>(this->gpu, array.size(), MTLCompute::ResourceStorage::Shared);
+                }
+                buffer.write(0, array);
+                this->arraylengths[index] = array.size();
+                this->commandManager.loadBuffer(buffer.view(0, array.size()), index);
             }
 
             /**
              * @brief Load a matrix into the GPU
              *
              * Takes in a vector of vectors of type T and an index and loads the matrix into the GPU
-             * at that index
+             * at that index. Each slot keeps its texture, so loading a matrix of the same size
+             * only copies the data. When the size changes the old texture goes back to the
+             * pool and one of the new size comes from it.
              *
              * @param matrix The matrix to load
              * @param index The index to load the matrix into
              *
             */
-            void loadMatrix(std::vector<std::vector<T>> &matrix, int index) {
+            void loadMatrix(const std::vector<std::vector<T>> &matrix, int index) {
                 this->checkloaded();
-                MTLCompute::Texture<T> texture(gpu, matrix[0].size(), matrix.size());
-                texture = matrix;
+                if (index < 0 || index >= MAX_TEXTURES) {
+                    throw std::out_of_range("Index out of bounds");
+                }
+                if (matrix.empty() || matrix[0].empty()) {
+                    throw std::invalid_argument("Matrix is empty");
+                }
+                int width = matrix[0].size();
+                int height = matrix.size();
+                for (const std::vector<T> &row : matrix) {
+                    if ((int)row.size() != width) {
+                        throw std::invalid_argument("Matrix rows are not all the same length");
+                    }
+                }
+
+                MTLCompute::Texture<T> &texture = this->matrices[index];
+                if (texture.getTexture() == nullptr || texture.getWidth() != width || texture.getHeight() != height) {
+                    MTLCompute::Texture<T> replacement = this->pool.template acquire<T>(width, height);
+                    if (texture.getTexture() != nullptr) {
+                        this->pool.recycle(texture);
+                    }
+                    // Moved in, so the slot holds the pool's reference rather than a copy that outlives it
+                    texture = std::move(replacement);
+                }
+                this->staging.resize((size_t)width*height);
+                for (int y = 0; y < height; y++) {
+                    std::copy(matrix[y].begin(), matrix[y].end(), this->staging.begin() + (size_t)y*width);
+                }
+                texture.writeRegion(0, 0, width, height, this->staging.data());
                 this->commandManager.loadTexture(texture, index);
             }
 
@@ -148,9 +233,26 @@ namespace MTLCompute {
              *
             */
             std::vector<T> getArray(int index) {
+                std::vector<T> array;
+                this->getArray(index, array);
+                return array;
+            }
+
+            /**
+             * @brief Get an array from the GPU into existing storage
+             *
+             * Copies straight from the GPU buffer into the vector. The vector is only
+             * resized if it's the wrong length, so reusing it every frame doesn't allocate.
+             *
+             * @param index The index of the array
+             * @param array Where to put the array
+             *
+            */
+            void getArray(int index, std::vector<T> &array) {
                 this->checkloaded();
-                MTLCompute::Buffer<T> buffer = commandManager.getBuffers()[index];
-                return buffer.getData();
+                this->checkarray(index);
+                array.resize(this->arraylengths[index]);
+                this->arrays[index].read(0, array.size(), array.data());
             }
 
             /**
@@ -164,15 +266,41 @@ namespace MTLCompute {
              *
             */
             std::vector<std::vector<T>> getMatrix(int index) {
+                std::vector<std::vector<T>> matrix;
+                this->getMatrix(index, matrix);
+                return matrix;
+            }
+
+            /**
+             * @brief Get a matrix from the GPU into existing storage
+             *
+             * Copies the whole texture in one call into a staging area kept by the GPU
+             * object and then into the rows of the matrix. Rows are only resized if
+             * they're the wrong length, so reusing the matrix every frame doesn't allocate.
+             *
+             * @param index The index of the matrix
+             * @param matrix Where to put the matrix
+             *
+            */
+            void getMatrix(int index, std::vector<std::vector<T>> &matrix) {
                 this->checkloaded();
-                MTLCompute::Texture<T> texture = commandManager.getTextures()[index];
-                return texture.getData();
+                this->checkmatrix(index);
+                MTLCompute::Texture<T> &texture = this->matrices[index];
+                int width = texture.getWidth();
+                int height = texture.getHeight();
+                this->staging.resize((size_t)width*height);
+                texture.readRegion(0, 0, width, height, this->staging.data());
+                matrix.resize(height);
+                for (int y = 0; y < height; y++) {
+                    matrix[y].assign(this->staging.begin() + (size_t)y*width, this->staging.begin() + (size_t)(y + 1)*width);
+                }
             }
 
             /**
              * @brief Reset the GPU
              *
-             * Resets the command manager
+             * Resets the command manager. The resident buffers and textures are kept,
+             * so the next loadArray and loadMatrix calls can reuse them.
              *
             */
             void reset() {
@@ -180,6 +308,16 @@ namespace MTLCompute {
                 this->commandManager.reset();
             }
 
+            /**
+             * @brief Get the texture pool
+             *
+             * @return The texture pool used by loadMatrix
+             *
+            */
+            MTLCompute::TexturePool &getTexturePool() {
+                return this->pool;
+            }
+
             /**
              * @brief Get the GPU device
              *
@@ -0,0 +1,536 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeBuffer.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include "MTLComputeTexture.hpp"
+#include "MTLComputeTypes.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source for matrix multiplication
+     *
+     * T is float or half and SIMD_MATRIX is 1 when the GPU has simdgroup
+     * matrices. Every kernel works on a 64x64 tile of C per threadgroup,
+     * stepping through K 16 at a time with tiles of A and B in threadgroup
+     * memory. The tiles are kept as float, so half inputs still add up in float.
+     *
+     * gemm_simd has 4 SIMD groups each doing a 32x32 block of the tile with
+     * 8x8 simdgroup matrices. gemm_tiled has 256 threads each doing 4x4
+     * elements, for GPUs without them. The _texture versions read A and B
+     * from textures and write C to one.
+     *
+    */
+    inline constexpr const char *GEMM_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+#define BM 64
+#define BN 64
+#define BK 16
+
+struct GemmParams {
+  uint m;
+  uint n;
+  uint k;
+  uint transposeA;
+  uint transposeB;
+  float alpha;
+  float beta;
+  uint strideA;
+  uint strideB;
+  uint strideC;
+};
+
+inline float readA(device const T *a, constant GemmParams &p, uint row, uint col) {
+  return float(p.transposeA ? a[col*p.m + row] : a[row*p.k + col]);
+}
+
+inline float readA(texture2d<float, access::read> a, constant GemmParams &p, uint row, uint col) {
+  return a.read(uint2(col, row)).x;
+}
+
+inline float readB(device const T *b, constant GemmParams &p, uint row, uint col) {
+  return float(p.transposeB ? b[col*p.k + row] : b[row*p.n + col]);
+}
+
+inline float readB(texture2d<float, access::read> b, constant GemmParams &p, uint row, uint col) {
+  return b.read(uint2(col, row)).x;
+}
+
+inline void writeC(device T *c, constant GemmParams &p, uint row, uint col, float value) {
+  if (row < p.m && col < p.n) {
+    uint i = row*p.n + col;
+    float result = p.alpha*value;
+    // Like BLAS, C isn't read at all when beta is 0, so it can start as anything
+    if (p.beta != 0.0f) {
+      result += p.beta*float(c[i]);
+    }
+    c[i] = T(result);
+  }
+}
+
+inline void writeC(texture2d<float, access::write> c, constant GemmParams &p, uint row, uint col, float value) {
+  if (row < p.m && col < p.n) {
+    c.write(float4(p.alpha*value), uint2(col, row));
+  }
+}
+
+// Copy the next BK columns of A and BK rows of B, with zeros past the edges
+template<typename A, typename B>
+void loadTiles(A a, B b, constant GemmParams &p, threadgroup float *as, threadgroup float *bs,
+               uint row0, uint col0, uint k0, uint tid, uint threads) {
+  for (uint j = tid; j < BM*BK; j += threads) {
+    uint row = row0 + j/BK;
+    uint col = k0 + j%BK;
+    as[j] = row < p.m && col < p.k ? readA(a, p, row, col) : 0.0f;
+  }
+  for (uint j = tid; j < BK*BN; j += threads) {
+    uint row = k0 + j/BN;
+    uint col = col0 + j%BN;
+    bs[j] = row < p.k && col < p.n ? readB(b, p, row, col) : 0.0f;
+  }
+}
+
+template<typename A, typename B, typename C>
+void gemmTiled(A a, B b, C c, constant GemmParams &p, threadgroup float *as, threadgroup float *bs, uint2 group, uint2 lid) {
+  uint row0 = group.y*BM;
+  uint col0 = group.x*BN;
+  uint tid = lid.y*16 + lid.x;
+  float acc[4][4] = {};
+  for (uint k0 = 0; k0 < p.k; k0 += BK) {
+    loadTiles(a, b, p, as, bs, row0, col0, k0, tid, 256);
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    for (uint kk = 0; kk < BK; kk++) {
+      // Rows and columns 16 apart, so neighbouring threads read neighbouring floats
+      float av[4];
+      float bv[4];
+      for (uint i = 0; i < 4; i++) {
+        av[i] = as[(lid.y + i*16)*BK + kk];
+        bv[i] = bs[kk*BN + lid.x + i*16];
+      }
+      for (uint i = 0; i < 4; i++) {
+        for (uint j = 0; j < 4; j++) {
+          acc[i][j] = fma(av[i], bv[j], acc[i][j]);
+        }
+      }
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+  }
+  for (uint i = 0; i < 4; i++) {
+    for (uint j = 0; j < 4; j++) {
+      writeC(c, p, row0 + lid.y + i*16, col0 + lid.x + j*16, acc[i][j]);
+    }
+  }
+}
+
+kernel void gemm_tiled(device const T *a [[buffer(0)]], device const T *b [[buffer(1)]], device T *c [[buffer(2)]],
+                       constant GemmParams &p [[buffer(3)]],
+                       uint3 group [[threadgroup_position_in_grid]], uint3 lid [[thread_position_in_threadgroup]]) {
+  threadgroup float as[BM*BK];
+  threadgroup float bs[BK*BN];
+  gemmTiled(a + ulong(group.z)*p.strideA, b + ulong(group.z)*p.strideB, c + ulong(group.z)*p.strideC,
+            p, as, bs, group.xy, lid.xy);
+}
+
+kernel void gemm_tiled_texture(texture2d<float, access::read> a [[texture(0)]], texture2d<float, access::read> b [[texture(1)]],
+                               texture2d<float, access::write> c [[texture(2)]], constant GemmParams &p [[buffer(0)]],
+                               uint3 group [[threadgroup_position_in_grid]], uint3 lid [[thread_position_in_threadgroup]]) {
+  threadgroup float as[BM*BK];
+  threadgroup float bs[BK*BN];
+  gemmTiled(a, b, c, p, as, bs, group.xy, lid.xy);
+}
+
+#if SIMD_MATRIX
+
+template<typename A, typename B, typename C>
+void gemmSimd(A a, B b, C c, constant GemmParams &p, threadgroup float *as, threadgroup float *bs, threadgroup float *scratch,
+              uint2 group, uint tid, uint lane, uint simdgroup) {
+  uint row0 = group.y*BM;
+  uint col0 = group.x*BN;
+  uint sr = (simdgroup/2)*32;
+  uint sc = (simdgroup%2)*32;
+  simdgroup_float8x8 acc[4][4];
+  for (uint i = 0; i < 4; i++) {
+    for (uint j = 0; j < 4; j++) {
+      acc[i][j] = make_filled_simdgroup_matrix<float, 8, 8>(0.0f);
+    }
+  }
+  for (uint k0 = 0; k0 < p.k; k0 += BK) {
+    loadTiles(a, b, p, as, bs, row0, col0, k0, tid, 128);
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    for (uint kk = 0; kk < BK; kk += 8) {
+      simdgroup_float8x8 am[4];
+      simdgroup_float8x8 bm[4];
+      for (uint i = 0; i < 4; i++) {
+        simdgroup_load(am[i], as + (sr + i*8)*BK + kk, BK);
+        simdgroup_load(bm[i], bs + kk*BN + sc + i*8, BN);
+      }
+      for (uint i = 0; i < 4; i++) {
+        for (uint j = 0; j < 4; j++) {
+          simdgroup_multiply_accumulate(acc[i][j], am[i], bm[j], acc[i][j]);
+        }
+      }
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+  }
+
+  // Each 8x8 result goes through threadgroup memory so the edges and alpha and beta are done per element
+  scratch += simdgroup*64;
+  for (uint i = 0; i < 4; i++) {
+    for (uint j = 0; j < 4; j++) {
+      simdgroup_store(acc[i][j], scratch, 8);
+      simdgroup_barrier(mem_flags::mem_threadgroup);
+      for (uint e = lane; e < 64; e += 32) {
+        writeC(c, p, row0 + sr + i*8 + e/8, col0 + sc + j*8 + e%8, scratch[e]);
+      }
+      simdgroup_barrier(mem_flags::mem_threadgroup);
+    }
+  }
+}
+
+kernel void gemm_simd(device const T *a [[buffer(0)]], device const T *b [[buffer(1)]], device T *c [[buffer(2)]],
+                      constant GemmParams &p [[buffer(3)]],
+                      uint3 group [[threadgroup_position_in_grid]], uint tid [[thread_index_in_threadgroup]],
+                      uint lane [[thread_index_in_simdgroup]], uint simdgroup [[simdgroup_index_in_threadgroup]]) {
+  threadgroup float as[BM*BK];
+  threadgroup float bs[BK*BN];
+  threadgroup float scratch[4*64];
+  gemmSimd(a + ulong(group.z)*p.strideA, b + ulong(group.z)*p.strideB, c + ulong(group.z)*p.strideC,
+           p, as, bs, scratch, group.xy, tid, lane, simdgroup);
+}
+
+kernel void gemm_simd_texture(texture2d<float, access::read> a [[texture(0)]], texture2d<float, access::read> b [[texture(1)]],
+                              texture2d<float, access::write> c [[texture(2)]], constant GemmParams &p [[buffer(0)]],
+                              uint3 group [[threadgroup_position_in_grid]], uint tid [[thread_index_in_threadgroup]],
+                              uint lane [[thread_index_in_simdgroup]], uint simdgroup [[simdgroup_index_in_threadgroup]]) {
+  threadgroup float as[BM*BK];
+  threadgroup float bs[BK*BN];
+  threadgroup float scratch[4*64];
+  gemmSimd(a, b, c, p, as, bs, scratch, group.xy, tid, lane, simdgroup);
+}
+
+#endif
+)";
+
+    /**
+     * @brief The shape of a matrix multiplication, C = alpha*A*B + beta*C
+     *
+     * Matrices are row major and packed, so A is m rows of k, B is k rows of
+     * n and C is m rows of n. A transposed A is stored as k rows of m, and a
+     * transposed B as n rows of k. A batch is batch multiplications with each
+     * matrix a stride after the one before it.
+     *
+    */
+    struct GemmShape {
+        size_t m = 0; ///< The rows of A and C
+        size_t n = 0; ///< The columns of B and C
+        size_t k = 0; ///< The columns of A and rows of B
+        bool transposeA = false; ///< Whether A is stored transposed
+        bool transposeB = false; ///< Whether B is stored transposed
+        float alpha = 1; ///< What A*B is multiplied by
+        float beta = 0; ///< What C is multiplied by before adding, C isn't read when it's 0
+        size_t batch = 1; ///< The number of multiplications
+        size_t strideA = 0; ///< Elements from one A to the next, 0 to use the same A for the whole batch
+        size_t strideB = 0; ///< Elements from one B to the next, 0 to use the same B for the whole batch
+        size_t strideC = 0; ///< Elements from one C to the next
+    };
+
+    namespace host {
+
+        /**
+         * @brief Matrix multiplication on every CPU thread
+         *
+         * Each thread takes 64 row blocks of C. A block of B is copied into
+         * floats that stay in the cache while every row of the block uses it,
+         * and the innermost loop runs along a row of B and C so it vectorizes.
+         * Adds up in float like the GPU kernels, including for half.
+         *
+         * @param a The A matrices
+         * @param b The B matrices
+         * @param c The C matrices, written in place
+         * @param shape The shape of the multiplication
+         *
+        */
+        template<typename T>
+        void gemm(const T *a, const T *b, T *c, const GemmShape &shape) {
+            constexpr size_t MC = 64;
+            constexpr size_t KC = 256;
+            constexpr size_t NC = 512;
+            size_t m = shape.m, n = shape.n, k = shape.k;
+            if (m == 0 || n == 0 || shape.batch == 0) {
+                return;
+            }
+            size_t rowBlocks = (m + MC - 1)/MC;
+            size_t blocks = shape.batch*rowBlocks;
+
+            parallelChunks(blocks, chunkCount(blocks, 1), [&](size_t, size_t begin, size_t end) {
+                std::vector<float> ap(MC*KC);
+                std::vector<float> bp(KC*NC);
+                std::vector<float> acc(MC*NC);
+                for (size_t block = begin; block < end; block++) {
+                    size_t batch = block/rowBlocks;
+                    const T *A = a + batch*shape.strideA;
+                    const T *B = b + batch*shape.strideB;
+                    T *C = c + batch*shape.strideC;
+                    size_t i0 = (block%rowBlocks)*MC;
+                    size_t mi = std::min(MC, m - i0);
+
+                    for (size_t j0 = 0; j0 < n; j0 += NC) {
+                        size_t nj = std::min(NC, n - j0);
+                        std::fill(acc.begin(), acc.end(), 0.0f);
+                        for (size_t k0 = 0; k0 < k; k0 += KC) {
+                            size_t kk = std::min(KC, k - k0);
+                            for (size_t i = 0; i < mi; i++) {
+                                for (size_t p = 0; p < kk; p++) {
+                                    ap[i*KC + p] = float(shape.transposeA ? A[(k0 + p)*m + i0 + i] : A[(i0 + i)*k + k0 + p]);
+                                }
+                            }
+                            for (size_t p = 0; p < kk; p++) {
+                                for (size_t j = 0; j < nj; j++) {
+                                    bp[p*NC + j] = float(shape.transposeB ? B[(j0 + j)*k + k0 + p] : B[(k0 + p)*n + j0 + j]);
+                                }
+                            }
+                            for (size_t i = 0; i < mi; i++) {
+                                float *row = &acc[i*NC];
+                                for (size_t p = 0; p < kk; p++) {
+                                    float av = ap[i*KC + p];
+                                    const float *brow = &bp[p*NC];
+                                    for (size_t j = 0; j < nj; j++) {
+                                        row[j] += av*brow[j];
+                                    }
+                                }
+                            }
+                        }
+                        for (size_t i = 0; i < mi; i++) {
+                            T *crow = C + (i0 + i)*n + j0;
+                            for (size_t j = 0; j < nj; j++) {
+                                float result = shape.alpha*acc[i*NC + j];
+                                if (shape.beta != 0.0f) {
+                                    result += shape.beta*float(crow[j]);
+                                }
+                                crow[j] = T(result);
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+    }
+
+    /**
+     * @brief Matrix multiplication of float or half matrices on the GPU
+     *
+     * Uses simdgroup matrices on GPUs that have them (Apple7 and later) and a
+     * register tiled kernel on the rest. Matrices can be in buffers, with
+     * batches and transposes, or be single channel textures.
+     *
+     * @tparam T float or half
+     *
+    */
+    template<typename T>
+    class Gemm {
+
+        static_assert(std::is_same_v<T, float> || std::is_same_v<T, half>, "Matrix multiplication is only compiled for float and half");
+
+        private:
+            static constexpr size_t TILE = 64; ///< Rows and columns of C per threadgroup, the same as BM and BN in GEMM_SOURCE
+
+            /**
+             * @brief The uniforms for the matrix kernels, the same layout as GemmParams
+             *
+            */
+            struct GemmParams {
+                uint32_t m; ///< The rows of A and C
+                uint32_t n; ///< The columns of B and C
+                uint32_t k; ///< The columns of A and rows of B
+                uint32_t transposeA; ///< Whether A is stored transposed
+                uint32_t transposeB; ///< Whether B is stored transposed
+                float alpha; ///< What A*B is multiplied by
+                float beta; ///< What C is multiplied by before adding
+                uint32_t strideA; ///< Elements from one A to the next
+                uint32_t strideB; ///< Elements from one B to the next
+                uint32_t strideC; ///< Elements from one C to the next
+            };
+
+            MTL::Device *gpu; ///< The Metal device object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+            bool simdMatrix; ///< Whether to use the simdgroup matrix kernels
+
+            /**
+             * @brief Get a matrix kernel
+             *
+             * @param texture Whether to get the texture version
+             *
+             * @return MTL::ComputePipelineState* The pipeline
+             *
+            */
+            MTL::ComputePipelineState *pipeline(bool texture) const {
+                KernelSource source{GEMM_SOURCE, {{"T", std::is_same_v<T, half> ? "half" : "float"},
+                                                  {"SIMD_MATRIX", this->simdMatrix ? "1" : "0"}}};
+                std::string name = std::string(this->simdMatrix ? "gemm_simd" : "gemm_tiled") + (texture ? "_texture" : "");
+                return LibraryCache::getPipeline(this->gpu, source, name);
+            }
+
+            /**
+             * @brief Encode a dispatch and wait for it
+             *
+             * @param pipeline The matrix kernel
+             * @param params The uniforms
+             * @param batch The number of multiplications
+             * @param bind Binds the matrices to the encoder
+             * @param c The buffer C is in, or null for a texture
+             *
+            */
+            template<typename F>
+            void run(MTL::ComputePipelineState *pipeline, const GemmParams &params, size_t batch, F bind, const Buffer<T> *c) {
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                commandEncoder->setComputePipelineState(pipeline);
+                bind(commandEncoder);
+                MTL::Size groups = MTL::Size::Make((params.n + TILE - 1)/TILE, (params.m + TILE - 1)/TILE, batch);
+                MTL::Size threads = this->simdMatrix ? MTL::Size::Make(128, 1, 1) : MTL::Size::Make(16, 16, 1);
+                commandEncoder->dispatchThreadgroups(groups, threads);
+                commandEncoder->endEncoding();
+
+                if (c != nullptr && c->getStorageMode() == ResourceStorage::Managed) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->synchronizeResource(c->getBuffer());
+                    blitEncoder->endEncoding();
+                }
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the Gemm class
+             *
+             * @param gpu The Metal device object
+             *
+            */
+            Gemm(MTL::Device *gpu) {
+                this->gpu = gpu;
+                this->commandQueue = gpu->newCommandQueue();
+                this->simdMatrix = gpu->supportsFamily(MTL::GPUFamilyApple7);
+            }
+
+            Gemm(const Gemm &) = delete;
+            Gemm & operator=(const Gemm &) = delete;
+
+            /**
+             * @brief Destructor for the Gemm class
+             *
+             * Releases the command queue
+             *
+            */
+            ~Gemm() {
+                this->commandQueue->autorelease();
+            }
+
+            /**
+             * @brief Multiply matrices in buffers, C = alpha*A*B + beta*C
+             *
+             * @param a The A matrices
+             * @param b The B matrices
+             * @param c The C matrices, written in place
+             * @param shape The shape of the multiplication
+             *
+            */
+            void multiply(const Buffer<T> &a, const Buffer<T> &b, Buffer<T> &c, const GemmShape &shape) {
+                if (a.getFreed() || b.getFreed() || c.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                size_t sizeA = shape.m*shape.k, sizeB = shape.k*shape.n, sizeC = shape.m*shape.n;
+                if (shape.m == 0 || shape.n == 0 || shape.batch == 0) {
+                    return;
+                }
+                if (shape.batch > 1 && shape.strideC < sizeC) {
+                    throw std::invalid_argument("The C matrices in a batch overlap");
+                }
+                size_t last = shape.batch - 1;
+                if (a.size() < last*shape.strideA + sizeA || b.size() < last*shape.strideB + sizeB ||
+                    c.size() < last*shape.strideC + sizeC) {
+                    throw std::invalid_argument("Buffer too small for the matrix shape");
+                }
+                if (std::max({sizeA, sizeB, sizeC, shape.strideA, shape.strideB, shape.strideC}) > 0xffffffff) {
+                    throw std::invalid_argument("Matrix too large, max is 2^32 - 1 elements");
+                }
+
+                GemmParams params{(uint32_t)shape.m, (uint32_t)shape.n, (uint32_t)shape.k, shape.transposeA, shape.transposeB,
+                                  shape.alpha, shape.beta, (uint32_t)shape.strideA, (uint32_t)shape.strideB, (uint32_t)shape.strideC};
+                a.flush();
+                b.flush();
+                c.flush();
+                this->run(this->pipeline(false), params, shape.batch, [&](MTL::ComputeCommandEncoder *encoder) {
+                    encoder->setBuffer(a.getBuffer(), 0, 0);
+                    encoder->setBuffer(b.getBuffer(), 0, 1);
+                    encoder->setBuffer(c.getBuffer(), 0, 2);
+                    encoder->setBytes(&params, sizeof(params), 3);
+                }, &c);
+            }
+
+            /**
+             * @brief Multiply matrices in textures, C = alpha*A*B
+             *
+             * Each texel is one element, with x as the column and y as the row
+             *
+             * @param a The A matrix, k wide and m high
+             * @param b The B matrix, n wide and k high
+             * @param c Where to put C, n wide and m high
+             * @param alpha What A*B is multiplied by
+             *
+            */
+            void multiply(const Texture<T> &a, const Texture<T> &b, Texture<T> &c, float alpha = 1) {
+                if (a.getFreed() || b.getFreed() || c.getFreed()) {
+                    throw std::runtime_error("Texture already freed");
+                }
+                if (a.getWidth() != b.getHeight() || c.getHeight() != a.getHeight() || c.getWidth() != b.getWidth()) {
+                    throw std::invalid_argument("Texture sizes don't match for a matrix multiplication");
+                }
+                GemmParams params{(uint32_t)a.getHeight(), (uint32_t)b.getWidth(), (uint32_t)a.getWidth(), 0, 0, alpha, 0, 0, 0, 0};
+                this->run(this->pipeline(true), params, 1, [&](MTL::ComputeCommandEncoder *encoder) {
+                    encoder->setTexture(a.getTexture(), 0);
+                    encoder->setTexture(b.getTexture(), 1);
+                    encoder->setTexture(c.getTexture(), 2);
+                    encoder->setBytes(&params, sizeof(params), 0);
+                }, nullptr);
+            }
+
+            /**
+             * @brief Choose between the simdgroup matrix kernels and the tiled ones
+             *
+             * The constructor picks simdgroup matrices when the GPU has them,
+             * this is for comparing the two
+             *
+             * @param use Whether to use simdgroup matrices
+             *
+            */
+            void setSimdgroupMatrix(bool use) {
+                if (use && !this->gpu->supportsFamily(MTL::GPUFamilyApple7)) {
+                    throw std::invalid_argument("This GPU doesn't have simdgroup matrices");
+                }
+                this->simdMatrix = use;
+            }
+
+            /**
+             * @brief Get whether the simdgroup matrix kernels are used
+             *
+             * @return bool True if they are
+             *
+            */
+            bool getSimdgroupMatrix() const {
+                return this->simdMatrix;
+            }
+
+    };
+
+}
@@ -1,8 +1,13 @@
+#include <algorithm>
+#include <array>
 #include <iostream>
-#include <map>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #define NS_PRIVATE_IMPLEMENTATION
 #define MTL_PRIVATE_IMPLEMENTATION
 #include "Metal.hpp"
+#include "MTLComputeTypes.hpp"
 
 #pragma once
 
@@ -11,14 +16,47 @@ namespace MTLCompute {
     constexpr int MAX_BUFFERS = 31;
     constexpr int MAX_TEXTURES = 128;
     constexpr long MAX_TEXTURE_SIZE = 16384;
+    constexpr long MAX_TEXTURE_3D_SIZE = 2048;
+    constexpr long MAX_TEXTURE_ARRAY_LENGTH = 2048;
     // i cant find the max buffer size
 
+#ifdef MTLCOMPUTE_UNCHECKED_ACCESS
+    constexpr bool CHECKED_ACCESS = false; ///< Whether element access checks bounds and freed resources
+#else
+    constexpr bool CHECKED_ACCESS = true; ///< Whether element access checks bounds and freed resources
+#endif
+
+    /**
+     * @brief Hash bytes with 64 bit FNV-1a
+     *
+     * Pass the result back in as the seed to hash several pieces together
+     *
+     * @param data The bytes to hash
+     * @param length The number of bytes
+     * @param seed The hash so far
+     *
+     * @return uint64_t The hash
+     *
+    */
+    inline uint64_t hashBytes(const void *data, size_t length, uint64_t seed = 14695981039346656037ull) {
+        const uint8_t *bytes = (const uint8_t *)data;
+        for (size_t i = 0; i < length; i++) {
+            seed = (seed ^ bytes[i])*1099511628211ull;
+        }
+        return seed;
+    }
+
     enum class ResourceStorage {
         Shared = MTL::ResourceStorageModeShared,
         Managed = MTL::ResourceStorageModeManaged,
         Private = MTL::ResourceStorageModePrivate
     };
 
+    enum class BufferAccess {
+        ReadOnly, ///< The kernel only reads the buffer
+        ReadWrite ///< The kernel may write to the buffer
+    };
+
     enum class TextureType {
         uint8 = MTL::PixelFormatR8Uint,
         uint16 = MTL::PixelFormatR16Uint,
@@ -28,17 +66,178 @@ namespace MTLCompute {
         int16 = MTL::PixelFormatR16Sint,
         int32 = MTL::PixelFormatR32Sint,
 
+        float16 = MTL::PixelFormatR16Float,
         float32 = MTL::PixelFormatR32Float,
+
+        rg8uint = MTL::PixelFormatRG8Uint,
+        rg16float = MTL::PixelFormatRG16Float,
+        rg32float = MTL::PixelFormatRG32Float,
+
+        rgba8uint = MTL::PixelFormatRGBA8Uint,
+        rgba8unorm = MTL::PixelFormatRGBA8Unorm,
+        rgba16float = MTL::PixelFormatRGBA16Float,
+        rgba32float = MTL::PixelFormatRGBA32Float,
+    };
+
+    /**
+     * @brief Get the size of one element of a texture type
+     *
+     * @param tt The texture type
+     *
+     * @return size_t The size in bytes
+     *
+    */
+    constexpr size_t textureTypeSize(TextureType tt) {
+        switch (tt) {
+            case TextureType::uint8:
+            case TextureType::int8:
+                return 1;
+            case TextureType::uint16:
+            case TextureType::int16:
+            case TextureType::float16:
+            case TextureType::rg8uint:
+                return 2;
+            case TextureType::rg32float:
+            case TextureType::rgba16float:
+                return 8;
+            case TextureType::rgba32float:
+                return 16;
+            default:
+                return 4;
+        }
+    }
+
+    /**
+     * @brief The pixel format information shared by every supported element type
+     *
+     * @tparam F The Metal pixel format
+     * @tparam C The type of one channel
+     * @tparam N The number of channels
+     *
+    */
+    template<MTL::PixelFormat F, typename C, int N>
+    struct PixelFormatInfo {
+        static constexpr bool supported = true; ///< Whether the type can be used in a texture
+        static constexpr MTL::PixelFormat format = F; ///< The Metal pixel format
+        static constexpr int channels = N; ///< The number of channels in a pixel
+        static constexpr size_t size = sizeof(C)*N; ///< The size of a pixel in bytes
+        static constexpr bool filterable = std::is_floating_point_v<C> || std::is_same_v<C, half>; ///< Whether the GPU can filter (and blit mipmaps for) the format
+        using channel_type = C; ///< The type of one channel
+    };
+
+    /**
+     * @brief Compile time pixel format of a texture element type
+     *
+     * Specialized for every type a Texture can hold. Single values map to the
+     * one channel formats and std::array<C, 2> or std::array<C, 4> map to the
+     * two and four channel formats. Anything else isn't supported, and creating
+     * a Texture of it fails to compile.
+     *
+     * @tparam T The element type
+     *
+    */
+    template<typename T>
+    struct PixelFormatTraits {
+        static constexpr bool supported = false; ///< Whether the type can be used in a texture
+    };
+
+    template<> struct PixelFormatTraits<uint8_t> : PixelFormatInfo<MTL::PixelFormatR8Uint, uint8_t, 1> {};
+    template<> struct PixelFormatTraits<uint16_t> : PixelFormatInfo<MTL::PixelFormatR16Uint, uint16_t, 1> {};
+    template<> struct PixelFormatTraits<uint32_t> : PixelFormatInfo<MTL::PixelFormatR32Uint, uint32_t, 1> {};
+    template<> struct PixelFormatTraits<int8_t> : PixelFormatInfo<MTL::PixelFormatR8Sint, int8_t, 1> {};
+    template<> struct PixelFormatTraits<int16_t> : PixelFormatInfo<MTL::PixelFormatR16Sint, int16_t, 1> {};
+    template<> struct PixelFormatTraits<int32_t> : PixelFormatInfo<MTL::PixelFormatR32Sint, int32_t, 1> {};
+    template<> struct PixelFormatTraits<half> : PixelFormatInfo<MTL::PixelFormatR16Float, half, 1> {};
+    template<> struct PixelFormatTraits<float> : PixelFormatInfo<MTL::PixelFormatR32Float, float, 1> {};
+
+    template<> struct PixelFormatTraits<std::array<uint8_t, 2>> : PixelFormatInfo<MTL::PixelFormatRG8Uint, uint8_t, 2> {};
+    template<> struct PixelFormatTraits<std::array<uint16_t, 2>> : PixelFormatInfo<MTL::PixelFormatRG16Uint, uint16_t, 2> {};
+    template<> struct PixelFormatTraits<std::array<uint32_t, 2>> : PixelFormatInfo<MTL::PixelFormatRG32Uint, uint32_t, 2> {};
+    template<> struct PixelFormatTraits<std::array<int8_t, 2>> : PixelFormatInfo<MTL::PixelFormatRG8Sint, int8_t, 2> {};
+    template<> struct PixelFormatTraits<std::array<int16_t, 2>> : PixelFormatInfo<MTL::PixelFormatRG16Sint, int16_t, 2> {};
+    template<> struct PixelFormatTraits<std::array<int32_t, 2>> : PixelFormatInfo<MTL::PixelFormatRG32Sint, int32_t, 2> {};
+    template<> struct PixelFormatTraits<std::array<half, 2>> : PixelFormatInfo<MTL::PixelFormatRG16Float, half, 2> {};
+    template<> struct PixelFormatTraits<std::array<float, 2>> : PixelFormatInfo<MTL::PixelFormatRG32Float, float, 2> {};
+
+    template<> struct PixelFormatTraits<std::array<uint8_t, 4>> : PixelFormatInfo<MTL::PixelFormatRGBA8Uint, uint8_t, 4> {};
+    template<> struct PixelFormatTraits<std::array<uint16_t, 4>> : PixelFormatInfo<MTL::PixelFormatRGBA16Uint, uint16_t, 4> {};
+    template<> struct PixelFormatTraits<std::array<uint32_t, 4>> : PixelFormatInfo<MTL::PixelFormatRGBA32Uint, uint32_t, 4> {};
+    template<> struct PixelFormatTraits<std::array<int8_t, 4>> : PixelFormatInfo<MTL::PixelFormatRGBA8Sint, int8_t, 4> {};
+    template<> struct PixelFormatTraits<std::array<int16_t, 4>> : PixelFormatInfo<MTL::PixelFormatRGBA16Sint, int16_t, 4> {};
+    template<> struct PixelFormatTraits<std::array<int32_t, 4>> : PixelFormatInfo<MTL::PixelFormatRGBA32Sint, int32_t, 4> {};
+    template<> struct PixelFormatTraits<std::array<half, 4>> : PixelFormatInfo<MTL::PixelFormatRGBA16Float, half, 4> {};
+    template<> struct PixelFormatTraits<std::array<float, 4>> : PixelFormatInfo<MTL::PixelFormatRGBA32Float, float, 4> {};
+
+    /**
+     * @brief The Metal Shading Language name of an element type
+     *
+     * Specialized for the types the built-in kernels are compiled for. The name
+     * is defined as T when the kernel source is compiled, so there's one
+     * library per element type.
+     *
+     * @tparam T The element type
+     *
+    */
+    template<typename T>
+    struct ShaderTypeTraits {
+        static constexpr bool supported = false; ///< Whether the built-in kernels can use the type
+    };
+
+    template<> struct ShaderTypeTraits<float> {
+        static constexpr bool supported = true; ///< Whether the built-in kernels can use the type
+        static constexpr const char *name = "float"; ///< The type in Metal
     };
 
-    inline std::map<TextureType, size_t> TextureTypeSizes = {
-        {TextureType::uint8, sizeof(uint8_t)},
-        {TextureType::uint16, sizeof(uint16_t)},
-        {TextureType::uint32, sizeof(uint32_t)},
-        {TextureType::int8, sizeof(int8_t)},
-        {TextureType::int16, sizeof(int16_t)},
-        {TextureType::int32, sizeof(int32_t)},
-        {TextureType::float32, sizeof(float_t)}
+    template<> struct ShaderTypeTraits<int32_t> {
+        static constexpr bool supported = true; ///< Whether the built-in kernels can use the type
+        static constexpr const char *name = "int"; ///< The type in Metal
     };
 
-}
\ No newline at end of file
+    template<> struct ShaderTypeTraits<uint32_t> {
+        static constexpr bool supported = true; ///< Whether the built-in kernels can use the type
+        static constexpr const char *name = "uint"; ///< The type in Metal
+    };
+
+    namespace host {
+
+        /**
+         * @brief Get how many pieces to split work into for the CPU
+         *
+         * @param count The number of elements
+         * @param grain The fewest elements worth giving a thread
+         *
+         * @return size_t The number of pieces, at most one per hardware thread
+         *
+        */
+        inline size_t chunkCount(size_t count, size_t grain) {
+            size_t threads = std::max(1u, std::thread::hardware_concurrency());
+            return std::max<size_t>(1, std::min(threads, count/std::max<size_t>(1, grain)));
+        }
+
+        /**
+         * @brief Run a function over even pieces of a range, one thread per piece
+         *
+         * The first piece runs on the calling thread. Returns once every piece is done.
+         *
+         * @param count The number of elements
+         * @param chunks The number of pieces, from host::chunkCount()
+         * @param function Called as function(piece, begin, end)
+         *
+        */
+        template<typename F>
+        void parallelChunks(size_t count, size_t chunks, F &&function) {
+            std::vector<std::thread> threads;
+            for (size_t c = 1; c < chunks; c++) {
+                threads.emplace_back([&function, c, count, chunks] {
+                    function(c, count*c/chunks, count*(c + 1)/chunks);
+                });
+            }
+            function((size_t)0, (size_t)0, count/chunks);
+            for (std::thread &thread : threads) {
+                thread.join();
+            }
+        }
+
+    }
+
+}
@@ -0,0 +1,551 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeBuffer.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include "MTLComputeTexture.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source for histograms
+     *
+     * T is the buffer element type and IN_C the texture channel type, N is the
+     * number of channels and BINS the bins per channel. With PRIVATE_BINS each
+     * threadgroup counts into its own bins in threadgroup memory, so its
+     * atomics only contend inside the threadgroup, and adds them to the output
+     * once at the end. Without it, when the bins don't fit in threadgroup
+     * memory, every element goes straight to the output with a device atomic.
+     *
+     * Compiled without fast math so NaNs are skipped and the bin edges match
+     * host::binIndex exactly.
+     *
+    */
+    inline constexpr const char *HISTOGRAM_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+#define TOTAL (N*BINS)
+
+struct HistogramParams {
+  uint count;
+  uint width;
+  float low;
+  float high;
+  float scale;
+};
+
+inline int binIndex(float x, constant HistogramParams &params) {
+  if (!(x >= params.low && x <= params.high)) {
+    return -1;
+  }
+  return min(int((x - params.low)*params.scale), BINS - 1);
+}
+
+#if PRIVATE_BINS
+#define BIN_SETUP \
+  threadgroup atomic_uint bins[TOTAL]; \
+  for (uint b = lid; b < TOTAL; b += groupSize) { \
+    atomic_store_explicit(&bins[b], 0, memory_order_relaxed); \
+  } \
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+#define BIN_ADD(b) atomic_fetch_add_explicit(&bins[b], 1, memory_order_relaxed)
+#define BIN_MERGE \
+  threadgroup_barrier(mem_flags::mem_threadgroup); \
+  for (uint b = lid; b < TOTAL; b += groupSize) { \
+    uint n = atomic_load_explicit(&bins[b], memory_order_relaxed); \
+    if (n != 0) { \
+      atomic_fetch_add_explicit(&out[b], n, memory_order_relaxed); \
+    } \
+  }
+#else
+#define BIN_SETUP
+#define BIN_ADD(b) atomic_fetch_add_explicit(&out[b], 1, memory_order_relaxed)
+#define BIN_MERGE
+#endif
+
+kernel void histogram_buffer(device const T *in [[buffer(0)]], device atomic_uint *out [[buffer(1)]],
+                             constant HistogramParams &params [[buffer(2)]],
+                             uint gid [[thread_position_in_grid]], uint threads [[threads_per_grid]],
+                             uint lid [[thread_index_in_threadgroup]], uint groupSize [[threads_per_threadgroup]]) {
+  BIN_SETUP
+  for (uint i = gid; i < params.count; i += threads) {
+    int bin = binIndex(float(in[i]), params);
+    if (bin >= 0) {
+      BIN_ADD(bin);
+    }
+  }
+  BIN_MERGE
+}
+
+kernel void histogram_texture(texture2d<IN_C, access::read> in [[texture(0)]], device atomic_uint *out [[buffer(0)]],
+                              constant HistogramParams &params [[buffer(1)]],
+                              uint gid [[thread_position_in_grid]], uint threads [[threads_per_grid]],
+                              uint lid [[thread_index_in_threadgroup]], uint groupSize [[threads_per_threadgroup]]) {
+  BIN_SETUP
+  for (uint i = gid; i < params.count; i += threads) {
+    vec<IN_C, 4> pixel = in.read(uint2(i % params.width, i / params.width));
+    for (int c = 0; c < N; c++) {
+      int bin = binIndex(float(pixel[c]), params);
+      if (bin >= 0) {
+        BIN_ADD(c*BINS + bin);
+      }
+    }
+  }
+  BIN_MERGE
+}
+)";
+
+    namespace host {
+
+        /**
+         * @brief Find the bin a value goes in
+         *
+         * Values are compared as floats, the same as the kernels do. The range
+         * includes both ends, with high going in the last bin.
+         *
+         * @param x The value
+         * @param low The bottom of the first bin
+         * @param high The top of the last bin
+         * @param scale bins/(high - low), as a float
+         * @param bins The number of bins
+         *
+         * @return int64_t The bin, or -1 for NaN and values outside the range
+         *
+        */
+        inline int64_t binIndex(float x, float low, float high, float scale, size_t bins) {
+            if (!(x >= low && x <= high)) {
+                return -1;
+            }
+            return std::min<int64_t>((int64_t)((x - low)*scale), (int64_t)bins - 1);
+        }
+
+        /**
+         * @brief Count interleaved channels into a histogram per channel on every CPU thread
+         *
+         * Each thread counts its piece into its own bins, and the bins are added
+         * up at the end, also on every thread
+         *
+         * @param data The channels, channels values per element
+         * @param count The number of elements
+         * @param channels The number of channels
+         * @param bins The number of bins per channel
+         * @param low The bottom of the first bin
+         * @param high The top of the last bin
+         * @param out Where to put the counts, bins for channel 0 then bins for channel 1 and so on
+         *
+        */
+        template<typename C>
+        void histogramChannels(const C *data, size_t count, int channels, size_t bins, float low, float high, uint32_t *out) {
+            float scale = (float)bins/(high - low);
+            size_t total = channels*bins;
+            size_t chunks = chunkCount(count, 1 << 16);
+            std::vector<std::vector<uint32_t>> partials(chunks);
+            parallelChunks(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+                partials[chunk].assign(total, 0);
+                uint32_t *local = partials[chunk].data();
+                for (size_t i = begin; i < end; i++) {
+                    for (int c = 0; c < channels; c++) {
+                        int64_t bin = binIndex(float(data[i*channels + c]), low, high, scale, bins);
+                        if (bin >= 0) {
+                            local[c*bins + bin]++;
+                        }
+                    }
+                }
+            });
+            parallelChunks(total, chunkCount(total, 1 << 12), [&](size_t, size_t begin, size_t end) {
+                for (size_t b = begin; b < end; b++) {
+                    uint32_t sum = 0;
+                    for (const std::vector<uint32_t> &partial : partials) {
+                        sum += partial[b];
+                    }
+                    out[b] = sum;
+                }
+            });
+        }
+
+        /**
+         * @brief Count numbers or pixels into a histogram on every CPU thread
+         *
+         * @param data The numbers, or pixels of any type a Texture can have
+         * @param count The number of elements
+         * @param bins The number of bins per channel
+         * @param low The bottom of the first bin
+         * @param high The top of the last bin
+         * @param out Where to put the counts, bins for each channel one after the other
+         *
+        */
+        template<typename T>
+        void histogram(const T *data, size_t count, size_t bins, float low, float high, uint32_t *out) {
+            if constexpr (std::is_arithmetic_v<T>) {
+                histogramChannels(data, count, 1, bins, low, high, out);
+            } else {
+                static_assert(PixelFormatTraits<T>::supported, "Pixel type not supported");
+                using C = typename PixelFormatTraits<T>::channel_type;
+                histogramChannels(reinterpret_cast<const C *>(data), count, PixelFormatTraits<T>::channels, bins, low, high, out);
+            }
+        }
+
+    }
+
+    /**
+     * @brief The number of channels a Histogram counts, 1 for numbers
+     *
+    */
+    template<typename T, bool = std::is_arithmetic_v<T>>
+    struct HistogramChannels {
+        static constexpr int value = 1; ///< The number of channels
+    };
+
+    template<typename T>
+    struct HistogramChannels<T, false> {
+        static constexpr int value = PixelFormatTraits<T>::channels; ///< The number of channels
+    };
+
+    /**
+     * @brief Counts Buffers and Textures into histograms on the GPU
+     *
+     * The bins are even between low and high, with values outside the range
+     * and NaNs left out and high counted in the last bin. So for an 8 bit image
+     * 256 bins from 0 to 256 is one bin per value. Textures get a histogram for
+     * each channel.
+     *
+     * Each threadgroup counts into its own bins in threadgroup memory and adds
+     * them to the result at the end, instead of every thread fighting over the
+     * same few counters in device memory. Buffers smaller than the host
+     * threshold are counted on the CPU, like Reducer does.
+     *
+     * @tparam T The buffer element or texture pixel type
+     *
+    */
+    template<typename T>
+    class Histogram {
+        private:
+            static constexpr size_t MAX_GROUPS = 256; ///< The most threadgroups, each one adds its bins to the result once
+            static constexpr size_t ELEMENTS_PER_THREAD = 32; ///< How many elements each thread should get before adding threadgroups
+            static constexpr int N = HistogramChannels<T>::value; ///< The number of channels
+
+            /**
+             * @brief The uniforms for the histogram kernels, the same layout as HistogramParams
+             *
+            */
+            struct Params {
+                uint32_t count; ///< The number of elements or pixels
+                uint32_t width; ///< The texture width
+                float low; ///< The bottom of the first bin
+                float high; ///< The top of the last bin
+                float scale; ///< bins/(high - low)
+            };
+
+            MTL::Device *gpu; ///< The Metal device object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+            size_t bins; ///< The number of bins per channel
+            float low; ///< The bottom of the first bin
+            float high; ///< The top of the last bin
+            size_t hostThreshold; ///< Buffers with fewer elements are counted on the CPU
+            Buffer<uint32_t> result; ///< Where the GPU counts go when they're returned as a vector
+
+            /**
+             * @brief Get the Metal channel type of a texture
+             *
+             * @return const char* float, int or uint
+             *
+            */
+            template<typename U>
+            static const char *channelType() {
+                if constexpr (std::is_integral_v<U>) {
+                    return std::is_signed_v<U> ? "int" : "uint";
+                } else {
+                    return "float";
+                }
+            }
+
+            /**
+             * @brief Get a histogram kernel
+             *
+             * @param bufferType The Metal buffer element type
+             * @param inType The Metal texture channel type
+             * @param funcname histogram_buffer or histogram_texture
+             *
+             * @return MTL::ComputePipelineState* The pipeline
+             *
+            */
+            MTL::ComputePipelineState *pipeline(const char *bufferType, const char *inType, const std::string &funcname) const {
+                bool privateBins = N*this->bins*sizeof(uint32_t) <= this->gpu->maxThreadgroupMemoryLength();
+                KernelSource source{HISTOGRAM_SOURCE, {{"T", bufferType}, {"IN_C", inType}, {"N", std::to_string(N)},
+                                                       {"BINS", std::to_string(this->bins)},
+                                                       {"PRIVATE_BINS", privateBins ? "1" : "0"}}, false};
+                return LibraryCache::getPipeline(this->gpu, source, funcname);
+            }
+
+            /**
+             * @brief Check the bins and range before anything is allocated
+             *
+             * @param bins The number of bins per channel
+             * @param low The bottom of the first bin
+             * @param high The top of the last bin
+             *
+             * @return size_t The number of bins for every channel
+             *
+            */
+            static size_t checkBins(size_t bins, float low, float high) {
+                if (bins == 0 || bins > (size_t)std::numeric_limits<int32_t>::max()/N) {
+                    throw std::invalid_argument("Histogram needs at least one bin, and fewer than 2^31");
+                }
+                if (!std::isfinite(low) || !std::isfinite(high) || !(high > low)) {
+                    throw std::invalid_argument("Histogram range has to be finite with high more than low");
+                }
+                return N*bins;
+            }
+
+            /**
+             * @brief Check the output buffer
+             *
+             * @param out The output buffer
+             *
+            */
+            void checkOutput(const Buffer<uint32_t> &out) const {
+                if (out.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (out.size() < N*this->bins) {
+                    throw std::invalid_argument("Buffer too small for the histogram");
+                }
+            }
+
+            /**
+             * @brief Count on the GPU and wait for it
+             *
+             * @param pipeline The histogram kernel
+             * @param params The uniforms
+             * @param out The output buffer
+             * @param accumulate Whether to add to the counts already in out
+             * @param bind Binds the input to the encoder
+             *
+            */
+            template<typename F>
+            void run(MTL::ComputePipelineState *pipeline, const Params &params, Buffer<uint32_t> &out, bool accumulate, F bind) {
+                size_t threads = std::min<size_t>(pipeline->maxTotalThreadsPerThreadgroup(), 256);
+                size_t groups = std::clamp<size_t>((params.count + threads*ELEMENTS_PER_THREAD - 1)/(threads*ELEMENTS_PER_THREAD),
+                                                   1, MAX_GROUPS);
+                out.flush();
+
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                if (!accumulate) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->fillBuffer(out.getBuffer(), NS::Range::Make(0, N*this->bins*sizeof(uint32_t)), 0);
+                    blitEncoder->endEncoding();
+                }
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                commandEncoder->setComputePipelineState(pipeline);
+                bind(commandEncoder);
+                commandEncoder->dispatchThreadgroups(MTL::Size::Make(groups, 1, 1), MTL::Size::Make(threads, 1, 1));
+                commandEncoder->endEncoding();
+
+                if (out.getStorageMode() == ResourceStorage::Managed) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->synchronizeResource(out.getBuffer());
+                    blitEncoder->endEncoding();
+                }
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+            }
+
+            /**
+             * @brief Put counts made on the CPU in the output buffer
+             *
+             * @param counts The counts
+             * @param out The output buffer
+             * @param accumulate Whether to add to the counts already in out
+             *
+            */
+            void store(const std::vector<uint32_t> &counts, Buffer<uint32_t> &out, bool accumulate) const {
+                if (out.getStorageMode() == ResourceStorage::Private) {
+                    throw std::invalid_argument("Private buffers of this type can't be counted into");
+                }
+                uint32_t *data = out.span(0, counts.size()).data();
+                for (size_t b = 0; b < counts.size(); b++) {
+                    data[b] = accumulate ? data[b] + counts[b] : counts[b];
+                }
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the Histogram class
+             *
+             * @param gpu The Metal device object
+             * @param bins The number of bins per channel
+             * @param low The bottom of the first bin
+             * @param high The top of the last bin, more than low
+             * @param hostThreshold Buffers with fewer elements are counted on the CPU
+             *
+            */
+            Histogram(MTL::Device *gpu, size_t bins, float low, float high, size_t hostThreshold = 1 << 16)
+                : result(gpu, checkBins(bins, low, high), ResourceStorage::Shared) {
+                this->gpu = gpu;
+                this->bins = bins;
+                this->low = low;
+                this->high = high;
+                this->hostThreshold = hostThreshold;
+                this->commandQueue = gpu->newCommandQueue();
+            }
+
+            Histogram(const Histogram &) = delete;
+            Histogram & operator=(const Histogram &) = delete;
+
+            /**
+             * @brief Destructor for the Histogram class
+             *
+             * Releases the command queue
+             *
+            */
+            ~Histogram() {
+                this->commandQueue->autorelease();
+            }
+
+            /**
+             * @brief Count a buffer into an output buffer
+             *
+             * @param buffer The numbers to count
+             * @param out Where to put the counts, at least bins elements
+             * @param accumulate Whether to add to the counts already in out, for counting several buffers
+             *
+            */
+            void count(const Buffer<T> &buffer, Buffer<uint32_t> &out, bool accumulate = false) {
+                static_assert(std::is_arithmetic_v<T>, "Only buffers of numbers can be counted, use a Texture for pixels");
+                if (buffer.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                this->checkOutput(out);
+                bool gpuOnly = buffer.getStorageMode() == ResourceStorage::Private || out.getStorageMode() == ResourceStorage::Private;
+                if constexpr (ShaderTypeTraits<T>::supported) {
+                    if (gpuOnly || buffer.size() >= this->hostThreshold) {
+                        if (buffer.size() > std::numeric_limits<uint32_t>::max()) {
+                            throw std::invalid_argument("Buffer too large to count, max is 2^32 - 1 elements");
+                        }
+                        Params params{(uint32_t)buffer.size(), 0, this->low, this->high, (float)this->bins/(this->high - this->low)};
+                        buffer.flush();
+                        this->run(this->pipeline(ShaderTypeTraits<T>::name, "float", "histogram_buffer"), params, out, accumulate,
+                                  [&](MTL::ComputeCommandEncoder *encoder) {
+                            encoder->setBuffer(buffer.getBuffer(), 0, 0);
+                            encoder->setBuffer(out.getBuffer(), 0, 1);
+                            encoder->setBytes(&params, sizeof(params), 2);
+                        });
+                        return;
+                    }
+                }
+                if (buffer.getStorageMode() == ResourceStorage::Private) {
+                    throw std::invalid_argument("Private buffers of this type can't be counted");
+                }
+                std::vector<uint32_t> counts(this->bins);
+                host::histogram(buffer.data(), buffer.size(), this->bins, this->low, this->high, counts.data());
+                this->store(counts, out, accumulate);
+            }
+
+            /**
+             * @brief Count a buffer
+             *
+             * @param buffer The numbers to count
+             *
+             * @return std::vector<uint32_t> The counts, one per bin
+             *
+            */
+            std::vector<uint32_t> count(const Buffer<T> &buffer) {
+                this->count(buffer, this->result);
+                return this->result.read(0, this->bins);
+            }
+
+            /**
+             * @brief Count every channel of a texture into an output buffer
+             *
+             * @param texture The texture to count
+             * @param out Where to put the counts, bins for the first channel then the next and so on
+             * @param accumulate Whether to add to the counts already in out, for counting several textures
+             *
+            */
+            void count(const Texture<T> &texture, Buffer<uint32_t> &out, bool accumulate = false) {
+                static_assert(PixelFormatTraits<T>::supported, "Texture type not supported");
+                if (texture.getFreed()) {
+                    throw std::runtime_error("Texture already freed");
+                }
+                this->checkOutput(out);
+                using C = typename PixelFormatTraits<T>::channel_type;
+                size_t pixels = (size_t)texture.getWidth()*texture.getHeight();
+                if (pixels > std::numeric_limits<uint32_t>::max()) {
+                    throw std::invalid_argument("Texture too large to count, max is 2^32 - 1 pixels");
+                }
+                Params params{(uint32_t)pixels, (uint32_t)texture.getWidth(), this->low, this->high,
+                              (float)this->bins/(this->high - this->low)};
+                this->run(this->pipeline("float", channelType<C>(), "histogram_texture"), params, out, accumulate,
+                          [&](MTL::ComputeCommandEncoder *encoder) {
+                    encoder->setTexture(texture.getTexture(), 0);
+                    encoder->setBuffer(out.getBuffer(), 0, 0);
+                    encoder->setBytes(&params, sizeof(params), 1);
+                });
+            }
+
+            /**
+             * @brief Count every channel of a texture
+             *
+             * @param texture The texture to count
+             *
+             * @return std::vector<uint32_t> The counts, bins for the first channel then the next and so on
+             *
+            */
+            std::vector<uint32_t> count(const Texture<T> &texture) {
+                this->count(texture, this->result);
+                return this->result.read(0, N*this->bins);
+            }
+
+            /**
+             * @brief Get the number of bins per channel
+             *
+             * @return size_t The number of bins
+             *
+            */
+            size_t getBins() const {
+                return this->bins;
+            }
+
+            /**
+             * @brief Get the number of channels counted, bins in the result come in this many groups
+             *
+             * @return int The number of channels
+             *
+            */
+            int getChannels() const {
+                return N;
+            }
+
+            /**
+             * @brief Set the size below which buffers are counted on the CPU
+             *
+             * @param hostThreshold The number of elements, 0 to always use the GPU
+             *
+            */
+            void setHostThreshold(size_t hostThreshold) {
+                this->hostThreshold = hostThreshold;
+            }
+
+            /**
+             * @brief Get the size below which buffers are counted on the CPU
+             *
+             * @return size_t The number of elements
+             *
+            */
+            size_t getHostThreshold() {
+                return this->hostThreshold;
+            }
+
+    };
+
+}
@@ -1,9 +1,289 @@
 #include "MTLComputeGlobals.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #pragma once
 
 namespace MTLCompute {
 
+    /**
+     * @brief The Metal data type of a function constant
+     *
+     * Specialized for every type a function constant can be set to
+     *
+     * @tparam T The constant type
+     *
+    */
+    template<typename T>
+    struct FunctionConstantTraits {
+        static constexpr bool supported = false; ///< Whether the type can be a function constant
+    };
+
+    /**
+     * @brief The information shared by every function constant type
+     *
+     * @tparam D The Metal data type
+     *
+    */
+    template<MTL::DataType D>
+    struct FunctionConstantInfo {
+        static constexpr bool supported = true; ///< Whether the type can be a function constant
+        static constexpr MTL::DataType type = D; ///< The Metal data type
+    };
+
+    template<> struct FunctionConstantTraits<bool> : FunctionConstantInfo<MTL::DataTypeBool> {};
+    template<> struct FunctionConstantTraits<int8_t> : FunctionConstantInfo<MTL::DataTypeChar> {};
+    template<> struct FunctionConstantTraits<uint8_t> : FunctionConstantInfo<MTL::DataTypeUChar> {};
+    template<> struct FunctionConstantTraits<int16_t> : FunctionConstantInfo<MTL::DataTypeShort> {};
+    template<> struct FunctionConstantTraits<uint16_t> : FunctionConstantInfo<MTL::DataTypeUShort> {};
+    template<> struct FunctionConstantTraits<int32_t> : FunctionConstantInfo<MTL::DataTypeInt> {};
+    template<> struct FunctionConstantTraits<uint32_t> : FunctionConstantInfo<MTL::DataTypeUInt> {};
+    template<> struct FunctionConstantTraits<int64_t> : FunctionConstantInfo<MTL::DataTypeLong> {};
+    template<> struct FunctionConstantTraits<uint64_t> : FunctionConstantInfo<MTL::DataTypeULong> {};
+    template<> struct FunctionConstantTraits<half> : FunctionConstantInfo<MTL::DataTypeHalf> {};
+    template<> struct FunctionConstantTraits<float> : FunctionConstantInfo<MTL::DataTypeFloat> {};
+
+    /**
+     * @brief Values for the [[function_constant(n)]] declarations in a Metal library
+     *
+     * Setting the same constant again replaces it. Two sets of constants with the
+     * same values have the same hash no matter what order they were set in.
+     *
+    */
+    class FunctionConstants {
+
+        private:
+
+            /**
+             * @brief One constant value
+             *
+            */
+            struct Constant {
+                MTL::DataType type; ///< The Metal data type
+                std::vector<uint8_t> bytes; ///< The value
+            };
+
+            std::map<std::pair<std::string, long>, Constant> constants; ///< The values by name, or by index with an empty name
+
+            /**
+             * @brief Store a constant
+             *
+             * @param key The name and index of the constant
+             * @param value The value
+             *
+            */
+            template<typename T>
+            void store(const std::pair<std::string, long> &key, T value) {
+                static_assert(FunctionConstantTraits<T>::supported, "Function constant type not supported");
+                Constant constant;
+                constant.type = FunctionConstantTraits<T>::type;
+                constant.bytes.resize(sizeof(T));
+                memcpy(constant.bytes.data(), &value, sizeof(T));
+                this->constants[key] = constant;
+            }
+
+        public:
+
+            /**
+             * @brief Set a constant by index
+             *
+             * @param index The n in [[function_constant(n)]]
+             * @param value The value
+             *
+             * @return FunctionConstants& This object, so calls can be chained
+             *
+            */
+            template<typename T>
+            FunctionConstants &set(long index, T value) {
+                if (index < 0 || index > 65535) {
+                    throw std::out_of_range("Function constant index out of bounds");
+                }
+                this->store(std::make_pair(std::string(), index), value);
+                return *this;
+            }
+
+            /**
+             * @brief Set a constant by name
+             *
+             * @param name The name of the constant in the Metal source
+             * @param value The value
+             *
+             * @return FunctionConstants& This object, so calls can be chained
+             *
+            */
+            template<typename T>
+            FunctionConstants &set(const std::string &name, T value) {
+                if (name.empty()) {
+                    throw std::invalid_argument("Function constant name is empty");
+                }
+                this->store(std::make_pair(name, -1L), value);
+                return *this;
+            }
+
+            /**
+             * @brief Get a hash of every constant
+             *
+             * @return uint64_t The 64 bit FNV-1a hash of the names, indices, types and values
+             *
+            */
+            uint64_t hash() const {
+                uint64_t hash = hashBytes(nullptr, 0);
+                for (const auto &pair : this->constants) {
+                    hash = hashBytes(pair.first.first.data(), pair.first.first.size() + 1, hash);
+                    hash = hashBytes(&pair.first.second, sizeof(pair.first.second), hash);
+                    hash = hashBytes(&pair.second.type, sizeof(pair.second.type), hash);
+                    hash = hashBytes(pair.second.bytes.data(), pair.second.bytes.size(), hash);
+                }
+                return hash;
+            }
+
+            /**
+             * @brief Make the Metal object holding the constants
+             *
+             * @return MTL::FunctionConstantValues* The values, the caller has to release it
+             *
+            */
+            MTL::FunctionConstantValues *build() const {
+                MTL::FunctionConstantValues *values = MTL::FunctionConstantValues::alloc()->init();
+                for (const auto &pair : this->constants) {
+                    if (pair.first.first.empty()) {
+                        values->setConstantValue(pair.second.bytes.data(), pair.second.type, pair.first.second);
+                    } else {
+                        values->setConstantValue(pair.second.bytes.data(), pair.second.type,
+                                                 NS::String::string(pair.first.first.c_str(), NS::UTF8StringEncoding));
+                    }
+                }
+                return values;
+            }
+
+            /**
+             * @brief Get the number of constants
+             *
+             * @return size_t The number of constants set
+             *
+            */
+            size_t size() const {
+                return this->constants.size();
+            }
+
+    };
+
+    /**
+     * @brief A pipeline that is compiling in the background
+     *
+     * Made by Kernel::compileAsync(). Copies share the same compile, and the
+     * pipeline is released when the last copy is gone.
+     *
+    */
+    class PipelineHandle {
+
+        friend class Kernel;
+
+        private:
+
+            /**
+             * @brief The compile shared by every copy of the handle
+             *
+            */
+            struct State {
+                std::mutex mutex; ///< Guards everything below
+                std::condition_variable finished; ///< Signalled when the compile is done
+                bool done = false; ///< Whether the compile is done
+                MTL::Library *library = nullptr; ///< The library the function is in, only compared
+                std::string name; ///< The name of the function
+                uint64_t hash = 0; ///< The hash of the function constants
+                MTL::ComputePipelineState *pipeline = nullptr; ///< The pipeline, null if the compile failed
+                std::string error; ///< Why the compile failed
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(); ///< When the compile was started
+                double milliseconds = 0; ///< How long the compile took
+
+                ~State() {
+                    if (this->pipeline != nullptr) {
+                        this->pipeline->release();
+                    }
+                }
+
+                /**
+                 * @brief Store the result and wake up anything waiting
+                 *
+                 * @param pipeline The pipeline, already retained, or null
+                 * @param error Why the compile failed
+                 *
+                */
+                void finish(MTL::ComputePipelineState *pipeline, const std::string &error) {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->pipeline = pipeline;
+                    this->error = error;
+                    this->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->start).count();
+                    this->done = true;
+                    this->finished.notify_all();
+                }
+            };
+
+            std::shared_ptr<State> state = std::make_shared<State>(); ///< The compile
+
+        public:
+
+            /**
+             * @brief Check if the pipeline is done compiling without waiting
+             *
+             * @return bool Whether PipelineHandle::wait() would return right away
+             *
+            */
+            bool ready() const {
+                std::lock_guard<std::mutex> lock(this->state->mutex);
+                return this->state->done;
+            }
+
+            /**
+             * @brief Wait for the pipeline to finish compiling
+             *
+             * @return MTL::ComputePipelineState* The pipeline, owned by the handle
+             *
+            */
+            MTL::ComputePipelineState *wait() const {
+                std::unique_lock<std::mutex> lock(this->state->mutex);
+                this->state->finished.wait(lock, [this] { return this->state->done; });
+                if (this->state->pipeline == nullptr) {
+                    throw std::runtime_error(this->state->error);
+                }
+                return this->state->pipeline;
+            }
+
+            /**
+             * @brief Get how long the pipeline took to compile
+             *
+             * Waits for the compile if it isn't done. Pipelines that were already
+             * cached take 0 ms.
+             *
+             * @return double The time from starting the compile to the pipeline being ready, in milliseconds
+             *
+            */
+            double getMilliseconds() const {
+                std::unique_lock<std::mutex> lock(this->state->mutex);
+                this->state->finished.wait(lock, [this] { return this->state->done; });
+                return this->state->milliseconds;
+            }
+
+            /**
+             * @brief Get the name of the function being compiled
+             *
+             * @return std::string The function name
+             *
+            */
+            std::string getName() const {
+                return this->state->name;
+            }
+
+    };
+
     class Kernel {
 
         private:
@@ -12,6 +292,118 @@ namespace MTLCompute {
             MTL::Function *function; ///< The Metal function object
             MTL::ComputePipelineState *pipeline; ///< The Metal compute pipeline state object
 
+            /**
+             * @brief Specialized pipelines, shared by copies of the kernel
+             *
+            */
+            struct VariantCache {
+                std::map<std::pair<std::string, uint64_t>, MTL::ComputePipelineState *> pipelines; ///< The pipelines by function name and constant hash
+
+                ~VariantCache() {
+                    for (auto &pair : this->pipelines) {
+                        pair.second->release();
+                    }
+                }
+            };
+            std::shared_ptr<VariantCache> variants = std::make_shared<VariantCache>(); ///< The specialized pipelines
+
+            /**
+             * @brief Get a specialized pipeline, compiling it if it isn't cached
+             *
+             * @param funcname The name of the function
+             * @param constants The function constant values
+             *
+             * @return MTL::ComputePipelineState* The pipeline
+             *
+            */
+            MTL::ComputePipelineState *specialize(const std::string &funcname, const FunctionConstants &constants) {
+                std::pair<std::string, uint64_t> key(funcname, constants.hash());
+                auto found = this->variants->pipelines.find(key);
+                if (found != this->variants->pipelines.end()) {
+                    return found->second;
+                }
+
+                NS::Error *error = nullptr;
+                MTL::FunctionConstantValues *values = constants.build();
+                MTL::Function *function = this->library->newFunction(NS::String::string(funcname.c_str(), NS::ASCIIStringEncoding), values, &error);
+                values->release();
+                if (function == nullptr) {
+                    throw std::runtime_error("Error: Could not specialize function " + funcname);
+                }
+                MTL::ComputePipelineState *pipeline = LibraryCache::newPipeline(this->gpu, function);
+                function->release();
+                if (pipeline == nullptr) {
+                    throw std::runtime_error("Error: Could not make pipeline for " + funcname);
+                }
+                this->variants->pipelines[key] = pipeline;
+                return pipeline;
+            }
+
+            /**
+             * @brief Wait for a background compile and cache its pipeline
+             *
+             * @param handle The compile, started by this kernel
+             *
+             * @return MTL::ComputePipelineState* The pipeline
+             *
+            */
+            MTL::ComputePipelineState *adopt(const PipelineHandle &handle) {
+                if (handle.state->library != this->library) {
+                    throw std::invalid_argument("Pipeline was compiled from a different library");
+                }
+                MTL::ComputePipelineState *pipeline = handle.wait();
+                std::pair<std::string, uint64_t> key(handle.state->name, handle.state->hash);
+                auto found = this->variants->pipelines.find(key);
+                if (found != this->variants->pipelines.end()) {
+                    return found->second;
+                }
+                pipeline->retain();
+                this->variants->pipelines[key] = pipeline;
+                return pipeline;
+            }
+
+            /**
+             * @brief Load a compiled Metal library from a file
+             *
+             * @param filename The path of the .metallib file
+             *
+            */
+            void loadFile(const std::string &filename) {
+                this->library = this->gpu->newLibrary(NS::URL::fileURLWithPath(NS::String::string(filename.c_str(), \
+                            NS::UTF8StringEncoding)), nullptr);
+
+                if (this->library == nullptr) {
+                    std::cerr << "Error: Could not load library " << filename << std::endl;
+                }
+            }
+
+            /**
+             * @brief Load a compiled Metal library from memory
+             *
+             * @param data The contents of a .metallib file
+             * @param size The size of the data in bytes
+             *
+            */
+            void loadData(const void *data, size_t size) {
+                if (data == nullptr || size == 0) {
+                    throw std::invalid_argument("Library data is empty");
+                }
+                // The default destructor makes dispatch copy the bytes, so the caller's copy can go away
+                dispatch_data_t blob = dispatch_data_create(data, size, nullptr, DISPATCH_DATA_DESTRUCTOR_DEFAULT);
+                NS::Error *error = nullptr;
+                this->library = this->gpu->newLibrary(blob, &error);
+                dispatch_release(blob);
+
+                if (this->library == nullptr) {
+                    std::string message = "Could not load library from memory";
+                    if (error != nullptr) {
+                        message += ": ";
+                        message += error->localizedDescription()->utf8String();
+                    }
+                    throw std::runtime_error(message);
+                }
+            }
+
         public:
 
             /**
@@ -26,14 +418,7 @@ namespace MTLCompute {
             */
             Kernel(MTL::Device *gpu, const std::string &filename) {
                 this->gpu = gpu;
-
-                this->library = this->gpu->newLibrary(NS::URL::fileURLWithPath(NS::String::string(filename.c_str(), \
-                            NS::ASCIIStringEncoding)), nullptr);
-
-                if (this->library == nullptr) {
-                    std::cerr << "Error: Could not load library " << filename << std::endl;
-                }
-
+                this->loadFile(filename);
             }
 
             /**
@@ -49,15 +434,69 @@ namespace MTLCompute {
             */
             Kernel(MTL::Device *gpu, const std::string &filename, const std::string &funcname) {
                 this->gpu = gpu;
+                this->loadFile(filename);
+                useFunction(funcname);
+            }
 
-                this->library = this->gpu->newLibrary(NS::String::string(filename.c_str(), NS::ASCIIStringEncoding), nullptr);
-
-                if (this->library == nullptr) {
-                    std::cerr << "Error: Could not load library " << filename << std::endl;
-                }
+            /**
+             * @brief Constructor for the Kernel class from Metal source
+             *
+             * Compiles the source at runtime through the LibraryCache, so the same
+             * source is only compiled once per process. With a LibraryCache directory,
+             * later processes load its pipelines from there.
+             *
+             * @param gpu The GPU device
+             * @param source The Metal source and compile options
+             *
+            */
+            Kernel(MTL::Device *gpu, const KernelSource &source) {
+                this->gpu = gpu;
+                this->library = LibraryCache::get(gpu, source);
+            }
 
+            /**
+             * @brief Constructor for the Kernel class from Metal source with function name
+             *
+             * @param gpu The GPU device
+             * @param source The Metal source and compile options
+             * @param funcname The name of the function
+             *
+            */
+            Kernel(MTL::Device *gpu, const KernelSource &source, const std::string &funcname) {
+                this->gpu = gpu;
+                this->library = LibraryCache::get(gpu, source);
                 useFunction(funcname);
+            }
+
+            /**
+             * @brief Constructor for the Kernel class from a metallib in memory
+             *
+             * Use this with a metallib embedded in the program (see mtlcompute_embed_metallib
+             * in cmake/EmbedMetallib.cmake) so loading kernels doesn't touch the filesystem
+             *
+             * @param gpu The GPU device
+             * @param data The contents of a .metallib file, copied so it doesn't have to stay around
+             * @param size The size of the data in bytes
+             *
+            */
+            Kernel(MTL::Device *gpu, const void *data, size_t size) {
+                this->gpu = gpu;
+                this->loadData(data, size);
+            }
 
+            /**
+             * @brief Constructor for the Kernel class from a metallib in memory with function name
+             *
+             * @param gpu The GPU device
+             * @param data The contents of a .metallib file, copied so it doesn't have to stay around
+             * @param size The size of the data in bytes
+             * @param funcname The name of the function
+             *
+            */
+            Kernel(MTL::Device *gpu, const void *data, size_t size, const std::string &funcname) {
+                this->gpu = gpu;
+                this->loadData(data, size);
+                useFunction(funcname);
             }
 
             /**
@@ -93,19 +532,144 @@ namespace MTLCompute {
             /**
              * @brief Use a function in the library
              *
-             * Takes in the name of a function in the library and creates a new function and compute pipeline state
+             * Takes in the name of a function in the library and creates a new function and compute pipeline state.
+             * If the function was already compiled with Kernel::compileAsync() or Kernel::precompile() (without
+             * constants), that pipeline is used instead
              *
              * @param funcname The name of the function
              *
             */
             void useFunction(const std::string &funcname) {
+                auto found = this->variants->pipelines.find(std::make_pair(funcname, FunctionConstants().hash()));
+                if (found != this->variants->pipelines.end()) {
+                    this->pipeline = found->second;
+                    return;
+                }
+
                 this->function = this->library->newFunction(NS::String::string(funcname.c_str(), NS::ASCIIStringEncoding));
                 if (this->function == nullptr) {
                     throw std::runtime_error("Error: Could not load function " + funcname);
                 }
 
-                NS::Error *error = nullptr;
-                this->pipeline = gpu->newComputePipelineState(this->function, &error);
+                this->pipeline = LibraryCache::newPipeline(gpu, this->function);
+            }
+
+            /**
+             * @brief Use a function specialized with function constants
+             *
+             * Each (function, constants) pair is compiled once and cached, so switching
+             * between variants in a loop is just a lookup. Copies of the kernel share the cache.
+             *
+             * @param funcname The name of the function
+             * @param constants The values for the function's [[function_constant(n)]] declarations
+             *
+            */
+            void useFunction(const std::string &funcname, const FunctionConstants &constants) {
+                this->pipeline = this->specialize(funcname, constants);
+            }
+
+            /**
+             * @brief Start compiling a function in the background
+             *
+             * Returns right away. Metal compiles on its own threads and the handle
+             * becomes ready when the pipeline is done, so many compiles started
+             * together take about as long as the slowest one. Pass the handle to
+             * Kernel::useFunction() to use the pipeline.
+             *
+             * @param funcname The name of the function
+             * @param constants The values for the function's [[function_constant(n)]] declarations, if it has any
+             *
+             * @return PipelineHandle The compile
+             *
+            */
+            PipelineHandle compileAsync(const std::string &funcname, const FunctionConstants &constants = FunctionConstants()) {
+                PipelineHandle handle;
+                std::shared_ptr<PipelineHandle::State> state = handle.state;
+                state->library = this->library;
+                state->name = funcname;
+                state->hash = constants.hash();
+
+                auto found = this->variants->pipelines.find(std::make_pair(funcname, state->hash));
+                if (found != this->variants->pipelines.end()) {
+                    found->second->retain();
+                    state->pipeline = found->second;
+                    state->done = true;
+                    return handle;
+                }
+
+                MTL::Device *gpu = this->gpu;
+                MTL::FunctionConstantValues *values = constants.build();
+                this->library->newFunction(NS::String::string(funcname.c_str(), NS::ASCIIStringEncoding), values,
+                                           [state, gpu](MTL::Function *function, NS::Error *error) {
+                    if (function == nullptr) {
+                        std::string message = "Error: Could not specialize function " + state->name;
+                        if (error != nullptr) {
+                            message += ": ";
+                            message += error->localizedDescription()->utf8String();
+                        }
+                        state->finish(nullptr, message);
+                        return;
+                    }
+                    // Through the same pipeline archive as Kernel::useFunction()
+                    LibraryCache::newPipelineAsync(gpu, function, [state](MTL::ComputePipelineState *pipeline, NS::Error *error) {
+                        if (pipeline == nullptr) {
+                            std::string message = "Error: Could not make pipeline for " + state->name;
+                            if (error != nullptr) {
+                                message += ": ";
+                                message += error->localizedDescription()->utf8String();
+                            }
+                            state->finish(nullptr, message);
+                            return;
+                        }
+                        state->finish(pipeline, "");
+                    });
+                });
+                values->release();
+                return handle;
+            }
+
+            /**
+             * @brief Use a function compiled in the background
+             *
+             * Waits for the compile if it isn't done, and caches the pipeline so
+             * Kernel::useFunction() with the same name and constants is just a lookup
+             *
+             * @param handle The compile, from this kernel's Kernel::compileAsync()
+             *
+            */
+            void useFunction(const PipelineHandle &handle) {
+                this->pipeline = this->adopt(handle);
+            }
+
+            /**
+             * @brief Compile a batch of specialized functions ahead of time
+             *
+             * Doesn't change the function in use. Variants that are already cached
+             * are skipped, and the rest compile at the same time.
+             * The new pipelines are saved to the LibraryCache directory, if there is one.
+             *
+             * @param variants The function names and constants to compile
+             *
+            */
+            void precompile(const std::vector<std::pair<std::string, FunctionConstants>> &variants) {
+                std::vector<PipelineHandle> handles;
+                for (const auto &variant : variants) {
+                    handles.push_back(this->compileAsync(variant.first, variant.second));
+                }
+                for (const PipelineHandle &handle : handles) {
+                    this->adopt(handle);
+                }
+                LibraryCache::save();
+            }
+
+            /**
+             * @brief Get the number of cached specialized pipelines
+             *
+             * @return size_t The number of variants
+             *
+            */
+            size_t getVariantCount() {
+                return this->variants->pipelines.size();
             }
 
             /**
@@ -118,6 +682,16 @@ namespace MTLCompute {
                 return this->pipeline;
             }
 
+            /**
+             * @brief Get the GPU device
+             *
+             * @return MTL::Device* The GPU device
+             *
+            */
+            MTL::Device *getGPU() {
+                return this->gpu;
+            }
+
     };
 
 }
\ No newline at end of file
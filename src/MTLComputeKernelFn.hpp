@@ -0,0 +1,366 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeBuffer.hpp"
+#include "MTLComputeKernel.hpp"
+#include "MTLComputeTexture.hpp"
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief How a KernelFn argument is bound
+     *
+    */
+    enum class KernelArgumentKind {
+        Buffer, ///< A Buffer or BufferView, bound with setBuffer
+        Texture, ///< A Texture or one of its subclasses, bound with setTexture
+        Bytes, ///< A small trivially copyable value, bound with setBytes
+        Unsupported ///< Anything else, which doesn't compile
+    };
+
+    /**
+     * @brief Whether a type is a Buffer or BufferView
+     *
+    */
+    template<typename U>
+    struct IsBufferArgument : std::false_type {};
+
+    template<typename V>
+    struct IsBufferArgument<Buffer<V>> : std::true_type {};
+
+    template<typename V>
+    struct IsBufferArgument<BufferView<V>> : std::true_type {};
+
+    /**
+     * @brief Overloads that match Texture and its subclasses, only used in decltype
+     *
+    */
+    template<typename V>
+    std::true_type isTextureArgument(const Texture<V> *);
+    std::false_type isTextureArgument(const void *);
+
+    /**
+     * @brief Compile time information about one KernelFn argument
+     *
+     * Buffers and textures passed by non-const reference (or by value) are
+     * treated as written by the kernel, and const references as read only.
+     * Values are limited to 4 KB, the most setBytes can send.
+     *
+     * @tparam A The argument type as written in the KernelFn signature
+     *
+    */
+    template<typename A>
+    struct KernelArgument {
+        using type = std::remove_cvref_t<A>; ///< The argument type without const or references
+        static constexpr KernelArgumentKind kind =
+            IsBufferArgument<type>::value ? KernelArgumentKind::Buffer :
+            decltype(isTextureArgument(std::declval<type *>()))::value ? KernelArgumentKind::Texture :
+            (std::is_trivially_copyable_v<type> && !std::is_pointer_v<type> && sizeof(type) <= 4096) ? KernelArgumentKind::Bytes :
+            KernelArgumentKind::Unsupported; ///< How the argument is bound
+        static constexpr bool writable = !std::is_const_v<std::remove_reference_t<A>>; ///< Whether the kernel can write to it
+    };
+
+    /**
+     * @brief A kernel with a typed signature
+     *
+     * The template arguments are the kernel's parameters in order. Calling the
+     * KernelFn binds each argument in one pass: buffers and values take the next
+     * buffer index and textures take the next texture index, the same order the
+     * Metal function declares them in. Wrong argument counts or types don't compile.
+     *
+     * The grid is the size of the first texture argument, or the length of the
+     * first buffer argument if there are no textures. Use KernelFn::run() to pick
+     * the grid yourself.
+     *
+     * @tparam Args The kernel parameter types, like const Buffer<float>& or uint32_t
+     *
+    */
+    template<typename... Args>
+    class KernelFn {
+
+        static_assert(((KernelArgument<Args>::kind != KernelArgumentKind::Unsupported) && ...),
+                      "Kernel arguments must be buffers, buffer views, textures or small trivially copyable values");
+
+        private:
+            static constexpr std::array<KernelArgumentKind, sizeof...(Args)> kinds = {KernelArgument<Args>::kind...}; ///< How each argument is bound
+            static constexpr std::array<bool, sizeof...(Args)> writable = {KernelArgument<Args>::writable...}; ///< Whether each argument is written
+
+            /**
+             * @brief Count the arguments before one that use buffer or texture indices
+             *
+             * @param argument The argument position
+             * @param textures Whether to count textures or buffers
+             *
+             * @return int The number of indices used before the argument
+             *
+            */
+            static constexpr int countBefore(size_t argument, bool textures) {
+                int count = 0;
+                for (size_t i = 0; i < argument; i++) {
+                    if ((kinds[i] == KernelArgumentKind::Texture) == textures) {
+                        count++;
+                    }
+                }
+                return count;
+            }
+
+            /**
+             * @brief Find the argument that decides the grid size
+             *
+             * @return int The position of the first texture, or the first buffer, or -1
+             *
+            */
+            static constexpr int gridArgument() {
+                for (size_t i = 0; i < sizeof...(Args); i++) {
+                    if (kinds[i] == KernelArgumentKind::Texture) {
+                        return i;
+                    }
+                }
+                for (size_t i = 0; i < sizeof...(Args); i++) {
+                    if (kinds[i] == KernelArgumentKind::Buffer) {
+                        return i;
+                    }
+                }
+                return -1;
+            }
+
+            static_assert(countBefore(sizeof...(Args), false) <= MAX_BUFFERS, "Too many buffer arguments");
+            static_assert(countBefore(sizeof...(Args), true) <= MAX_TEXTURES, "Too many texture arguments");
+
+            static constexpr int managedSlots = countBefore(sizeof...(Args), false) + 1; ///< Room for every buffer that might need synchronizing
+
+            MTL::Device *gpu; ///< The Metal device object
+            Kernel *kernel; ///< The kernel object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+
+            /**
+             * @brief Flush a buffer and get what to bind
+             *
+             * @param buffer The buffer
+             * @param offset Set to the byte offset to bind at
+             * @param storage Set to the storage mode of the buffer
+             *
+             * @return MTL::Buffer* The buffer to bind
+             *
+            */
+            template<typename V>
+            static MTL::Buffer *resolve(const Buffer<V> &buffer, size_t &offset, ResourceStorage &storage) {
+                if constexpr (CHECKED_ACCESS) {
+                    if (buffer.getFreed() || buffer.getBuffer() == nullptr) {
+                        throw std::runtime_error("Buffer already freed");
+                    }
+                }
+                offset = 0;
+                storage = buffer.getStorageMode();
+                buffer.flush();
+                return buffer.getBuffer();
+            }
+
+            /**
+             * @brief Flush the parent of a view and get what to bind
+             *
+             * @param view The buffer view
+             * @param offset Set to the byte offset of the view
+             * @param storage Set to the storage mode of the parent buffer
+             *
+             * @return MTL::Buffer* The parent buffer to bind
+             *
+            */
+            template<typename V>
+            static MTL::Buffer *resolve(const BufferView<V> &view, size_t &offset, ResourceStorage &storage) {
+                if constexpr (CHECKED_ACCESS) {
+                    if (view.getParent().getFreed() || view.getBuffer() == nullptr) {
+                        throw std::runtime_error("Buffer already freed");
+                    }
+                }
+                offset = view.getOffset()*sizeof(V);
+                storage = view.getParent().getStorageMode();
+                view.getParent().flush();
+                return view.getBuffer();
+            }
+
+            /**
+             * @brief Bind one argument to the encoder
+             *
+             * @tparam I The argument position
+             * @param encoder The compute command encoder
+             * @param written The Managed buffers the kernel can write
+             * @param count The number of buffers in written
+             * @param argument The argument
+             *
+            */
+            template<size_t I, typename A>
+            static void bind(MTL::ComputeCommandEncoder *encoder, std::array<MTL::Buffer *, managedSlots> &written, int &count, const A &argument) {
+                if constexpr (kinds[I] == KernelArgumentKind::Buffer) {
+                    size_t offset;
+                    ResourceStorage storage;
+                    MTL::Buffer *buffer = resolve(argument, offset, storage);
+                    encoder->setBuffer(buffer, offset, countBefore(I, false));
+                    if (writable[I] && storage == ResourceStorage::Managed) {
+                        written[count++] = buffer;
+                    }
+                } else if constexpr (kinds[I] == KernelArgumentKind::Texture) {
+                    if constexpr (CHECKED_ACCESS) {
+                        if (argument.getFreed() || argument.getTexture() == nullptr) {
+                            throw std::runtime_error("Texture already freed");
+                        }
+                    }
+                    encoder->setTexture(argument.getTexture(), countBefore(I, true));
+                } else {
+                    encoder->setBytes(&argument, sizeof(A), countBefore(I, false));
+                }
+            }
+
+            /**
+             * @brief Get the grid size an argument covers
+             *
+             * @param argument A buffer, view or texture
+             *
+             * @return MTL::Size One thread per element or texel
+             *
+            */
+            template<typename A>
+            static MTL::Size gridOf(const A &argument) {
+                if constexpr (KernelArgument<A>::kind == KernelArgumentKind::Texture) {
+                    return MTL::Size::Make(argument.getWidth(), argument.getHeight(), argument.getSlices());
+                } else {
+                    return MTL::Size::Make(argument.length, 1, 1);
+                }
+            }
+
+            /**
+             * @brief Encode, dispatch and wait for the kernel
+             *
+             * @param grid The number of threads
+             * @param arguments References to the arguments
+             *
+            */
+            void dispatch(MTL::Size grid, const std::tuple<const std::remove_cvref_t<Args> &...> &arguments) {
+                MTL::ComputePipelineState *pipeline = this->kernel->getPLS();
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                commandEncoder->setComputePipelineState(pipeline);
+
+                std::array<MTL::Buffer *, managedSlots> written;
+                int count = 0;
+                [&]<size_t... I>(std::index_sequence<I...>) {
+                    (bind<I>(commandEncoder, written, count, std::get<I>(arguments)), ...);
+                }(std::index_sequence_for<Args...>{});
+
+                MTL::Size threadsPerThreadgroup;
+                threadsPerThreadgroup.width = pipeline->threadExecutionWidth();
+                threadsPerThreadgroup.height = pipeline->maxTotalThreadsPerThreadgroup() / threadsPerThreadgroup.width;
+                threadsPerThreadgroup.depth = 1;
+                commandEncoder->dispatchThreads(grid, threadsPerThreadgroup);
+                commandEncoder->endEncoding();
+
+                // Copy what the kernel wrote back to the host copy of Managed buffers
+                if (count > 0) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    for (int i = 0; i < count; i++) {
+                        blitEncoder->synchronizeResource(written[i]);
+                    }
+                    blitEncoder->endEncoding();
+                }
+
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the KernelFn class
+             *
+             * The kernel's current pipeline is used every call, so changing the
+             * function with Kernel::useFunction is picked up
+             *
+             * @param kernel The kernel to run, with a function already selected
+             *
+            */
+            KernelFn(Kernel &kernel) {
+                this->kernel = &kernel;
+                this->gpu = kernel.getGPU();
+                this->commandQueue = this->gpu->newCommandQueue();
+            }
+
+            KernelFn(const KernelFn &) = delete;
+            KernelFn & operator=(const KernelFn &) = delete;
+
+            /**
+             * @brief Destructor for the KernelFn class
+             *
+             * Releases the command queue
+             *
+            */
+            ~KernelFn() {
+                this->commandQueue->autorelease();
+            }
+
+            /**
+             * @brief Run the kernel over the grid of its first texture or buffer
+             *
+             * @param args The kernel arguments
+             *
+            */
+            void operator()(Args... args) {
+                static_assert(gridArgument() >= 0, "Kernels without buffer or texture arguments need KernelFn::run() with a grid");
+                std::tuple<const std::remove_cvref_t<Args> &...> arguments(args...);
+                this->dispatch(gridOf(std::get<gridArgument()>(arguments)), arguments);
+            }
+
+            /**
+             * @brief Run the kernel over a grid
+             *
+             * @param grid The number of threads in each dimension
+             * @param args The kernel arguments
+             *
+            */
+            void run(MTL::Size grid, Args... args) {
+                std::tuple<const std::remove_cvref_t<Args> &...> arguments(args...);
+                this->dispatch(grid, arguments);
+            }
+
+            /**
+             * @brief Get the buffer index an argument is bound to
+             *
+             * @param argument The argument position
+             *
+             * @return int The [[buffer(n)]] index, for buffers and values
+             *
+            */
+            static constexpr int bufferIndex(size_t argument) {
+                return countBefore(argument, false);
+            }
+
+            /**
+             * @brief Get the texture index an argument is bound to
+             *
+             * @param argument The argument position
+             *
+             * @return int The [[texture(n)]] index, for textures
+             *
+            */
+            static constexpr int textureIndex(size_t argument) {
+                return countBefore(argument, true);
+            }
+
+            /**
+             * @brief Get the kernel object
+             *
+             * @return Kernel* The kernel object
+             *
+            */
+            Kernel *getKernel() {
+                return this->kernel;
+            }
+
+    };
+
+}
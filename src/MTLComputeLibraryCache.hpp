@@ -0,0 +1,557 @@
+#include "MTLComputeGlobals.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source code and how to compile it
+     *
+    */
+    struct KernelSource {
+        std::string source; ///< The Metal Shading Language source
+        std::map<std::string, std::string> macros; ///< Preprocessor macros, added as #define lines before the source
+        bool fastMath = true; ///< Whether the compiler can reorder and approximate float math
+
+        /**
+         * @brief Get the source with the macros added
+         *
+         * @return std::string What actually gets compiled
+         *
+        */
+        std::string text() const {
+            std::string text;
+            for (const auto &macro : this->macros) {
+                text += "#define " + macro.first + " " + macro.second + "\n";
+            }
+            return text + this->source;
+        }
+
+        /**
+         * @brief Get a hash of the source and options
+         *
+         * @return uint64_t The hash the library is cached by
+         *
+        */
+        uint64_t hash() const {
+            std::string text = this->text();
+            uint64_t hash = hashBytes(text.data(), text.size());
+            return hashBytes(&this->fastMath, sizeof(this->fastMath), hash);
+        }
+    };
+
+    /**
+     * @brief Hit and compile counts for the LibraryCache
+     *
+    */
+    struct LibraryCacheStats {
+        size_t memoryHits = 0; ///< Libraries found already loaded in this process
+        size_t diskHits = 0; ///< Pipelines loaded from the binary archive in the cache directory
+        size_t compiles = 0; ///< Libraries compiled from source
+    };
+
+    /**
+     * @brief Caches libraries compiled from source in memory, and pipelines on disk
+     *
+     * Libraries are keyed by a hash of the source and compile options and are
+     * compiled once per device in each process. The disk cache is off unless
+     * `$MTLCOMPUTE_CACHE_DIR` or LibraryCache::setDirectory() gives it a directory.
+     * Then pipelines made through LibraryCache::newPipeline() and
+     * LibraryCache::newPipelineAsync() are added to a per device MTL::BinaryArchive,
+     * which LibraryCache::save() writes out, so the next process skips the backend
+     * compile. The source still goes through the front end in every process.
+     *
+    */
+    class LibraryCache {
+
+        private:
+
+            /**
+             * @brief The state shared by the whole process
+             *
+            */
+            struct State {
+                std::mutex mutex; ///< Guards the libraries, pipelines, directory and stats
+                std::map<std::pair<MTL::Device *, uint64_t>, MTL::Library *> libraries; ///< The loaded libraries
+                std::map<std::tuple<MTL::Device *, uint64_t, std::string>, MTL::ComputePipelineState *> pipelines; ///< Pipelines made by LibraryCache::getPipeline()
+                std::filesystem::path directory; ///< The cache directory, empty for memory only
+                LibraryCacheStats stats; ///< The hit and compile counts
+                std::mutex archiveMutex; ///< Guards the archives and the unsaved set, always taken after mutex
+                std::map<MTL::Device *, MTL::BinaryArchive *> archives; ///< The pipeline archive for each device, nullptr if it couldn't be made
+                std::set<MTL::Device *> unsaved; ///< The devices whose archive has pipelines that aren't on disk yet
+
+                State() {
+                    const char *env = std::getenv("MTLCOMPUTE_CACHE_DIR");
+                    if (env != nullptr) {
+                        this->directory = env;
+                    }
+                }
+
+                ~State() {
+                    // Anything added since the last save goes to disk when the program exits
+                    std::scoped_lock lock(this->mutex, this->archiveMutex);
+                    saveArchives(*this);
+                }
+            };
+
+            /**
+             * @brief Get the process wide state
+             *
+             * @return State& The state
+             *
+            */
+            static State &state() {
+                static State state;
+                return state;
+            }
+
+            /**
+             * @brief Get where a device's pipeline archive is saved
+             *
+             * @param directory The cache directory
+             * @param gpu The Metal device object
+             *
+             * @return std::filesystem::path The archive file
+             *
+            */
+            static std::filesystem::path archivePath(const std::filesystem::path &directory, MTL::Device *gpu) {
+                char name[48];
+                snprintf(name, sizeof(name), "pipelines-%016llx.metallib", (unsigned long long)gpu->registryID());
+                return directory / name;
+            }
+
+            /**
+             * @brief Get the pipeline archive for a device, loading it the first time
+             *
+             * Call with archiveMutex held
+             *
+             * @param cache The process wide state
+             * @param gpu The Metal device object
+             * @param directory The cache directory
+             *
+             * @return MTL::BinaryArchive* The archive, nullptr if one couldn't be made
+             *
+            */
+            static MTL::BinaryArchive *loadArchive(State &cache, MTL::Device *gpu, const std::filesystem::path &directory) {
+                auto found = cache.archives.find(gpu);
+                if (found != cache.archives.end()) {
+                    return found->second;
+                }
+
+                std::filesystem::path path = archivePath(directory, gpu);
+                MTL::BinaryArchiveDescriptor *descriptor = MTL::BinaryArchiveDescriptor::alloc()->init();
+                MTL::BinaryArchive *archive = nullptr;
+                NS::Error *error = nullptr;
+                std::error_code exists;
+                if (std::filesystem::exists(path, exists)) {
+                    descriptor->setUrl(NS::URL::fileURLWithPath(NS::String::string(path.c_str(), NS::UTF8StringEncoding)));
+                    archive = gpu->newBinaryArchive(descriptor, &error);
+                }
+                if (archive == nullptr) {
+                    // Nothing saved yet, or saved by an OS version that can't read it
+                    descriptor->setUrl(nullptr);
+                    archive = gpu->newBinaryArchive(descriptor, &error);
+                }
+                descriptor->release();
+                cache.archives[gpu] = archive;
+                return archive;
+            }
+
+            /**
+             * @brief Write a pipeline archive to disk
+             *
+             * Writes to a temporary name first and renames it, so another process
+             * never loads half a file. Call with archiveMutex held.
+             *
+             * @param archive The archive to save
+             * @param path Where to put it
+             *
+            */
+            static void saveArchive(MTL::BinaryArchive *archive, const std::filesystem::path &path) {
+                std::error_code error;
+                std::filesystem::create_directories(path.parent_path(), error);
+                if (error) {
+                    return;
+                }
+                std::filesystem::path temp = path;
+                temp += "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+                NS::Error *serialize = nullptr;
+                if (archive->serializeToURL(NS::URL::fileURLWithPath(NS::String::string(temp.c_str(), NS::UTF8StringEncoding)), &serialize)) {
+                    std::filesystem::rename(temp, path, error);
+                }
+                std::filesystem::remove(temp, error);
+            }
+
+            /**
+             * @brief Write every archive that has pipelines that aren't on disk yet
+             *
+             * Call with mutex and archiveMutex held
+             *
+             * @param cache The process wide state
+             *
+            */
+            static void saveArchives(State &cache) {
+                if (!cache.directory.empty()) {
+                    for (MTL::Device *gpu : cache.unsaved) {
+                        auto found = cache.archives.find(gpu);
+                        if (found != cache.archives.end() && found->second != nullptr) {
+                            saveArchive(found->second, archivePath(cache.directory, gpu));
+                        }
+                    }
+                }
+                cache.unsaved.clear();
+            }
+
+            /**
+             * @brief Get the pipeline archive for a device, if there's a cache directory
+             *
+             * @param cache The process wide state
+             * @param gpu The Metal device object
+             *
+             * @return MTL::BinaryArchive* The archive, retained for the caller, nullptr without a cache directory
+             *
+            */
+            static MTL::BinaryArchive *retainArchive(State &cache, MTL::Device *gpu) {
+                std::scoped_lock lock(cache.mutex, cache.archiveMutex);
+                if (cache.directory.empty()) {
+                    return nullptr;
+                }
+                MTL::BinaryArchive *archive = loadArchive(cache, gpu, cache.directory);
+                if (archive != nullptr) {
+                    // So LibraryCache::clear() can't free it from under us
+                    archive->retain();
+                }
+                return archive;
+            }
+
+            /**
+             * @brief Add a pipeline that missed the archive, to be written by the next save
+             *
+             * Processes saving at the same time can drop each other's additions,
+             * those pipelines just get added again next time
+             *
+             * @param cache The process wide state
+             * @param gpu The Metal device object
+             * @param archive The archive the pipeline missed
+             * @param descriptor The pipeline's descriptor
+             *
+            */
+            static void addToArchive(State &cache, MTL::Device *gpu, MTL::BinaryArchive *archive, MTL::ComputePipelineDescriptor *descriptor) {
+                std::lock_guard<std::mutex> lock(cache.archiveMutex);
+                NS::Error *error = nullptr;
+                if (archive->addComputePipelineFunctions(descriptor, &error)) {
+                    cache.unsaved.insert(gpu);
+                }
+            }
+
+            /**
+             * @brief Make a pipeline descriptor that looks in an archive
+             *
+             * @param function The function to make a pipeline for
+             * @param archive The archive
+             *
+             * @return MTL::ComputePipelineDescriptor* The descriptor, for the caller to release
+             *
+            */
+            static MTL::ComputePipelineDescriptor *archiveDescriptor(MTL::Function *function, MTL::BinaryArchive *archive) {
+                MTL::ComputePipelineDescriptor *descriptor = MTL::ComputePipelineDescriptor::alloc()->init();
+                descriptor->setComputeFunction(function);
+                descriptor->setBinaryArchives(NS::Array::array(archive));
+                return descriptor;
+            }
+
+            /**
+             * @brief Release every pipeline archive, so they're loaded from disk again
+             *
+             * Call with archiveMutex held
+             *
+             * @param cache The process wide state
+             *
+            */
+            static void releaseArchives(State &cache) {
+                for (auto &pair : cache.archives) {
+                    if (pair.second != nullptr) {
+                        pair.second->release();
+                    }
+                }
+                cache.archives.clear();
+            }
+
+        public:
+
+            /**
+             * @brief Get a library for some source, compiling it only if needed
+             *
+             * @param gpu The Metal device object
+             * @param source The source and compile options
+             *
+             * @return MTL::Library* The library, retained for the caller
+             *
+            */
+            static MTL::Library *get(MTL::Device *gpu, const KernelSource &source) {
+                State &cache = state();
+                std::pair<MTL::Device *, uint64_t> key(gpu, source.hash());
+                {
+                    std::lock_guard<std::mutex> lock(cache.mutex);
+                    auto found = cache.libraries.find(key);
+                    if (found != cache.libraries.end()) {
+                        cache.stats.memoryHits++;
+                        found->second->retain();
+                        return found->second;
+                    }
+                }
+
+                // Compile without holding the lock, so lookups from other threads don't wait on it
+                NS::Error *error = nullptr;
+                MTL::CompileOptions *options = MTL::CompileOptions::alloc()->init();
+                options->setFastMathEnabled(source.fastMath);
+                MTL::Library *library = gpu->newLibrary(NS::String::string(source.text().c_str(), NS::UTF8StringEncoding), options, &error);
+                options->release();
+                if (library == nullptr) {
+                    std::string message = "Could not compile Metal source";
+                    if (error != nullptr) {
+                        message += ": ";
+                        message += error->localizedDescription()->utf8String();
+                    }
+                    throw std::runtime_error(message);
+                }
+
+                std::lock_guard<std::mutex> lock(cache.mutex);
+                cache.stats.compiles++;
+                auto inserted = cache.libraries.insert({key, library});
+                if (!inserted.second) {
+                    // Another thread compiled it first
+                    library->release();
+                }
+                inserted.first->second->retain();
+                return inserted.first->second;
+            }
+
+            /**
+             * @brief Make a pipeline, loading it from the cache directory's archive if it's there
+             *
+             * Pipelines that aren't in the archive are compiled and added to it, and
+             * LibraryCache::save() writes them out for the next process. Without a
+             * cache directory this is just MTL::Device::newComputePipelineState().
+             *
+             * @param gpu The Metal device object
+             * @param function The function to make a pipeline for
+             *
+             * @return MTL::ComputePipelineState* The pipeline, retained for the caller, nullptr if it couldn't be made
+             *
+            */
+            static MTL::ComputePipelineState *newPipeline(MTL::Device *gpu, MTL::Function *function) {
+                State &cache = state();
+                NS::Error *error = nullptr;
+                MTL::BinaryArchive *archive = retainArchive(cache, gpu);
+                if (archive == nullptr) {
+                    return gpu->newComputePipelineState(function, &error);
+                }
+
+                MTL::ComputePipelineDescriptor *descriptor = archiveDescriptor(function, archive);
+                MTL::ComputePipelineState *pipeline = gpu->newComputePipelineState(descriptor, MTL::PipelineOptionFailOnBinaryArchiveMiss, nullptr, &error);
+                if (pipeline != nullptr) {
+                    std::lock_guard<std::mutex> lock(cache.mutex);
+                    cache.stats.diskHits++;
+                } else {
+                    error = nullptr;
+                    pipeline = gpu->newComputePipelineState(descriptor, MTL::PipelineOptionNone, nullptr, &error);
+                    if (pipeline != nullptr) {
+                        addToArchive(cache, gpu, archive, descriptor);
+                    }
+                }
+                descriptor->release();
+                archive->release();
+                return pipeline;
+            }
+
+            /**
+             * @brief Start making a pipeline in the background, through the same archive as LibraryCache::newPipeline()
+             *
+             * Returns right away and calls done on one of Metal's threads when the
+             * pipeline is ready. Pipelines that aren't in the archive are added to it
+             * for LibraryCache::save() to write out.
+             *
+             * @param gpu The Metal device object
+             * @param function The function to make a pipeline for
+             * @param done Called with the pipeline, retained for the caller (nullptr if it couldn't be made), and the error if there was one
+             *
+            */
+            static void newPipelineAsync(MTL::Device *gpu, MTL::Function *function,
+                                         const std::function<void(MTL::ComputePipelineState *, NS::Error *)> &done) {
+                MTL::BinaryArchive *archive = retainArchive(state(), gpu);
+                if (archive == nullptr) {
+                    gpu->newComputePipelineState(function, [done](MTL::ComputePipelineState *pipeline, NS::Error *error) {
+                        // The completion handler doesn't own the pipeline, so keep a reference
+                        if (pipeline != nullptr) {
+                            pipeline->retain();
+                        }
+                        done(pipeline, error);
+                    });
+                    return;
+                }
+
+                // The descriptor and archive are released by whichever handler finishes
+                MTL::ComputePipelineDescriptor *descriptor = archiveDescriptor(function, archive);
+                gpu->newComputePipelineState(descriptor, MTL::PipelineOptionFailOnBinaryArchiveMiss,
+                                             [gpu, descriptor, archive, done](MTL::ComputePipelineState *pipeline, MTL::ComputePipelineReflection *, NS::Error *) {
+                    if (pipeline != nullptr) {
+                        {
+                            std::lock_guard<std::mutex> lock(state().mutex);
+                            state().stats.diskHits++;
+                        }
+                        pipeline->retain();
+                        descriptor->release();
+                        archive->release();
+                        done(pipeline, nullptr);
+                        return;
+                    }
+                    gpu->newComputePipelineState(descriptor, MTL::PipelineOptionNone,
+                                                 [gpu, descriptor, archive, done](MTL::ComputePipelineState *pipeline, MTL::ComputePipelineReflection *, NS::Error *error) {
+                        if (pipeline != nullptr) {
+                            pipeline->retain();
+                            addToArchive(state(), gpu, archive, descriptor);
+                        }
+                        descriptor->release();
+                        archive->release();
+                        done(pipeline, error);
+                    });
+                });
+            }
+
+            /**
+             * @brief Write the pipelines added since the last save to the cache directory
+             *
+             * Each archive is written whole, so this is called once per batch of
+             * pipelines (by PipelineBatch::wait() and Kernel::precompile()) and when
+             * the program exits, rather than once per pipeline
+             *
+            */
+            static void save() {
+                State &cache = state();
+                std::scoped_lock lock(cache.mutex, cache.archiveMutex);
+                saveArchives(cache);
+            }
+
+            /**
+             * @brief Get a pipeline for a function in some source, making it only once
+             *
+             * For the built-in kernels, which keep their pipelines for the life of the program
+             *
+             * @param gpu The Metal device object
+             * @param source The source and compile options
+             * @param funcname The name of the function
+             *
+             * @return MTL::ComputePipelineState* The pipeline, owned by the cache
+             *
+            */
+            static MTL::ComputePipelineState *getPipeline(MTL::Device *gpu, const KernelSource &source, const std::string &funcname) {
+                State &cache = state();
+                std::tuple<MTL::Device *, uint64_t, std::string> key(gpu, source.hash(), funcname);
+                {
+                    std::lock_guard<std::mutex> lock(cache.mutex);
+                    auto found = cache.pipelines.find(key);
+                    if (found != cache.pipelines.end()) {
+                        return found->second;
+                    }
+                }
+
+                // Compile without holding the lock, LibraryCache::get() takes it too
+                MTL::Library *library = get(gpu, source);
+                MTL::Function *function = library->newFunction(NS::String::string(funcname.c_str(), NS::UTF8StringEncoding));
+                library->release();
+                if (function == nullptr) {
+                    throw std::runtime_error("Could not load function " + funcname);
+                }
+                MTL::ComputePipelineState *pipeline = newPipeline(gpu, function);
+                function->release();
+                if (pipeline == nullptr) {
+                    throw std::runtime_error("Could not make pipeline for " + funcname);
+                }
+
+                std::lock_guard<std::mutex> lock(cache.mutex);
+                auto inserted = cache.pipelines.insert({key, pipeline});
+                if (!inserted.second) {
+                    // Another thread made it first
+                    pipeline->release();
+                }
+                return inserted.first->second;
+            }
+
+            /**
+             * @brief Set the cache directory
+             *
+             * Pipelines added to the old directory's archives are saved there first
+             *
+             * @param directory The directory for pipeline archives, empty to only cache in memory
+             *
+            */
+            static void setDirectory(const std::filesystem::path &directory) {
+                State &cache = state();
+                std::scoped_lock lock(cache.mutex, cache.archiveMutex);
+                saveArchives(cache);
+                cache.directory = directory;
+                releaseArchives(cache);
+            }
+
+            /**
+             * @brief Get the cache directory
+             *
+             * @return std::filesystem::path The directory, empty if only caching in memory
+             *
+            */
+            static std::filesystem::path getDirectory() {
+                State &cache = state();
+                std::lock_guard<std::mutex> lock(cache.mutex);
+                return cache.directory;
+            }
+
+            /**
+             * @brief Release every library, pipeline and archive loaded in this process
+             *
+             * Kernels that use them keep their own references, and pipelines from
+             * LibraryCache::getPipeline() are made again the next time they're asked
+             * for. The archives are saved first, so afterwards the cache behaves
+             * like it does in a fresh process.
+             *
+            */
+            static void clear() {
+                State &cache = state();
+                std::scoped_lock lock(cache.mutex, cache.archiveMutex);
+                saveArchives(cache);
+                releaseArchives(cache);
+                for (auto &pair : cache.libraries) {
+                    pair.second->release();
+                }
+                cache.libraries.clear();
+                for (auto &pair : cache.pipelines) {
+                    pair.second->release();
+                }
+                cache.pipelines.clear();
+            }
+
+            /**
+             * @brief Get the hit and compile counts
+             *
+             * @return LibraryCacheStats The counts
+             *
+            */
+            static LibraryCacheStats getStats() {
+                State &cache = state();
+                std::lock_guard<std::mutex> lock(cache.mutex);
+                return cache.stats;
+            }
+
+    };
+
+}
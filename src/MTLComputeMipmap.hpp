@@ -0,0 +1,273 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include "MTLComputeTexture.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source for halving integer textures
+     *
+     * Each thread averages a 2x2 block of the level above, rounded the same way
+     * as host::downsample(). Edges are clamped for odd sizes.
+     *
+    */
+    inline constexpr const char *MIPMAP_REDUCE_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+template<typename V>
+V average4(V a, V b, V c, V d) {
+  return (a >> 2) + (b >> 2) + (c >> 2) + (d >> 2) + (((a & 3) + (b & 3) + (c & 3) + (d & 3) + 2) >> 2);
+}
+
+template<typename C>
+void reduce(texture2d<C, access::read> src, texture2d<C, access::write> dst, uint2 gid) {
+  if (gid.x >= dst.get_width() || gid.y >= dst.get_height()) {
+    return;
+  }
+  uint2 last = uint2(src.get_width() - 1, src.get_height() - 1);
+  uint2 a = min(gid*2, last);
+  uint2 b = min(gid*2 + 1, last);
+  dst.write(average4(src.read(a), src.read(uint2(b.x, a.y)), src.read(uint2(a.x, b.y)), src.read(b)), gid);
+}
+
+kernel void mipmap_reduce_uint(texture2d<uint, access::read> src [[texture(0)]],
+                               texture2d<uint, access::write> dst [[texture(1)]],
+                               uint2 gid [[thread_position_in_grid]]) {
+  reduce(src, dst, gid);
+}
+
+kernel void mipmap_reduce_int(texture2d<int, access::read> src [[texture(0)]],
+                              texture2d<int, access::write> dst [[texture(1)]],
+                              uint2 gid [[thread_position_in_grid]]) {
+  reduce(src, dst, gid);
+}
+)";
+
+    /**
+     * @brief Get the number of levels in a full mipmap chain
+     *
+     * @param width The width of the largest level
+     * @param height The height of the largest level
+     *
+     * @return int The number of levels down to 1x1
+     *
+    */
+    inline int mipmapLevelCount(int width, int height) {
+        int levels = 1;
+        for (int size = std::max(width, height); size > 1; size >>= 1) {
+            levels++;
+        }
+        return levels;
+    }
+
+    /**
+     * @brief A 2D texture with mipmap levels
+     *
+     * Level 0 is the full image and every level after it is half the size of the
+     * one before, which makes an image pyramid. Fill level 0, call
+     * MipmappedTexture::generateMipmaps(), and use Texture::level() to get each
+     * level as its own texture for dispatching.
+     *
+    */
+    template<typename T>
+    class MipmappedTexture : public Texture<T> {
+        private:
+
+            /**
+             * @brief Get the pipeline that halves integer textures
+             *
+             * The pipeline is made once per device and kept for the life of the program
+             *
+             * @param gpu The Metal device object
+             *
+             * @return MTL::ComputePipelineState* The pipeline
+             *
+            */
+            static MTL::ComputePipelineState *reducePipeline(MTL::Device *gpu) {
+                const char *name = std::is_signed_v<typename PixelFormatTraits<T>::channel_type> ? "mipmap_reduce_int" : "mipmap_reduce_uint";
+                return LibraryCache::getPipeline(gpu, KernelSource{MIPMAP_REDUCE_SOURCE, {}}, name);
+            }
+
+            /**
+             * @brief Get the command queue mipmaps are generated on
+             *
+             * The queue is made once per device and kept for the life of the program
+             *
+             * @param gpu The Metal device object
+             *
+             * @return MTL::CommandQueue* The command queue
+             *
+            */
+            static MTL::CommandQueue *commandQueue(MTL::Device *gpu) {
+                static std::mutex mutex;
+                static std::map<MTL::Device *, MTL::CommandQueue *> queues;
+                std::lock_guard<std::mutex> lock(mutex);
+                MTL::CommandQueue *&queue = queues[gpu];
+                if (queue == nullptr) {
+                    queue = gpu->newCommandQueue();
+                }
+                return queue;
+            }
+
+        public:
+            /**
+             * @brief Constructor for the MipmappedTexture class
+             *
+             * @param gpu The Metal device object
+             * @param width The width of level 0
+             * @param height The height of level 0
+             * @param levels The number of levels, 0 for a full chain down to 1x1
+             *
+            */
+            MipmappedTexture(MTL::Device *gpu, int width, int height, int levels = 0)
+                : Texture<T>(gpu, MTL::TextureType2D, width, height, 1, 1,
+                             levels == 0 ? mipmapLevelCount(width, height) : levels) {
+                if (levels < 0 || levels > mipmapLevelCount(width, height)) {
+                    throw std::invalid_argument("Too many mipmap levels for the texture size");
+                }
+            }
+
+            /**
+             * @brief Fill every level from level 0
+             *
+             * Float and half formats use the GPU's own mipmap blit. Integer formats
+             * can't be filtered, so a kernel averages each 2x2 block one level at a time.
+             *
+            */
+            void generateMipmaps() {
+                if (this->getFreed()) {
+                    throw std::runtime_error("Texture already freed");
+                }
+                if (this->getLevels() < 2) {
+                    return;
+                }
+                MTL::CommandBuffer *commandBuffer = commandQueue(this->getGPU())->commandBuffer();
+
+                if constexpr (PixelFormatTraits<T>::filterable) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->generateMipmaps(this->getTexture());
+                    blitEncoder->endEncoding();
+                    commandBuffer->commit();
+                    commandBuffer->waitUntilCompleted();
+                    blitEncoder->release();
+                } else {
+                    MTL::ComputePipelineState *pipeline = reducePipeline(this->getGPU());
+                    std::vector<Texture<T>> views;
+                    views.reserve(this->getLevels());
+                    for (int l = 0; l < this->getLevels(); l++) {
+                        views.emplace_back(this->level(l));
+                    }
+
+                    MTL::Size threadsPerThreadgroup;
+                    threadsPerThreadgroup.width = pipeline->threadExecutionWidth();
+                    threadsPerThreadgroup.height = pipeline->maxTotalThreadsPerThreadgroup() / threadsPerThreadgroup.width;
+                    threadsPerThreadgroup.depth = 1;
+
+                    // Dispatches in one encoder run in order, so each level sees the one before it
+                    MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                    commandEncoder->setComputePipelineState(pipeline);
+                    for (int l = 1; l < this->getLevels(); l++) {
+                        commandEncoder->setTexture(views[l - 1].getTexture(), 0);
+                        commandEncoder->setTexture(views[l].getTexture(), 1);
+                        commandEncoder->dispatchThreads(MTL::Size::Make(views[l].getWidth(), views[l].getHeight(), 1),
+                                                        threadsPerThreadgroup);
+                    }
+                    commandEncoder->endEncoding();
+                    commandBuffer->commit();
+                    commandBuffer->waitUntilCompleted();
+                    commandEncoder->release();
+                }
+
+                commandBuffer->release();
+            }
+    };
+
+    namespace host {
+
+        /**
+         * @brief Halve an image on the CPU
+         *
+         * Averages each 2x2 block per channel, clamping at the edges for odd sizes.
+         * Float channels are averaged exactly, integer channels are rounded like
+         * the GPU integer reduction, so the results can be compared directly.
+         *
+         * @param src The image, width*height pixels in row order
+         * @param width The width of the image
+         * @param height The height of the image
+         * @param dst Where to put the result, max(1, width/2)*max(1, height/2) pixels
+         *
+        */
+        template<typename T>
+        void downsample(const T *src, int width, int height, T *dst) {
+            using C = typename PixelFormatTraits<T>::channel_type;
+            constexpr int N = PixelFormatTraits<T>::channels;
+            int dw = std::max(1, width >> 1);
+            int dh = std::max(1, height >> 1);
+
+            for (int y = 0; y < dh; y++) {
+                int y0 = std::min(2*y, height - 1);
+                int y1 = std::min(2*y + 1, height - 1);
+                for (int x = 0; x < dw; x++) {
+                    int x0 = std::min(2*x, width - 1);
+                    int x1 = std::min(2*x + 1, width - 1);
+                    C a[N], b[N], c[N], d[N], out[N];
+                    memcpy(a, &src[(size_t)y0*width + x0], sizeof(T));
+                    memcpy(b, &src[(size_t)y0*width + x1], sizeof(T));
+                    memcpy(c, &src[(size_t)y1*width + x0], sizeof(T));
+                    memcpy(d, &src[(size_t)y1*width + x1], sizeof(T));
+                    for (int ch = 0; ch < N; ch++) {
+                        if constexpr (PixelFormatTraits<T>::filterable) {
+                            out[ch] = C(((float)a[ch] + (float)b[ch] + (float)c[ch] + (float)d[ch])*0.25f);
+                        } else {
+                            long long sum = (long long)a[ch] + b[ch] + c[ch] + d[ch] + 2;
+                            out[ch] = (C)(sum >> 2);
+                        }
+                    }
+                    memcpy(&dst[(size_t)y*dw + x], out, sizeof(T));
+                }
+            }
+        }
+
+        /**
+         * @brief Build an image pyramid on the CPU
+         *
+         * @param image The full size image, width*height pixels in row order
+         * @param width The width of the image
+         * @param height The height of the image
+         * @param levels The number of levels, 0 for a full chain down to 1x1
+         *
+         * @return std::vector<std::vector<T>> One image per level, level 0 is a copy of the input
+         *
+        */
+        template<typename T>
+        std::vector<std::vector<T>> buildPyramid(const std::vector<T> &image, int width, int height, int levels = 0) {
+            if (image.size() != (size_t)width*height) {
+                throw std::invalid_argument("Data size does not match image size");
+            }
+            if (levels == 0) {
+                levels = mipmapLevelCount(width, height);
+            } else if (levels < 0 || levels > mipmapLevelCount(width, height)) {
+                throw std::invalid_argument("Too many mipmap levels for the image size");
+            }
+            std::vector<std::vector<T>> pyramid(levels);
+            pyramid[0] = image;
+            for (int l = 1; l < levels; l++) {
+                int w = std::max(1, width >> (l - 1));
+                int h = std::max(1, height >> (l - 1));
+                pyramid[l].resize((size_t)std::max(1, w >> 1)*std::max(1, h >> 1));
+                downsample(pyramid[l - 1].data(), w, h, pyramid[l].data());
+            }
+            return pyramid;
+        }
+
+    }
+
+}
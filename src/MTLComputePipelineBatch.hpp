@@ -0,0 +1,143 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeKernel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief How long one pipeline in a PipelineBatch took to compile
+     *
+    */
+    struct PipelineTiming {
+        std::string name; ///< The name of the function
+        double milliseconds = 0; ///< The time from starting the compile to the pipeline being ready
+        bool failed = false; ///< Whether the compile failed
+    };
+
+    /**
+     * @brief Compiles the pipelines for many kernels at the same time
+     *
+     * Loading kernels one by one waits for each compile before starting the
+     * next. A PipelineBatch starts every compile as soon as it's added, so
+     * loading them all takes about as long as the slowest one. Each handle
+     * becomes ready on its own, so a kernel can be used before the rest are done.
+     *
+    */
+    class PipelineBatch {
+
+        private:
+
+            /**
+             * @brief One compile in the batch
+             *
+            */
+            struct Entry {
+                Kernel *kernel; ///< The kernel the function is from
+                PipelineHandle handle; ///< The compile
+            };
+
+            std::vector<Entry> entries; ///< The compiles, in the order they were added
+            std::chrono::steady_clock::time_point start; ///< When the first compile was started
+            double milliseconds = 0; ///< How long PipelineBatch::wait() took from the first compile
+
+        public:
+
+            /**
+             * @brief Start compiling a function
+             *
+             * @param kernel The kernel the function is in, it has to outlive the batch
+             * @param funcname The name of the function
+             * @param constants The values for the function's [[function_constant(n)]] declarations, if it has any
+             *
+             * @return PipelineHandle The compile
+             *
+            */
+            PipelineHandle add(Kernel &kernel, const std::string &funcname, const FunctionConstants &constants = FunctionConstants()) {
+                if (this->entries.empty()) {
+                    this->start = std::chrono::steady_clock::now();
+                }
+                PipelineHandle handle = kernel.compileAsync(funcname, constants);
+                this->entries.push_back(Entry{&kernel, handle});
+                return handle;
+            }
+
+            /**
+             * @brief Wait for every compile and set each kernel's function
+             *
+             * Kernels that had more than one function added use the last one.
+             * Every compile is waited for before the first error is thrown, and
+             * the new pipelines are saved to the LibraryCache directory, if there is one.
+             *
+            */
+            void wait() {
+                std::string error;
+                for (Entry &entry : this->entries) {
+                    try {
+                        entry.kernel->useFunction(entry.handle);
+                    } catch (const std::runtime_error &e) {
+                        if (error.empty()) {
+                            error = e.what();
+                        }
+                    }
+                }
+                this->milliseconds = this->entries.empty() ? 0 :
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->start).count();
+                // The pipelines that weren't in the disk cache go in with one write
+                LibraryCache::save();
+                if (!error.empty()) {
+                    throw std::runtime_error(error);
+                }
+            }
+
+            /**
+             * @brief Get how long each pipeline took to compile
+             *
+             * Waits for any compile that isn't done
+             *
+             * @return std::vector<PipelineTiming> One timing per compile, in the order they were added
+             *
+            */
+            std::vector<PipelineTiming> getTimings() const {
+                std::vector<PipelineTiming> timings;
+                for (const Entry &entry : this->entries) {
+                    PipelineTiming timing;
+                    timing.name = entry.handle.getName();
+                    timing.milliseconds = entry.handle.getMilliseconds();
+                    try {
+                        entry.handle.wait();
+                    } catch (const std::runtime_error &) {
+                        timing.failed = true;
+                    }
+                    timings.push_back(timing);
+                }
+                return timings;
+            }
+
+            /**
+             * @brief Get how long the whole batch took
+             *
+             * @return double The time from the first compile to PipelineBatch::wait() returning, in milliseconds
+             *
+            */
+            double getMilliseconds() const {
+                return this->milliseconds;
+            }
+
+            /**
+             * @brief Get the number of compiles in the batch
+             *
+             * @return size_t The number of compiles
+             *
+            */
+            size_t size() const {
+                return this->entries.size();
+            }
+
+    };
+
+}
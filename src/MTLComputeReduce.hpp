@@ -0,0 +1,602 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeBuffer.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source for the reductions
+     *
+     * T is defined as a macro before compiling. Each thread walks the input with
+     * a grid sized stride, then SIMD-group reductions combine the threads of a
+     * SIMD group and then the SIMD groups of a threadgroup. Each threadgroup
+     * writes one partial result, and a second pass with a single threadgroup
+     * reduces the partials.
+     *
+    */
+    inline constexpr const char *REDUCE_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+struct ReduceParams {
+  uint count;
+  uint indexed;
+};
+
+struct SumOp {
+  static T identity() { return T(0); }
+  static T combine(T a, T b) { return a + b; }
+  static T simd(T a) { return simd_sum(a); }
+};
+
+// Infinity for floats, so buffers of infinities still find an element
+struct MinOp {
+  static T identity() { return is_floating_point_v<T> ? numeric_limits<T>::infinity() : numeric_limits<T>::max(); }
+  static T combine(T a, T b) { return min(a, b); }
+  static T simd(T a) { return simd_min(a); }
+};
+
+struct MaxOp {
+  static T identity() { return is_floating_point_v<T> ? -numeric_limits<T>::infinity() : numeric_limits<T>::lowest(); }
+  static T combine(T a, T b) { return max(a, b); }
+  static T simd(T a) { return simd_max(a); }
+};
+
+template<typename Op>
+void reduce(device const T *in, device T *out, uint count, threadgroup T *shared,
+            uint gid, uint threads, uint group, uint lane, uint simdgroup, uint simdgroups) {
+  T value = Op::identity();
+  for (uint i = gid; i < count; i += threads) {
+    value = Op::combine(value, in[i]);
+  }
+  value = Op::simd(value);
+  if (lane == 0) {
+    shared[simdgroup] = value;
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+  if (simdgroup == 0) {
+    value = Op::simd(lane < simdgroups ? shared[lane] : Op::identity());
+    if (lane == 0) {
+      out[group] = value;
+    }
+  }
+}
+
+// Best value and then lowest index, so ties go to the first element
+template<typename Op>
+void reduceIndex(device const T *in, device const uint *inIndex, device T *out, device uint *outIndex,
+                 constant ReduceParams &params, threadgroup T *sharedValues, threadgroup uint *sharedIndices,
+                 uint gid, uint threads, uint group, uint lane, uint simdgroup, uint simdgroups) {
+  T value = Op::identity();
+  uint index = 0xffffffff;
+  for (uint i = gid; i < params.count; i += threads) {
+    T v = in[i];
+    uint j = params.indexed ? inIndex[i] : i;
+    if (Op::combine(value, v) != value || (v == value && j < index)) {
+      value = v;
+      index = j;
+    }
+  }
+  T best = Op::simd(value);
+  index = simd_min(value == best ? index : 0xffffffff);
+  if (lane == 0) {
+    sharedValues[simdgroup] = best;
+    sharedIndices[simdgroup] = index;
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+  if (simdgroup == 0) {
+    value = lane < simdgroups ? sharedValues[lane] : Op::identity();
+    index = lane < simdgroups ? sharedIndices[lane] : 0xffffffff;
+    best = Op::simd(value);
+    index = simd_min(value == best ? index : 0xffffffff);
+    if (lane == 0) {
+      out[group] = best;
+      outIndex[group] = index;
+    }
+  }
+}
+
+#define REDUCE_KERNEL(NAME, OP) \
+kernel void NAME(device const T *in [[buffer(0)]], device T *out [[buffer(1)]], \
+                 constant ReduceParams &params [[buffer(2)]], \
+                 uint gid [[thread_position_in_grid]], uint threads [[threads_per_grid]], \
+                 uint group [[threadgroup_position_in_grid]], uint lane [[thread_index_in_simdgroup]], \
+                 uint simdgroup [[simdgroup_index_in_threadgroup]], uint simdgroups [[simdgroups_per_threadgroup]]) { \
+  threadgroup T shared[32]; \
+  reduce<OP>(in, out, params.count, shared, gid, threads, group, lane, simdgroup, simdgroups); \
+}
+
+#define REDUCE_INDEX_KERNEL(NAME, OP) \
+kernel void NAME(device const T *in [[buffer(0)]], device const uint *inIndex [[buffer(1)]], \
+                 device T *out [[buffer(2)]], device uint *outIndex [[buffer(3)]], \
+                 constant ReduceParams &params [[buffer(4)]], \
+                 uint gid [[thread_position_in_grid]], uint threads [[threads_per_grid]], \
+                 uint group [[threadgroup_position_in_grid]], uint lane [[thread_index_in_simdgroup]], \
+                 uint simdgroup [[simdgroup_index_in_threadgroup]], uint simdgroups [[simdgroups_per_threadgroup]]) { \
+  threadgroup T sharedValues[32]; \
+  threadgroup uint sharedIndices[32]; \
+  reduceIndex<OP>(in, inIndex, out, outIndex, params, sharedValues, sharedIndices, \
+                  gid, threads, group, lane, simdgroup, simdgroups); \
+}
+
+REDUCE_KERNEL(reduce_sum, SumOp)
+REDUCE_KERNEL(reduce_min, MinOp)
+REDUCE_KERNEL(reduce_max, MaxOp)
+REDUCE_INDEX_KERNEL(reduce_argmin, MinOp)
+REDUCE_INDEX_KERNEL(reduce_argmax, MaxOp)
+)";
+
+    namespace host {
+
+        /**
+         * @brief Reduce a range on one thread
+         *
+         * Keeps one running value per lane so the compiler can use vector
+         * instructions, then combines the lanes at the end.
+         *
+         * @param data The elements
+         * @param count The number of elements
+         * @param identity The value that doesn't change the result
+         * @param combine Combines two values
+         *
+         * @return T The reduced value
+         *
+        */
+        template<typename T, typename F>
+        T reduceRange(const T *data, size_t count, T identity, F combine) {
+            constexpr size_t LANES = std::max<size_t>(4, 32/sizeof(T));
+            T lanes[LANES];
+            std::fill(lanes, lanes + LANES, identity);
+            size_t i = 0;
+            for (; i + LANES <= count; i += LANES) {
+                for (size_t l = 0; l < LANES; l++) {
+                    lanes[l] = combine(lanes[l], data[i + l]);
+                }
+            }
+            for (; i < count; i++) {
+                lanes[0] = combine(lanes[0], data[i]);
+            }
+            T result = identity;
+            for (size_t l = 0; l < LANES; l++) {
+                result = combine(result, lanes[l]);
+            }
+            return result;
+        }
+
+        /**
+         * @brief Reduce a range on every CPU thread
+         *
+         * @param data The elements
+         * @param count The number of elements
+         * @param identity The value that doesn't change the result
+         * @param combine Combines two values
+         *
+         * @return T The reduced value
+         *
+        */
+        template<typename T, typename F>
+        T reduce(const T *data, size_t count, T identity, F combine) {
+            size_t chunks = chunkCount(count, 1 << 18);
+            std::vector<T> partials(chunks, identity);
+            parallelChunks(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+                partials[chunk] = reduceRange(data + begin, end - begin, identity, combine);
+            });
+            return reduceRange(partials.data(), chunks, identity, combine);
+        }
+
+        /**
+         * @brief Get the identity for min, infinity for floating point types
+         *
+         * @return T Nothing compares larger
+         *
+        */
+        template<typename T>
+        constexpr T highest() {
+            if constexpr (std::is_floating_point_v<T>) {
+                return std::numeric_limits<T>::infinity();
+            } else {
+                return std::numeric_limits<T>::max();
+            }
+        }
+
+        /**
+         * @brief Get the identity for max, minus infinity for floating point types
+         *
+         * @return T Nothing compares smaller
+         *
+        */
+        template<typename T>
+        constexpr T lowest() {
+            if constexpr (std::is_floating_point_v<T>) {
+                return -std::numeric_limits<T>::infinity();
+            } else {
+                return std::numeric_limits<T>::lowest();
+            }
+        }
+
+        /**
+         * @brief Add up every element on the CPU
+         *
+         * The sum is kept in T, so small integer types wrap around
+         *
+         * @param data The elements
+         * @param count The number of elements
+         *
+         * @return T The sum, 0 if there are no elements
+         *
+        */
+        template<typename T>
+        T sum(const T *data, size_t count) {
+            return reduce(data, count, T(0), [](T a, T b) { return T(a + b); });
+        }
+
+        /**
+         * @brief Find the smallest element on the CPU
+         *
+         * @param data The elements
+         * @param count The number of elements, at least 1
+         *
+         * @return T The smallest element
+         *
+        */
+        template<typename T>
+        T min(const T *data, size_t count) {
+            if (count == 0) {
+                throw std::invalid_argument("No elements to reduce");
+            }
+            return reduce(data, count, highest<T>(), [](T a, T b) { return b < a ? b : a; });
+        }
+
+        /**
+         * @brief Find the largest element on the CPU
+         *
+         * @param data The elements
+         * @param count The number of elements, at least 1
+         *
+         * @return T The largest element
+         *
+        */
+        template<typename T>
+        T max(const T *data, size_t count) {
+            if (count == 0) {
+                throw std::invalid_argument("No elements to reduce");
+            }
+            return reduce(data, count, lowest<T>(), [](T a, T b) { return b > a ? b : a; });
+        }
+
+        /**
+         * @brief Find the first smallest element on the CPU
+         *
+         * Finds the smallest value first and then where it is, since both of
+         * those vectorize and tracking the index while comparing doesn't
+         *
+         * @param data The elements
+         * @param count The number of elements, at least 1
+         *
+         * @return size_t The index of the first smallest element
+         *
+        */
+        template<typename T>
+        size_t argmin(const T *data, size_t count) {
+            T value = min(data, count);
+            return std::find(data, data + count, value) - data;
+        }
+
+        /**
+         * @brief Find the first largest element on the CPU
+         *
+         * @param data The elements
+         * @param count The number of elements, at least 1
+         *
+         * @return size_t The index of the first largest element
+         *
+        */
+        template<typename T>
+        size_t argmax(const T *data, size_t count) {
+            T value = max(data, count);
+            return std::find(data, data + count, value) - data;
+        }
+
+    }
+
+    /**
+     * @brief Sum, min, max, argmin and argmax of a Buffer on the GPU
+     *
+     * Only the result comes back to the host, instead of the whole buffer.
+     * Buffers smaller than the host threshold are reduced on the CPU, where
+     * they're faster than a round trip to the GPU, and so are element types
+     * the kernels aren't compiled for. Private buffers always use the GPU.
+     *
+     * @tparam T The element type
+     *
+    */
+    template<typename T>
+    class Reducer {
+        private:
+            static constexpr size_t MAX_GROUPS = 1024; ///< The most partial results the first pass makes
+            static constexpr size_t ELEMENTS_PER_THREAD = 16; ///< How many elements each thread should get before adding threadgroups
+
+            /**
+             * @brief The uniforms for the reduction kernels, the same layout as ReduceParams
+             *
+            */
+            struct Params {
+                uint32_t count; ///< The number of elements
+                uint32_t indexed; ///< Whether to read indices for argmin and argmax
+            };
+
+            MTL::Device *gpu; ///< The Metal device object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+            MTL::Buffer *partials; ///< The partial results, with the final one after them
+            MTL::Buffer *partialIndices; ///< The partial indices for argmin and argmax
+            size_t hostThreshold; ///< Buffers with fewer elements are reduced on the CPU
+
+            /**
+             * @brief Whether to reduce a buffer on the CPU
+             *
+             * @param buffer The buffer
+             *
+             * @return bool True for small buffers that the host can read
+             *
+            */
+            bool useHost(const Buffer<T> &buffer) const {
+                if (buffer.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                return buffer.getStorageMode() != ResourceStorage::Private && buffer.size() < this->hostThreshold;
+            }
+
+            /**
+             * @brief Get the elements of a buffer for reducing on the CPU
+             *
+             * @param buffer The buffer
+             *
+             * @return const T* The elements
+             *
+            */
+            const T *hostData(const Buffer<T> &buffer) const {
+                if (buffer.getStorageMode() == ResourceStorage::Private) {
+                    throw std::invalid_argument("Private buffers of this type can't be reduced");
+                }
+                return buffer.data();
+            }
+
+            /**
+             * @brief Reduce a buffer on the GPU
+             *
+             * @param funcname The reduction kernel
+             * @param buffer The buffer, not empty
+             * @param index Set to the index of the result for argmin and argmax, null otherwise
+             *
+             * @return T The reduced value
+             *
+            */
+            T run(const std::string &funcname, const Buffer<T> &buffer, uint32_t *index) {
+                if (buffer.size() > std::numeric_limits<uint32_t>::max()) {
+                    throw std::invalid_argument("Buffer too large to reduce, max is 2^32 - 1 elements");
+                }
+                KernelSource source{REDUCE_SOURCE, {{"T", ShaderTypeTraits<T>::name}}};
+                MTL::ComputePipelineState *pipeline = LibraryCache::getPipeline(this->gpu, source, funcname);
+
+                // Whole SIMD groups, and no more than the 32 the kernels have room for
+                size_t width = pipeline->threadExecutionWidth();
+                size_t threads = std::min<size_t>(pipeline->maxTotalThreadsPerThreadgroup(), 32*width)/width*width;
+                size_t groups = std::clamp<size_t>((buffer.size() + threads*ELEMENTS_PER_THREAD - 1)/(threads*ELEMENTS_PER_THREAD),
+                                                   1, MAX_GROUPS);
+
+                buffer.flush();
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                commandEncoder->setComputePipelineState(pipeline);
+
+                // Dispatches in one encoder run in order, so the second pass sees the first
+                Params params{(uint32_t)buffer.size(), 0};
+                size_t last = MAX_GROUPS*sizeof(T);
+                size_t lastIndex = MAX_GROUPS*sizeof(uint32_t);
+                if (index == nullptr) {
+                    commandEncoder->setBuffer(buffer.getBuffer(), 0, 0);
+                    commandEncoder->setBuffer(this->partials, 0, 1);
+                    commandEncoder->setBytes(&params, sizeof(params), 2);
+                    commandEncoder->dispatchThreadgroups(MTL::Size::Make(groups, 1, 1), MTL::Size::Make(threads, 1, 1));
+                    if (groups > 1) {
+                        params.count = groups;
+                        commandEncoder->setBuffer(this->partials, 0, 0);
+                        commandEncoder->setBuffer(this->partials, last, 1);
+                        commandEncoder->setBytes(&params, sizeof(params), 2);
+                        commandEncoder->dispatchThreadgroups(MTL::Size::Make(1, 1, 1), MTL::Size::Make(threads, 1, 1));
+                    }
+                } else {
+                    commandEncoder->setBuffer(buffer.getBuffer(), 0, 0);
+                    commandEncoder->setBuffer(this->partialIndices, 0, 1);
+                    commandEncoder->setBuffer(this->partials, 0, 2);
+                    commandEncoder->setBuffer(this->partialIndices, 0, 3);
+                    commandEncoder->setBytes(&params, sizeof(params), 4);
+                    commandEncoder->dispatchThreadgroups(MTL::Size::Make(groups, 1, 1), MTL::Size::Make(threads, 1, 1));
+                    if (groups > 1) {
+                        params = Params{(uint32_t)groups, 1};
+                        commandEncoder->setBuffer(this->partials, 0, 0);
+                        commandEncoder->setBuffer(this->partialIndices, 0, 1);
+                        commandEncoder->setBuffer(this->partials, last, 2);
+                        commandEncoder->setBuffer(this->partialIndices, lastIndex, 3);
+                        commandEncoder->setBytes(&params, sizeof(params), 4);
+                        commandEncoder->dispatchThreadgroups(MTL::Size::Make(1, 1, 1), MTL::Size::Make(threads, 1, 1));
+                    }
+                }
+                commandEncoder->endEncoding();
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+
+                size_t result = groups > 1 ? MAX_GROUPS : 0;
+                if (index != nullptr) {
+                    *index = ((uint32_t *)this->partialIndices->contents())[result];
+                }
+                return ((T *)this->partials->contents())[result];
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the Reducer class
+             *
+             * @param gpu The Metal device object
+             * @param hostThreshold Buffers with fewer elements are reduced on the CPU
+             *
+            */
+            Reducer(MTL::Device *gpu, size_t hostThreshold = 1 << 16) {
+                this->gpu = gpu;
+                this->hostThreshold = hostThreshold;
+                this->commandQueue = gpu->newCommandQueue();
+                this->partials = gpu->newBuffer((MAX_GROUPS + 1)*sizeof(T), MTL::ResourceStorageModeShared);
+                this->partialIndices = gpu->newBuffer((MAX_GROUPS + 1)*sizeof(uint32_t), MTL::ResourceStorageModeShared);
+            }
+
+            Reducer(const Reducer &) = delete;
+            Reducer & operator=(const Reducer &) = delete;
+
+            /**
+             * @brief Destructor for the Reducer class
+             *
+             * Releases the command queue and the partial result buffers
+             *
+            */
+            ~Reducer() {
+                this->commandQueue->autorelease();
+                this->partials->autorelease();
+                this->partialIndices->autorelease();
+            }
+
+            /**
+             * @brief Add up every element
+             *
+             * Float sums are added in a different order than a plain loop, so
+             * the last few bits can differ from one
+             *
+             * @param buffer The buffer
+             *
+             * @return T The sum, 0 for an empty buffer
+             *
+            */
+            T sum(const Buffer<T> &buffer) {
+                if constexpr (ShaderTypeTraits<T>::supported) {
+                    if (!this->useHost(buffer)) {
+                        return buffer.size() == 0 ? T(0) : this->run("reduce_sum", buffer, nullptr);
+                    }
+                }
+                return host::sum(this->hostData(buffer), buffer.size());
+            }
+
+            /**
+             * @brief Find the smallest element
+             *
+             * @param buffer The buffer, not empty
+             *
+             * @return T The smallest element
+             *
+            */
+            T min(const Buffer<T> &buffer) {
+                if (buffer.size() == 0) {
+                    throw std::invalid_argument("No elements to reduce");
+                }
+                if constexpr (ShaderTypeTraits<T>::supported) {
+                    if (!this->useHost(buffer)) {
+                        return this->run("reduce_min", buffer, nullptr);
+                    }
+                }
+                return host::min(this->hostData(buffer), buffer.size());
+            }
+
+            /**
+             * @brief Find the largest element
+             *
+             * @param buffer The buffer, not empty
+             *
+             * @return T The largest element
+             *
+            */
+            T max(const Buffer<T> &buffer) {
+                if (buffer.size() == 0) {
+                    throw std::invalid_argument("No elements to reduce");
+                }
+                if constexpr (ShaderTypeTraits<T>::supported) {
+                    if (!this->useHost(buffer)) {
+                        return this->run("reduce_max", buffer, nullptr);
+                    }
+                }
+                return host::max(this->hostData(buffer), buffer.size());
+            }
+
+            /**
+             * @brief Find the first smallest element
+             *
+             * @param buffer The buffer, not empty
+             *
+             * @return size_t The index of the first smallest element
+             *
+            */
+            size_t argmin(const Buffer<T> &buffer) {
+                if (buffer.size() == 0) {
+                    throw std::invalid_argument("No elements to reduce");
+                }
+                if constexpr (ShaderTypeTraits<T>::supported) {
+                    if (!this->useHost(buffer)) {
+                        uint32_t index = 0;
+                        this->run("reduce_argmin", buffer, &index);
+                        return index;
+                    }
+                }
+                return host::argmin(this->hostData(buffer), buffer.size());
+            }
+
+            /**
+             * @brief Find the first largest element
+             *
+             * @param buffer The buffer, not empty
+             *
+             * @return size_t The index of the first largest element
+             *
+            */
+            size_t argmax(const Buffer<T> &buffer) {
+                if (buffer.size() == 0) {
+                    throw std::invalid_argument("No elements to reduce");
+                }
+                if constexpr (ShaderTypeTraits<T>::supported) {
+                    if (!this->useHost(buffer)) {
+                        uint32_t index = 0;
+                        this->run("reduce_argmax", buffer, &index);
+                        return index;
+                    }
+                }
+                return host::argmax(this->hostData(buffer), buffer.size());
+            }
+
+            /**
+             * @brief Set the size below which buffers are reduced on the CPU
+             *
+             * @param hostThreshold The number of elements, 0 to always use the GPU
+             *
+            */
+            void setHostThreshold(size_t hostThreshold) {
+                this->hostThreshold = hostThreshold;
+            }
+
+            /**
+             * @brief Get the size below which buffers are reduced on the CPU
+             *
+             * @return size_t The number of elements
+             *
+            */
+            size_t getHostThreshold() {
+                return this->hostThreshold;
+            }
+
+    };
+
+}
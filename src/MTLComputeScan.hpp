@@ -0,0 +1,727 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeBuffer.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include "MTLComputeReduce.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source for prefix scans
+     *
+     * T is defined as a macro before compiling. A scan is done reduce-then-scan:
+     * scan_reduce adds up each block, the block sums are scanned (recursively if
+     * there are a lot of them), and scan_block scans each block in threadgroup
+     * memory starting from its block's offset. Every pass only waits on the one
+     * before it, so there's no need for threadgroups to wait on each other.
+     *
+    */
+    inline constexpr const char *SCAN_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+#define ITEMS 4
+
+struct ScanParams {
+  uint count;
+  uint exclusive;
+  uint offsets;
+};
+
+kernel void scan_reduce(device const T *in [[buffer(0)]], device T *sums [[buffer(1)]],
+                        constant ScanParams &params [[buffer(2)]],
+                        uint tid [[thread_index_in_threadgroup]], uint threads [[threads_per_threadgroup]],
+                        uint group [[threadgroup_position_in_grid]], uint lane [[thread_index_in_simdgroup]],
+                        uint simdgroup [[simdgroup_index_in_threadgroup]], uint simdgroups [[simdgroups_per_threadgroup]]) {
+  threadgroup T shared[32];
+  uint base = group*threads*ITEMS;
+  T value = T(0);
+  for (uint k = 0; k < ITEMS; k++) {
+    uint i = base + k*threads + tid;
+    if (i < params.count) {
+      value += in[i];
+    }
+  }
+  value = simd_sum(value);
+  if (lane == 0) {
+    shared[simdgroup] = value;
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+  if (simdgroup == 0) {
+    value = simd_sum(lane < simdgroups ? shared[lane] : T(0));
+    if (lane == 0) {
+      sums[group] = value;
+    }
+  }
+}
+
+kernel void scan_block(device const T *in [[buffer(0)]], device T *out [[buffer(1)]],
+                       device const T *offsets [[buffer(2)]], constant ScanParams &params [[buffer(3)]],
+                       uint tid [[thread_index_in_threadgroup]], uint threads [[threads_per_threadgroup]],
+                       uint group [[threadgroup_position_in_grid]], uint lane [[thread_index_in_simdgroup]],
+                       uint width [[threads_per_simdgroup]], uint simdgroup [[simdgroup_index_in_threadgroup]],
+                       uint simdgroups [[simdgroups_per_threadgroup]]) {
+  threadgroup T tile[ITEMS*1024];
+  threadgroup T shared[32];
+  uint base = group*threads*ITEMS;
+
+  // Load the block with neighbouring threads reading neighbouring elements
+  for (uint k = 0; k < ITEMS; k++) {
+    uint j = k*threads + tid;
+    tile[j] = base + j < params.count ? in[base + j] : T(0);
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+
+  // Each thread owns ITEMS elements in a row, then the SIMD groups and the threadgroup are scanned
+  T items[ITEMS];
+  T total = T(0);
+  for (uint k = 0; k < ITEMS; k++) {
+    items[k] = tile[tid*ITEMS + k];
+    total += items[k];
+  }
+  T prefix = simd_prefix_exclusive_sum(total);
+  if (lane == width - 1) {
+    shared[simdgroup] = prefix + total;
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+  if (simdgroup == 0) {
+    T sum = simd_prefix_exclusive_sum(lane < simdgroups ? shared[lane] : T(0));
+    if (lane < simdgroups) {
+      shared[lane] = sum;
+    }
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+
+  T running = prefix + shared[simdgroup] + (params.offsets ? offsets[group] : T(0));
+  for (uint k = 0; k < ITEMS; k++) {
+    if (params.exclusive) {
+      tile[tid*ITEMS + k] = running;
+      running += items[k];
+    } else {
+      running += items[k];
+      tile[tid*ITEMS + k] = running;
+    }
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+
+  for (uint k = 0; k < ITEMS; k++) {
+    uint j = k*threads + tid;
+    if (base + j < params.count) {
+      out[base + j] = tile[j];
+    }
+  }
+}
+)";
+
+    /**
+     * @brief Metal source for stream compaction
+     *
+     * T and PREDICATE(x) are defined as macros before compiling, so there's one
+     * library per element type and predicate. compact_flags marks the elements
+     * to keep, the marks are scanned, and compact_scatter writes every element
+     * to its place in the output.
+     *
+    */
+    inline constexpr const char *COMPACT_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+struct CompactParams {
+  uint count;
+  uint partition;
+};
+
+kernel void compact_flags(device const T *in [[buffer(0)]], device uint *flags [[buffer(1)]],
+                          constant CompactParams &params [[buffer(2)]], uint i [[thread_position_in_grid]]) {
+  if (i < params.count) {
+    T x = in[i];
+    flags[i] = PREDICATE(x) ? 1 : 0;
+  }
+}
+
+kernel void compact_scatter(device const T *in [[buffer(0)]], device const uint *offsets [[buffer(1)]],
+                            device const uint *flags [[buffer(2)]], device T *out [[buffer(3)]],
+                            constant CompactParams &params [[buffer(4)]], uint i [[thread_position_in_grid]]) {
+  if (i >= params.count) {
+    return;
+  }
+  if (flags[i]) {
+    out[offsets[i]] = in[i];
+  } else if (params.partition) {
+    // Rejected elements go after every kept one, still in order
+    uint kept = offsets[params.count - 1] + flags[params.count - 1];
+    out[kept + i - offsets[i]] = in[i];
+  }
+}
+)";
+
+    namespace host {
+
+        /**
+         * @brief Scan a range on every CPU thread
+         *
+         * Each thread adds up its piece, the piece sums are scanned, and then each
+         * thread scans its piece starting from its offset. in and out can be the same.
+         *
+         * @param in The elements
+         * @param out Where to put the scan, count elements
+         * @param count The number of elements
+         * @param exclusive Whether each output leaves out its own element
+         *
+        */
+        template<typename T>
+        void scan(const T *in, T *out, size_t count, bool exclusive) {
+            size_t chunks = chunkCount(count, 1 << 18);
+            std::vector<T> offsets(chunks, T(0));
+            parallelChunks(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+                offsets[chunk] = reduceRange(in + begin, end - begin, T(0), [](T a, T b) { return T(a + b); });
+            });
+            T running = T(0);
+            for (size_t c = 0; c < chunks; c++) {
+                T sum = offsets[c];
+                offsets[c] = running;
+                running += sum;
+            }
+            parallelChunks(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+                T running = offsets[chunk];
+                for (size_t i = begin; i < end; i++) {
+                    T value = in[i];
+                    if (exclusive) {
+                        out[i] = running;
+                        running += value;
+                    } else {
+                        running += value;
+                        out[i] = running;
+                    }
+                }
+            });
+        }
+
+        /**
+         * @brief Inclusive prefix sum on the CPU
+         *
+         * @param in The elements
+         * @param out Where to put the sums, can be the same as in
+         * @param count The number of elements
+         *
+        */
+        template<typename T>
+        void inclusiveScan(const T *in, T *out, size_t count) {
+            scan(in, out, count, false);
+        }
+
+        /**
+         * @brief Exclusive prefix sum on the CPU
+         *
+         * @param in The elements
+         * @param out Where to put the sums, can be the same as in
+         * @param count The number of elements
+         *
+        */
+        template<typename T>
+        void exclusiveScan(const T *in, T *out, size_t count) {
+            scan(in, out, count, true);
+        }
+
+        /**
+         * @brief Copy the elements that pass a test, or split them, on every CPU thread
+         *
+         * @param in The elements
+         * @param out Where to put the result, count elements, not the same as in
+         * @param count The number of elements
+         * @param predicate Returns true for elements to keep
+         * @param partition Whether to put the other elements after the kept ones
+         *
+         * @return size_t The number of elements kept
+         *
+        */
+        template<typename T, typename P>
+        size_t compact(const T *in, T *out, size_t count, P predicate, bool partition) {
+            size_t chunks = chunkCount(count, 1 << 16);
+            std::vector<size_t> kept(chunks + 1, 0);
+            parallelChunks(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+                size_t n = 0;
+                for (size_t i = begin; i < end; i++) {
+                    n += predicate(in[i]) ? 1 : 0;
+                }
+                kept[chunk + 1] = n;
+            });
+            for (size_t c = 0; c < chunks; c++) {
+                kept[c + 1] += kept[c];
+            }
+            size_t total = kept[chunks];
+            parallelChunks(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+                size_t keep = kept[chunk];
+                size_t reject = total + begin - kept[chunk];
+                for (size_t i = begin; i < end; i++) {
+                    if (predicate(in[i])) {
+                        out[keep++] = in[i];
+                    } else if (partition) {
+                        out[reject++] = in[i];
+                    }
+                }
+            });
+            return total;
+        }
+
+        /**
+         * @brief Copy the elements that pass a test, in order, on the CPU
+         *
+         * @param in The elements
+         * @param out Where to put the kept elements, not the same as in
+         * @param count The number of elements
+         * @param predicate Returns true for elements to keep
+         *
+         * @return size_t The number of elements kept
+         *
+        */
+        template<typename T, typename P>
+        size_t selectIf(const T *in, T *out, size_t count, P predicate) {
+            return compact(in, out, count, predicate, false);
+        }
+
+        /**
+         * @brief Split elements by a test on the CPU, keeping their order
+         *
+         * @param in The elements
+         * @param out Where to put the kept elements and then the rest, not the same as in
+         * @param count The number of elements
+         * @param predicate Returns true for elements to put first
+         *
+         * @return size_t The number of elements that passed
+         *
+        */
+        template<typename T, typename P>
+        size_t partition(const T *in, T *out, size_t count, P predicate) {
+            return compact(in, out, count, predicate, true);
+        }
+
+    }
+
+    /**
+     * @brief Prefix scans and stream compaction of a Buffer on the GPU
+     *
+     * Predicates for compaction are Metal expressions of `x`, like "x > 0.5f",
+     * and each one is compiled once. Scratch buffers are kept between calls and
+     * only grow.
+     *
+     * @tparam T The element type
+     *
+    */
+    template<typename T>
+    class Scanner {
+
+        static_assert(ShaderTypeTraits<T>::supported, "Scans are only compiled for float, int32_t and uint32_t");
+
+        private:
+            static constexpr size_t ITEMS = 4; ///< Elements per thread in a scan block, the same as ITEMS in SCAN_SOURCE
+
+            /**
+             * @brief The uniforms for the scan kernels, the same layout as ScanParams
+             *
+            */
+            struct ScanParams {
+                uint32_t count; ///< The number of elements
+                uint32_t exclusive; ///< Whether the scan is exclusive
+                uint32_t offsets; ///< Whether to add the block offsets
+            };
+
+            /**
+             * @brief The uniforms for the compaction kernels, the same layout as CompactParams
+             *
+            */
+            struct CompactParams {
+                uint32_t count; ///< The number of elements
+                uint32_t partition; ///< Whether to keep the rejected elements after the kept ones
+            };
+
+            MTL::Device *gpu; ///< The Metal device object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+            std::vector<MTL::Buffer *> levels; ///< Block sums for each level of a scan
+            MTL::Buffer *flags = nullptr; ///< Which elements a compaction keeps
+            MTL::Buffer *offsets = nullptr; ///< Where each kept element goes
+            MTL::Buffer *staging = nullptr; ///< The output of an in place compaction
+
+            /**
+             * @brief Make sure a scratch buffer is big enough
+             *
+             * @param buffer The scratch buffer, replaced if it's too small
+             * @param bytes The size it needs
+             *
+             * @return MTL::Buffer* The scratch buffer
+             *
+            */
+            MTL::Buffer *reserve(MTL::Buffer *&buffer, size_t bytes) {
+                if (buffer == nullptr || buffer->length() < bytes) {
+                    if (buffer != nullptr) {
+                        buffer->release();
+                    }
+                    buffer = this->gpu->newBuffer(std::max<size_t>(bytes, 16), MTL::ResourceStorageModeShared);
+                }
+                return buffer;
+            }
+
+            /**
+             * @brief Check a buffer before a dispatch
+             *
+             * @param buffer The buffer
+             *
+            */
+            static void check(const Buffer<T> &buffer) {
+                if (buffer.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (buffer.size() > 0xffffffff) {
+                    throw std::invalid_argument("Buffer too large to scan, max is 2^32 - 1 elements");
+                }
+            }
+
+            /**
+             * @brief Encode a scan of 4 byte elements
+             *
+             * Scans that don't fit in one block scan their block sums first, one
+             * level deeper each time
+             *
+             * @param encoder The compute command encoder
+             * @param type The Metal element type
+             * @param in The elements
+             * @param out Where to put the scan, can be the same as in
+             * @param count The number of elements
+             * @param exclusive Whether the scan is exclusive
+             * @param level How many levels of block sums deep this is
+             *
+            */
+            void encodeScan(MTL::ComputeCommandEncoder *encoder, const char *type, MTL::Buffer *in, MTL::Buffer *out,
+                            size_t count, bool exclusive, size_t level) {
+                KernelSource source{SCAN_SOURCE, {{"T", type}}};
+                MTL::ComputePipelineState *reduce = LibraryCache::getPipeline(this->gpu, source, "scan_reduce");
+                MTL::ComputePipelineState *block = LibraryCache::getPipeline(this->gpu, source, "scan_block");
+
+                // Both passes need the same block size, and the tile only has room for 1024 threads
+                size_t width = block->threadExecutionWidth();
+                size_t threads = std::min<size_t>({reduce->maxTotalThreadsPerThreadgroup(), block->maxTotalThreadsPerThreadgroup(), 1024})/width*width;
+                size_t groups = (count + threads*ITEMS - 1)/(threads*ITEMS);
+
+                ScanParams params{(uint32_t)count, exclusive, 0};
+                if (groups > 1) {
+                    if (this->levels.size() <= level) {
+                        this->levels.resize(level + 1, nullptr);
+                    }
+                    MTL::Buffer *sums = this->reserve(this->levels[level], groups*4);
+                    encoder->setComputePipelineState(reduce);
+                    encoder->setBuffer(in, 0, 0);
+                    encoder->setBuffer(sums, 0, 1);
+                    encoder->setBytes(&params, sizeof(params), 2);
+                    encoder->dispatchThreadgroups(MTL::Size::Make(groups, 1, 1), MTL::Size::Make(threads, 1, 1));
+
+                    this->encodeScan(encoder, type, sums, sums, groups, true, level + 1);
+
+                    params.offsets = 1;
+                    encoder->setComputePipelineState(block);
+                    encoder->setBuffer(in, 0, 0);
+                    encoder->setBuffer(out, 0, 1);
+                    encoder->setBuffer(sums, 0, 2);
+                } else {
+                    encoder->setComputePipelineState(block);
+                    encoder->setBuffer(in, 0, 0);
+                    encoder->setBuffer(out, 0, 1);
+                    encoder->setBuffer(in, 0, 2);
+                }
+                encoder->setBytes(&params, sizeof(params), 3);
+                encoder->dispatchThreadgroups(MTL::Size::Make(groups, 1, 1), MTL::Size::Make(threads, 1, 1));
+            }
+
+            /**
+             * @brief Copy what the GPU wrote back to the host copy of a Managed buffer
+             *
+             * @param commandBuffer The command buffer
+             * @param buffer The buffer that was written
+             *
+            */
+            static void synchronize(MTL::CommandBuffer *commandBuffer, const Buffer<T> &buffer) {
+                if (buffer.getStorageMode() == ResourceStorage::Managed) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->synchronizeResource(buffer.getBuffer());
+                    blitEncoder->endEncoding();
+                }
+            }
+
+            /**
+             * @brief Scan a buffer on the GPU and wait for it
+             *
+             * @param in The elements
+             * @param out Where to put the scan
+             * @param exclusive Whether the scan is exclusive
+             *
+            */
+            void scan(const Buffer<T> &in, Buffer<T> &out, bool exclusive) {
+                check(in);
+                check(out);
+                if (out.size() < in.size()) {
+                    throw std::invalid_argument("Output buffer is smaller than the input");
+                }
+                if (in.size() == 0) {
+                    return;
+                }
+                in.flush();
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                this->encodeScan(commandEncoder, ShaderTypeTraits<T>::name, in.getBuffer(), out.getBuffer(), in.size(), exclusive, 0);
+                commandEncoder->endEncoding();
+                synchronize(commandBuffer, out);
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+            }
+
+            /**
+             * @brief Compact a buffer on the GPU and wait for it
+             *
+             * @param in The elements
+             * @param out Where to put the result, or null to write back to in
+             * @param predicate A Metal expression of x
+             * @param partition Whether to put the rejected elements after the kept ones
+             *
+             * @return size_t The number of elements kept
+             *
+            */
+            size_t compact(const Buffer<T> &in, Buffer<T> *out, const std::string &predicate, bool partition) {
+                check(in);
+                if (out != nullptr) {
+                    check(*out);
+                    if (out->size() < in.size()) {
+                        throw std::invalid_argument("Output buffer is smaller than the input");
+                    }
+                    if (out->getBuffer() == in.getBuffer()) {
+                        throw std::invalid_argument("Compaction can't write to its input, use the in place version");
+                    }
+                }
+                size_t count = in.size();
+                if (count == 0) {
+                    return 0;
+                }
+
+                KernelSource source{COMPACT_SOURCE, {{"T", ShaderTypeTraits<T>::name}, {"PREDICATE(x)", "(" + predicate + ")"}}};
+                MTL::ComputePipelineState *mark = LibraryCache::getPipeline(this->gpu, source, "compact_flags");
+                MTL::ComputePipelineState *scatter = LibraryCache::getPipeline(this->gpu, source, "compact_scatter");
+                MTL::Buffer *flags = this->reserve(this->flags, count*4);
+                MTL::Buffer *offsets = this->reserve(this->offsets, count*4);
+                MTL::Buffer *target = out != nullptr ? out->getBuffer() : this->reserve(this->staging, count*sizeof(T));
+
+                in.flush();
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+
+                // In place selection leaves the elements after the kept ones alone, so start from a copy
+                if (out == nullptr && !partition) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->copyFromBuffer(in.getBuffer(), 0, target, 0, count*sizeof(T));
+                    blitEncoder->endEncoding();
+                }
+
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                CompactParams params{(uint32_t)count, partition};
+                MTL::Size grid = MTL::Size::Make(count, 1, 1);
+                MTL::Size threadsPerThreadgroup = MTL::Size::Make(mark->maxTotalThreadsPerThreadgroup(), 1, 1);
+
+                commandEncoder->setComputePipelineState(mark);
+                commandEncoder->setBuffer(in.getBuffer(), 0, 0);
+                commandEncoder->setBuffer(flags, 0, 1);
+                commandEncoder->setBytes(&params, sizeof(params), 2);
+                commandEncoder->dispatchThreads(grid, threadsPerThreadgroup);
+
+                this->encodeScan(commandEncoder, "uint", flags, offsets, count, true, 0);
+
+                threadsPerThreadgroup.width = scatter->maxTotalThreadsPerThreadgroup();
+                commandEncoder->setComputePipelineState(scatter);
+                commandEncoder->setBuffer(in.getBuffer(), 0, 0);
+                commandEncoder->setBuffer(offsets, 0, 1);
+                commandEncoder->setBuffer(flags, 0, 2);
+                commandEncoder->setBuffer(target, 0, 3);
+                commandEncoder->setBytes(&params, sizeof(params), 4);
+                commandEncoder->dispatchThreads(grid, threadsPerThreadgroup);
+                commandEncoder->endEncoding();
+
+                // In place, copy the result back over the input
+                if (out == nullptr) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->copyFromBuffer(target, 0, in.getBuffer(), 0, count*sizeof(T));
+                    if (in.getStorageMode() == ResourceStorage::Managed) {
+                        blitEncoder->synchronizeResource(in.getBuffer());
+                    }
+                    blitEncoder->endEncoding();
+                } else {
+                    synchronize(commandBuffer, *out);
+                }
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+
+                return ((uint32_t *)offsets->contents())[count - 1] + ((uint32_t *)flags->contents())[count - 1];
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the Scanner class
+             *
+             * @param gpu The Metal device object
+             *
+            */
+            Scanner(MTL::Device *gpu) {
+                this->gpu = gpu;
+                this->commandQueue = gpu->newCommandQueue();
+            }
+
+            Scanner(const Scanner &) = delete;
+            Scanner & operator=(const Scanner &) = delete;
+
+            /**
+             * @brief Destructor for the Scanner class
+             *
+             * Releases the command queue and the scratch buffers
+             *
+            */
+            ~Scanner() {
+                this->commandQueue->autorelease();
+                for (MTL::Buffer *buffer : this->levels) {
+                    if (buffer != nullptr) {
+                        buffer->autorelease();
+                    }
+                }
+                for (MTL::Buffer *buffer : {this->flags, this->offsets, this->staging}) {
+                    if (buffer != nullptr) {
+                        buffer->autorelease();
+                    }
+                }
+            }
+
+            /**
+             * @brief Add a scan of raw Metal buffers to an encoder
+             *
+             * For GPU algorithms that need a scan in the middle of their own
+             * command buffer. The scan runs after whatever was encoded before it.
+             *
+             * @param encoder The compute command encoder
+             * @param in The elements, count of T
+             * @param out Where to put the scan, can be the same as in
+             * @param count The number of elements
+             * @param exclusive Whether the scan is exclusive
+             *
+            */
+            void encode(MTL::ComputeCommandEncoder *encoder, MTL::Buffer *in, MTL::Buffer *out, size_t count, bool exclusive) {
+                if (count > 0) {
+                    this->encodeScan(encoder, ShaderTypeTraits<T>::name, in, out, count, exclusive, 0);
+                }
+            }
+
+            /**
+             * @brief Replace every element with the sum of it and the ones before it
+             *
+             * @param buffer The buffer to scan in place
+             *
+            */
+            void inclusiveScan(Buffer<T> &buffer) {
+                this->scan(buffer, buffer, false);
+            }
+
+            /**
+             * @brief Write the sum of each element and the ones before it
+             *
+             * @param in The elements
+             * @param out Where to put the sums, at least as long as in
+             *
+            */
+            void inclusiveScan(const Buffer<T> &in, Buffer<T> &out) {
+                this->scan(in, out, false);
+            }
+
+            /**
+             * @brief Replace every element with the sum of the ones before it
+             *
+             * The first element becomes 0
+             *
+             * @param buffer The buffer to scan in place
+             *
+            */
+            void exclusiveScan(Buffer<T> &buffer) {
+                this->scan(buffer, buffer, true);
+            }
+
+            /**
+             * @brief Write the sum of the elements before each element
+             *
+             * @param in The elements
+             * @param out Where to put the sums, at least as long as in
+             *
+            */
+            void exclusiveScan(const Buffer<T> &in, Buffer<T> &out) {
+                this->scan(in, out, true);
+            }
+
+            /**
+             * @brief Move the elements that pass a test to the front, in order
+             *
+             * The elements after the kept ones are left as they were
+             *
+             * @param buffer The buffer to compact in place
+             * @param predicate A Metal expression of x, like "x > 0"
+             *
+             * @return size_t The number of elements kept
+             *
+            */
+            size_t selectIf(Buffer<T> &buffer, const std::string &predicate) {
+                return this->compact(buffer, nullptr, predicate, false);
+            }
+
+            /**
+             * @brief Copy the elements that pass a test, in order
+             *
+             * @param in The elements
+             * @param out Where to put the kept elements, at least as long as in
+             * @param predicate A Metal expression of x, like "x > 0"
+             *
+             * @return size_t The number of elements kept
+             *
+            */
+            size_t selectIf(const Buffer<T> &in, Buffer<T> &out, const std::string &predicate) {
+                return this->compact(in, &out, predicate, false);
+            }
+
+            /**
+             * @brief Put the elements that pass a test before the ones that don't
+             *
+             * Both groups keep their order
+             *
+             * @param buffer The buffer to partition in place
+             * @param predicate A Metal expression of x, like "x > 0"
+             *
+             * @return size_t The number of elements that passed
+             *
+            */
+            size_t partition(Buffer<T> &buffer, const std::string &predicate) {
+                return this->compact(buffer, nullptr, predicate, true);
+            }
+
+            /**
+             * @brief Copy the elements that pass a test and then the ones that don't
+             *
+             * @param in The elements
+             * @param out Where to put the result, at least as long as in
+             * @param predicate A Metal expression of x, like "x > 0"
+             *
+             * @return size_t The number of elements that passed
+             *
+            */
+            size_t partition(const Buffer<T> &in, Buffer<T> &out, const std::string &predicate) {
+                return this->compact(in, &out, predicate, true);
+            }
+
+    };
+
+}
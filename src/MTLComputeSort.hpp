@@ -0,0 +1,590 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeBuffer.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include "MTLComputeScan.hpp"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source for radix sorting
+     *
+     * K is the unsigned type with the same size as the key, and KEY_FLIP says
+     * how to turn a key's bits into ones that sort as unsigned integers:
+     * 0 for unsigned keys, 1 for signed keys and 2 for floats. V is the
+     * unsigned type with the same size as a value, and HAS_VALUES is 1 when
+     * there are values to move with the keys.
+     *
+     * Each pass sorts by 8 bits. radix_count counts the digits of a block in
+     * threadgroup memory, the counts are scanned digit by digit across the
+     * blocks, and radix_scatter ranks each element within its block and
+     * writes it after the earlier blocks' elements with the same digit.
+     * Ranks keep the order of equal digits, so the sort is stable.
+     *
+    */
+    inline constexpr const char *SORT_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+#define RADIX 256
+#define THREADS 256
+#define ITEMS 8
+#define SIGN_BIT (K(1) << (sizeof(K)*8 - 1))
+
+#if KEY_FLIP == 1
+#define ORDERED(k) ((k) ^ SIGN_BIT)
+#elif KEY_FLIP == 2
+#define ORDERED(k) (((k) & SIGN_BIT) ? ~(k) : ((k) | SIGN_BIT))
+#else
+#define ORDERED(k) (k)
+#endif
+
+struct SortParams {
+  uint count;
+  uint shift;
+  uint groups;
+};
+
+inline uint digitOf(K key, uint shift) {
+  return uint((ORDERED(key) >> shift) & K(RADIX - 1));
+}
+
+kernel void radix_count(device const K *keys [[buffer(0)]], device uint *counts [[buffer(1)]],
+                        constant SortParams &params [[buffer(2)]],
+                        uint tid [[thread_index_in_threadgroup]], uint group [[threadgroup_position_in_grid]]) {
+  threadgroup atomic_uint histogram[RADIX];
+  for (uint d = tid; d < RADIX; d += THREADS) {
+    atomic_store_explicit(&histogram[d], 0, memory_order_relaxed);
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+
+  uint base = group*THREADS*ITEMS;
+  for (uint k = 0; k < ITEMS; k++) {
+    uint i = base + k*THREADS + tid;
+    if (i < params.count) {
+      atomic_fetch_add_explicit(&histogram[digitOf(keys[i], params.shift)], 1, memory_order_relaxed);
+    }
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+
+  // Digit major, so scanning the whole array gives each block's offset for each digit
+  for (uint d = tid; d < RADIX; d += THREADS) {
+    counts[d*params.groups + group] = atomic_load_explicit(&histogram[d], memory_order_relaxed);
+  }
+}
+
+kernel void radix_scatter(device const K *keys [[buffer(0)]], device K *keysOut [[buffer(1)]],
+                          device const V *values [[buffer(2)]], device V *valuesOut [[buffer(3)]],
+                          device const uint *offsets [[buffer(4)]], constant SortParams &params [[buffer(5)]],
+                          uint tid [[thread_index_in_threadgroup]], uint group [[threadgroup_position_in_grid]],
+                          uint lane [[thread_index_in_simdgroup]], uint simdgroup [[simdgroup_index_in_threadgroup]]) {
+  threadgroup uint next[RADIX];
+  threadgroup uint starts[(THREADS/32)*RADIX];
+  for (uint d = tid; d < RADIX; d += THREADS) {
+    next[d] = offsets[d*params.groups + group];
+  }
+
+  uint base = group*THREADS*ITEMS;
+  for (uint k = 0; k < ITEMS; k++) {
+    uint i = base + k*THREADS + tid;
+    bool valid = i < params.count;
+    K key = valid ? keys[i] : K(0);
+    uint digit = valid ? digitOf(key, params.shift) : RADIX;
+
+    // The lanes with the same digit, one vote per bit, with the 9th bit for past the end
+    ulong peers = ulong(simd_ballot(true));
+    for (uint b = 0; b < 9; b++) {
+      bool bit = (digit >> b) & 1;
+      ulong vote = ulong(simd_ballot(bit));
+      peers &= bit ? vote : ~vote;
+    }
+    uint rank = uint(popcount(peers & ((ulong(1) << lane) - 1)));
+
+    // The first lane of each digit says how many the SIMD group has
+    for (uint j = tid; j < (THREADS/32)*RADIX; j += THREADS) {
+      starts[j] = 0;
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    if (valid && rank == 0) {
+      starts[simdgroup*RADIX + digit] = uint(popcount(peers));
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    // Turn the counts into where each SIMD group's run of each digit starts
+    for (uint d = tid; d < RADIX; d += THREADS) {
+      uint running = next[d];
+      for (uint s = 0; s < THREADS/32; s++) {
+        uint n = starts[s*RADIX + d];
+        starts[s*RADIX + d] = running;
+        running += n;
+      }
+      next[d] = running;
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (valid) {
+      uint j = starts[simdgroup*RADIX + digit] + rank;
+      keysOut[j] = key;
+#if HAS_VALUES
+      valuesOut[j] = values[i];
+#endif
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+  }
+}
+)";
+
+    /**
+     * @brief How a key type is radix sorted
+     *
+     * Keys are sorted by their bits as an unsigned integer of the same size,
+     * after flipping the sign bit of signed integers and every bit of
+     * negative floats so they come out in numeric order.
+     *
+     * @tparam K The key type
+     *
+    */
+    template<typename K>
+    struct RadixKeyTraits {
+        static constexpr bool supported = false; ///< Whether keys of the type can be radix sorted
+    };
+
+    template<> struct RadixKeyTraits<uint32_t> {
+        static constexpr bool supported = true; ///< Whether keys of the type can be radix sorted
+        using bits_type = uint32_t; ///< The unsigned type the key is sorted as
+        static constexpr const char *name = "uint"; ///< bits_type in Metal
+        static constexpr int flip = 0; ///< KEY_FLIP in SORT_SOURCE
+    };
+
+    template<> struct RadixKeyTraits<int32_t> {
+        static constexpr bool supported = true; ///< Whether keys of the type can be radix sorted
+        using bits_type = uint32_t; ///< The unsigned type the key is sorted as
+        static constexpr const char *name = "uint"; ///< bits_type in Metal
+        static constexpr int flip = 1; ///< KEY_FLIP in SORT_SOURCE
+    };
+
+    template<> struct RadixKeyTraits<float> {
+        static constexpr bool supported = true; ///< Whether keys of the type can be radix sorted
+        using bits_type = uint32_t; ///< The unsigned type the key is sorted as
+        static constexpr const char *name = "uint"; ///< bits_type in Metal
+        static constexpr int flip = 2; ///< KEY_FLIP in SORT_SOURCE
+    };
+
+    template<> struct RadixKeyTraits<uint64_t> {
+        static constexpr bool supported = true; ///< Whether keys of the type can be radix sorted
+        using bits_type = uint64_t; ///< The unsigned type the key is sorted as
+        static constexpr const char *name = "ulong"; ///< bits_type in Metal
+        static constexpr int flip = 0; ///< KEY_FLIP in SORT_SOURCE
+    };
+
+    template<> struct RadixKeyTraits<int64_t> {
+        static constexpr bool supported = true; ///< Whether keys of the type can be radix sorted
+        using bits_type = uint64_t; ///< The unsigned type the key is sorted as
+        static constexpr const char *name = "ulong"; ///< bits_type in Metal
+        static constexpr int flip = 1; ///< KEY_FLIP in SORT_SOURCE
+    };
+
+    template<> struct RadixKeyTraits<double> {
+        static constexpr bool supported = true; ///< Whether keys of the type can be radix sorted
+        using bits_type = uint64_t; ///< The unsigned type the key is sorted as
+        static constexpr const char *name = "ulong"; ///< bits_type in Metal
+        static constexpr int flip = 2; ///< KEY_FLIP in SORT_SOURCE
+    };
+
+    namespace host {
+
+        /**
+         * @brief Get the bits a key is radix sorted by
+         *
+         * @param key The key
+         *
+         * @return RadixKeyTraits<K>::bits_type Bits that sort as unsigned in the same order as the keys
+         *
+        */
+        template<typename K>
+        typename RadixKeyTraits<K>::bits_type radixBits(K key) {
+            using U = typename RadixKeyTraits<K>::bits_type;
+            constexpr U sign = U(1) << (sizeof(U)*8 - 1);
+            U bits;
+            memcpy(&bits, &key, sizeof(K));
+            if constexpr (RadixKeyTraits<K>::flip == 1) {
+                return bits ^ sign;
+            } else if constexpr (RadixKeyTraits<K>::flip == 2) {
+                return (bits & sign) ? U(~bits) : U(bits | sign);
+            } else {
+                return bits;
+            }
+        }
+
+        /**
+         * @brief Stable radix sort of keys and values on every CPU thread
+         *
+         * Sorts 8 bits a pass. Each thread counts the digits in its piece, the
+         * counts give every piece its place for each digit, and each thread
+         * moves its piece. Passes where every key has the same digit are skipped.
+         * Floats sort by their bits: -0 before 0 and NaNs at the ends.
+         *
+         * @param keys The keys, sorted in place
+         * @param values Moved with their keys, or null for keys only
+         * @param count The number of keys
+         *
+        */
+        template<typename K, typename V>
+        void radixSort(K *keys, V *values, size_t count) {
+            static_assert(RadixKeyTraits<K>::supported, "Radix sort keys have to be 32 or 64 bit integers or floats");
+            constexpr size_t RADIX = 256;
+            if (count < 2) {
+                return;
+            }
+            size_t chunks = chunkCount(count, 1 << 16);
+            std::vector<K> keyScratch(count);
+            std::vector<V> valueScratch(values != nullptr ? count : 0);
+            K *src = keys;
+            K *dst = keyScratch.data();
+            V *srcValues = values;
+            V *dstValues = valueScratch.data();
+            std::vector<size_t> counts(chunks*RADIX);
+
+            for (size_t shift = 0; shift < sizeof(K)*8; shift += 8) {
+                parallelChunks(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+                    size_t *piece = &counts[chunk*RADIX];
+                    std::fill(piece, piece + RADIX, 0);
+                    for (size_t i = begin; i < end; i++) {
+                        piece[(radixBits(src[i]) >> shift) & (RADIX - 1)]++;
+                    }
+                });
+
+                // Digit by digit, each piece goes after the earlier pieces
+                size_t running = 0;
+                bool same = false;
+                for (size_t d = 0; d < RADIX && !same; d++) {
+                    size_t start = running;
+                    for (size_t c = 0; c < chunks; c++) {
+                        size_t n = counts[c*RADIX + d];
+                        counts[c*RADIX + d] = running;
+                        running += n;
+                    }
+                    same = running - start == count;
+                }
+                if (same) {
+                    continue;
+                }
+
+                parallelChunks(count, chunks, [&](size_t chunk, size_t begin, size_t end) {
+                    size_t *next = &counts[chunk*RADIX];
+                    for (size_t i = begin; i < end; i++) {
+                        size_t j = next[(radixBits(src[i]) >> shift) & (RADIX - 1)]++;
+                        dst[j] = src[i];
+                        if (values != nullptr) {
+                            dstValues[j] = srcValues[i];
+                        }
+                    }
+                });
+                std::swap(src, dst);
+                std::swap(srcValues, dstValues);
+            }
+
+            if (src != keys) {
+                parallelChunks(count, chunks, [&](size_t, size_t begin, size_t end) {
+                    std::copy(src + begin, src + end, keys + begin);
+                    if (values != nullptr) {
+                        std::copy(srcValues + begin, srcValues + end, values + begin);
+                    }
+                });
+            }
+        }
+
+        /**
+         * @brief Radix sort keys on every CPU thread
+         *
+         * @param keys The keys, sorted in place
+         * @param count The number of keys
+         *
+        */
+        template<typename K>
+        void radixSort(K *keys, size_t count) {
+            radixSort(keys, (K *)nullptr, count);
+        }
+
+    }
+
+    /**
+     * @brief Radix sorts a Buffer of keys, or keys and values, on the GPU
+     *
+     * Keys can be 32 or 64 bit integers, float or double, and values any 4 or
+     * 8 byte type. The sort is stable, and runs in one command buffer with no
+     * copies to the host. Small buffers are sorted with host::radixSort()
+     * instead. Scratch buffers are kept between calls and only grow.
+     *
+     * @tparam K The key type
+     *
+    */
+    template<typename K>
+    class RadixSorter {
+
+        static_assert(RadixKeyTraits<K>::supported, "Radix sort keys have to be 32 or 64 bit integers or floats");
+
+        private:
+            static constexpr size_t RADIX = 256; ///< Digits per pass, the same as RADIX in SORT_SOURCE
+            static constexpr size_t THREADS = 256; ///< Threads per threadgroup, the same as THREADS in SORT_SOURCE
+            static constexpr size_t ITEMS = 8; ///< Keys per thread, the same as ITEMS in SORT_SOURCE
+
+            /**
+             * @brief The uniforms for the sort kernels, the same layout as SortParams
+             *
+            */
+            struct SortParams {
+                uint32_t count; ///< The number of keys
+                uint32_t shift; ///< The lowest bit of this pass's digit
+                uint32_t groups; ///< The number of blocks
+            };
+
+            MTL::Device *gpu; ///< The Metal device object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+            Scanner<uint32_t> scanner; ///< Scans the digit counts
+            MTL::Buffer *keyScratch = nullptr; ///< The keys between passes
+            MTL::Buffer *valueScratch = nullptr; ///< The values between passes
+            MTL::Buffer *counts = nullptr; ///< The digit counts of every block
+            size_t hostThreshold; ///< Buffers with fewer keys are sorted on the CPU
+
+            /**
+             * @brief Make sure a scratch buffer is big enough
+             *
+             * @param buffer The scratch buffer, replaced if it's too small
+             * @param bytes The size it needs
+             *
+             * @return MTL::Buffer* The scratch buffer
+             *
+            */
+            MTL::Buffer *reserve(MTL::Buffer *&buffer, size_t bytes) {
+                if (buffer == nullptr || buffer->length() < bytes) {
+                    if (buffer != nullptr) {
+                        buffer->release();
+                    }
+                    buffer = this->gpu->newBuffer(std::max<size_t>(bytes, 16), MTL::ResourceStorageModePrivate);
+                }
+                return buffer;
+            }
+
+            /**
+             * @brief Get the elements of a buffer for sorting on the CPU
+             *
+             * @param buffer The buffer
+             *
+             * @return U* The elements
+             *
+            */
+            template<typename U>
+            static U *hostData(Buffer<U> &buffer) {
+                if (buffer.getStorageMode() == ResourceStorage::Private) {
+                    throw std::invalid_argument("Private buffers of this type can't be sorted");
+                }
+                return buffer.contents();
+            }
+
+            /**
+             * @brief Copy what the GPU wrote back to the host copy of a Managed buffer
+             *
+             * @param commandBuffer The command buffer
+             * @param buffer The buffer that was written
+             *
+            */
+            template<typename U>
+            static void synchronize(MTL::CommandBuffer *commandBuffer, const Buffer<U> &buffer) {
+                if (buffer.getStorageMode() == ResourceStorage::Managed) {
+                    MTL::BlitCommandEncoder *blitEncoder = commandBuffer->blitCommandEncoder();
+                    blitEncoder->synchronizeResource(buffer.getBuffer());
+                    blitEncoder->endEncoding();
+                }
+            }
+
+            /**
+             * @brief Sort on the GPU and wait for it
+             *
+             * @param keys The keys
+             * @param values The values, or null for keys only
+             *
+            */
+            template<typename V>
+            void run(Buffer<K> &keys, Buffer<V> *values) {
+                size_t count = keys.size();
+                if (count > 0xffffffff) {
+                    throw std::invalid_argument("Buffer too large to sort, max is 2^32 - 1 elements");
+                }
+
+                KernelSource source{SORT_SOURCE, {{"K", RadixKeyTraits<K>::name},
+                                                  {"V", sizeof(V) == 8 ? "ulong" : "uint"},
+                                                  {"KEY_FLIP", std::to_string(RadixKeyTraits<K>::flip)},
+                                                  {"HAS_VALUES", values != nullptr ? "1" : "0"}}};
+                MTL::ComputePipelineState *countPipeline = LibraryCache::getPipeline(this->gpu, source, "radix_count");
+                MTL::ComputePipelineState *scatterPipeline = LibraryCache::getPipeline(this->gpu, source, "radix_scatter");
+                // The scatter's ranks are built from 32 lane ballots
+                if (scatterPipeline->threadExecutionWidth() != 32 || countPipeline->maxTotalThreadsPerThreadgroup() < THREADS ||
+                    scatterPipeline->maxTotalThreadsPerThreadgroup() < THREADS) {
+                    throw std::runtime_error("Radix sort needs 32 wide SIMD groups and 256 thread threadgroups");
+                }
+
+                size_t groups = (count + THREADS*ITEMS - 1)/(THREADS*ITEMS);
+                MTL::Buffer *counts = this->reserve(this->counts, RADIX*groups*4);
+                MTL::Buffer *keyScratch = this->reserve(this->keyScratch, count*sizeof(K));
+                MTL::Buffer *valueScratch = values != nullptr ? this->reserve(this->valueScratch, count*sizeof(V)) : keyScratch;
+
+                keys.flush();
+                if (values != nullptr) {
+                    values->flush();
+                }
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+
+                // Every pass goes back and forth between the buffer and the scratch,
+                // and there's an even number of them, so the result ends up in the buffer
+                MTL::Buffer *src = keys.getBuffer();
+                MTL::Buffer *dst = keyScratch;
+                MTL::Buffer *srcValues = values != nullptr ? values->getBuffer() : src;
+                MTL::Buffer *dstValues = valueScratch;
+                for (size_t shift = 0; shift < sizeof(K)*8; shift += 8) {
+                    SortParams params{(uint32_t)count, (uint32_t)shift, (uint32_t)groups};
+
+                    commandEncoder->setComputePipelineState(countPipeline);
+                    commandEncoder->setBuffer(src, 0, 0);
+                    commandEncoder->setBuffer(counts, 0, 1);
+                    commandEncoder->setBytes(&params, sizeof(params), 2);
+                    commandEncoder->dispatchThreadgroups(MTL::Size::Make(groups, 1, 1), MTL::Size::Make(THREADS, 1, 1));
+
+                    this->scanner.encode(commandEncoder, counts, counts, RADIX*groups, true);
+
+                    commandEncoder->setComputePipelineState(scatterPipeline);
+                    commandEncoder->setBuffer(src, 0, 0);
+                    commandEncoder->setBuffer(dst, 0, 1);
+                    commandEncoder->setBuffer(srcValues, 0, 2);
+                    commandEncoder->setBuffer(dstValues, 0, 3);
+                    commandEncoder->setBuffer(counts, 0, 4);
+                    commandEncoder->setBytes(&params, sizeof(params), 5);
+                    commandEncoder->dispatchThreadgroups(MTL::Size::Make(groups, 1, 1), MTL::Size::Make(THREADS, 1, 1));
+
+                    std::swap(src, dst);
+                    std::swap(srcValues, dstValues);
+                }
+                commandEncoder->endEncoding();
+
+                synchronize(commandBuffer, keys);
+                if (values != nullptr) {
+                    synchronize(commandBuffer, *values);
+                }
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the RadixSorter class
+             *
+             * @param gpu The Metal device object
+             * @param hostThreshold Buffers with fewer keys are sorted on the CPU
+             *
+            */
+            RadixSorter(MTL::Device *gpu, size_t hostThreshold = 1 << 16) : scanner(gpu) {
+                this->gpu = gpu;
+                this->hostThreshold = hostThreshold;
+                this->commandQueue = gpu->newCommandQueue();
+            }
+
+            RadixSorter(const RadixSorter &) = delete;
+            RadixSorter & operator=(const RadixSorter &) = delete;
+
+            /**
+             * @brief Destructor for the RadixSorter class
+             *
+             * Releases the command queue and the scratch buffers
+             *
+            */
+            ~RadixSorter() {
+                this->commandQueue->autorelease();
+                for (MTL::Buffer *buffer : {this->keyScratch, this->valueScratch, this->counts}) {
+                    if (buffer != nullptr) {
+                        buffer->autorelease();
+                    }
+                }
+            }
+
+            /**
+             * @brief Sort a buffer of keys in place
+             *
+             * @param keys The keys
+             *
+            */
+            void sort(Buffer<K> &keys) {
+                if (keys.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (keys.size() < 2) {
+                    return;
+                }
+                if (keys.getStorageMode() != ResourceStorage::Private && keys.size() < this->hostThreshold) {
+                    host::radixSort(hostData(keys), keys.size());
+                    return;
+                }
+                this->run<uint32_t>(keys, nullptr);
+            }
+
+            /**
+             * @brief Sort keys in place and move each value with its key
+             *
+             * Values that aren't 4 or 8 bytes are sorted on the CPU
+             *
+             * @param keys The keys
+             * @param values The values, the same length as keys
+             *
+            */
+            template<typename V>
+            void sort(Buffer<K> &keys, Buffer<V> &values) {
+                if (keys.getFreed() || values.getFreed()) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (keys.size() != values.size()) {
+                    throw std::invalid_argument("Keys and values have different lengths");
+                }
+                if (keys.size() < 2) {
+                    return;
+                }
+                if constexpr (sizeof(V) == 4 || sizeof(V) == 8) {
+                    if (keys.getStorageMode() == ResourceStorage::Private || values.getStorageMode() == ResourceStorage::Private ||
+                        keys.size() >= this->hostThreshold) {
+                        this->run(keys, &values);
+                        return;
+                    }
+                }
+                host::radixSort(hostData(keys), hostData(values), keys.size());
+            }
+
+            /**
+             * @brief Set the size below which buffers are sorted on the CPU
+             *
+             * @param hostThreshold The number of keys, 0 to always use the GPU
+             *
+            */
+            void setHostThreshold(size_t hostThreshold) {
+                this->hostThreshold = hostThreshold;
+            }
+
+            /**
+             * @brief Get the size below which buffers are sorted on the CPU
+             *
+             * @return size_t The number of keys
+             *
+            */
+            size_t getHostThreshold() const {
+                return this->hostThreshold;
+            }
+
+    };
+
+}
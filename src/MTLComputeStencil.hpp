@@ -0,0 +1,606 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeLibraryCache.hpp"
+#include "MTLComputeTexture.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Metal source for stencils
+     *
+     * Generated per stencil: RX and RY are the radii, WEIGHTS is the
+     * (2*RX + 1)*(2*RY + 1) weights in row order, and BORDER is 0 for clamp,
+     * 1 for mirror and 2 for zero. IN_C and OUT_C are the texture channel
+     * types, N is the number of channels, and INTEGER_OUT with OUT_MIN and
+     * OUT_MAX round and clamp the result for integer textures.
+     *
+     * Each 16x16 threadgroup loads its tile plus a halo of RX and RY pixels
+     * into threadgroup memory once, with the border already applied, and
+     * every thread then reads its neighbours from there.
+     *
+    */
+    inline constexpr const char *STENCIL_SOURCE = R"(
+#include <metal_stdlib>
+using namespace metal;
+
+#define TILE 16
+#define SHARED_W (TILE + 2*RX)
+#define SHARED_H (TILE + 2*RY)
+
+#if N == 1
+typedef float V;
+#define CHANNELS x
+#elif N == 2
+typedef float2 V;
+#define CHANNELS xy
+#else
+typedef float4 V;
+#define CHANNELS xyzw
+#endif
+
+#if INTEGER_OUT
+#define CONVERT(v) clamp(rint(v), V(OUT_MIN), V(OUT_MAX))
+#else
+#define CONVERT(v) (v)
+#endif
+
+constant float weights[(2*RX + 1)*(2*RY + 1)] = {WEIGHTS};
+
+inline float4 pad(float v) { return float4(v, 0, 0, 0); }
+inline float4 pad(float2 v) { return float4(v, 0, 0); }
+inline float4 pad(float4 v) { return v; }
+
+// Where to read for a pixel past the edge, -1 for zero
+inline int borderIndex(int i, int size) {
+#if BORDER == 0
+  return clamp(i, 0, size - 1);
+#elif BORDER == 1
+  if (size == 1) {
+    return 0;
+  }
+  int period = 2*(size - 1);
+  i = abs(i) % period;
+  return i < size ? i : period - i;
+#else
+  return i >= 0 && i < size ? i : -1;
+#endif
+}
+
+kernel void stencil(texture2d<IN_C, access::read> in [[texture(0)]], texture2d<OUT_C, access::write> out [[texture(1)]],
+                    uint2 gid [[thread_position_in_grid]], uint2 lid [[thread_position_in_threadgroup]],
+                    uint2 group [[threadgroup_position_in_grid]]) {
+  threadgroup V tile[SHARED_W*SHARED_H];
+  int width = in.get_width();
+  int height = in.get_height();
+  int2 origin = int2(group*TILE) - int2(RX, RY);
+  for (uint j = lid.y*TILE + lid.x; j < SHARED_W*SHARED_H; j += TILE*TILE) {
+    int x = borderIndex(origin.x + int(j % SHARED_W), width);
+    int y = borderIndex(origin.y + int(j / SHARED_W), height);
+    tile[j] = x < 0 || y < 0 ? V(0) : V(float4(in.read(uint2(x, y))).CHANNELS);
+  }
+  threadgroup_barrier(mem_flags::mem_threadgroup);
+  if (gid.x >= uint(width) || gid.y >= uint(height)) {
+    return;
+  }
+
+  V sum = V(0);
+  for (uint dy = 0; dy <= 2*RY; dy++) {
+    for (uint dx = 0; dx <= 2*RX; dx++) {
+      sum += weights[dy*(2*RX + 1) + dx]*tile[(lid.y + dy)*SHARED_W + lid.x + dx];
+    }
+  }
+  out.write(vec<OUT_C, 4>(pad(CONVERT(sum))), gid);
+}
+)";
+
+    /**
+     * @brief What a stencil reads past the edge of an image
+     *
+    */
+    enum class BorderMode {
+        Clamp, ///< The nearest edge pixel
+        Mirror, ///< The image reflected about its edge pixel, so -1 reads 1
+        Zero ///< Zero
+    };
+
+    /**
+     * @brief Make normalized gaussian weights for a separable blur
+     *
+     * @param radius The number of pixels on each side
+     * @param sigma The standard deviation in pixels
+     *
+     * @return std::vector<float> 2*radius + 1 weights that add up to 1
+     *
+    */
+    inline std::vector<float> gaussianWeights(int radius, float sigma) {
+        if (radius < 0 || !(sigma > 0)) {
+            throw std::invalid_argument("Gaussian radius and sigma have to be positive");
+        }
+        std::vector<float> weights(2*radius + 1);
+        double total = 0;
+        for (int i = -radius; i <= radius; i++) {
+            total += std::exp(-0.5*i*i/((double)sigma*sigma));
+        }
+        for (int i = -radius; i <= radius; i++) {
+            weights[i + radius] = (float)(std::exp(-0.5*i*i/((double)sigma*sigma))/total);
+        }
+        return weights;
+    }
+
+    /**
+     * @brief Make weights for a separable box blur
+     *
+     * @param radius The number of pixels on each side
+     *
+     * @return std::vector<float> 2*radius + 1 equal weights that add up to 1
+     *
+    */
+    inline std::vector<float> boxWeights(int radius) {
+        if (radius < 0) {
+            throw std::invalid_argument("Box radius can't be negative");
+        }
+        return std::vector<float>(2*radius + 1, 1.0f/(2*radius + 1));
+    }
+
+    namespace host {
+
+        /**
+         * @brief Find the pixel a stencil reads for a coordinate
+         *
+         * The same as borderIndex in STENCIL_SOURCE
+         *
+         * @param i The coordinate, can be past either edge
+         * @param size The width or height of the image
+         * @param border What to read past the edge
+         *
+         * @return int The coordinate to read, or -1 for zero
+         *
+        */
+        inline int borderIndex(int i, int size, BorderMode border) {
+            switch (border) {
+                case BorderMode::Clamp:
+                    return std::clamp(i, 0, size - 1);
+                case BorderMode::Mirror: {
+                    if (size == 1) {
+                        return 0;
+                    }
+                    int period = 2*(size - 1);
+                    i = std::abs(i) % period;
+                    return i < size ? i : period - i;
+                }
+                default:
+                    return i >= 0 && i < size ? i : -1;
+            }
+        }
+
+        /**
+         * @brief Run one stencil over float channels on every CPU thread
+         *
+         * Adds up the weights in the same order as the kernel
+         *
+         * @param in The image, width*height pixels of channels floats
+         * @param out Where to put the result, not the same as in
+         * @param width The width of the image
+         * @param height The height of the image
+         * @param channels The floats per pixel
+         * @param rx The horizontal radius
+         * @param ry The vertical radius
+         * @param weights The (2*rx + 1)*(2*ry + 1) weights in row order
+         * @param border What to read past the edge
+         *
+        */
+        inline void stencilPass(const float *in, float *out, int width, int height, int channels, int rx, int ry,
+                                const float *weights, BorderMode border) {
+            parallelChunks(height, chunkCount(height, 16), [&](size_t, size_t begin, size_t end) {
+                std::vector<float> sum(channels);
+                for (int y = (int)begin; y < (int)end; y++) {
+                    for (int x = 0; x < width; x++) {
+                        std::fill(sum.begin(), sum.end(), 0.0f);
+                        for (int dy = 0; dy <= 2*ry; dy++) {
+                            int sy = borderIndex(y + dy - ry, height, border);
+                            for (int dx = 0; dx <= 2*rx; dx++) {
+                                int sx = borderIndex(x + dx - rx, width, border);
+                                float w = weights[dy*(2*rx + 1) + dx];
+                                for (int c = 0; c < channels; c++) {
+                                    float value = sx < 0 || sy < 0 ? 0.0f : in[((size_t)sy*width + sx)*channels + c];
+                                    sum[c] += w*value;
+                                }
+                            }
+                        }
+                        std::copy(sum.begin(), sum.end(), out + ((size_t)y*width + x)*channels);
+                    }
+                }
+            });
+        }
+
+        /**
+         * @brief Convert pixels to float channels
+         *
+         * @param in The pixels
+         * @param count The number of pixels
+         *
+         * @return std::vector<float> count*channels floats
+         *
+        */
+        template<typename T>
+        std::vector<float> pixelsToFloats(const T *in, size_t count) {
+            using C = typename PixelFormatTraits<T>::channel_type;
+            constexpr int N = PixelFormatTraits<T>::channels;
+            std::vector<float> floats(count*N);
+            for (size_t i = 0; i < count; i++) {
+                C channels[N];
+                memcpy(channels, &in[i], sizeof(T));
+                for (int c = 0; c < N; c++) {
+                    floats[i*N + c] = float(channels[c]);
+                }
+            }
+            return floats;
+        }
+
+        /**
+         * @brief Convert float channels back to pixels
+         *
+         * Integer channels are rounded to nearest even and clamped to the
+         * channel's range like the kernel does
+         *
+         * @param in The floats, count*channels of them
+         * @param out Where to put the pixels
+         * @param count The number of pixels
+         *
+        */
+        template<typename T>
+        void floatsToPixels(const float *in, T *out, size_t count) {
+            using C = typename PixelFormatTraits<T>::channel_type;
+            constexpr int N = PixelFormatTraits<T>::channels;
+            for (size_t i = 0; i < count; i++) {
+                C channels[N];
+                for (int c = 0; c < N; c++) {
+                    if constexpr (std::is_integral_v<C>) {
+                        double value = std::nearbyint(in[i*N + c]);
+                        channels[c] = (C)std::clamp(value, (double)std::numeric_limits<C>::min(), (double)std::numeric_limits<C>::max());
+                    } else {
+                        channels[c] = C(in[i*N + c]);
+                    }
+                }
+                memcpy(&out[i], channels, sizeof(T));
+            }
+        }
+
+        /**
+         * @brief Convolve an image with a square stencil on the CPU
+         *
+         * @param in The image, width*height pixels in row order
+         * @param out Where to put the result, can be the same as in
+         * @param width The width of the image
+         * @param height The height of the image
+         * @param radius The number of pixels on each side
+         * @param weights The (2*radius + 1)^2 weights in row order
+         * @param border What to read past the edge
+         *
+        */
+        template<typename T>
+        void convolve(const T *in, T *out, int width, int height, int radius, const std::vector<float> &weights,
+                      BorderMode border = BorderMode::Clamp) {
+            if (radius < 0 || weights.size() != (size_t)(2*radius + 1)*(2*radius + 1)) {
+                throw std::invalid_argument("A stencil needs (2*radius + 1)^2 weights");
+            }
+            size_t count = (size_t)width*height;
+            std::vector<float> src = pixelsToFloats(in, count);
+            std::vector<float> dst(src.size());
+            stencilPass(src.data(), dst.data(), width, height, PixelFormatTraits<T>::channels, radius, radius, weights.data(), border);
+            floatsToPixels(dst.data(), out, count);
+        }
+
+        /**
+         * @brief Convolve an image with a row and then a column of weights on the CPU
+         *
+         * The row pass is kept in float, and the result is only rounded once
+         *
+         * @param in The image, width*height pixels in row order
+         * @param out Where to put the result, can be the same as in
+         * @param width The width of the image
+         * @param height The height of the image
+         * @param rowWeights The horizontal weights, an odd number of them
+         * @param columnWeights The vertical weights, an odd number of them
+         * @param border What to read past the edge
+         *
+        */
+        template<typename T>
+        void convolveSeparable(const T *in, T *out, int width, int height, const std::vector<float> &rowWeights,
+                               const std::vector<float> &columnWeights, BorderMode border = BorderMode::Clamp) {
+            if (rowWeights.size() % 2 == 0 || columnWeights.size() % 2 == 0) {
+                throw std::invalid_argument("A separable stencil needs an odd number of weights in each direction");
+            }
+            constexpr int N = PixelFormatTraits<T>::channels;
+            size_t count = (size_t)width*height;
+            std::vector<float> src = pixelsToFloats(in, count);
+            std::vector<float> rows(src.size());
+            stencilPass(src.data(), rows.data(), width, height, N, (int)rowWeights.size()/2, 0, rowWeights.data(), border);
+            stencilPass(rows.data(), src.data(), width, height, N, 0, (int)columnWeights.size()/2, columnWeights.data(), border);
+            floatsToPixels(src.data(), out, count);
+        }
+
+    }
+
+    /**
+     * @brief Convolves a Texture with a stencil on the GPU
+     *
+     * A kernel is generated for each stencil with its weights built in and
+     * compiled once. Separable stencils run as a row pass into a float texture
+     * and a column pass out of it, so a radius r blur reads 4r + 2 pixels
+     * instead of (2r + 1)^2. Integer results are rounded to nearest even and
+     * clamped to the channel's range, only after the last pass.
+     *
+     * @tparam T The pixel type
+     *
+    */
+    template<typename T>
+    class Stencil {
+
+        static_assert(PixelFormatTraits<T>::supported, "Texture type not supported");
+
+        private:
+            using C = typename PixelFormatTraits<T>::channel_type; ///< The type of one channel
+            static constexpr int N = PixelFormatTraits<T>::channels; ///< The number of channels
+            using Intermediate = std::conditional_t<N == 1, float, std::array<float, N>>; ///< The pixel type between separable passes
+            static constexpr int TILE = 16; ///< The threadgroup width and height, the same as TILE in STENCIL_SOURCE
+
+            MTL::Device *gpu; ///< The Metal device object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+            BorderMode border; ///< What to read past the edge
+            bool separable; ///< Whether there's a row pass and a column pass
+            int radius = 0; ///< The radius of a square stencil
+            std::vector<float> weights; ///< The square weights, or the row weights for a separable stencil
+            std::vector<float> columnWeights; ///< The column weights for a separable stencil
+            std::optional<Texture<Intermediate>> intermediate; ///< The row pass result, kept while the size doesn't change
+
+            /**
+             * @brief Get the Metal channel type of a texture
+             *
+             * @return const char* float, int or uint
+             *
+            */
+            template<typename U>
+            static const char *channelType() {
+                if constexpr (std::is_integral_v<U>) {
+                    return std::is_signed_v<U> ? "int" : "uint";
+                } else {
+                    return "float";
+                }
+            }
+
+            /**
+             * @brief Write a float as a Metal literal that reads back exactly
+             *
+             * @param value The value
+             *
+             * @return std::string The literal
+             *
+            */
+            static std::string literal(double value) {
+                std::ostringstream stream;
+                stream.precision(std::numeric_limits<float>::max_digits10);
+                stream << value;
+                std::string text = stream.str();
+                if (text.find_first_of(".e") == std::string::npos) {
+                    text += ".0";
+                }
+                return text + "f";
+            }
+
+            /**
+             * @brief Check the weights and radius of a pass
+             *
+             * @param rx The horizontal radius
+             * @param ry The vertical radius
+             * @param weights The weights
+             *
+            */
+            void check(int rx, int ry, const std::vector<float> &weights) const {
+                for (float w : weights) {
+                    if (!std::isfinite(w)) {
+                        throw std::invalid_argument("Stencil weights have to be finite");
+                    }
+                }
+                size_t bytes = (size_t)(TILE + 2*rx)*(TILE + 2*ry)*sizeof(float)*(N == 1 ? 1 : N);
+                if (bytes > this->gpu->maxThreadgroupMemoryLength()) {
+                    throw std::invalid_argument("Stencil radius too large for threadgroup memory");
+                }
+            }
+
+            /**
+             * @brief Get the kernel for one pass
+             *
+             * @param rx The horizontal radius
+             * @param ry The vertical radius
+             * @param weights The weights
+             * @param inType The Metal channel type of the input
+             * @param outType The Metal channel type of the output
+             * @param integerOut Whether to round and clamp the result
+             *
+             * @return MTL::ComputePipelineState* The pipeline
+             *
+            */
+            MTL::ComputePipelineState *pipeline(int rx, int ry, const std::vector<float> &weights, const char *inType,
+                                                const char *outType, bool integerOut) const {
+                std::string list;
+                for (float w : weights) {
+                    list += (list.empty() ? "" : ", ") + literal(w);
+                }
+                KernelSource source{STENCIL_SOURCE, {{"RX", std::to_string(rx)}, {"RY", std::to_string(ry)}, {"WEIGHTS", list},
+                                                     {"BORDER", std::to_string((int)this->border)}, {"IN_C", inType},
+                                                     {"OUT_C", outType}, {"N", std::to_string(N)},
+                                                     {"INTEGER_OUT", integerOut ? "1" : "0"}}};
+                if (integerOut) {
+                    source.macros["OUT_MIN"] = literal((double)std::numeric_limits<C>::min());
+                    source.macros["OUT_MAX"] = literal((double)std::numeric_limits<C>::max());
+                }
+                return LibraryCache::getPipeline(this->gpu, source, "stencil");
+            }
+
+            /**
+             * @brief Add one pass to an encoder
+             *
+             * @param encoder The compute command encoder
+             * @param pipeline The pass's kernel
+             * @param in The texture to read
+             * @param out The texture to write
+             * @param width The width of both
+             * @param height The height of both
+             *
+            */
+            static void encode(MTL::ComputeCommandEncoder *encoder, MTL::ComputePipelineState *pipeline, MTL::Texture *in,
+                               MTL::Texture *out, int width, int height) {
+                encoder->setComputePipelineState(pipeline);
+                encoder->setTexture(in, 0);
+                encoder->setTexture(out, 1);
+                encoder->dispatchThreadgroups(MTL::Size::Make((width + TILE - 1)/TILE, (height + TILE - 1)/TILE, 1),
+                                              MTL::Size::Make(TILE, TILE, 1));
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for a square stencil
+             *
+             * @param gpu The Metal device object
+             * @param radius The number of pixels on each side
+             * @param weights The (2*radius + 1)^2 weights in row order
+             * @param border What to read past the edge
+             *
+            */
+            Stencil(MTL::Device *gpu, int radius, const std::vector<float> &weights, BorderMode border = BorderMode::Clamp) {
+                if (radius < 0 || weights.size() != (size_t)(2*radius + 1)*(2*radius + 1)) {
+                    throw std::invalid_argument("A stencil needs (2*radius + 1)^2 weights");
+                }
+                this->gpu = gpu;
+                this->border = border;
+                this->separable = false;
+                this->radius = radius;
+                this->weights = weights;
+                this->check(radius, radius, weights);
+                this->commandQueue = gpu->newCommandQueue();
+            }
+
+            /**
+             * @brief Constructor for a separable stencil
+             *
+             * Convolves with the outer product of the column and row weights
+             *
+             * @param gpu The Metal device object
+             * @param rowWeights The horizontal weights, an odd number of them
+             * @param columnWeights The vertical weights, an odd number of them
+             * @param border What to read past the edge
+             *
+            */
+            Stencil(MTL::Device *gpu, const std::vector<float> &rowWeights, const std::vector<float> &columnWeights,
+                    BorderMode border = BorderMode::Clamp) {
+                if (rowWeights.size() % 2 == 0 || columnWeights.size() % 2 == 0) {
+                    throw std::invalid_argument("A separable stencil needs an odd number of weights in each direction");
+                }
+                this->gpu = gpu;
+                this->border = border;
+                this->separable = true;
+                this->weights = rowWeights;
+                this->columnWeights = columnWeights;
+                this->check((int)rowWeights.size()/2, 0, rowWeights);
+                this->check(0, (int)columnWeights.size()/2, columnWeights);
+                this->commandQueue = gpu->newCommandQueue();
+            }
+
+            Stencil(const Stencil &) = delete;
+            Stencil & operator=(const Stencil &) = delete;
+
+            /**
+             * @brief Destructor for the Stencil class
+             *
+             * Releases the command queue
+             *
+            */
+            ~Stencil() {
+                this->commandQueue->autorelease();
+            }
+
+            /**
+             * @brief Convolve a texture and wait for it
+             *
+             * @param in The texture to read
+             * @param out Where to put the result, the same size and not the same texture
+             *
+            */
+            void apply(const Texture<T> &in, Texture<T> &out) {
+                if (in.getFreed() || out.getFreed()) {
+                    throw std::runtime_error("Texture already freed");
+                }
+                if (in.getWidth() != out.getWidth() || in.getHeight() != out.getHeight()) {
+                    throw std::invalid_argument("Stencil input and output are different sizes");
+                }
+                if (in.getTexture() == out.getTexture()) {
+                    throw std::invalid_argument("A stencil can't write to its input");
+                }
+                int width = in.getWidth();
+                int height = in.getHeight();
+                if (width <= 0 || height <= 0) {
+                    return;
+                }
+
+                const char *type = channelType<C>();
+                bool integer = std::is_integral_v<C>;
+                MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                if (this->separable) {
+                    // Made in place, a temporary's destructor would release the texture the copy still points to
+                    if (!this->intermediate || this->intermediate->getWidth() != width || this->intermediate->getHeight() != height) {
+                        this->intermediate.emplace(this->gpu, width, height);
+                    }
+                    int rx = (int)this->weights.size()/2;
+                    int ry = (int)this->columnWeights.size()/2;
+                    // Dispatches in one encoder run in order, so the column pass sees the whole row pass
+                    encode(commandEncoder, this->pipeline(rx, 0, this->weights, type, "float", false),
+                           in.getTexture(), this->intermediate->getTexture(), width, height);
+                    encode(commandEncoder, this->pipeline(0, ry, this->columnWeights, "float", type, integer),
+                           this->intermediate->getTexture(), out.getTexture(), width, height);
+                } else {
+                    encode(commandEncoder, this->pipeline(this->radius, this->radius, this->weights, type, type, integer),
+                           in.getTexture(), out.getTexture(), width, height);
+                }
+                commandEncoder->endEncoding();
+                commandBuffer->commit();
+                commandBuffer->waitUntilCompleted();
+                commandEncoder->release();
+                commandBuffer->release();
+            }
+
+            /**
+             * @brief Get what the stencil reads past the edge
+             *
+             * @return BorderMode The border mode
+             *
+            */
+            BorderMode getBorder() const {
+                return this->border;
+            }
+
+            /**
+             * @brief Get whether the stencil runs as a row pass and a column pass
+             *
+             * @return bool True for separable stencils
+             *
+            */
+            bool getSeparable() const {
+                return this->separable;
+            }
+
+    };
+
+}
@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <span>
+#include <utility>
 #include <vector>
 #include "MTLComputeGlobals.hpp"
+#include "MTLComputeBuffer.hpp"
 
 #pragma once
 
@@ -14,6 +19,11 @@ namespace MTLCompute {
             MTL::TextureDescriptor *descriptor; ///< The Metal texture descriptor object
             int width = -1; ///< The width and height of the texture
             int height = -1; ///< The width and height of the texture
+            int depth = 1; ///< The depth of a 3D texture
+            int arrayLength = 1; ///< The number of slices in a texture array
+            int levels = 1; ///< The number of mipmap levels
+            MTL::TextureType type = MTL::TextureType2D; ///< The kind of texture
+            size_t pitch = 0; ///< The elements per row when the texture is made from a buffer, 0 otherwise
             bool freed = false; ///< Whether the texture has been freed
 
             /**
@@ -26,8 +36,14 @@ namespace MTLCompute {
                 using std::swap;
                 swap(this->gpu, tex.gpu);
                 swap(this->texture, tex.texture);
+                swap(this->descriptor, tex.descriptor);
                 swap(this->width, tex.width);
                 swap(this->height, tex.height);
+                swap(this->depth, tex.depth);
+                swap(this->arrayLength, tex.arrayLength);
+                swap(this->levels, tex.levels);
+                swap(this->type, tex.type);
+                swap(this->pitch, tex.pitch);
                 swap(this->freed, tex.freed);
             }
 
@@ -66,6 +82,107 @@ namespace MTLCompute {
                 }
                 return result;
             }
+
+            /**
+             * @brief Check that a region is inside the texture
+             *
+             * Skipped when MTLCOMPUTE_UNCHECKED_ACCESS is defined
+             *
+             * @param x The x coordinate of the region
+             * @param y The y coordinate of the region
+             * @param w The width of the region
+             * @param h The height of the region
+             *
+            */
+            void checkRegion(int x, int y, int w, int h) const {
+                if constexpr (!CHECKED_ACCESS) {
+                    return;
+                }
+                if (this->freed) {
+                    throw std::runtime_error("Texture already freed");
+                }
+                if (this->width == -1 || this->height == -1) {
+                    throw std::runtime_error("Texture not initialized");
+                }
+                if (x < 0 || y < 0 || w < 0 || h < 0 || x + w > this->width || y + h > this->height) {
+                    throw std::out_of_range("Region out of bounds");
+                }
+            }
+
+            /**
+             * @brief Check that a range of slices is inside the texture
+             *
+             * Skipped when MTLCOMPUTE_UNCHECKED_ACCESS is defined
+             *
+             * @param first The first slice
+             * @param count The number of slices
+             *
+            */
+            void checkSlices(int first, int count) const {
+                if constexpr (!CHECKED_ACCESS) {
+                    return;
+                }
+                if (this->freed) {
+                    throw std::runtime_error("Texture already freed");
+                }
+                if (this->width == -1 || this->height == -1) {
+                    throw std::runtime_error("Texture not initialized");
+                }
+                if (first < 0 || count < 0 || first + count > this->getSlices()) {
+                    throw std::out_of_range("Slices out of bounds");
+                }
+            }
+
+        protected:
+
+            /**
+             * @brief Constructor for any kind of texture
+             *
+             * Used by Texture1D, Texture3D, Texture2DArray and MipmappedTexture. The pixel
+             * format is inferred from the template type.
+             *
+             * @param gpu The Metal device object
+             * @param type The kind of texture
+             * @param width The width of the texture
+             * @param height The height of the texture
+             * @param depth The depth of the texture (3D only)
+             * @param arrayLength The number of slices (arrays only)
+             * @param levels The number of mipmap levels
+             *
+            */
+            Texture(MTL::Device *gpu, MTL::TextureType type, int width, int height, int depth, int arrayLength, int levels = 1) {
+                static_assert(PixelFormatTraits<T>::supported, "Texture type not supported");
+                this->gpu = gpu;
+                if (type == MTL::TextureType3D) {
+                    if (width > MAX_TEXTURE_3D_SIZE || height > MAX_TEXTURE_3D_SIZE || depth > MAX_TEXTURE_3D_SIZE) {
+                        throw std::invalid_argument("Texture size too large, max 3D size is 2048");
+                    }
+                } else if (width > MAX_TEXTURE_SIZE || height > MAX_TEXTURE_SIZE) {
+                    throw std::invalid_argument("Texture size too large, max size is 16384");
+                }
+                if (arrayLength > MAX_TEXTURE_ARRAY_LENGTH) {
+                    throw std::invalid_argument("Texture array too long, max length is 2048");
+                }
+                this->width = width;
+                this->height = height;
+                this->depth = depth;
+                this->arrayLength = arrayLength;
+                this->levels = levels;
+                this->type = type;
+                this->descriptor = MTL::TextureDescriptor::alloc()->init();
+                this->descriptor->setTextureType(type);
+                this->descriptor->setPixelFormat(PixelFormatTraits<T>::format);
+                this->descriptor->setWidth(width);
+                this->descriptor->setHeight(height);
+                this->descriptor->setDepth(depth);
+                this->descriptor->setArrayLength(arrayLength);
+                this->descriptor->setMipmapLevelCount(levels);
+                if (levels > 1) {
+                    // Kernels write the smaller levels of integer pyramids
+                    this->descriptor->setUsage(MTL::TextureUsageShaderRead | MTL::TextureUsageShaderWrite);
+                }
+                this->texture = this->gpu->newTexture(this->descriptor);
+            }
             
         public:
 
@@ -90,9 +207,10 @@ namespace MTLCompute {
                 this->descriptor = MTL::TextureDescriptor::alloc()->init();
                 this->descriptor->setTextureType(MTL::TextureType2D);
                 this->descriptor->setPixelFormat(static_cast<MTL::PixelFormat>(tt));
-                if (sizeof(T) != TextureTypeSizes[tt]) {
-                    std::cout << sizeof(T) << " " << TextureTypeSizes[tt] << std::endl;
-                    throw std::invalid_argument("Texture type does not match template type");
+                if (sizeof(T) != textureTypeSize(tt)) {
+                    throw std::invalid_argument("Texture type does not match template type, the template type is "
+                                                + std::to_string(sizeof(T)) + " bytes and the texture type is "
+                                                + std::to_string(textureTypeSize(tt)) + " bytes");
                 }
                 this->descriptor->setWidth(width);
                 this->descriptor->setHeight(height);
@@ -102,7 +220,8 @@ namespace MTLCompute {
             /**
              * @brief Constructor for the Texture class
              *
-             * Constructs a new texture object and tries to infer the texture type
+             * Constructs a new texture object and infers the pixel format from
+             * the template type with PixelFormatTraits. Unsupported types don't compile.
              *
              * @param gpu The Metal device object
              * @param width The width of the texture
@@ -110,6 +229,7 @@ namespace MTLCompute {
              *
             */
             Texture(MTL::Device *gpu, int width, int height) {
+                static_assert(PixelFormatTraits<T>::supported, "Texture type not supported");
                 this->gpu = gpu;
                 if (width > MAX_TEXTURE_SIZE || height > MAX_TEXTURE_SIZE) {
                     throw std::invalid_argument("Texture size too large, max size is 16384");
@@ -118,35 +238,108 @@ namespace MTLCompute {
                 this->height = height;
                 this->descriptor = MTL::TextureDescriptor::alloc()->init();
                 this->descriptor->setTextureType(MTL::TextureType2D);
-                if (typeid(uint8_t) == typeid(T)) {
-                    this->descriptor->setPixelFormat(MTL::PixelFormatR8Uint);
-                } else if (typeid(uint16_t) == typeid(T)) {
-                    this->descriptor->setPixelFormat(MTL::PixelFormatR16Uint);
-                } else if (typeid(uint32_t) == typeid(T)) {
-                    this->descriptor->setPixelFormat(MTL::PixelFormatR32Uint);
-                } else if (typeid(float) == typeid(T)) {
-                    this->descriptor->setPixelFormat(MTL::PixelFormatR32Float);
-                } else if (typeid(int8_t) == typeid(T)) {
-                    this->descriptor->setPixelFormat(MTL::PixelFormatR8Sint);
-                } else if (typeid(int16_t) == typeid(T)) {
-                    this->descriptor->setPixelFormat(MTL::PixelFormatR16Sint);
-                } else if (typeid(int32_t) == typeid(T)) {
-                    this->descriptor->setPixelFormat(MTL::PixelFormatR32Sint);
-                } else if (typeid(float) == typeid(T)) {
-                    this->descriptor->setPixelFormat(MTL::PixelFormatR32Float);
-                } else {
-                    throw std::invalid_argument("Texture type not supported");
-                }
+                this->descriptor->setPixelFormat(PixelFormatTraits<T>::format);
                 this->descriptor->setWidth(width);
                 this->descriptor->setHeight(height);
                 this->texture = this->gpu->newTexture(this->descriptor);
             }
 
 
+            /**
+             * @brief Constructor for a texture that shares memory with a buffer
+             *
+             * Makes a linear 2D texture over the buffer's memory, so a kernel can write
+             * the buffer and the next kernel can sample it as a texture with no copy.
+             * Rows in the buffer have to start on the alignment the GPU needs, so row y
+             * starts at element offset + y*Texture::alignedPitch(gpu, width). If
+             * width*sizeof(T) is already aligned there is no padding.
+             *
+             * @param buffer The buffer to use the memory of
+             * @param width The width of the texture
+             * @param height The height of the texture
+             * @param offset The element of the buffer where the texture starts
+             *
+            */
+            Texture(Buffer<T> &buffer, int width, int height, size_t offset = 0) {
+                static_assert(PixelFormatTraits<T>::supported, "Texture type not supported");
+                if (buffer.getFreed() || buffer.getBuffer() == nullptr) {
+                    throw std::runtime_error("Buffer already freed");
+                }
+                if (width > MAX_TEXTURE_SIZE || height > MAX_TEXTURE_SIZE) {
+                    throw std::invalid_argument("Texture size too large, max size is 16384");
+                }
+                this->gpu = buffer.getGPU();
+                this->width = width;
+                this->height = height;
+                this->pitch = alignedPitch(this->gpu, width);
+
+                size_t alignment = this->gpu->minimumLinearTextureAlignmentForPixelFormat(PixelFormatTraits<T>::format);
+                if ((offset*sizeof(T)) % alignment != 0) {
+                    throw std::invalid_argument("Texture offset is not aligned");
+                }
+                if (height > 0 && offset + this->pitch*(height - 1) + width > buffer.length) {
+                    throw std::invalid_argument("Buffer too small for texture");
+                }
+
+                this->descriptor = MTL::TextureDescriptor::alloc()->init();
+                this->descriptor->setTextureType(MTL::TextureType2D);
+                this->descriptor->setPixelFormat(PixelFormatTraits<T>::format);
+                this->descriptor->setWidth(width);
+                this->descriptor->setHeight(height);
+                this->descriptor->setUsage(MTL::TextureUsageShaderRead | MTL::TextureUsageShaderWrite);
+                switch (buffer.getStorageMode()) {
+                    case ResourceStorage::Shared:
+                        this->descriptor->setStorageMode(MTL::StorageModeShared);
+                        break;
+                    case ResourceStorage::Managed:
+                        this->descriptor->setStorageMode(MTL::StorageModeManaged);
+                        break;
+                    case ResourceStorage::Private:
+                        this->descriptor->setStorageMode(MTL::StorageModePrivate);
+                        break;
+                }
+                this->texture = buffer.getBuffer()->newTexture(this->descriptor, offset*sizeof(T), this->pitch*sizeof(T));
+                if (this->texture == nullptr) {
+                    throw std::runtime_error("Could not make a texture from the buffer");
+                }
+            }
+
+            /**
+             * @brief Constructor for a texture around an existing Metal texture
+             *
+             * Takes over one reference to the texture (like the one newTexture returns)
+             * and retains the descriptor. Used by TexturePool to hand out reused textures.
+             *
+             * @param gpu The Metal device object the texture belongs to
+             * @param texture The Metal texture object
+             * @param descriptor The descriptor the texture was made with
+             *
+            */
+            Texture(MTL::Device *gpu, MTL::Texture *texture, MTL::TextureDescriptor *descriptor) {
+                static_assert(PixelFormatTraits<T>::supported, "Texture type not supported");
+                if (texture == nullptr || descriptor == nullptr) {
+                    throw std::invalid_argument("Texture and descriptor can't be null");
+                }
+                if (texture->pixelFormat() != PixelFormatTraits<T>::format) {
+                    throw std::invalid_argument("Texture type does not match template type");
+                }
+                this->gpu = gpu;
+                this->texture = texture;
+                this->descriptor = descriptor;
+                this->descriptor->retain();
+                this->width = texture->width();
+                this->height = texture->height();
+                this->depth = texture->depth();
+                this->arrayLength = texture->arrayLength();
+                this->levels = texture->mipmapLevelCount();
+                this->type = texture->textureType();
+            }
+
             /**
              * @brief Copy constructor for the Texture class
              *
-             * Constructs a new texture from an existing texture
+             * Constructs a new texture from an existing texture. Both use the same
+             * Metal texture, and the copy keeps its own reference to it.
              *
              * @param other The texture to copy
              *
@@ -156,7 +349,33 @@ namespace MTLCompute {
                 this->texture = other.texture;
                 this->width = other.width;
                 this->height = other.height;
+                this->depth = other.depth;
+                this->arrayLength = other.arrayLength;
+                this->levels = other.levels;
+                this->type = other.type;
+                this->pitch = other.pitch;
                 this->descriptor = other.descriptor;
+                this->freed = other.freed;
+                if (!this->freed) {
+                    if (this->texture != nullptr) {
+                        this->texture->retain();
+                    }
+                    if (this->descriptor != nullptr) {
+                        this->descriptor->retain();
+                    }
+                }
+            }
+
+            /**
+             * @brief Move constructor for the Texture class
+             *
+             * Takes over the other texture's references and leaves it empty
+             *
+             * @param other The texture to move from
+             *
+            */
+            Texture(Texture &&other) noexcept : Texture() {
+                this->swap(other);
             }
 
 
@@ -183,8 +402,12 @@ namespace MTLCompute {
             */
             ~Texture() {
                 if (!this->freed) {
-                    this->texture->autorelease();
-                    this->descriptor->autorelease();
+                    if (this->texture != nullptr) {
+                        this->texture->autorelease();
+                    }
+                    if (this->descriptor != nullptr) {
+                        this->descriptor->autorelease();
+                    }
                     this->freed = true;
                 }
             }
@@ -223,6 +446,20 @@ namespace MTLCompute {
                 return *this;
             }
 
+            /**
+             * @brief Overload the = operator to take over another texture
+             *
+             * @param other The texture to move from, left empty
+             *
+            */
+            Texture & operator=(Texture &&other) noexcept {
+
+                Texture temp(std::move(other));
+                swap(temp);
+
+                return *this;
+            }
+
             /**
              * @brief Overload the [] operator to get a row from the texture
              *
@@ -232,15 +469,89 @@ namespace MTLCompute {
              *
             */
             std::vector<T> operator[](size_t index) const {
-                if (this->freed) {
-                    throw std::runtime_error("Texture already freed");
+                if constexpr (CHECKED_ACCESS) {
+                    if (this->freed) {
+                        throw std::runtime_error("Texture already freed");
+                    }
+                    if (this->height < 0 || index >= (size_t)this->height) {
+                        throw std::out_of_range("Index out of bounds");
+                    }
+                }
+                std::vector<T> row(this->width);
+                this->readRegion(0, index, this->width, 1, row.data());
+                return row;
+            }
+
+            /**
+             * @brief Copy a region of the texture into host memory
+             *
+             * @param x The x coordinate of the region
+             * @param y The y coordinate of the region
+             * @param w The width of the region
+             * @param h The height of the region
+             * @param dst Where to put the region
+             * @param stride The number of elements between rows in dst, 0 if the rows are packed
+             *
+            */
+            void readRegion(int x, int y, int w, int h, T *dst, size_t stride = 0) const {
+                this->checkRegion(x, y, w, h);
+                this->texture->getBytes(dst, (stride == 0 ? w : stride)*sizeof(T), MTL::Region::Make2D(x, y, w, h), 0);
+            }
+
+            /**
+             * @brief Get a region of the texture as a 2D vector
+             *
+             * @param x The x coordinate of the region
+             * @param y The y coordinate of the region
+             * @param w The width of the region
+             * @param h The height of the region
+             *
+             * @return std::vector<std::vector<T>> The region
+             *
+            */
+            std::vector<std::vector<T>> readRegion(int x, int y, int w, int h) const {
+                std::vector<T> flat((long)w*(long)h);
+                this->readRegion(x, y, w, h, flat.data());
+                return unflatten(flat, w, h);
+            }
+
+            /**
+             * @brief Copy host memory into a region of the texture
+             *
+             * @param x The x coordinate of the region
+             * @param y The y coordinate of the region
+             * @param w The width of the region
+             * @param h The height of the region
+             * @param src The region data in row order
+             * @param stride The number of elements between rows in src, 0 if the rows are packed
+             *
+            */
+            void writeRegion(int x, int y, int w, int h, const T *src, size_t stride = 0) {
+                this->checkRegion(x, y, w, h);
+                this->texture->replaceRegion(MTL::Region::Make2D(x, y, w, h), 0, src, (stride == 0 ? w : stride)*sizeof(T));
+            }
+
+            /**
+             * @brief Copy a 2D vector into a region of the texture
+             *
+             * The size of the region is the size of the vector
+             *
+             * @param x The x coordinate of the region
+             * @param y The y coordinate of the region
+             * @param data The region data
+             *
+            */
+            void writeRegion(int x, int y, std::vector<std::vector<T>> data) {
+                if (data.empty()) {
+                    return;
                 }
-                if (index >= (long)this->width*(long)this->height) {
-                    throw std::out_of_range("Index out of bounds");
+                for (auto &row : data) {
+                    if (row.size() != data[0].size()) {
+                        throw std::invalid_argument("Rows are not all the same length");
+                    }
                 }
-                std::vector<T> flat((long)this->width*(long)this->height);
-                this->texture->getBytes(flat.data(), this->width*sizeof(T), MTL::Region::Make2D(0, 0, this->width, this->height), 0);
-                return unflatten(flat, this->width, this->height)[index];
+                std::vector<T> flat = flatten(data);
+                this->writeRegion(x, y, data[0].size(), data.size(), flat.data());
             }
 
             /**
@@ -261,13 +572,107 @@ namespace MTLCompute {
                 return unflatten(flat, this->width, this->height);
             }
 
+            /**
+             * @brief Copy host memory into a range of slices
+             *
+             * A slice is one depth layer of a 3D texture or one element of a
+             * texture array. 3D slices are copied with one replaceRegion, so a
+             * volume can be streamed in slab by slab without a full host copy.
+             *
+             * @param first The first slice
+             * @param count The number of slices
+             * @param src The slice data, count*width*height elements
+             *
+            */
+            void writeSlices(int first, int count, const T *src) {
+                this->checkSlices(first, count);
+                size_t rowbytes = this->width*sizeof(T);
+                size_t slicebytes = rowbytes*this->height;
+                if (this->type == MTL::TextureType3D) {
+                    this->texture->replaceRegion(MTL::Region::Make3D(0, 0, first, this->width, this->height, count), 0, 0,
+                            src, rowbytes, slicebytes);
+                } else {
+                    for (int i = 0; i < count; i++) {
+                        this->texture->replaceRegion(MTL::Region::Make2D(0, 0, this->width, this->height), 0, first + i,
+                                src + (size_t)i*this->width*this->height, rowbytes, 0);
+                    }
+                }
+            }
+
+            /**
+             * @brief Copy a range of slices into host memory
+             *
+             * @param first The first slice
+             * @param count The number of slices
+             * @param dst Where to put the slices, must hold count*width*height elements
+             *
+            */
+            void readSlices(int first, int count, T *dst) const {
+                this->checkSlices(first, count);
+                size_t rowbytes = this->width*sizeof(T);
+                size_t slicebytes = rowbytes*this->height;
+                if (this->type == MTL::TextureType3D) {
+                    this->texture->getBytes(dst, rowbytes, slicebytes,
+                            MTL::Region::Make3D(0, 0, first, this->width, this->height, count), 0, 0);
+                } else {
+                    for (int i = 0; i < count; i++) {
+                        this->texture->getBytes(dst + (size_t)i*this->width*this->height, rowbytes, 0,
+                                MTL::Region::Make2D(0, 0, this->width, this->height), 0, first + i);
+                    }
+                }
+            }
+
+            /**
+             * @brief Set one slice from a 2D vector
+             *
+             * @param slice The slice to set
+             * @param data The data to set the slice to
+             *
+            */
+            void writeSlice(int slice, std::vector<std::vector<T>> data) {
+                if (data.empty() || data.size() != (size_t)this->height || data[0].size() != (size_t)this->width) {
+                    throw std::invalid_argument("Data size does not match texture size");
+                }
+                std::vector<T> flat = flatten(data);
+                this->writeSlices(slice, 1, flat.data());
+            }
+
+            /**
+             * @brief Get one slice as a 2D vector
+             *
+             * @param slice The slice to get
+             *
+             * @return std::vector<std::vector<T>> The slice
+             *
+            */
+            std::vector<std::vector<T>> readSlice(int slice) const {
+                std::vector<T> flat((long)this->width*(long)this->height);
+                this->readSlices(slice, 1, flat.data());
+                return unflatten(flat, this->width, this->height);
+            }
+
+            /**
+             * @brief Get the row pitch a buffer needs to back a texture
+             *
+             * @param gpu The Metal device object
+             * @param width The width of the texture
+             *
+             * @return size_t The number of elements from the start of one row to the next
+             *
+            */
+            static size_t alignedPitch(MTL::Device *gpu, int width) {
+                size_t alignment = gpu->minimumLinearTextureAlignmentForPixelFormat(PixelFormatTraits<T>::format);
+                size_t bytes = (width*sizeof(T) + alignment - 1)/alignment*alignment;
+                return bytes/sizeof(T);
+            }
+
             /**
              * @brief Get the MTL::Texture object
              *
              * @return MTL::Texture* The MTL::Texture object
              *
             */
-            MTL::Texture *getTexture() {
+            MTL::Texture *getTexture() const {
                 return this->texture;
             }
 
@@ -287,7 +692,7 @@ namespace MTLCompute {
              * @return bool Whether the texture has been freed
              *
             */
-            bool getFreed() {
+            bool getFreed() const {
                 return this->freed;
             }
 
@@ -307,7 +712,7 @@ namespace MTLCompute {
              * @return int The width of the texture
              *
             */
-            int getWidth() {
+            int getWidth() const {
                 return this->width;
             }
 
@@ -317,7 +722,326 @@ namespace MTLCompute {
              * @return int The height of the texture
              *
             */
-            int getHeight() {
+            int getHeight() const {
+                return this->height;
+            }
+
+            /**
+             * @brief Get the depth of the texture
+             *
+             * @return int The depth of a 3D texture, 1 otherwise
+             *
+            */
+            int getDepth() {
+                return this->depth;
+            }
+
+            /**
+             * @brief Get the array length of the texture
+             *
+             * @return int The number of slices in a texture array, 1 otherwise
+             *
+            */
+            int getArrayLength() {
+                return this->arrayLength;
+            }
+
+            /**
+             * @brief Get the number of mipmap levels
+             *
+             * @return int The number of levels, 1 if the texture isn't mipmapped
+             *
+            */
+            int getLevels() {
+                return this->levels;
+            }
+
+            /**
+             * @brief Get one mipmap level as its own texture
+             *
+             * The returned texture is a view, it uses the same memory as this level.
+             * It can be read, written and loaded into a CommandManager like any texture.
+             *
+             * @param level The level, 0 is the full size image
+             *
+             * @return Texture<T> The level
+             *
+            */
+            Texture<T> level(int level) {
+                if (this->freed) {
+                    throw std::runtime_error("Texture already freed");
+                }
+                if (level < 0 || level >= this->levels) {
+                    throw std::out_of_range("Mipmap level out of bounds");
+                }
+                MTL::Texture *view = this->texture->newTextureView(PixelFormatTraits<T>::format, this->type,
+                                                                   NS::Range::Make(level, 1), NS::Range::Make(0, this->arrayLength));
+                MTL::TextureDescriptor *descriptor = MTL::TextureDescriptor::alloc()->init();
+                descriptor->setTextureType(this->type);
+                descriptor->setPixelFormat(PixelFormatTraits<T>::format);
+                descriptor->setWidth(std::max(1, this->width >> level));
+                descriptor->setHeight(std::max(1, this->height >> level));
+                descriptor->setDepth(std::max(1, this->depth >> level));
+                descriptor->setArrayLength(this->arrayLength);
+                // The Texture retains the descriptor, this reference goes when the autorelease pool drains
+                descriptor->autorelease();
+                return Texture<T>(this->gpu, view, descriptor);
+            }
+
+            /**
+             * @brief Get the number of slices in the texture
+             *
+             * @return int The depth of a 3D texture, or the array length of anything else
+             *
+            */
+            int getSlices() const {
+                return this->type == MTL::TextureType3D ? this->depth : this->arrayLength;
+            }
+
+            /**
+             * @brief Get the row pitch of a texture made from a buffer
+             *
+             * @return size_t The elements per row in the buffer, 0 if the texture has its own memory
+             *
+            */
+            size_t getRowPitch() {
+                return this->pitch;
+            }
+
+            /**
+             * @brief Get the kind of texture
+             *
+             * @return MTL::TextureType The texture type
+             *
+            */
+            MTL::TextureType getTextureType() {
+                return this->type;
+            }
+    };
+
+    /**
+     * @brief A one dimensional texture
+     *
+     * A Texture with a height of 1. It can be loaded into a CommandManager like any other texture.
+     *
+    */
+    template<typename T>
+    class Texture1D : public Texture<T> {
+        public:
+            /**
+             * @brief Constructor for the Texture1D class
+             *
+             * @param gpu The Metal device object
+             * @param width The width of the texture
+             *
+            */
+            Texture1D(MTL::Device *gpu, int width) : Texture<T>(gpu, MTL::TextureType1D, width, 1, 1, 1) {}
+    };
+
+    /**
+     * @brief A three dimensional texture
+     *
+     * Each depth layer is a slice, so Texture::writeSlices and Texture::readSlices
+     * stream the volume in and out slab by slab. A CommandManager dispatches
+     * one thread per texel in a 3D grid.
+     *
+    */
+    template<typename T>
+    class Texture3D : public Texture<T> {
+        public:
+            /**
+             * @brief Constructor for the Texture3D class
+             *
+             * @param gpu The Metal device object
+             * @param width The width of the texture
+             * @param height The height of the texture
+             * @param depth The depth of the texture
+             *
+            */
+            Texture3D(MTL::Device *gpu, int width, int height, int depth)
+                : Texture<T>(gpu, MTL::TextureType3D, width, height, depth, 1) {}
+    };
+
+    /**
+     * @brief An array of two dimensional textures
+     *
+     * Every element of the array is a slice. A CommandManager dispatches
+     * a 3D grid with one layer per slice.
+     *
+    */
+    template<typename T>
+    class Texture2DArray : public Texture<T> {
+        public:
+            /**
+             * @brief Constructor for the Texture2DArray class
+             *
+             * @param gpu The Metal device object
+             * @param width The width of each slice
+             * @param height The height of each slice
+             * @param length The number of slices
+             *
+            */
+            Texture2DArray(MTL::Device *gpu, int width, int height, int length)
+                : Texture<T>(gpu, MTL::TextureType2DArray, width, height, 1, length) {}
+    };
+
+    /**
+     * @brief A host copy of a texture that can be iterated row by row
+     *
+     * Textures can't be read through a pointer, so the mirror copies the texture
+     * into one contiguous host allocation with TextureMirror::pull and writes it
+     * back with TextureMirror::push. Every row is a std::span, so standard
+     * algorithms work on the rows (or on TextureMirror::data for the whole image).
+     *
+    */
+    template<typename T>
+    class TextureMirror {
+        private:
+            Texture<T> texture; ///< The mirrored texture
+            std::vector<T> pixels; ///< The host copy of the texture, row by row
+            int width; ///< The width of the texture
+            int height; ///< The height of the texture
+
+        public:
+            /**
+             * @brief A random access iterator over the rows of a mirror
+             *
+            */
+            class RowIterator {
+                private:
+                    T *row; ///< The first element of the current row
+                    size_t width; ///< The number of elements in a row
+
+                public:
+                    using iterator_category = std::random_access_iterator_tag;
+                    using value_type = std::span<T>;
+                    using difference_type = std::ptrdiff_t;
+                    using reference = std::span<T>;
+                    using pointer = void;
+
+                    RowIterator() : row(nullptr), width(0) {}
+                    RowIterator(T *row, size_t width) : row(row), width(width) {}
+
+                    std::span<T> operator*() const { return std::span<T>(this->row, this->width); }
+                    std::span<T> operator[](difference_type n) const { return *(*this + n); }
+
+                    RowIterator &operator++() { this->row += this->width; return *this; }
+                    RowIterator operator++(int) { RowIterator old = *this; ++*this; return old; }
+                    RowIterator &operator--() { this->row -= this->width; return *this; }
+                    RowIterator operator--(int) { RowIterator old = *this; --*this; return old; }
+                    RowIterator &operator+=(difference_type n) { this->row += n*(difference_type)this->width; return *this; }
+                    RowIterator &operator-=(difference_type n) { this->row -= n*(difference_type)this->width; return *this; }
+
+                    friend RowIterator operator+(RowIterator it, difference_type n) { return it += n; }
+                    friend RowIterator operator+(difference_type n, RowIterator it) { return it += n; }
+                    friend RowIterator operator-(RowIterator it, difference_type n) { return it -= n; }
+                    friend difference_type operator-(const RowIterator &a, const RowIterator &b) {
+                        return a.width == 0 ? 0 : (a.row - b.row)/(difference_type)a.width;
+                    }
+                    friend bool operator==(const RowIterator &a, const RowIterator &b) { return a.row == b.row; }
+                    friend auto operator<=>(const RowIterator &a, const RowIterator &b) { return a.row <=> b.row; }
+            };
+
+            /**
+             * @brief Constructor for the TextureMirror class
+             *
+             * Allocates the host copy and pulls the texture into it
+             *
+             * @param texture The texture to mirror
+             *
+            */
+            TextureMirror(Texture<T> &texture) : texture(texture) {
+                this->width = texture.getWidth();
+                this->height = texture.getHeight();
+                this->pixels.resize((long)this->width*(long)this->height);
+                this->pull();
+            }
+
+            /**
+             * @brief Copy the texture into the mirror
+             *
+            */
+            void pull() {
+                this->texture.readRegion(0, 0, this->width, this->height, this->pixels.data());
+            }
+
+            /**
+             * @brief Copy the mirror back into the texture
+             *
+            */
+            void push() {
+                this->texture.writeRegion(0, 0, this->width, this->height, this->pixels.data());
+            }
+
+            /**
+             * @brief Overload the [] operator to get a row
+             *
+             * @param index The index of the row
+             *
+             * @return std::span<T> The row
+             *
+            */
+            std::span<T> operator[](size_t index) {
+                return *(this->begin() + index);
+            }
+
+            /**
+             * @brief Get an iterator to the first row
+             *
+             * @return RowIterator The first row
+             *
+            */
+            RowIterator begin() {
+                return RowIterator(this->pixels.data(), this->width);
+            }
+
+            /**
+             * @brief Get an iterator past the last row
+             *
+             * @return RowIterator One past the last row
+             *
+            */
+            RowIterator end() {
+                return this->begin() + this->height;
+            }
+
+            /**
+             * @brief Get every pixel of the mirror in row order
+             *
+             * @return std::span<T> The pixels
+             *
+            */
+            std::span<T> data() {
+                return std::span<T>(this->pixels);
+            }
+
+            /**
+             * @brief Get the number of rows
+             *
+             * @return size_t The height of the texture
+             *
+            */
+            size_t size() const {
+                return this->height;
+            }
+
+            /**
+             * @brief Get the width of the mirror
+             *
+             * @return int The width of the texture
+             *
+            */
+            int getWidth() const {
+                return this->width;
+            }
+
+            /**
+             * @brief Get the height of the mirror
+             *
+             * @return int The height of the texture
+             *
+            */
+            int getHeight() const {
                 return this->height;
             }
     };
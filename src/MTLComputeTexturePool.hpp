@@ -0,0 +1,297 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeTexture.hpp"
+#include <list>
+#include <map>
+#include <tuple>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Hit and miss counts for a TexturePool
+     *
+    */
+    struct TexturePoolStats {
+        size_t hits = 0; ///< The number of acquires that reused a texture
+        size_t misses = 0; ///< The number of acquires that made a new texture
+        size_t evictions = 0; ///< The number of idle textures released to stay under the budget
+        size_t idleBytes = 0; ///< The bytes held by idle textures
+        size_t idleCount = 0; ///< The number of idle textures
+
+        /**
+         * @brief Get the fraction of acquires that reused a texture
+         *
+         * @return double The hit rate, 0 if nothing has been acquired
+         *
+        */
+        double hitRate() const {
+            size_t total = this->hits + this->misses;
+            return total == 0 ? 0.0 : (double)this->hits/total;
+        }
+    };
+
+    /**
+     * @brief Reuses textures instead of making new ones
+     *
+     * Idle textures are kept with their descriptors by pixel format, width,
+     * height and usage. TexturePool::acquire() hands out an idle texture with the same
+     * key if there is one and only makes a new one if there isn't.
+     * TexturePool::recycle() gives a texture back. Idle textures are released
+     * least recently used first when they take more than the byte budget.
+     *
+    */
+    class TexturePool {
+
+        private:
+            using Key = std::tuple<MTL::PixelFormat, int, int, MTL::TextureUsage>; ///< Format, width, height and usage
+
+            /**
+             * @brief An idle texture
+             *
+            */
+            struct Entry {
+                Key key; ///< The key of the texture
+                MTL::Texture *texture; ///< The Metal texture object
+                MTL::TextureDescriptor *descriptor; ///< The descriptor the texture was made with
+                size_t bytes; ///< The size of the texture in bytes
+            };
+
+            MTL::Device *gpu; ///< The Metal device object
+            size_t budget; ///< The most bytes idle textures can take
+            std::list<Entry> idle; ///< The idle textures, most recently recycled first
+            std::multimap<Key, std::list<Entry>::iterator> index; ///< The idle textures by key
+            TexturePoolStats stats; ///< The hit and miss counts
+
+            /**
+             * @brief Make a descriptor for a key
+             *
+             * Only needed on a miss, idle textures keep the descriptor they were made
+             * with, so nothing is held for keys that aren't in the pool
+             *
+             * @param key The key
+             *
+             * @return MTL::TextureDescriptor* The descriptor, owned by the caller
+             *
+            */
+            static MTL::TextureDescriptor *descriptor(const Key &key) {
+                MTL::TextureDescriptor *descriptor = MTL::TextureDescriptor::alloc()->init();
+                descriptor->setTextureType(MTL::TextureType2D);
+                descriptor->setPixelFormat(std::get<0>(key));
+                descriptor->setWidth(std::get<1>(key));
+                descriptor->setHeight(std::get<2>(key));
+                descriptor->setUsage(std::get<3>(key));
+                return descriptor;
+            }
+
+            /**
+             * @brief Remove an idle texture from the list and the index
+             *
+             * @param entry The idle texture
+             *
+            */
+            void remove(std::list<Entry>::iterator entry) {
+                auto range = this->index.equal_range(entry->key);
+                for (auto i = range.first; i != range.second; i++) {
+                    if (i->second == entry) {
+                        this->index.erase(i);
+                        break;
+                    }
+                }
+                this->stats.idleBytes -= entry->bytes;
+                this->stats.idleCount--;
+                this->idle.erase(entry);
+            }
+
+            /**
+             * @brief Release least recently used idle textures until they fit the budget
+             *
+            */
+            void trim() {
+                while (this->stats.idleBytes > this->budget && !this->idle.empty()) {
+                    auto last = std::prev(this->idle.end());
+                    last->texture->release();
+                    last->descriptor->release();
+                    this->remove(last);
+                    this->stats.evictions++;
+                }
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the TexturePool class
+             *
+             * @param gpu The Metal device object
+             * @param budget The most bytes idle textures can take, 256 MB by default
+             *
+            */
+            TexturePool(MTL::Device *gpu, size_t budget = 256 << 20) {
+                this->gpu = gpu;
+                this->budget = budget;
+            }
+
+            TexturePool(const TexturePool &) = delete;
+            TexturePool & operator=(const TexturePool &) = delete;
+
+            /**
+             * @brief Destructor for the TexturePool class
+             *
+             * Releases the idle textures. Textures that are still handed out are
+             * released by their Texture objects.
+             *
+            */
+            ~TexturePool() {
+                this->clear();
+            }
+
+            /**
+             * @brief Get a texture from the pool
+             *
+             * The contents of a reused texture are whatever was left in it
+             *
+             * @param width The width of the texture
+             * @param height The height of the texture
+             * @param usage How kernels use the texture
+             *
+             * @return Texture<T> The texture
+             *
+            */
+            template<typename T>
+            Texture<T> acquire(int width, int height, MTL::TextureUsage usage = MTL::TextureUsageShaderRead | MTL::TextureUsageShaderWrite) {
+                static_assert(PixelFormatTraits<T>::supported, "Texture type not supported");
+                if (width <= 0 || height <= 0) {
+                    throw std::invalid_argument("Texture size must be positive");
+                }
+                if (width > MAX_TEXTURE_SIZE || height > MAX_TEXTURE_SIZE) {
+                    throw std::invalid_argument("Texture size too large, max size is 16384");
+                }
+                Key key(PixelFormatTraits<T>::format, width, height, usage);
+
+                // Take the most recently recycled texture with this key
+                auto range = this->index.equal_range(key);
+                if (range.first != range.second) {
+                    auto found = std::prev(range.second);
+                    MTL::Texture *texture = found->second->texture;
+                    MTL::TextureDescriptor *descriptor = found->second->descriptor;
+                    this->remove(found->second);
+                    this->stats.hits++;
+                    // The Texture retains the descriptor, the pool's reference goes when it's drained
+                    descriptor->autorelease();
+                    return Texture<T>(this->gpu, texture, descriptor);
+                }
+
+                this->stats.misses++;
+                MTL::TextureDescriptor *descriptor = this->descriptor(key);
+                MTL::Texture *texture = this->gpu->newTexture(descriptor);
+                if (texture == nullptr) {
+                    descriptor->release();
+                    throw std::runtime_error("Could not make a texture");
+                }
+                descriptor->autorelease();
+                return Texture<T>(this->gpu, texture, descriptor);
+            }
+
+            /**
+             * @brief Give a texture back to the pool
+             *
+             * Don't use the texture (or any copy of it) after this, the pool
+             * can hand it out again. Textures made from a buffer can't be recycled.
+             *
+             * @param texture The texture to give back
+             *
+            */
+            template<typename T>
+            void recycle(Texture<T> &texture) {
+                if (texture.getFreed() || texture.getTexture() == nullptr) {
+                    throw std::runtime_error("Texture already freed");
+                }
+                if (texture.getRowPitch() != 0 || texture.getTextureType() != MTL::TextureType2D) {
+                    throw std::invalid_argument("Only plain 2D textures can be recycled");
+                }
+                MTL::Texture *mtltexture = texture.getTexture();
+                Key key(mtltexture->pixelFormat(), texture.getWidth(), texture.getHeight(), mtltexture->usage());
+                size_t bytes = mtltexture->allocatedSize();
+
+                // The pool keeps its own references, the Texture object releases the others
+                mtltexture->retain();
+                MTL::TextureDescriptor *descriptor = texture.getDescriptor();
+                descriptor->retain();
+                this->idle.push_front(Entry{key, mtltexture, descriptor, bytes});
+                this->index.insert({key, this->idle.begin()});
+                this->stats.idleBytes += bytes;
+                this->stats.idleCount++;
+                this->trim();
+            }
+
+            /**
+             * @brief Release every idle texture
+             *
+            */
+            void clear() {
+                for (Entry &entry : this->idle) {
+                    entry.texture->release();
+                    entry.descriptor->release();
+                }
+                this->idle.clear();
+                this->index.clear();
+                this->stats.idleBytes = 0;
+                this->stats.idleCount = 0;
+            }
+
+            /**
+             * @brief Set the byte budget for idle textures
+             *
+             * Releases idle textures right away if they no longer fit
+             *
+             * @param budget The most bytes idle textures can take
+             *
+            */
+            void setBudget(size_t budget) {
+                this->budget = budget;
+                this->trim();
+            }
+
+            /**
+             * @brief Get the byte budget for idle textures
+             *
+             * @return size_t The budget in bytes
+             *
+            */
+            size_t getBudget() {
+                return this->budget;
+            }
+
+            /**
+             * @brief Get the hit and miss counts
+             *
+             * @return TexturePoolStats The counts
+             *
+            */
+            TexturePoolStats getStats() {
+                return this->stats;
+            }
+
+            /**
+             * @brief Set the hit, miss and eviction counts back to 0
+             *
+            */
+            void resetStats() {
+                this->stats.hits = 0;
+                this->stats.misses = 0;
+                this->stats.evictions = 0;
+            }
+
+            /**
+             * @brief Get the GPU device
+             *
+             * @return MTL::Device* The GPU device
+             *
+            */
+            MTL::Device *getGPU() {
+                return this->gpu;
+            }
+
+    };
+
+}
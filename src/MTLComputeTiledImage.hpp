@@ -0,0 +1,253 @@
+#include "MTLComputeGlobals.hpp"
+#include "MTLComputeKernel.hpp"
+#include "MTLComputeTexture.hpp"
+#include <algorithm>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Runs a kernel over an image too big for one texture
+     *
+     * The image stays in host memory (a vector, or a file mapped with mmap) and is cut
+     * into square tiles that fit in a texture. Each tile is uploaded with a halo of extra
+     * pixels on every side so kernels that read neighbours work across tile seams, and
+     * halo pixels past the edge of the image repeat the edge pixel. Only the inside of
+     * each output tile is copied back, straight into the output image.
+     *
+     * The kernel gets the input tile at texture(0), the output tile at texture(1), and
+     * an int4 at buffer(0) holding the image position of the tile's top left texel
+     * (including the halo) and the image width and height.
+     *
+     * At most `resident` tiles are on the GPU at once. They're all encoded into one
+     * command buffer, so memory use stays the same no matter how big the image is.
+     *
+    */
+    template<typename T>
+    class TiledImage {
+
+        private:
+            MTL::Device *gpu; ///< The Metal device object
+            MTL::CommandQueue *commandQueue; ///< The Metal command queue object
+            long width; ///< The width of the image
+            long height; ///< The height of the image
+            int tilesize; ///< The width and height of a tile without the halo
+            int halo; ///< The number of extra pixels on each side of a tile
+            int resident; ///< The number of tiles on the GPU at once
+            std::vector<Texture<T>> inputs; ///< The input tile textures
+            std::vector<Texture<T>> outputs; ///< The output tile textures
+            std::vector<T> staging; ///< Host memory for tiles at the edge of the image
+
+            /**
+             * @brief Copy a tile and its halo into a texture
+             *
+             * Tiles away from the edge are copied straight from the image. Tiles at
+             * the edge are built in the staging memory first so the halo can repeat
+             * the edge pixels.
+             *
+             * @param tile The texture to copy into
+             * @param input The image
+             * @param x0 The x coordinate of the tile in the image
+             * @param y0 The y coordinate of the tile in the image
+             * @param tw The width of the tile
+             * @param th The height of the tile
+             *
+            */
+            void upload(Texture<T> &tile, const T *input, long x0, long y0, int tw, int th) {
+                long left = x0 - this->halo;
+                long top = y0 - this->halo;
+                int w = tw + 2*this->halo;
+                int h = th + 2*this->halo;
+                if (left >= 0 && top >= 0 && left + w <= this->width && top + h <= this->height) {
+                    tile.writeRegion(0, 0, w, h, input + top*this->width + left, this->width);
+                    return;
+                }
+
+                this->staging.resize((size_t)w*h);
+                for (int y = 0; y < h; y++) {
+                    const T *row = input + std::clamp(top + y, 0L, this->height - 1)*this->width;
+                    for (int x = 0; x < w; x++) {
+                        this->staging[(size_t)y*w + x] = row[std::clamp(left + x, 0L, this->width - 1)];
+                    }
+                }
+                tile.writeRegion(0, 0, w, h, this->staging.data());
+            }
+
+        public:
+
+            /**
+             * @brief Constructor for the TiledImage class
+             *
+             * @param gpu The GPU device
+             * @param width The width of the image
+             * @param height The height of the image
+             * @param tilesize The width and height of a tile without the halo
+             * @param halo The number of extra pixels on each side of a tile
+             * @param resident The number of tiles on the GPU at once
+             *
+            */
+            TiledImage(MTL::Device *gpu, long width, long height, int tilesize = 4096, int halo = 0, int resident = 4) {
+                if (width <= 0 || height <= 0) {
+                    throw std::invalid_argument("Image size must be positive");
+                }
+                if (tilesize <= 0 || halo < 0 || resident <= 0) {
+                    throw std::invalid_argument("Tile size and residency must be positive");
+                }
+                if (tilesize + 2*halo > MAX_TEXTURE_SIZE) {
+                    throw std::invalid_argument("Tile size too large, max size with halo is 16384");
+                }
+                this->gpu = gpu;
+                this->width = width;
+                this->height = height;
+                this->tilesize = tilesize;
+                this->halo = halo;
+                this->resident = resident;
+                this->commandQueue = this->gpu->newCommandQueue();
+            }
+
+            /**
+             * @brief Destructor for the TiledImage class
+             *
+             * Releases the command queue
+             *
+            */
+            ~TiledImage() {
+                this->commandQueue->autorelease();
+            }
+
+            /**
+             * @brief Run a kernel over the whole image
+             *
+             * @param kernel The kernel to run, with a function already selected
+             * @param input The image, width*height elements in row order
+             * @param output Where to put the result, width*height elements in row order.
+             * Can't be the same memory as the input.
+             *
+            */
+            void process(Kernel &kernel, const T *input, T *output) {
+                if (input == output) {
+                    throw std::invalid_argument("Input and output can't be the same image");
+                }
+                int size = this->tilesize + 2*this->halo;
+                if (this->inputs.empty()) {
+                    this->inputs.reserve(this->resident);
+                    this->outputs.reserve(this->resident);
+                    for (int i = 0; i < this->resident; i++) {
+                        this->inputs.emplace_back(this->gpu, size, size);
+                        this->outputs.emplace_back(this->gpu, size, size);
+                    }
+                }
+
+                MTL::ComputePipelineState *pipeline = kernel.getPLS();
+                MTL::Size threadsPerThreadgroup;
+                threadsPerThreadgroup.width = pipeline->threadExecutionWidth();
+                threadsPerThreadgroup.height = pipeline->maxTotalThreadsPerThreadgroup() / threadsPerThreadgroup.width;
+                threadsPerThreadgroup.depth = 1;
+
+                long tilesx = this->getTilesX();
+                long count = this->getTileCount();
+                for (long first = 0; first < count; first += this->resident) {
+                    long last = std::min(count, first + this->resident);
+
+                    // Upload a batch of tiles and encode one dispatch per tile
+                    MTL::CommandBuffer *commandBuffer = this->commandQueue->commandBuffer();
+                    MTL::ComputeCommandEncoder *commandEncoder = commandBuffer->computeCommandEncoder();
+                    commandEncoder->setComputePipelineState(pipeline);
+                    for (long t = first; t < last; t++) {
+                        int slot = t - first;
+                        long x0 = (t % tilesx)*this->tilesize;
+                        long y0 = (t / tilesx)*this->tilesize;
+                        int tw = std::min((long)this->tilesize, this->width - x0);
+                        int th = std::min((long)this->tilesize, this->height - y0);
+                        this->upload(this->inputs[slot], input, x0, y0, tw, th);
+
+                        int32_t origin[4] = {(int32_t)(x0 - this->halo), (int32_t)(y0 - this->halo),
+                                             (int32_t)this->width, (int32_t)this->height};
+                        commandEncoder->setTexture(this->inputs[slot].getTexture(), 0);
+                        commandEncoder->setTexture(this->outputs[slot].getTexture(), 1);
+                        commandEncoder->setBytes(origin, sizeof(origin), 0);
+                        commandEncoder->dispatchThreads(MTL::Size::Make(tw + 2*this->halo, th + 2*this->halo, 1),
+                                                        threadsPerThreadgroup);
+                    }
+                    commandEncoder->endEncoding();
+                    commandBuffer->commit();
+                    commandBuffer->waitUntilCompleted();
+
+                    // Copy the inside of every output tile into place
+                    for (long t = first; t < last; t++) {
+                        int slot = t - first;
+                        long x0 = (t % tilesx)*this->tilesize;
+                        long y0 = (t / tilesx)*this->tilesize;
+                        int tw = std::min((long)this->tilesize, this->width - x0);
+                        int th = std::min((long)this->tilesize, this->height - y0);
+                        this->outputs[slot].readRegion(this->halo, this->halo, tw, th, output + y0*this->width + x0, this->width);
+                    }
+
+                    commandEncoder->release();
+                    commandBuffer->release();
+                }
+            }
+
+            /**
+             * @brief Run a kernel over an image stored in vectors
+             *
+             * @param kernel The kernel to run, with a function already selected
+             * @param input The image, width*height elements in row order
+             *
+             * @return std::vector<T> The result
+             *
+            */
+            std::vector<T> process(Kernel &kernel, const std::vector<T> &input) {
+                if (input.size() != (size_t)this->width*this->height) {
+                    throw std::invalid_argument("Data size does not match image size");
+                }
+                std::vector<T> output(input.size());
+                this->process(kernel, input.data(), output.data());
+                return output;
+            }
+
+            /**
+             * @brief Get the number of tile columns
+             *
+             * @return long The number of tiles across the image
+             *
+            */
+            long getTilesX() {
+                return (this->width + this->tilesize - 1)/this->tilesize;
+            }
+
+            /**
+             * @brief Get the number of tile rows
+             *
+             * @return long The number of tiles down the image
+             *
+            */
+            long getTilesY() {
+                return (this->height + this->tilesize - 1)/this->tilesize;
+            }
+
+            /**
+             * @brief Get the number of tiles
+             *
+             * @return long The number of tiles in the image
+             *
+            */
+            long getTileCount() {
+                return this->getTilesX()*this->getTilesY();
+            }
+
+            /**
+             * @brief Get the GPU device
+             *
+             * @return MTL::Device* The GPU device
+             *
+            */
+            MTL::Device *getGPU() {
+                return this->gpu;
+            }
+
+    };
+
+}
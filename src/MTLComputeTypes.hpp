@@ -0,0 +1,273 @@
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#pragma once
+
+namespace MTLCompute {
+
+    /**
+     * @brief Pick between two values without a branch
+     *
+     * @param condition Which value to pick
+     * @param a The value if the condition is true
+     * @param b The value if the condition is false
+     *
+     * @return uint32_t The picked value
+     *
+    */
+    inline uint32_t bitSelect(bool condition, uint32_t a, uint32_t b) {
+        uint32_t mask = 0u - (uint32_t)condition;
+        return (a & mask) | (b & ~mask);
+    }
+
+    /**
+     * @brief Convert a float to the bits of an IEEE half
+     *
+     * Rounds to nearest even. Every case is computed and then picked with
+     * MTLCompute::bitSelect so loops over this function can be vectorized.
+     *
+     * @param value The float to convert
+     *
+     * @return uint16_t The half bits
+     *
+    */
+    inline uint16_t floatToHalfBits(float value) {
+        uint32_t x;
+        memcpy(&x, &value, sizeof(x));
+        uint32_t sign = x & 0x80000000u;
+        x ^= sign;
+
+        // too big for a half: infinity, or a quiet nan if it was a nan
+        uint32_t overflow = bitSelect(x > (255u << 23), 0x7e00u, 0x7c00u);
+
+        // too small to be normal: let the float adder do the rounding
+        const uint32_t magicbits = 126u << 23;
+        float magic;
+        memcpy(&magic, &magicbits, sizeof(magic));
+        float shifted;
+        memcpy(&shifted, &x, sizeof(shifted));
+        shifted += magic;
+        uint32_t subnormal;
+        memcpy(&subnormal, &shifted, sizeof(subnormal));
+        subnormal -= magicbits;
+
+        // normal: rebias the exponent and round the mantissa
+        uint32_t normal = (x + ((uint32_t)(15 - 127) << 23) + 0xfffu + ((x >> 13) & 1u)) >> 13;
+
+        uint32_t result = bitSelect(x >= (143u << 23), overflow, bitSelect(x < (113u << 23), subnormal, normal));
+        return (uint16_t)(result | (sign >> 16));
+    }
+
+    /**
+     * @brief Convert the bits of an IEEE half to a float
+     *
+     * @param bits The half bits
+     *
+     * @return float The converted value
+     *
+    */
+    inline float halfBitsToFloat(uint16_t bits) {
+        const uint32_t shiftedexp = 0x7c00u << 13;
+        uint32_t x = (bits & 0x7fffu) << 13;
+        uint32_t exp = x & shiftedexp;
+        x += (uint32_t)(127 - 15) << 23;
+
+        // infinity and nan keep the maximum exponent
+        uint32_t special = x + ((uint32_t)(128 - 16) << 23);
+
+        // subnormals get renormalized by the float subtractor
+        const uint32_t magicbits = 113u << 23;
+        float magic;
+        memcpy(&magic, &magicbits, sizeof(magic));
+        uint32_t adjusted = x + (1u << 23);
+        float renormalized;
+        memcpy(&renormalized, &adjusted, sizeof(renormalized));
+        renormalized -= magic;
+        uint32_t subnormal;
+        memcpy(&subnormal, &renormalized, sizeof(subnormal));
+
+        uint32_t result = bitSelect(exp == shiftedexp, special, bitSelect(exp == 0, subnormal, x));
+        result |= (uint32_t)(bits & 0x8000u) << 16;
+        float value;
+        memcpy(&value, &result, sizeof(value));
+        return value;
+    }
+
+    /**
+     * @brief Convert a float to the bits of a bfloat16
+     *
+     * Rounds to nearest even, nans stay nans
+     *
+     * @param value The float to convert
+     *
+     * @return uint16_t The bfloat16 bits
+     *
+    */
+    inline uint16_t floatToBfloat16Bits(float value) {
+        uint32_t x;
+        memcpy(&x, &value, sizeof(x));
+        uint32_t rounded = (x + 0x7fffu + ((x >> 16) & 1u)) >> 16;
+        bool nan = (x & 0x7fffffffu) > 0x7f800000u;
+        return (uint16_t)bitSelect(nan, (x >> 16) | 0x40u, rounded);
+    }
+
+    /**
+     * @brief Convert the bits of a bfloat16 to a float
+     *
+     * @param bits The bfloat16 bits
+     *
+     * @return float The converted value
+     *
+    */
+    inline float bfloat16BitsToFloat(uint16_t bits) {
+        uint32_t x = (uint32_t)bits << 16;
+        float value;
+        memcpy(&value, &x, sizeof(value));
+        return value;
+    }
+
+    /**
+     * @brief A 16 bit IEEE float, the same as half in the Metal Shading Language
+     *
+     * Only used for storage. It converts to and from float for arithmetic.
+     *
+    */
+    struct half {
+        uint16_t bits = 0; ///< The raw bits
+
+        half() = default;
+        half(float value) : bits(floatToHalfBits(value)) {}
+        operator float() const { return halfBitsToFloat(this->bits); }
+    };
+
+    /**
+     * @brief A 16 bit brain float, the same as bfloat in the Metal Shading Language
+     *
+     * Only used for storage. It converts to and from float for arithmetic.
+     * Metal has no bfloat16 pixel formats, so it can go in a Buffer but not a Texture.
+     *
+    */
+    struct bfloat16 {
+        uint16_t bits = 0; ///< The raw bits
+
+        bfloat16() = default;
+        bfloat16(float value) : bits(floatToBfloat16Bits(value)) {}
+        operator float() const { return bfloat16BitsToFloat(this->bits); }
+    };
+
+    /**
+     * @brief Convert floats to halves
+     *
+     * @param src The floats
+     * @param dst Where to put the halves, must hold count elements
+     * @param count The number of elements
+     *
+    */
+    inline void toHalf(const float *src, half *dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i].bits = floatToHalfBits(src[i]);
+        }
+    }
+
+    /**
+     * @brief Convert halves to floats
+     *
+     * @param src The halves
+     * @param dst Where to put the floats, must hold count elements
+     * @param count The number of elements
+     *
+    */
+    inline void fromHalf(const half *src, float *dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = halfBitsToFloat(src[i].bits);
+        }
+    }
+
+    /**
+     * @brief Convert floats to bfloat16s
+     *
+     * @param src The floats
+     * @param dst Where to put the bfloat16s, must hold count elements
+     * @param count The number of elements
+     *
+    */
+    inline void toBfloat16(const float *src, bfloat16 *dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i].bits = floatToBfloat16Bits(src[i]);
+        }
+    }
+
+    /**
+     * @brief Convert bfloat16s to floats
+     *
+     * @param src The bfloat16s
+     * @param dst Where to put the floats, must hold count elements
+     * @param count The number of elements
+     *
+    */
+    inline void fromBfloat16(const bfloat16 *src, float *dst, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = bfloat16BitsToFloat(src[i].bits);
+        }
+    }
+
+    /**
+     * @brief Pack separate channel planes into multi channel pixels
+     *
+     * Turns N planes (like R, G, B and A) into one array of pixels
+     * that can be written to a texture with one replaceRegion
+     *
+     * @tparam N The number of channels
+     * @tparam C The type of one channel
+     * @param planes The channel planes, all the same length
+     *
+     * @return std::vector<std::array<C, N>> The pixels
+     *
+    */
+    template<size_t N, typename C>
+    std::vector<std::array<C, N>> interleave(const std::vector<std::vector<C>> &planes) {
+        if (planes.size() != N) {
+            throw std::invalid_argument("Number of planes does not match number of channels");
+        }
+        size_t count = planes[0].size();
+        for (const auto &plane : planes) {
+            if (plane.size() != count) {
+                throw std::invalid_argument("Planes are not all the same length");
+            }
+        }
+        std::vector<std::array<C, N>> pixels(count);
+        for (size_t c = 0; c < N; c++) {
+            const C *plane = planes[c].data();
+            for (size_t i = 0; i < count; i++) {
+                pixels[i][c] = plane[i];
+            }
+        }
+        return pixels;
+    }
+
+    /**
+     * @brief Split multi channel pixels into separate channel planes
+     *
+     * @tparam N The number of channels
+     * @tparam C The type of one channel
+     * @param pixels The pixels
+     *
+     * @return std::vector<std::vector<C>> One plane per channel
+     *
+    */
+    template<size_t N, typename C>
+    std::vector<std::vector<C>> deinterleave(const std::vector<std::array<C, N>> &pixels) {
+        std::vector<std::vector<C>> planes(N, std::vector<C>(pixels.size()));
+        for (size_t c = 0; c < N; c++) {
+            C *plane = planes[c].data();
+            for (size_t i = 0; i < pixels.size(); i++) {
+                plane[i] = pixels[i][c];
+            }
+        }
+        return planes;
+    }
+
+}
@@ -1,4 +1,6 @@
 #include "MTLCompute.hpp"
+#include <numeric>
+#include <ranges>
 #include <vector>
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
@@ -75,14 +77,144 @@ TEST_CASE("Test get with returned vector") {
 }
 
 TEST_CASE("Test out of bounds [] operator") {
-    CHECK_THROWS(buffer[11]);
-    CHECK_THROWS(buffer[-1]);
+    // Builds with MTLCOMPUTE_UNCHECKED_ACCESS skip the check on purpose
+    if constexpr (MTLCompute::CHECKED_ACCESS) {
+        CHECK_THROWS(buffer[11]);
+        CHECK_THROWS(buffer[-1]);
+    }
+}
+
+TEST_CASE("Test at and data") {
+    buffer = data;
+    CHECK(buffer.at(3) == 3);
+    CHECK_THROWS(buffer.at(10));
+    CHECK(buffer.data()[9] == 9);
+    CHECK(buffer.data() == buffer.contents());
+}
+
+TEST_CASE("Test standard algorithms") {
+    static_assert(std::ranges::contiguous_range<MTLCompute::Buffer<int>>);
+    static_assert(std::ranges::sized_range<MTLCompute::Buffer<int>>);
+    buffer = {9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
+    std::sort(buffer.begin(), buffer.end());
+    CHECK(buffer.getData() == data);
+    CHECK(std::transform_reduce(buffer.cbegin(), buffer.cend(), 0, std::plus<>(), [](int x) { return x*x; }) == 285);
+    CHECK(std::ranges::max(buffer) == 9);
+
+    MTLCompute::BufferView<int> last = buffer.view(5, 5);
+    std::ranges::reverse(last);
+    CHECK(buffer[5] == 9);
+    CHECK(std::accumulate(last.begin(), last.end(), 0) == 35);
 }
 
 TEST_CASE("Test set with too much data") {
     CHECK_THROWS(buffer = toomuch);
 }
 
+TEST_CASE("Test Shared buffer has no dirty ranges") {
+    buffer[3] = 3;
+    CHECK(buffer.getDirtyRanges().empty());
+}
+
+TEST_CASE("Test Managed dirty range coalescing") {
+    MTLCompute::Buffer<int> managed(gpu, 100, MTLCompute::ResourceStorage::Managed);
+    managed[10] = 1;
+    managed[11] = 2;
+    managed[13] = 3;
+    std::vector<std::pair<size_t, size_t>> expected = {{10*sizeof(int), 12*sizeof(int)}, {13*sizeof(int), 14*sizeof(int)}};
+    CHECK(managed.getDirtyRanges() == expected);
+
+    managed[12] = 4;
+    expected = {{10*sizeof(int), 14*sizeof(int)}};
+    CHECK(managed.getDirtyRanges() == expected);
+
+    managed.span(50, 10)[0] = 5;
+    managed.markDirty(0, 1);
+    expected = {{0, sizeof(int)}, {10*sizeof(int), 14*sizeof(int)}, {50*sizeof(int), 60*sizeof(int)}};
+    CHECK(managed.getDirtyRanges() == expected);
+
+    managed = std::vector<int>(100);
+    expected = {{0, 100*sizeof(int)}};
+    CHECK(managed.getDirtyRanges() == expected);
+
+    managed.flush();
+    CHECK(managed.getDirtyRanges().empty());
+}
+
+TEST_CASE("Test data doesn't mark dirty") {
+    MTLCompute::Buffer<int> managed(gpu, 100, MTLCompute::ResourceStorage::Managed);
+    int *values = managed.data();
+    values[20] = 7;
+    CHECK(managed.getDirtyRanges().empty());
+    managed.markDirty(20, 1);
+    std::vector<std::pair<size_t, size_t>> expected = {{20*sizeof(int), 21*sizeof(int)}};
+    CHECK(managed.getDirtyRanges() == expected);
+
+    managed.contents();
+    expected = {{0, 100*sizeof(int)}};
+    CHECK(managed.getDirtyRanges() == expected);
+}
+
+TEST_CASE("Test dirty ranges are shared between copies") {
+    MTLCompute::Buffer<int> managed(gpu, 10, MTLCompute::ResourceStorage::Managed);
+    MTLCompute::Buffer<int> copy(managed);
+    copy[2] = 2;
+    CHECK(managed.getDirtyRanges().size() == 1);
+    managed.flush();
+    CHECK(copy.getDirtyRanges().empty());
+}
+
+TEST_CASE("Test out of bounds span") {
+    MTLCompute::Buffer<int> managed(gpu, 10, MTLCompute::ResourceStorage::Managed);
+    CHECK_NOTHROW(managed.span(0, 10));
+    CHECK_THROWS(managed.span(5, 6));
+    CHECK_THROWS(managed.markDirty(11, 0));
+}
+
+TEST_CASE("Test view shares memory") {
+    MTLCompute::Buffer<int> big(gpu, 30, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::BufferView<int> middle = big.view(10, 10);
+    REQUIRE(middle.length == 10);
+    REQUIRE(middle.getOffset() == 10);
+    REQUIRE(middle.getBuffer() == big.getBuffer());
+    middle = data;
+    for (int i = 0; i < 10; i++) {
+        CHECK(big[10 + i] == i);
+    }
+    big[15] = 50;
+    CHECK(middle[5] == 50);
+    CHECK(middle.getData()[5] == 50);
+}
+
+TEST_CASE("Test out of bounds view") {
+    MTLCompute::Buffer<int> big(gpu, 30, MTLCompute::ResourceStorage::Shared);
+    CHECK_NOTHROW(big.view(20, 10));
+    CHECK_THROWS(big.view(21, 10));
+    CHECK_THROWS(big.view(10, 10)[10]);
+    CHECK_THROWS(big.view(0, 10) = toomuch);
+}
+
+TEST_CASE("Test partial read and write") {
+    MTLCompute::Buffer<int> managed(gpu, 100, MTLCompute::ResourceStorage::Managed);
+    managed.flush();
+    managed.write(40, data);
+    std::vector<std::pair<size_t, size_t>> expected = {{40*sizeof(int), 50*sizeof(int)}};
+    CHECK(managed.getDirtyRanges() == expected);
+    CHECK(managed.read(42, 3) == std::vector<int>({2, 3, 4}));
+
+    int out[2];
+    managed.read(48, 2, out);
+    CHECK(out[0] == 8);
+    CHECK(out[1] == 9);
+}
+
+TEST_CASE("Test out of bounds partial read and write") {
+    MTLCompute::Buffer<int> small(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    CHECK_NOTHROW(small.read(0, 10));
+    CHECK_THROWS(small.read(5, 6));
+    CHECK_THROWS(small.write(1, data));
+}
+
 TEST_CASE("Test Buffer Destructor") {
     REQUIRE_NOTHROW(buffer.~Buffer());
 }
@@ -93,6 +225,8 @@ TEST_CASE("Double free") {
 
 TEST_CASE("Test freed buffer access") {
     buffer.~Buffer();
-    CHECK_THROWS(buffer[0]);
+    if constexpr (MTLCompute::CHECKED_ACCESS) {
+        CHECK_THROWS(buffer[0]);
+    }
     CHECK_THROWS(buffer = data);
 }
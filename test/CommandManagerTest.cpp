@@ -60,6 +60,60 @@ TEST_CASE("Test double dispatch") {
     manager.resetBuffers();
 }
 
+TEST_CASE("Test dispatch flushes Managed buffers") {
+    MTLCompute::Buffer<float> a(gpu, 10, MTLCompute::ResourceStorage::Managed);
+    MTLCompute::Buffer<float> b(gpu, 10, MTLCompute::ResourceStorage::Managed);
+    MTLCompute::Buffer<float> c(gpu, 10, MTLCompute::ResourceStorage::Managed);
+    manager.loadBuffer(a, 0, MTLCompute::BufferAccess::ReadOnly);
+    manager.loadBuffer(b, 1, MTLCompute::BufferAccess::ReadOnly);
+    manager.loadBuffer(c, 2);
+    a = std::vector<float>(10, 1.0);
+    b[4] = 2.0;
+    manager.dispatch();
+    CHECK(a.getDirtyRanges().empty());
+    CHECK(b.getDirtyRanges().empty());
+    CHECK(c.getData()[0] == 1.0);
+    CHECK(c.getData()[4] == 3.0);
+    manager.resetBuffers();
+}
+
+TEST_CASE("Test dispatch flushes Managed views") {
+    MTLCompute::Buffer<float> big(gpu, 30, MTLCompute::ResourceStorage::Managed);
+    big = std::vector<float>(30, 0.0);
+    big.flush();
+    MTLCompute::BufferView<float> a = big.view(0, 10);
+    a = std::vector<float>(10, 1.0);
+    big.view(10, 10)[4] = 2.0;
+    CHECK(big.getDirtyRanges().size() == 2);
+    manager.loadBuffer(a, 0, MTLCompute::BufferAccess::ReadOnly);
+    manager.loadBuffer(big.view(10, 10), 1, MTLCompute::BufferAccess::ReadOnly);
+    manager.loadBuffer(big.view(20, 10), 2);
+    manager.dispatch();
+    CHECK(big.getDirtyRanges().empty());
+    std::vector<float> c = big.view(20, 10).getData();
+    CHECK(c[0] == 1.0);
+    CHECK(c[4] == 3.0);
+    manager.resetBuffers();
+}
+
+TEST_CASE("Test dispatch with views of one buffer") {
+    MTLCompute::Buffer<float> big(gpu, 30, MTLCompute::ResourceStorage::Shared);
+    big = std::vector<float>(30, 2.0);
+    manager.loadBuffer(big.view(0, 10), 0);
+    manager.loadBuffer(big.view(10, 10), 1);
+    manager.loadBuffer(big.view(20, 10), 2);
+    manager.dispatch();
+    CHECK(big.view(20, 10).getData() == std::vector<float>(10, 4.0));
+    manager.resetBuffers();
+}
+
+TEST_CASE("Test inconsistent size views") {
+    MTLCompute::Buffer<float> big(gpu, 30, MTLCompute::ResourceStorage::Shared);
+    CHECK_NOTHROW(manager.loadBuffer(big.view(0, 10), 0));
+    CHECK_THROWS(manager.loadBuffer(big.view(10, 20), 1));
+    manager.resetBuffers();
+}
+
 TEST_CASE("Test double load buffer on same index") {
     MTLCompute::Buffer<float> bufferone(gpu, 10, MTLCompute::ResourceStorage::Shared);
     MTLCompute::Buffer<float> buffertwo(gpu, 10, MTLCompute::ResourceStorage::Shared);
@@ -90,4 +144,21 @@ TEST_CASE("Test inconsistent size loadTexture") {
     CHECK_NOTHROW(manager.loadTexture(textureone, 0));
     CHECK_THROWS(manager.loadTexture(texturetwo, 1));
     manager.resetTextures();
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test 3D dispatch") {
+    MTLCompute::Kernel volumekernel(gpu, name, "fill_volume");
+    MTLCompute::CommandManager<float> volumemanager(gpu, &volumekernel);
+    MTLCompute::Texture3D<float> volume(gpu, 4, 4, 4);
+    volumemanager.loadTexture(volume, 0);
+    volumemanager.dispatch();
+    CHECK(volume.readSlice(2)[3][1] == 1 + 30 + 200);
+}
+
+TEST_CASE("Test mismatched depth loadTexture") {
+    MTLCompute::Texture3D<float> volume(gpu, 4, 4, 4);
+    MTLCompute::Texture3D<float> other(gpu, 4, 4, 2);
+    CHECK_NOTHROW(manager.loadTexture(volume, 0));
+    CHECK_THROWS(manager.loadTexture(other, 1));
+    manager.resetTextures();
+}
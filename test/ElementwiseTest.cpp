@@ -0,0 +1,153 @@
+#include "MTLCompute.hpp"
+#include "TestUtils.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <cmath>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+
+TEST_CASE("Test expression source") {
+    MTLCompute::Buffer<float> a(gpu, 4, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> b(gpu, 4, MTLCompute::ResourceStorage::Shared);
+    std::string source = MTLCompute::Elementwise<float>::source(a*2.0f + MTLCompute::max(b, 0));
+    CHECK(source.find("#define EXPR ((in0[i] * scalars[0]) + max(in1[i], scalars[1]))") != std::string::npos);
+    CHECK(source.find("#define OUT_INDEX 2") != std::string::npos);
+
+    // The scalar values aren't in the source, so only the shape picks the kernel
+    CHECK(MTLCompute::Elementwise<float>::source(a*3.0f + MTLCompute::max(b, 5)) == source);
+    CHECK(MTLCompute::Elementwise<float>::source(a*a) != MTLCompute::Elementwise<float>::source(a + a));
+}
+
+template<typename T>
+void checkHost() {
+    size_t count = 1000;
+    MTLCompute::Buffer<T> a(gpu, count, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<T> b(gpu, count, MTLCompute::ResourceStorage::Shared);
+    std::vector<T> da = randomData<T>(count, 1, 0, 50);
+    std::vector<T> db = randomData<T>(count, 2, 1, 9);
+    a = da;
+    b = db;
+
+    std::vector<T> out(count);
+    MTLCompute::host::evaluate(a*3 + b, out.data(), count);
+    std::vector<T> expected(count);
+    for (size_t i = 0; i < count; i++) {
+        expected[i] = T(da[i]*3 + db[i]);
+    }
+    CHECK(out == expected);
+
+    MTLCompute::host::evaluate(MTLCompute::min(a - b, 20)*MTLCompute::max(b, 4)/2, out.data(), count);
+    for (size_t i = 0; i < count; i++) {
+        expected[i] = T(std::min<T>(T(da[i] - db[i]), 20)*std::max<T>(db[i], 4)/2);
+    }
+    CHECK(out == expected);
+}
+
+TEST_CASE("Test host expressions") {
+    checkHost<float>();
+    checkHost<int32_t>();
+    checkHost<uint32_t>();
+
+    // Negative numbers and functions only floats have
+    MTLCompute::Buffer<float> a(gpu, 300, MTLCompute::ResourceStorage::Shared);
+    a = randomData<float>(300, 3, -20, 20);
+    std::vector<float> out(300);
+    MTLCompute::host::evaluate(MTLCompute::sqrt(MTLCompute::abs(-a)) + MTLCompute::exp(a/10.0f), out.data(), 300);
+    std::vector<float> expected(300);
+    for (size_t i = 0; i < 300; i++) {
+        expected[i] = std::sqrt(std::abs(a[i])) + std::exp(a[i]/10.0f);
+    }
+    CHECK(out == expected);
+}
+
+template<typename T>
+void checkGPU(MTLCompute::ResourceStorage storage) {
+    MTLCompute::Elementwise<T> elementwise(gpu, 0);
+    // Bigger than a threadgroup and not a multiple of one
+    size_t count = 100003;
+    MTLCompute::Buffer<T> a(gpu, count, storage);
+    MTLCompute::Buffer<T> b(gpu, count, storage);
+    MTLCompute::Buffer<T> c(gpu, count, storage);
+    a = randomData<T>(count, 4, 0, 1000);
+    b = randomData<T>(count, 5, 1, 100);
+    std::vector<T> expected(count);
+
+    MTLCompute::host::evaluate(a*7 + b, expected.data(), count);
+    elementwise.assign(c, a*7 + b);
+    CHECK(c.getData() == expected);
+
+    // Every operator at once, with the same buffer read more than once. Dividing by 4 is exact even with fast math.
+    auto expression = MTLCompute::max(a - b*2, b)/4 + MTLCompute::min(-b, a) + MTLCompute::abs(b - 50)*a;
+    MTLCompute::host::evaluate(expression, expected.data(), count);
+    elementwise.assign(c, expression);
+    CHECK(c.getData() == expected);
+
+    // Writing over an input
+    MTLCompute::host::evaluate(a + c, expected.data(), count);
+    elementwise.assign(c, a + c);
+    CHECK(c.getData() == expected);
+
+    // A plain copy
+    elementwise.assign(c, b);
+    CHECK(c.getData() == b.getData());
+}
+
+TEST_CASE("Test GPU expressions") {
+    for (MTLCompute::ResourceStorage storage : {MTLCompute::ResourceStorage::Shared, MTLCompute::ResourceStorage::Managed}) {
+        checkGPU<float>(storage);
+        checkGPU<int32_t>(storage);
+        checkGPU<uint32_t>(storage);
+    }
+
+    // Fast math can be a little off for these
+    MTLCompute::Elementwise<float> elementwise(gpu, 0);
+    MTLCompute::Buffer<float> a(gpu, 5000, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> c(gpu, 5000, MTLCompute::ResourceStorage::Shared);
+    a = randomData<float>(5000, 6, 1, 100);
+    auto expression = MTLCompute::log(a)*MTLCompute::sin(a) + MTLCompute::pow(a, 0.5f) - MTLCompute::tanh(MTLCompute::cos(a));
+    std::vector<float> expected(5000);
+    MTLCompute::host::evaluate(expression, expected.data(), 5000);
+    elementwise.assign(c, expression);
+    CHECK(countMismatches(c.getData(), expected, 1e-4) == 0);
+}
+
+TEST_CASE("Test host fallback") {
+    // Small buffers and types the GPU can't use both run on the CPU
+    MTLCompute::Elementwise<float> elementwise(gpu);
+    CHECK(elementwise.getHostThreshold() == 1 << 16);
+    MTLCompute::Buffer<float> a(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> c(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    a = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    elementwise.assign(c, a*a - 1);
+    CHECK(c.getData() == std::vector<float>{0, 3, 8, 15, 24, 35, 48, 63, 80, 99});
+
+    MTLCompute::Elementwise<double> doubles(gpu, 0);
+    MTLCompute::Buffer<double> d(gpu, 3, MTLCompute::ResourceStorage::Shared);
+    d = {1.5, 2.5, 3.5};
+    doubles.assign(d, d*2 + 0.25);
+    CHECK(d.getData() == std::vector<double>{3.25, 5.25, 7.25});
+}
+
+TEST_CASE("Test expression errors") {
+    MTLCompute::Elementwise<float> elementwise(gpu);
+    MTLCompute::Buffer<float> a(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> b(gpu, 11, MTLCompute::ResourceStorage::Shared);
+    CHECK_THROWS_AS(elementwise.assign(a, a + b), std::invalid_argument);
+    CHECK_THROWS_AS(elementwise.assign(b, a*2), std::invalid_argument);
+
+    MTLCompute::Elementwise<double> doubles(gpu);
+    MTLCompute::Buffer<double> d(gpu, 10, MTLCompute::ResourceStorage::Private);
+    CHECK_THROWS_AS(doubles.assign(d, d + 1), std::invalid_argument);
+
+    MTLCompute::Buffer<float> empty(gpu, 0, MTLCompute::ResourceStorage::Shared);
+    CHECK_NOTHROW(elementwise.assign(empty, empty*2));
+
+    // A fractional number in an integer expression doesn't compile rather than being truncated
+    CHECK(MTLCompute::isScalarConvertible<float, int>);
+    CHECK(MTLCompute::isScalarConvertible<float, double>);
+    CHECK(MTLCompute::isScalarConvertible<uint32_t, int>);
+    CHECK(!MTLCompute::isScalarConvertible<int32_t, double>);
+    CHECK(!MTLCompute::isScalarConvertible<uint32_t, float>);
+}
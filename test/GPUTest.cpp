@@ -31,4 +31,55 @@ TEST_CASE("Test runKernel") {
     gpu.loadArray(array, 0);
     gpu.loadMatrix(matrix, 0);
     CHECK_NOTHROW(gpu.runKernel());
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test loadMatrix updates textures in place") {
+    gpu.loadKernel("default", "both");
+    gpu.getTexturePool().resetStats();
+    gpu.loadMatrix(matrix, 1);
+    gpu.reset();
+    gpu.loadMatrix(matrix, 1);
+    CHECK(gpu.getTexturePool().getStats().misses == 1);
+    CHECK(gpu.getMatrix(1) == matrix);
+
+    // A different size goes through the pool
+    std::vector<std::vector<float>> wide(10, std::vector<float>(20, 2.0));
+    gpu.reset();
+    gpu.loadMatrix(wide, 1);
+    CHECK(gpu.getMatrix(1) == wide);
+    gpu.reset();
+    gpu.loadMatrix(matrix, 1);
+    CHECK(gpu.getTexturePool().getStats().hits == 1);
+    CHECK(gpu.getMatrix(1) == matrix);
+}
+
+TEST_CASE("Test loadArray reuses buffers") {
+    gpu.loadKernel("default", "add_arrays");
+    std::vector<float> longer(20, 3.0);
+    gpu.loadArray(longer, 2);
+    gpu.reset();
+    gpu.loadArray(array, 2);
+    CHECK(gpu.getArray(2) == array);
+    gpu.reset();
+    gpu.loadArray(longer, 2);
+    CHECK(gpu.getArray(2) == longer);
+}
+
+TEST_CASE("Test readback into existing storage") {
+    gpu.loadKernel("default", "both");
+    gpu.loadArray(array, 0);
+    gpu.loadMatrix(matrix, 0);
+
+    std::vector<float> arrayout(3, 0.0);
+    gpu.getArray(0, arrayout);
+    CHECK(arrayout == array);
+
+    std::vector<std::vector<float>> matrixout(10, std::vector<float>(10, 0.0));
+    const float *row = matrixout[0].data();
+    gpu.getMatrix(0, matrixout);
+    CHECK(matrixout == matrix);
+    CHECK(matrixout[0].data() == row);
+
+    CHECK_THROWS(gpu.getArray(30, arrayout));
+    CHECK_THROWS(gpu.getMatrix(-1, matrixout));
+}
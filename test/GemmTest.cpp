@@ -0,0 +1,168 @@
+#include "MTLCompute.hpp"
+#include "TestUtils.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <array>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+
+// Small multiples of 1/4, so products and sums are exact in float and every input fits in a half
+template<typename T>
+std::vector<T> randomMatrix(size_t count, unsigned seed) {
+    return randomData<T>(count, seed, -8, 8, 0.25f);
+}
+
+// The textbook triple loop
+std::vector<float> naiveGemm(const std::vector<float> &a, const std::vector<float> &b, const std::vector<float> &c,
+                             const MTLCompute::GemmShape &shape) {
+    std::vector<float> out = c;
+    for (size_t batch = 0; batch < shape.batch; batch++) {
+        for (size_t i = 0; i < shape.m; i++) {
+            for (size_t j = 0; j < shape.n; j++) {
+                float sum = 0;
+                for (size_t p = 0; p < shape.k; p++) {
+                    float x = shape.transposeA ? a[batch*shape.strideA + p*shape.m + i] : a[batch*shape.strideA + i*shape.k + p];
+                    float y = shape.transposeB ? b[batch*shape.strideB + j*shape.k + p] : b[batch*shape.strideB + p*shape.n + j];
+                    sum += x*y;
+                }
+                size_t index = batch*shape.strideC + i*shape.n + j;
+                out[index] = shape.alpha*sum + (shape.beta != 0 ? shape.beta*c[index] : 0.0f);
+            }
+        }
+    }
+    return out;
+}
+
+std::vector<MTLCompute::GemmShape> shapes() {
+    std::vector<MTLCompute::GemmShape> shapes;
+    // One tile, ragged edges, K not a multiple of the tile, and more than one host block in every direction
+    for (auto [m, n, k] : {std::array<size_t, 3>{1, 1, 1}, {64, 64, 16}, {37, 70, 19}, {130, 600, 300}}) {
+        MTLCompute::GemmShape shape;
+        shape.m = m;
+        shape.n = n;
+        shape.k = k;
+        shapes.push_back(shape);
+        shape.transposeA = true;
+        shape.transposeB = true;
+        shape.alpha = 0.5f;
+        shape.beta = 2.0f;
+        shapes.push_back(shape);
+    }
+    MTLCompute::GemmShape batched;
+    batched.m = 33;
+    batched.n = 20;
+    batched.k = 45;
+    batched.batch = 3;
+    batched.strideA = 33*45;
+    batched.strideB = 0;
+    batched.strideC = 33*20 + 7;
+    shapes.push_back(batched);
+    return shapes;
+}
+
+template<typename T>
+void checkHost() {
+    for (const MTLCompute::GemmShape &shape : shapes()) {
+        size_t sizeA = (shape.batch - 1)*shape.strideA + shape.m*shape.k;
+        size_t sizeB = (shape.batch - 1)*shape.strideB + shape.k*shape.n;
+        size_t sizeC = (shape.batch - 1)*shape.strideC + shape.m*shape.n;
+        std::vector<T> a = randomMatrix<T>(sizeA, 1);
+        std::vector<T> b = randomMatrix<T>(sizeB, 2);
+        std::vector<T> c = randomMatrix<T>(sizeC, 3);
+        std::vector<float> expected = naiveGemm(std::vector<float>(a.begin(), a.end()), std::vector<float>(b.begin(), b.end()),
+                                                std::vector<float>(c.begin(), c.end()), shape);
+
+        MTLCompute::host::gemm(a.data(), b.data(), c.data(), shape);
+        std::vector<float> result(c.begin(), c.end());
+        std::vector<float> rounded(sizeC);
+        for (size_t i = 0; i < sizeC; i++) {
+            rounded[i] = float(T(expected[i]));
+        }
+        CHECK(result == rounded);
+    }
+}
+
+template<typename T>
+void checkGPU() {
+    MTLCompute::Gemm<T> gemm(gpu);
+    for (bool simd : {false, true}) {
+        if (simd && !gpu->supportsFamily(MTL::GPUFamilyApple7)) {
+            continue;
+        }
+        gemm.setSimdgroupMatrix(simd);
+        for (const MTLCompute::GemmShape &shape : shapes()) {
+            size_t sizeA = (shape.batch - 1)*shape.strideA + shape.m*shape.k;
+            size_t sizeB = (shape.batch - 1)*shape.strideB + shape.k*shape.n;
+            size_t sizeC = (shape.batch - 1)*shape.strideC + shape.m*shape.n;
+            std::vector<T> expected = randomMatrix<T>(sizeC, 3);
+            MTLCompute::Buffer<T> a(gpu, sizeA, MTLCompute::ResourceStorage::Shared);
+            MTLCompute::Buffer<T> b(gpu, sizeB, MTLCompute::ResourceStorage::Shared);
+            MTLCompute::Buffer<T> c(gpu, sizeC, MTLCompute::ResourceStorage::Shared);
+            a = randomMatrix<T>(sizeA, 1);
+            b = randomMatrix<T>(sizeB, 2);
+            c = expected;
+
+            MTLCompute::host::gemm(std::as_const(a).data(), std::as_const(b).data(), expected.data(), shape);
+            gemm.multiply(a, b, c, shape);
+            CHECK(countMismatches(c.getData(), expected) == 0);
+        }
+    }
+}
+
+TEST_CASE("Test host GEMM") {
+    checkHost<float>();
+    checkHost<MTLCompute::half>();
+}
+
+TEST_CASE("Test GPU GEMM") {
+    checkGPU<float>();
+    checkGPU<MTLCompute::half>();
+}
+
+TEST_CASE("Test texture GEMM") {
+    MTLCompute::Gemm<float> gemm(gpu);
+    MTLCompute::Texture<float> a(gpu, 19, 37, MTLCompute::TextureType::float32);
+    MTLCompute::Texture<float> b(gpu, 70, 19, MTLCompute::TextureType::float32);
+    MTLCompute::Texture<float> c(gpu, 70, 37, MTLCompute::TextureType::float32);
+    std::vector<float> da = randomMatrix<float>(37*19, 1);
+    std::vector<float> db = randomMatrix<float>(19*70, 2);
+    a.writeRegion(0, 0, 19, 37, da.data());
+    b.writeRegion(0, 0, 70, 19, db.data());
+
+    MTLCompute::GemmShape shape;
+    shape.m = 37;
+    shape.n = 70;
+    shape.k = 19;
+    shape.alpha = 2.0f;
+    std::vector<float> expected(37*70);
+    MTLCompute::host::gemm(da.data(), db.data(), expected.data(), shape);
+
+    gemm.multiply(a, b, c, 2.0f);
+    std::vector<float> result(37*70);
+    c.readRegion(0, 0, 70, 37, result.data());
+    CHECK(result == expected);
+
+    CHECK_THROWS_AS(gemm.multiply(a, a, c), std::invalid_argument);
+}
+
+TEST_CASE("Test GEMM errors") {
+    MTLCompute::Gemm<float> gemm(gpu);
+    MTLCompute::Buffer<float> a(gpu, 100, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> c(gpu, 50, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::GemmShape shape;
+    shape.m = 10;
+    shape.n = 10;
+    shape.k = 10;
+    CHECK_THROWS_AS(gemm.multiply(a, a, c, shape), std::invalid_argument);
+
+    // The C matrices of a batch can't overlap
+    shape.n = 5;
+    shape.batch = 2;
+    shape.strideC = 10;
+    CHECK_THROWS_AS(gemm.multiply(a, a, c, shape), std::invalid_argument);
+
+    shape.m = 0;
+    CHECK_NOTHROW(gemm.multiply(a, a, c, shape));
+}
@@ -0,0 +1,166 @@
+#include "MTLCompute.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <random>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+
+// One value at a time on one thread
+template<typename C>
+std::vector<uint32_t> naiveHistogram(const C *data, size_t count, int channels, size_t bins, float low, float high) {
+    std::vector<uint32_t> counts(channels*bins, 0);
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < channels; c++) {
+            float x = float(data[i*channels + c]);
+            if (x >= low && x <= high) {
+                counts[c*bins + std::min(bins - 1, (size_t)((x - low)*((float)bins/(high - low))))]++;
+            }
+        }
+    }
+    return counts;
+}
+
+// Floats from a bit below to a bit above the range, with some NaNs
+std::vector<float> randomFloats(size_t count, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.2f, 1.2f);
+    std::vector<float> data(count);
+    for (size_t i = 0; i < count; i++) {
+        data[i] = i % 1000 == 7 ? NAN : dist(rng);
+    }
+    return data;
+}
+
+template<typename T>
+std::vector<T> randomPixels(size_t count, unsigned seed) {
+    using C = typename MTLCompute::PixelFormatTraits<T>::channel_type;
+    constexpr int N = MTLCompute::PixelFormatTraits<T>::channels;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<uint32_t> dist(0, std::numeric_limits<C>::max());
+    std::vector<T> pixels(count);
+    for (T &pixel : pixels) {
+        C channels[N];
+        for (int c = 0; c < N; c++) {
+            channels[c] = C(dist(rng));
+        }
+        memcpy(&pixel, channels, sizeof(T));
+    }
+    return pixels;
+}
+
+TEST_CASE("Test bin edges") {
+    float scale = 10.0f/2.0f;
+    CHECK(MTLCompute::host::binIndex(-1.0f, -1, 1, scale, 10) == 0);
+    CHECK(MTLCompute::host::binIndex(-0.7f, -1, 1, scale, 10) == 1);
+    CHECK(MTLCompute::host::binIndex(0.99f, -1, 1, scale, 10) == 9);
+    CHECK(MTLCompute::host::binIndex(1.0f, -1, 1, scale, 10) == 9);
+    CHECK(MTLCompute::host::binIndex(1.01f, -1, 1, scale, 10) == -1);
+    CHECK(MTLCompute::host::binIndex(-1.01f, -1, 1, scale, 10) == -1);
+    CHECK(MTLCompute::host::binIndex(NAN, -1, 1, scale, 10) == -1);
+}
+
+TEST_CASE("Test host histogram") {
+    // Enough for every CPU thread to get its own bins
+    std::vector<float> data = randomFloats(1000003, 1);
+    std::vector<uint32_t> counts(100);
+    MTLCompute::host::histogram(data.data(), data.size(), 100, -1, 1, counts.data());
+    CHECK(counts == naiveHistogram(data.data(), data.size(), 1, 100, -1, 1));
+
+    using Pixel = std::array<uint8_t, 4>;
+    std::vector<Pixel> pixels = randomPixels<Pixel>(300000, 2);
+    std::vector<uint32_t> channels(4*256);
+    MTLCompute::host::histogram(pixels.data(), pixels.size(), 256, 0, 256, channels.data());
+    CHECK(channels == naiveHistogram(&pixels[0][0], pixels.size(), 4, 256, 0, 256));
+    CHECK(std::accumulate(channels.begin(), channels.begin() + 256, 0u) == 300000);
+
+    std::vector<uint32_t> empty(8, 5);
+    MTLCompute::host::histogram(data.data(), 0, 8, -1, 1, empty.data());
+    CHECK(empty == std::vector<uint32_t>(8, 0));
+}
+
+TEST_CASE("Test GPU buffer histogram") {
+    std::vector<float> data = randomFloats(1000003, 3);
+    MTLCompute::Buffer<float> buffer(gpu, data.size(), MTLCompute::ResourceStorage::Shared);
+    buffer = data;
+
+    // Few bins in threadgroup memory, and too many for it so they go straight to device memory
+    for (size_t bins : {1, 64, 1000, 100000}) {
+        MTLCompute::Histogram<float> histogram(gpu, bins, -1, 1, 0);
+        CHECK(histogram.count(buffer) == naiveHistogram(data.data(), data.size(), 1, bins, -1, 1));
+    }
+
+    // Small buffers are counted on the CPU
+    MTLCompute::Histogram<float> small(gpu, 50, -1, 1);
+    MTLCompute::Buffer<float> few(gpu, 1000, MTLCompute::ResourceStorage::Shared);
+    few = std::vector<float>(data.begin(), data.begin() + 1000);
+    CHECK(small.count(few) == naiveHistogram(data.data(), 1000, 1, 50, -1, 1));
+
+    // Counting a second buffer on top of the first
+    MTLCompute::Histogram<int32_t> histogram(gpu, 16, -50, 50, 0);
+    MTLCompute::Buffer<int32_t> ints(gpu, 100000, MTLCompute::ResourceStorage::Managed);
+    MTLCompute::Buffer<uint32_t> counts(gpu, 16, MTLCompute::ResourceStorage::Managed);
+    std::vector<int32_t> values(100000);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = int32_t(i % 123) - 60;
+    }
+    ints = values;
+    std::vector<uint32_t> expected = naiveHistogram(values.data(), values.size(), 1, 16, -50, 50);
+    histogram.count(ints, counts);
+    CHECK(counts.getData() == expected);
+    histogram.count(ints, counts, true);
+    for (uint32_t &count : expected) {
+        count *= 2;
+    }
+    CHECK(counts.getData() == expected);
+}
+
+template<typename T>
+void checkTexture(size_t bins, float low, float high) {
+    using C = typename MTLCompute::PixelFormatTraits<T>::channel_type;
+    constexpr int N = MTLCompute::PixelFormatTraits<T>::channels;
+    int width = 301, height = 199;
+    std::vector<T> pixels = randomPixels<T>((size_t)width*height, 4);
+    MTLCompute::Texture<T> texture(gpu, width, height);
+    texture.writeRegion(0, 0, width, height, pixels.data());
+
+    MTLCompute::Histogram<T> histogram(gpu, bins, low, high);
+    CHECK(histogram.getChannels() == N);
+    std::vector<uint32_t> result = histogram.count(texture);
+    CHECK(result == naiveHistogram(reinterpret_cast<const C *>(pixels.data()), pixels.size(), N, bins, low, high));
+    std::vector<uint32_t> host(N*bins);
+    MTLCompute::host::histogram(pixels.data(), pixels.size(), bins, low, high, host.data());
+    CHECK(result == host);
+}
+
+TEST_CASE("Test GPU texture histogram") {
+    using RGBA = std::array<uint8_t, 4>;
+    using RG16 = std::array<uint16_t, 2>;
+    checkTexture<uint8_t>(256, 0, 256);
+    checkTexture<uint8_t>(10, 100, 200);
+    checkTexture<RGBA>(256, 0, 256);
+    checkTexture<uint16_t>(256, 0, 65536);
+    checkTexture<uint16_t>(65536, 0, 65536);
+    checkTexture<RG16>(1024, 0, 65536);
+}
+
+TEST_CASE("Test histogram errors") {
+    CHECK_THROWS_AS(MTLCompute::Histogram<float>(gpu, 0, 0, 1), std::invalid_argument);
+    CHECK_THROWS_AS(MTLCompute::Histogram<float>(gpu, 10, 1, 1), std::invalid_argument);
+    CHECK_THROWS_AS(MTLCompute::Histogram<float>(gpu, 10, 0, INFINITY), std::invalid_argument);
+
+    MTLCompute::Histogram<float> histogram(gpu, 10, 0, 1);
+    MTLCompute::Buffer<float> buffer(gpu, 100, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<uint32_t> small(gpu, 9, MTLCompute::ResourceStorage::Shared);
+    CHECK_THROWS_AS(histogram.count(buffer, small), std::invalid_argument);
+
+    MTLCompute::Histogram<uint16_t> shorts(gpu, 10, 0, 1);
+    MTLCompute::Buffer<uint16_t> hidden(gpu, 100, MTLCompute::ResourceStorage::Private);
+    CHECK_THROWS_AS(shorts.count(hidden), std::invalid_argument);
+}
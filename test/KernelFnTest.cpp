@@ -0,0 +1,77 @@
+#include "MTLCompute.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+
+std::string name = "default.metallib";
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+using AddArrays = MTLCompute::KernelFn<const MTLCompute::Buffer<float> &, const MTLCompute::Buffer<float> &, MTLCompute::Buffer<float> &>;
+using Both = MTLCompute::KernelFn<const MTLCompute::Buffer<float> &, MTLCompute::Texture<float> &>;
+using Mixed = MTLCompute::KernelFn<MTLCompute::BufferView<int>, uint32_t, MTLCompute::Texture3D<float> &, MTLCompute::Texture<float> &, MTLCompute::Buffer<int> &>;
+
+// Arity and types are checked at compile time
+static_assert(std::is_invocable_v<AddArrays, MTLCompute::Buffer<float> &, MTLCompute::Buffer<float> &, MTLCompute::Buffer<float> &>);
+static_assert(!std::is_invocable_v<AddArrays, MTLCompute::Buffer<float> &, MTLCompute::Buffer<float> &>);
+static_assert(!std::is_invocable_v<AddArrays, MTLCompute::Buffer<float> &, MTLCompute::Buffer<float> &, MTLCompute::Texture<float> &>);
+static_assert(!std::is_invocable_v<AddArrays, MTLCompute::Buffer<float> &, MTLCompute::Buffer<float> &, const MTLCompute::Buffer<float> &>);
+
+// Buffers and values share buffer indices, textures have their own
+static_assert(Mixed::bufferIndex(0) == 0);
+static_assert(Mixed::bufferIndex(1) == 1);
+static_assert(Mixed::textureIndex(2) == 0);
+static_assert(Mixed::textureIndex(3) == 1);
+static_assert(Mixed::bufferIndex(4) == 2);
+
+static_assert(MTLCompute::KernelArgument<const MTLCompute::Buffer<float> &>::kind == MTLCompute::KernelArgumentKind::Buffer);
+static_assert(MTLCompute::KernelArgument<MTLCompute::Texture2DArray<float> &>::kind == MTLCompute::KernelArgumentKind::Texture);
+static_assert(MTLCompute::KernelArgument<float>::kind == MTLCompute::KernelArgumentKind::Bytes);
+static_assert(MTLCompute::KernelArgument<float *>::kind == MTLCompute::KernelArgumentKind::Unsupported);
+static_assert(MTLCompute::KernelArgument<std::vector<float>>::kind == MTLCompute::KernelArgumentKind::Unsupported);
+static_assert(!MTLCompute::KernelArgument<const MTLCompute::Buffer<float> &>::writable);
+static_assert(MTLCompute::KernelArgument<MTLCompute::Buffer<float> &>::writable);
+
+TEST_CASE("Test call") {
+    MTLCompute::Kernel kernel(gpu, name);
+    kernel.useFunction("add_arrays");
+    AddArrays add(kernel);
+    REQUIRE(add.getKernel() == &kernel);
+
+    MTLCompute::Buffer<float> a(gpu, 5, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> b(gpu, 5, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> c(gpu, 5, MTLCompute::ResourceStorage::Shared);
+    a = {1, 2, 3, 4, 5};
+    b = {5, 4, 3, 2, 1};
+    REQUIRE_NOTHROW(add(a, b, c));
+    CHECK(c.getData() == std::vector<float>(5, 6));
+}
+
+TEST_CASE("Test call with textures and managed buffers") {
+    MTLCompute::Kernel kernel(gpu, name);
+    kernel.useFunction("both");
+    Both both(kernel);
+
+    MTLCompute::Buffer<float> a(gpu, 10, MTLCompute::ResourceStorage::Managed);
+    MTLCompute::Texture<float> b(gpu, 10, 10);
+    a = std::vector<float>(10, 1);
+    REQUIRE_NOTHROW(both(a, b));
+    REQUIRE(a.getDirtyRanges().empty());
+    CHECK(b.getData() == std::vector<std::vector<float>>(10, std::vector<float>(10, 2)));
+}
+
+TEST_CASE("Test run with a grid") {
+    MTLCompute::Kernel kernel(gpu, name);
+    kernel.useFunction("add_arrays");
+    AddArrays add(kernel);
+
+    MTLCompute::Buffer<float> a(gpu, 8, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> b(gpu, 8, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> c(gpu, 8, MTLCompute::ResourceStorage::Shared);
+    REQUIRE_NOTHROW(add.run(MTL::Size::Make(4, 1, 1), a, b, c));
+
+    MTLCompute::Buffer<float> freed(gpu, 8, MTLCompute::ResourceStorage::Shared);
+    freed.~Buffer();
+    if constexpr (MTLCompute::CHECKED_ACCESS) {
+        REQUIRE_THROWS(add(a, b, freed));
+    }
+}
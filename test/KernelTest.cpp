@@ -1,4 +1,5 @@
 #include "MTLCompute.hpp"
+#include "default_metallib.hpp"
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
@@ -19,4 +20,136 @@ TEST_CASE("Test useFunction") {
 
 TEST_CASE("Test faulty useFunction") {
     CHECK_THROWS(kernel.useFunction("doesn't exist"));
-}
\ No newline at end of file
+}
+TEST_CASE("Test function constants") {
+    MTLCompute::FunctionConstants a;
+    a.set(0, 2.0f).set(1, true);
+    MTLCompute::FunctionConstants b;
+    b.set(1, true).set(0, 2.0f);
+    CHECK(a.size() == 2);
+    CHECK(a.hash() == b.hash());
+
+    b.set(0, 3.0f);
+    CHECK(b.size() == 2);
+    CHECK(a.hash() != b.hash());
+
+    MTLCompute::FunctionConstants named;
+    named.set("scale", 2.0f);
+    CHECK(named.hash() != MTLCompute::FunctionConstants().set(0, 2.0f).hash());
+    CHECK_THROWS(named.set("", 1));
+    CHECK_THROWS(named.set(-1, 1));
+}
+
+TEST_CASE("Test specialized useFunction") {
+    MTLCompute::Kernel specialized(gpu, name);
+    MTLCompute::FunctionConstants two = MTLCompute::FunctionConstants().set(0, 2.0f).set(1, false);
+    MTLCompute::FunctionConstants three = MTLCompute::FunctionConstants().set(0, 3.0f).set(1, true);
+
+    specialized.useFunction("scale_array", two);
+    MTL::ComputePipelineState *first = specialized.getPLS();
+    CHECK(specialized.getVariantCount() == 1);
+
+    specialized.useFunction("scale_array", three);
+    CHECK(specialized.getPLS() != first);
+    specialized.useFunction("scale_array", two);
+    CHECK(specialized.getPLS() == first);
+    CHECK(specialized.getVariantCount() == 2);
+
+    MTLCompute::FunctionConstants four = MTLCompute::FunctionConstants().set(0, 4.0f).set(1, true);
+    specialized.precompile({{"scale_array", two}, {"scale_array", four}});
+    CHECK(specialized.getVariantCount() == 3);
+    CHECK(specialized.getPLS() == first);
+}
+
+TEST_CASE("Test kernel from source") {
+    MTLCompute::LibraryCache::setDirectory("");
+    MTLCompute::KernelSource source{"kernel void twice(device float* a [[buffer(0)]], uint i [[thread_position_in_grid]]) { a[i] *= FACTOR; }",
+                                    {{"FACTOR", "2.0"}}};
+    CHECK(source.text().find("#define FACTOR 2.0\n") == 0);
+
+    MTLCompute::LibraryCacheStats before = MTLCompute::LibraryCache::getStats();
+    MTLCompute::Kernel first(gpu, source, "twice");
+    MTLCompute::Kernel second(gpu, source, "twice");
+    MTLCompute::LibraryCacheStats after = MTLCompute::LibraryCache::getStats();
+    CHECK(after.compiles == before.compiles + 1);
+    CHECK(after.memoryHits == before.memoryHits + 1);
+    CHECK(first.getPLS() != nullptr);
+
+    // Macros and options are part of the key
+    MTLCompute::KernelSource other = source;
+    other.macros["FACTOR"] = "3.0";
+    CHECK(other.hash() != source.hash());
+    other = source;
+    other.fastMath = false;
+    CHECK(other.hash() != source.hash());
+}
+
+TEST_CASE("Test disk pipeline cache") {
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "mtlcompute-test-cache";
+    std::filesystem::remove_all(directory);
+    MTLCompute::LibraryCache::setDirectory(directory);
+    CHECK(MTLCompute::LibraryCache::getDirectory() == directory);
+
+    // The first process compiles the pipeline and saves it
+    MTLCompute::KernelSource source{"kernel void triple(device float* a [[buffer(0)]], uint i [[thread_position_in_grid]]) { a[i] *= 3.0; }", {}};
+    MTLCompute::LibraryCacheStats before = MTLCompute::LibraryCache::getStats();
+    {
+        MTLCompute::Kernel first(gpu, source, "triple");
+    }
+    CHECK(MTLCompute::LibraryCache::getStats().diskHits == before.diskHits);
+    // Nothing is written until the cache is saved
+    CHECK(!std::filesystem::exists(directory));
+    MTLCompute::LibraryCache::save();
+    CHECK(!std::filesystem::is_empty(directory));
+
+    // The next one loads it from the archive and it still runs
+    MTLCompute::LibraryCache::clear();
+    before = MTLCompute::LibraryCache::getStats();
+    MTLCompute::Kernel second(gpu, source, "triple");
+    CHECK(MTLCompute::LibraryCache::getStats().diskHits == before.diskHits + 1);
+
+    // Background compiles go through the same archive
+    MTLCompute::LibraryCache::clear();
+    before = MTLCompute::LibraryCache::getStats();
+    MTLCompute::Kernel third(gpu, source);
+    MTLCompute::PipelineBatch batch;
+    batch.add(third, "triple");
+    batch.wait();
+    CHECK(MTLCompute::LibraryCache::getStats().diskHits == before.diskHits + 1);
+
+    std::vector<float> values(100);
+    std::vector<float> expected(100);
+    for (int i = 0; i < 100; i++) {
+        values[i] = i;
+        expected[i] = 3*i;
+    }
+    MTLCompute::Buffer<float> buffer(gpu, values.size(), MTLCompute::ResourceStorage::Shared);
+    buffer = values;
+    MTLCompute::CommandManager<float> manager(gpu, &second);
+    manager.loadBuffer(buffer, 0);
+    manager.dispatch();
+    CHECK(buffer.getData() == expected);
+
+    MTLCompute::LibraryCache::setDirectory("");
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("Test kernel from memory") {
+    MTLCompute::Kernel embedded(gpu, default_metallib, default_metallib_size, "add_arrays");
+    CHECK(embedded.getPLS() != nullptr);
+    CHECK(embedded.getFunctionNames() == kernel.getFunctionNames());
+
+    MTLCompute::Buffer<float> a(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> b(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> c(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    a = std::vector<float>(10, 1.5);
+    b = std::vector<float>(10, 2.0);
+    MTLCompute::CommandManager<float> manager(gpu, &embedded);
+    manager.loadBuffer(a, 0);
+    manager.loadBuffer(b, 1);
+    manager.loadBuffer(c, 2);
+    manager.dispatch();
+    CHECK(c.getData() == std::vector<float>(10, 3.5));
+
+    CHECK_THROWS_AS(MTLCompute::Kernel(gpu, nullptr, 0), std::invalid_argument);
+}
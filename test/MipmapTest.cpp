@@ -0,0 +1,114 @@
+#include "MTLCompute.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <array>
+#include <cmath>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+TEST_CASE("Test level count") {
+    REQUIRE(MTLCompute::mipmapLevelCount(1, 1) == 1);
+    REQUIRE(MTLCompute::mipmapLevelCount(16, 16) == 5);
+    REQUIRE(MTLCompute::mipmapLevelCount(17, 3) == 5);
+    REQUIRE(MTLCompute::mipmapLevelCount(1920, 1080) == 11);
+}
+
+TEST_CASE("Test constructor") {
+    MTLCompute::MipmappedTexture<float> texture(gpu, 16, 8);
+    REQUIRE(texture.getLevels() == 5);
+    REQUIRE(texture.getWidth() == 16);
+    REQUIRE(texture.getHeight() == 8);
+
+    MTLCompute::MipmappedTexture<float> partial(gpu, 16, 8, 3);
+    REQUIRE(partial.getLevels() == 3);
+    REQUIRE_THROWS(MTLCompute::MipmappedTexture<float>(gpu, 16, 8, 6));
+
+    MTLCompute::Texture<float> plain(gpu, 16, 8);
+    REQUIRE(plain.getLevels() == 1);
+}
+
+TEST_CASE("Test level views") {
+    MTLCompute::MipmappedTexture<uint8_t> texture(gpu, 20, 7);
+    MTLCompute::Texture<uint8_t> level1 = texture.level(1);
+    REQUIRE(level1.getWidth() == 10);
+    REQUIRE(level1.getHeight() == 3);
+    MTLCompute::Texture<uint8_t> last = texture.level(texture.getLevels() - 1);
+    REQUIRE(last.getWidth() == 1);
+    REQUIRE(last.getHeight() == 1);
+    REQUIRE_THROWS(texture.level(-1));
+    REQUIRE_THROWS(texture.level(texture.getLevels()));
+}
+
+// Fill level 0, generate the rest, and read every level back
+template<typename T>
+std::vector<std::vector<T>> generate(const std::vector<T> &image, int width, int height) {
+    MTLCompute::MipmappedTexture<T> texture(gpu, width, height);
+    texture.writeRegion(0, 0, width, height, image.data());
+    REQUIRE_NOTHROW(texture.generateMipmaps());
+    std::vector<std::vector<T>> levels;
+    for (int l = 0; l < texture.getLevels(); l++) {
+        MTLCompute::Texture<T> level = texture.level(l);
+        std::vector<T> pixels((size_t)level.getWidth()*level.getHeight());
+        level.readRegion(0, 0, level.getWidth(), level.getHeight(), pixels.data());
+        levels.push_back(pixels);
+    }
+    return levels;
+}
+
+TEST_CASE("Test generateMipmaps") {
+    // Quarters of small whole numbers, so the 2x2 averages are exact in float
+    std::vector<float> floats(16*16);
+    for (size_t i = 0; i < floats.size(); i++) {
+        floats[i] = float(i*7 % 29)/4;
+    }
+    std::vector<std::vector<float>> levels = generate(floats, 16, 16);
+    std::vector<std::vector<float>> expected = MTLCompute::host::buildPyramid(floats, 16, 16);
+    REQUIRE(levels.size() == expected.size());
+    float worst = 0;
+    for (size_t l = 0; l < levels.size(); l++) {
+        REQUIRE(levels[l].size() == expected[l].size());
+        for (size_t i = 0; i < levels[l].size(); i++) {
+            worst = std::max(worst, std::abs(levels[l][i] - expected[l][i]));
+        }
+    }
+    CHECK(worst < 1e-5f);
+
+    // Integer formats go through the kernel, odd sizes clamp at the edges and round the same way
+    std::vector<int16_t> ints(21*13);
+    for (size_t i = 0; i < ints.size(); i++) {
+        ints[i] = int16_t(int(i*131 % 2001) - 1000);
+    }
+    CHECK(generate(ints, 21, 13) == MTLCompute::host::buildPyramid(ints, 21, 13));
+
+    using RGBA = std::array<uint8_t, 4>;
+    std::vector<RGBA> pixels(17*32);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = {uint8_t(i), uint8_t(i*3), uint8_t(i*7), 255};
+    }
+    CHECK(generate(pixels, 17, 32) == MTLCompute::host::buildPyramid(pixels, 17, 32));
+}
+
+TEST_CASE("Test host pyramid") {
+    std::vector<float> image = {1, 2, 3,
+                                4, 5, 6,
+                                7, 8, 9};
+    std::vector<std::vector<float>> pyramid = MTLCompute::host::buildPyramid(image, 3, 3);
+    REQUIRE(pyramid.size() == 2);
+    REQUIRE(pyramid[0] == image);
+    REQUIRE(pyramid[1].size() == 1);
+    CHECK(pyramid[1][0] == doctest::Approx(3.0));
+
+    std::vector<int8_t> ints = {-1, -2, 5, 6};
+    std::vector<std::vector<int8_t>> intpyramid = MTLCompute::host::buildPyramid(ints, 2, 2);
+    CHECK(intpyramid[1][0] == 2);
+
+    std::vector<std::array<uint8_t, 4>> pixels(4*4, {10, 20, 30, 255});
+    pixels[0] = {14, 20, 30, 255};
+    std::vector<std::vector<std::array<uint8_t, 4>>> rgba = MTLCompute::host::buildPyramid(pixels, 4, 4);
+    REQUIRE(rgba.size() == 3);
+    CHECK(rgba[1][0] == std::array<uint8_t, 4>({11, 20, 30, 255}));
+    CHECK(rgba[2][0] == std::array<uint8_t, 4>({10, 20, 30, 255}));
+
+    REQUIRE_THROWS(MTLCompute::host::buildPyramid(image, 3, 2));
+}
@@ -0,0 +1,64 @@
+#include "MTLCompute.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+std::string name = "default.metallib";
+
+
+TEST_CASE("Test compileAsync") {
+    MTLCompute::Kernel kernel(gpu, name);
+    MTLCompute::PipelineHandle handle = kernel.compileAsync("add_arrays");
+    CHECK(handle.getName() == "add_arrays");
+    CHECK(handle.wait() != nullptr);
+    CHECK(handle.ready());
+    CHECK(handle.getMilliseconds() >= 0);
+
+    kernel.useFunction(handle);
+    CHECK(kernel.getPLS() == handle.wait());
+    CHECK(kernel.getVariantCount() == 1);
+
+    // Already compiled, so this is a lookup
+    kernel.useFunction("add_arrays");
+    CHECK(kernel.getPLS() == handle.wait());
+    MTLCompute::PipelineHandle again = kernel.compileAsync("add_arrays");
+    CHECK(again.ready());
+    CHECK(again.getMilliseconds() == 0);
+}
+
+TEST_CASE("Test handle from another kernel") {
+    MTLCompute::Kernel first(gpu, name);
+    MTLCompute::Kernel second(gpu, name);
+    MTLCompute::PipelineHandle handle = first.compileAsync("add_arrays");
+    CHECK_THROWS_AS(second.useFunction(handle), std::invalid_argument);
+    handle.wait();
+}
+
+TEST_CASE("Test PipelineBatch") {
+    MTLCompute::Kernel add(gpu, name);
+    MTLCompute::Kernel both(gpu, name);
+    MTLCompute::Kernel scale(gpu, name);
+
+    MTLCompute::PipelineBatch batch;
+    batch.add(add, "add_arrays");
+    batch.add(both, "both");
+    MTLCompute::PipelineHandle scaled = batch.add(scale, "scale_array", MTLCompute::FunctionConstants().set(0, 2.0f).set(1, false));
+    CHECK(batch.size() == 3);
+
+    batch.wait();
+    CHECK(add.getPLS() != nullptr);
+    CHECK(both.getPLS() != nullptr);
+    CHECK(scale.getPLS() == scaled.wait());
+    CHECK(batch.getMilliseconds() >= 0);
+
+    std::vector<MTLCompute::PipelineTiming> timings = batch.getTimings();
+    REQUIRE(timings.size() == 3);
+    CHECK(timings[0].name == "add_arrays");
+    CHECK(timings[1].name == "both");
+    CHECK(timings[2].name == "scale_array");
+    for (const MTLCompute::PipelineTiming &timing : timings) {
+        CHECK_FALSE(timing.failed);
+        CHECK(timing.milliseconds <= batch.getMilliseconds());
+    }
+}
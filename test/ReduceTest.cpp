@@ -0,0 +1,123 @@
+#include "MTLCompute.hpp"
+#include "TestUtils.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+
+// Whole numbers around zero, shifted up for unsigned types
+template<typename T>
+std::vector<T> reduceData(size_t count, unsigned seed) {
+    return std::is_signed_v<T> ? randomData<T>(count, seed, -1000, 1000) : randomData<T>(count, seed, 0, 2000);
+}
+
+template<typename T>
+void checkHost() {
+    for (size_t count : {1, 7, 1000, 1 << 20}) {
+        std::vector<T> data = reduceData<T>(count, count);
+        T sum = 0;
+        size_t lowest = 0;
+        size_t highest = 0;
+        for (size_t i = 0; i < count; i++) {
+            sum += data[i];
+            lowest = data[i] < data[lowest] ? i : lowest;
+            highest = data[i] > data[highest] ? i : highest;
+        }
+        CHECK(MTLCompute::host::sum(data.data(), count) == sum);
+        CHECK(MTLCompute::host::min(data.data(), count) == data[lowest]);
+        CHECK(MTLCompute::host::max(data.data(), count) == data[highest]);
+        CHECK(MTLCompute::host::argmin(data.data(), count) == lowest);
+        CHECK(MTLCompute::host::argmax(data.data(), count) == highest);
+    }
+    CHECK(MTLCompute::host::sum((const T *)nullptr, 0) == T(0));
+    CHECK_THROWS_AS(MTLCompute::host::min((const T *)nullptr, 0), std::invalid_argument);
+}
+
+template<typename T>
+void checkGPU() {
+    MTLCompute::Reducer<T> reducer(gpu, 0);
+    // One threadgroup, a few, and enough to need the second pass
+    for (size_t count : {1, 31, 1000, 100000, 5000000}) {
+        std::vector<T> data = reduceData<T>(count, count + 1);
+        MTLCompute::Buffer<T> buffer(gpu, count, MTLCompute::ResourceStorage::Shared);
+        buffer = data;
+
+        // Small integers keep float sums exact
+        CHECK(reducer.sum(buffer) == MTLCompute::host::sum(data.data(), count));
+        CHECK(reducer.min(buffer) == MTLCompute::host::min(data.data(), count));
+        CHECK(reducer.max(buffer) == MTLCompute::host::max(data.data(), count));
+        CHECK(reducer.argmin(buffer) == MTLCompute::host::argmin(data.data(), count));
+        CHECK(reducer.argmax(buffer) == MTLCompute::host::argmax(data.data(), count));
+    }
+}
+
+TEST_CASE("Test host reductions") {
+    checkHost<float>();
+    checkHost<int32_t>();
+    checkHost<uint32_t>();
+    checkHost<double>();
+}
+
+TEST_CASE("Test GPU reductions") {
+    checkGPU<float>();
+    checkGPU<int32_t>();
+    checkGPU<uint32_t>();
+}
+
+TEST_CASE("Test argmax ties") {
+    MTLCompute::Reducer<int32_t> reducer(gpu, 0);
+    MTLCompute::Buffer<int32_t> buffer(gpu, 100000, MTLCompute::ResourceStorage::Shared);
+    std::vector<int32_t> data(100000, 1);
+    data[70000] = 5;
+    data[90000] = 5;
+    buffer = data;
+    CHECK(reducer.argmax(buffer) == 70000);
+    CHECK(reducer.argmin(buffer) == 0);
+}
+
+TEST_CASE("Test infinite values") {
+    MTLCompute::Reducer<float> reducer(gpu, 0);
+    MTLCompute::Buffer<float> buffer(gpu, 100000, MTLCompute::ResourceStorage::Shared);
+    float inf = std::numeric_limits<float>::infinity();
+    std::vector<float> positive(100000, inf);
+    std::vector<float> negative(100000, -inf);
+    std::vector<float> mixed(100000, 1.0f);
+    mixed[30000] = -inf;
+    mixed[60000] = inf;
+
+    for (const std::vector<float> &data : {positive, negative, mixed}) {
+        buffer = data;
+        CHECK(MTLCompute::host::argmin(data.data(), data.size()) < data.size());
+        CHECK(MTLCompute::host::argmax(data.data(), data.size()) < data.size());
+        CHECK(reducer.min(buffer) == MTLCompute::host::min(data.data(), data.size()));
+        CHECK(reducer.max(buffer) == MTLCompute::host::max(data.data(), data.size()));
+        CHECK(reducer.argmin(buffer) == MTLCompute::host::argmin(data.data(), data.size()));
+        CHECK(reducer.argmax(buffer) == MTLCompute::host::argmax(data.data(), data.size()));
+    }
+    CHECK(MTLCompute::host::min(positive.data(), positive.size()) == inf);
+    CHECK(MTLCompute::host::max(negative.data(), negative.size()) == -inf);
+    CHECK(MTLCompute::host::argmin(mixed.data(), mixed.size()) == 30000);
+    CHECK(MTLCompute::host::argmax(mixed.data(), mixed.size()) == 60000);
+}
+
+TEST_CASE("Test reducer host fallback") {
+    MTLCompute::Reducer<float> reducer(gpu);
+    CHECK(reducer.getHostThreshold() == 1 << 16);
+    MTLCompute::Buffer<float> small(gpu, 4, MTLCompute::ResourceStorage::Shared);
+    small = {3, 1, 4, 1};
+    CHECK(reducer.sum(small) == 9);
+    CHECK(reducer.argmin(small) == 1);
+
+    MTLCompute::Buffer<float> empty(gpu, 0, MTLCompute::ResourceStorage::Shared);
+    CHECK(reducer.sum(empty) == 0);
+    CHECK_THROWS_AS(reducer.max(empty), std::invalid_argument);
+
+    // Types the kernels aren't compiled for always use the CPU
+    MTLCompute::Reducer<double> doubles(gpu, 0);
+    MTLCompute::Buffer<double> values(gpu, 3, MTLCompute::ResourceStorage::Shared);
+    values = {0.5, 2.5, 1.0};
+    CHECK(doubles.max(values) == 2.5);
+    CHECK(doubles.argmax(values) == 1);
+}
@@ -0,0 +1,112 @@
+#include "MTLCompute.hpp"
+#include "TestUtils.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <algorithm>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+
+// Small whole numbers, so float sums are exact no matter what order they're added in
+template<typename T>
+std::vector<T> scanData(size_t count, unsigned seed) {
+    return std::is_signed_v<T> ? randomData<T>(count, seed, -7, 8) : randomData<T>(count, seed, 0, 15);
+}
+
+template<typename T>
+void checkHost() {
+    for (size_t count : {0, 1, 5, 1000, 4097, 1 << 20}) {
+        std::vector<T> data = scanData<T>(count, count);
+        std::vector<T> expected(count);
+        std::vector<T> result(count);
+
+        std::inclusive_scan(data.begin(), data.end(), expected.begin());
+        MTLCompute::host::inclusiveScan(data.data(), result.data(), count);
+        CHECK(result == expected);
+
+        std::exclusive_scan(data.begin(), data.end(), expected.begin(), T(0));
+        MTLCompute::host::exclusiveScan(data.data(), result.data(), count);
+        CHECK(result == expected);
+
+        // In place
+        result = data;
+        MTLCompute::host::exclusiveScan(result.data(), result.data(), count);
+        CHECK(result == expected);
+
+        auto positive = [](T x) { return x > T(3); };
+        std::vector<T> selected;
+        std::copy_if(data.begin(), data.end(), std::back_inserter(selected), positive);
+        size_t kept = MTLCompute::host::selectIf(data.data(), result.data(), count, positive);
+        REQUIRE(kept == selected.size());
+        CHECK(std::equal(selected.begin(), selected.end(), result.begin()));
+
+        expected = data;
+        std::stable_partition(expected.begin(), expected.end(), positive);
+        CHECK(MTLCompute::host::partition(data.data(), result.data(), count, positive) == kept);
+        CHECK(result == expected);
+    }
+}
+
+template<typename T>
+void checkGPU() {
+    MTLCompute::Scanner<T> scanner(gpu);
+    // One block, one block and a bit, one level of block sums, and two levels. Float sums
+    // of 20M values pass 2^24 where they stop being exact, so only integers go that far
+    std::vector<size_t> counts = {1, 1000, 4097, 1 << 20};
+    if (std::is_integral_v<T>) {
+        counts.push_back(20000000);
+    }
+    for (size_t count : counts) {
+        std::vector<T> data = scanData<T>(count, count + 1);
+        std::vector<T> expected(count);
+        MTLCompute::Buffer<T> buffer(gpu, count, MTLCompute::ResourceStorage::Shared);
+        MTLCompute::Buffer<T> out(gpu, count, MTLCompute::ResourceStorage::Shared);
+
+        buffer = data;
+        MTLCompute::host::inclusiveScan(data.data(), expected.data(), count);
+        scanner.inclusiveScan(buffer, out);
+        CHECK(out.getData() == expected);
+        scanner.inclusiveScan(buffer);
+        CHECK(buffer.getData() == expected);
+
+        buffer = data;
+        MTLCompute::host::exclusiveScan(data.data(), expected.data(), count);
+        scanner.exclusiveScan(buffer);
+        CHECK(buffer.getData() == expected);
+
+        buffer = data;
+        size_t kept = MTLCompute::host::partition(data.data(), expected.data(), count, [](T x) { return x > T(3); });
+        CHECK(scanner.partition(buffer, out, "x > 3") == kept);
+        CHECK(out.getData() == expected);
+        CHECK(scanner.selectIf(buffer, "x > 3") == kept);
+        std::vector<T> selected = buffer.getData();
+        CHECK(std::equal(expected.begin(), expected.begin() + kept, selected.begin()));
+        CHECK(std::equal(data.begin() + kept, data.end(), selected.begin() + kept));
+    }
+}
+
+TEST_CASE("Test host scan and compaction") {
+    checkHost<float>();
+    checkHost<int32_t>();
+    checkHost<uint32_t>();
+    checkHost<double>();
+}
+
+TEST_CASE("Test GPU scan and compaction") {
+    checkGPU<float>();
+    checkGPU<int32_t>();
+    checkGPU<uint32_t>();
+}
+
+TEST_CASE("Test scan errors") {
+    MTLCompute::Scanner<float> scanner(gpu);
+    MTLCompute::Buffer<float> big(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> small(gpu, 5, MTLCompute::ResourceStorage::Shared);
+    CHECK_THROWS_AS(scanner.inclusiveScan(big, small), std::invalid_argument);
+    CHECK_THROWS_AS(scanner.selectIf(big, big, "x > 0"), std::invalid_argument);
+
+    MTLCompute::Buffer<float> empty(gpu, 0, MTLCompute::ResourceStorage::Shared);
+    CHECK_NOTHROW(scanner.exclusiveScan(empty));
+    CHECK(scanner.selectIf(empty, "x > 0") == 0);
+}
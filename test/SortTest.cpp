@@ -0,0 +1,170 @@
+#include "MTLCompute.hpp"
+#include "TestUtils.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+
+// Few distinct keys so there are lots of ties to keep in order, plus the extremes of the type
+template<typename K>
+std::vector<K> randomKeys(size_t count, unsigned seed) {
+    if constexpr (std::is_floating_point_v<K>) {
+        return randomData<K>(count, seed, -1000, 1000, 0.125f);
+    }
+    std::vector<K> keys = randomData<K>(count, seed, std::is_signed_v<K> ? -1000 : 0, std::is_signed_v<K> ? 1000 : 2000);
+    for (size_t i = 0; i < count; i += 16) {
+        keys[i] = i % 32 == 0 ? std::numeric_limits<K>::max() : std::numeric_limits<K>::min();
+    }
+    return keys;
+}
+
+// The expected result, from a stable sort of the keys with their original indices
+template<typename K>
+void expectedSort(const std::vector<K> &keys, std::vector<K> &sortedKeys, std::vector<uint32_t> &sortedIndices) {
+    sortedIndices.resize(keys.size());
+    std::iota(sortedIndices.begin(), sortedIndices.end(), 0);
+    std::stable_sort(sortedIndices.begin(), sortedIndices.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    sortedKeys.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        sortedKeys[i] = keys[sortedIndices[i]];
+    }
+}
+
+template<typename K>
+void checkHost() {
+    for (size_t count : {0, 1, 2, 1000, 4097, 1 << 20}) {
+        std::vector<K> keys = randomKeys<K>(count, count);
+        std::vector<K> expected;
+        std::vector<uint32_t> indices;
+        expectedSort(keys, expected, indices);
+
+        std::vector<K> result = keys;
+        MTLCompute::host::radixSort(result.data(), count);
+        CHECK(result == expected);
+
+        result = keys;
+        std::vector<uint32_t> values(count);
+        std::iota(values.begin(), values.end(), 0);
+        MTLCompute::host::radixSort(result.data(), values.data(), count);
+        CHECK(result == expected);
+        CHECK(values == indices);
+    }
+}
+
+template<typename K>
+void checkGPU() {
+    MTLCompute::RadixSorter<K> sorter(gpu, 0);
+    // One block, a partial block, many blocks, and enough blocks for two levels of scan
+    for (size_t count : {2, 1000, 2049, 1 << 20, 20000000}) {
+        std::vector<K> keys = randomKeys<K>(count, count + 1);
+        std::vector<K> expected;
+        std::vector<uint32_t> indices;
+        expectedSort(keys, expected, indices);
+
+        MTLCompute::Buffer<K> buffer(gpu, count, MTLCompute::ResourceStorage::Shared);
+        buffer = keys;
+        sorter.sort(buffer);
+        CHECK(buffer.getData() == expected);
+
+        buffer = keys;
+        std::vector<uint32_t> iota(count);
+        std::iota(iota.begin(), iota.end(), 0);
+        MTLCompute::Buffer<uint32_t> values(gpu, count, MTLCompute::ResourceStorage::Shared);
+        values = iota;
+        sorter.sort(buffer, values);
+        CHECK(buffer.getData() == expected);
+        CHECK(values.getData() == indices);
+    }
+}
+
+TEST_CASE("Test host radix sort") {
+    checkHost<uint32_t>();
+    checkHost<int32_t>();
+    checkHost<float>();
+    checkHost<uint64_t>();
+    checkHost<int64_t>();
+    checkHost<double>();
+}
+
+TEST_CASE("Test host radix sort float order") {
+    std::vector<float> keys = {1.0f, -0.0f, -2.5f, std::numeric_limits<float>::infinity(), 0.0f,
+                               -std::numeric_limits<float>::infinity(), 1e-30f, -1e-30f};
+    std::vector<float> expected = {-std::numeric_limits<float>::infinity(), -2.5f, -1e-30f, -0.0f, 0.0f, 1e-30f, 1.0f,
+                                   std::numeric_limits<float>::infinity()};
+    MTLCompute::host::radixSort(keys.data(), keys.size());
+    CHECK(keys == expected);
+    CHECK(std::signbit(keys[3]));
+    CHECK(!std::signbit(keys[4]));
+}
+
+TEST_CASE("Test GPU radix sort") {
+    checkGPU<uint32_t>();
+    checkGPU<int32_t>();
+    checkGPU<float>();
+    checkGPU<uint64_t>();
+    checkGPU<int64_t>();
+    checkGPU<double>();
+}
+
+TEST_CASE("Test radix sort fallback") {
+    // Below the threshold the host sort is used, including for values the GPU can't move
+    MTLCompute::RadixSorter<int32_t> sorter(gpu);
+    CHECK(sorter.getHostThreshold() == 1 << 16);
+    std::vector<int32_t> keys = randomKeys<int32_t>(1000, 3);
+    std::vector<int32_t> expected;
+    std::vector<uint32_t> indices;
+    expectedSort(keys, expected, indices);
+
+    MTLCompute::Buffer<int32_t> buffer(gpu, keys.size(), MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<uint16_t> values(gpu, keys.size(), MTLCompute::ResourceStorage::Shared);
+    buffer = keys;
+    for (size_t i = 0; i < keys.size(); i++) {
+        values[i] = (uint16_t)i;
+    }
+    sorter.sort(buffer, values);
+    CHECK(buffer.getData() == expected);
+    for (size_t i = 0; i < keys.size(); i++) {
+        CHECK(values[i] == indices[i]);
+    }
+}
+
+TEST_CASE("Test radix sort fallback flushes Managed buffers") {
+    // Sorted on the CPU, so the GPU only sees the result if the buffer gets flushed
+    MTLCompute::RadixSorter<uint32_t> sorter(gpu);
+    std::vector<uint32_t> keys = randomKeys<uint32_t>(1000, 4);
+    std::vector<uint32_t> expected;
+    std::vector<uint32_t> indices;
+    expectedSort(keys, expected, indices);
+
+    MTLCompute::Buffer<uint32_t> buffer(gpu, keys.size(), MTLCompute::ResourceStorage::Managed);
+    buffer = keys;
+    buffer.flush();
+    sorter.sort(buffer);
+    CHECK(buffer.getDirtyRanges() == std::vector<std::pair<size_t, size_t>>{{0, keys.size()*sizeof(uint32_t)}});
+
+    // Read the keys back through a kernel
+    MTLCompute::Elementwise<uint32_t> copy(gpu, 0);
+    MTLCompute::Buffer<uint32_t> out(gpu, keys.size(), MTLCompute::ResourceStorage::Managed);
+    copy.assign(out, buffer);
+    CHECK(out.getData() == expected);
+}
+
+TEST_CASE("Test radix sort errors") {
+    MTLCompute::RadixSorter<float> sorter(gpu);
+    MTLCompute::Buffer<float> keys(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Buffer<float> values(gpu, 5, MTLCompute::ResourceStorage::Shared);
+    CHECK_THROWS_AS(sorter.sort(keys, values), std::invalid_argument);
+
+    MTLCompute::Buffer<uint16_t> small(gpu, 10, MTLCompute::ResourceStorage::Private);
+    MTLCompute::Buffer<float> privateKeys(gpu, 10, MTLCompute::ResourceStorage::Private);
+    CHECK_THROWS_AS(sorter.sort(privateKeys, small), std::invalid_argument);
+
+    MTLCompute::Buffer<float> empty(gpu, 0, MTLCompute::ResourceStorage::Shared);
+    CHECK_NOTHROW(sorter.sort(empty));
+}
@@ -0,0 +1,141 @@
+#include "MTLCompute.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+const MTLCompute::BorderMode borders[] = {MTLCompute::BorderMode::Clamp, MTLCompute::BorderMode::Mirror, MTLCompute::BorderMode::Zero};
+
+
+// Small whole numbers, and weights that are multiples of 1/16, so every sum is exact
+template<typename T>
+std::vector<T> randomImage(int width, int height, unsigned seed) {
+    using C = typename MTLCompute::PixelFormatTraits<T>::channel_type;
+    constexpr int N = MTLCompute::PixelFormatTraits<T>::channels;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> dist(0, 100);
+    std::vector<T> image((size_t)width*height);
+    for (T &pixel : image) {
+        C channels[N];
+        for (int c = 0; c < N; c++) {
+            channels[c] = C(float(dist(rng)));
+        }
+        memcpy(&pixel, channels, sizeof(T));
+    }
+    return image;
+}
+
+TEST_CASE("Test border modes") {
+    // Weights that pick the pixel two to the right show what's read past the edge
+    std::vector<float> row = {1, 2, 3, 4, 5};
+    std::vector<float> shift = {0, 0, 0, 0, 1};
+    std::vector<float> out(5);
+    MTLCompute::host::convolveSeparable(row.data(), out.data(), 5, 1, shift, {1}, MTLCompute::BorderMode::Clamp);
+    CHECK(out == std::vector<float>{3, 4, 5, 5, 5});
+    MTLCompute::host::convolveSeparable(row.data(), out.data(), 5, 1, shift, {1}, MTLCompute::BorderMode::Mirror);
+    CHECK(out == std::vector<float>{3, 4, 5, 4, 3});
+    MTLCompute::host::convolveSeparable(row.data(), out.data(), 5, 1, shift, {1}, MTLCompute::BorderMode::Zero);
+    CHECK(out == std::vector<float>{3, 4, 5, 0, 0});
+
+    // Mirroring keeps bouncing when the radius is bigger than the image
+    CHECK(MTLCompute::host::borderIndex(-7, 3, MTLCompute::BorderMode::Mirror) == 1);
+    CHECK(MTLCompute::host::borderIndex(9, 3, MTLCompute::BorderMode::Mirror) == 1);
+    CHECK(MTLCompute::host::borderIndex(-3, 1, MTLCompute::BorderMode::Mirror) == 0);
+}
+
+TEST_CASE("Test host separable matches square") {
+    std::vector<float> rows = {0.25f, 0.5f, 0.25f};
+    std::vector<float> columns = {0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f};
+    std::vector<float> square;
+    // The row weights go in the middle row of a 5x5 stencil
+    for (int i = 0; i < 5; i++) {
+        square.insert(square.end(), {0, columns[i]*rows[0], columns[i]*rows[1], columns[i]*rows[2], 0});
+    }
+    std::vector<std::array<uint8_t, 4>> image = randomImage<std::array<uint8_t, 4>>(23, 17, 1);
+    std::vector<std::array<uint8_t, 4>> a(image.size());
+    std::vector<std::array<uint8_t, 4>> b(image.size());
+    for (MTLCompute::BorderMode border : borders) {
+        MTLCompute::host::convolveSeparable(image.data(), a.data(), 23, 17, rows, columns, border);
+        MTLCompute::host::convolve(image.data(), b.data(), 23, 17, 2, square, border);
+        CHECK(a == b);
+    }
+}
+
+TEST_CASE("Test host stencil rounding") {
+    // Sobel on an 8 bit image: negative edges clamp to 0 and big ones to 255
+    std::vector<uint8_t> image = {0, 0, 255, 255, 0, 0, 255, 255, 0, 0, 255, 255};
+    std::vector<uint8_t> out(image.size());
+    MTLCompute::host::convolveSeparable(image.data(), out.data(), 4, 3, {-1, 0, 1}, {1, 2, 1});
+    CHECK(out == std::vector<uint8_t>{0, 255, 255, 0, 0, 255, 255, 0, 0, 255, 255, 0});
+
+    // Halves round to even
+    std::vector<int16_t> odd = {1, 2, 3};
+    std::vector<int16_t> halved(3);
+    MTLCompute::host::convolveSeparable(odd.data(), halved.data(), 3, 1, {0.5f}, {1});
+    CHECK(halved == std::vector<int16_t>{0, 1, 2});
+}
+
+template<typename T>
+void checkGPU() {
+    int width = 53, height = 37;
+    std::vector<T> image = randomImage<T>(width, height, 2);
+    std::vector<T> expected(image.size());
+    std::vector<T> result(image.size());
+    MTLCompute::Texture<T> in(gpu, width, height);
+    MTLCompute::Texture<T> out(gpu, width, height);
+    in.writeRegion(0, 0, width, height, image.data());
+
+    std::vector<float> blur = {0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f};
+    std::vector<float> sobel = {-1, 0, 1};
+    std::vector<float> laplace = {0, 1, 0, 1, -4, 1, 0, 1, 0};
+    for (MTLCompute::BorderMode border : borders) {
+        MTLCompute::Stencil<T> separable(gpu, blur, sobel, border);
+        MTLCompute::host::convolveSeparable(image.data(), expected.data(), width, height, blur, sobel, border);
+        separable.apply(in, out);
+        out.readRegion(0, 0, width, height, result.data());
+        CHECK(result == expected);
+
+        MTLCompute::Stencil<T> square(gpu, 1, laplace, border);
+        MTLCompute::host::convolve(image.data(), expected.data(), width, height, 1, laplace, border);
+        square.apply(in, out);
+        out.readRegion(0, 0, width, height, result.data());
+        CHECK(result == expected);
+    }
+
+    // A radius bigger than a tile, with the halo going past both edges
+    std::vector<float> wideWeights(41, 1.0f/64);
+    MTLCompute::Stencil<T> wide(gpu, wideWeights, {1}, MTLCompute::BorderMode::Mirror);
+    MTLCompute::host::convolveSeparable(image.data(), expected.data(), width, height, wideWeights, {1}, MTLCompute::BorderMode::Mirror);
+    wide.apply(in, out);
+    out.readRegion(0, 0, width, height, result.data());
+    CHECK(result == expected);
+}
+
+TEST_CASE("Test GPU stencil") {
+    checkGPU<float>();
+    checkGPU<uint8_t>();
+    checkGPU<int16_t>();
+    checkGPU<std::array<uint8_t, 4>>();
+    checkGPU<std::array<float, 2>>();
+}
+
+TEST_CASE("Test stencil errors") {
+    CHECK_THROWS_AS(MTLCompute::Stencil<float>(gpu, 1, {1, 2, 3}), std::invalid_argument);
+    CHECK_THROWS_AS(MTLCompute::Stencil<float>(gpu, {1, 1}, {1}), std::invalid_argument);
+    CHECK_THROWS_AS(MTLCompute::Stencil<float>(gpu, {1}, {NAN}), std::invalid_argument);
+    // The tile and halo don't fit in threadgroup memory
+    using Pixel = std::array<float, 4>;
+    CHECK_THROWS_AS(MTLCompute::Stencil<Pixel>(gpu, 20, std::vector<float>(41*41, 0)), std::invalid_argument);
+    CHECK(MTLCompute::gaussianWeights(3, 1.5f).size() == 7);
+
+    MTLCompute::Stencil<float> stencil(gpu, MTLCompute::boxWeights(1), MTLCompute::boxWeights(1));
+    MTLCompute::Texture<float> a(gpu, 8, 8);
+    MTLCompute::Texture<float> b(gpu, 8, 4);
+    CHECK_THROWS_AS(stencil.apply(a, b), std::invalid_argument);
+    CHECK_THROWS_AS(stencil.apply(a, a), std::invalid_argument);
+}
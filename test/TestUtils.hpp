@@ -0,0 +1,60 @@
+#include "MTLCompute.hpp"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#pragma once
+
+
+/**
+ * @brief Random whole numbers, optionally scaled
+ *
+ * Small whole numbers (or small multiples of a power of two) keep sums and
+ * products exact on both the CPU and the GPU, whatever order they're done in
+ *
+ * @param count The number of values
+ * @param seed The seed for the generator
+ * @param low The smallest whole number
+ * @param high The largest whole number
+ * @param scale What every whole number is multiplied by
+ *
+ * @return std::vector<T> The values
+ *
+*/
+template<typename T>
+std::vector<T> randomData(size_t count, unsigned seed, int low, int high, float scale = 1.0f) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> dist(low, high);
+    std::vector<T> data(count);
+    for (T &value : data) {
+        value = scale == 1.0f ? T(dist(rng)) : T(dist(rng)*scale);
+    }
+    return data;
+}
+
+/**
+ * @brief Count the values that are further from what's expected than a relative tolerance
+ *
+ * One count instead of a check per value, so a wrong result doesn't flood the output
+ *
+ * @param result The values to check
+ * @param expected The values they should be
+ * @param tolerance How far off a value can be, relative to the expected value (or 1 if that's smaller)
+ *
+ * @return size_t The number of values that are too far off, or every value if the sizes differ
+ *
+*/
+template<typename T>
+size_t countMismatches(const std::vector<T> &result, const std::vector<T> &expected, double tolerance = 0) {
+    if (result.size() != expected.size()) {
+        return std::max(result.size(), expected.size());
+    }
+    size_t wrong = 0;
+    for (size_t i = 0; i < result.size(); i++) {
+        double x = double(result[i]);
+        double y = double(expected[i]);
+        wrong += !(std::abs(x - y) <= tolerance*std::max(1.0, std::abs(y)));
+    }
+    return wrong;
+}
@@ -0,0 +1,85 @@
+#include "MTLCompute.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+
+TEST_CASE("Test acquire") {
+    MTLCompute::TexturePool pool(gpu);
+    MTLCompute::Texture<float> texture = pool.acquire<float>(10, 20);
+    REQUIRE(texture.getWidth() == 10);
+    REQUIRE(texture.getHeight() == 20);
+    REQUIRE(texture.getGPU() == gpu);
+    REQUIRE(texture.getTexture() != nullptr);
+    REQUIRE(pool.getStats().misses == 1);
+    REQUIRE(pool.getStats().hits == 0);
+    REQUIRE_THROWS(pool.acquire<float>(0, 10));
+    REQUIRE_THROWS(pool.acquire<float>(20000, 10));
+}
+
+TEST_CASE("Test reuse") {
+    MTLCompute::TexturePool pool(gpu);
+    MTLCompute::Texture<float> first = pool.acquire<float>(16, 16);
+    MTL::Texture *mtltexture = first.getTexture();
+    pool.recycle(first);
+    REQUIRE(pool.getStats().idleCount == 1);
+    REQUIRE(pool.getStats().idleBytes == 16*16*sizeof(float));
+
+    // Different format, size or usage is a different key
+    MTLCompute::Texture<int32_t> other = pool.acquire<int32_t>(16, 16);
+    MTLCompute::Texture<float> bigger = pool.acquire<float>(32, 16);
+    MTLCompute::Texture<float> readonly = pool.acquire<float>(16, 16, MTL::TextureUsageShaderRead);
+    REQUIRE(pool.getStats().hits == 0);
+
+    MTLCompute::Texture<float> second = pool.acquire<float>(16, 16);
+    REQUIRE(second.getTexture() == mtltexture);
+    REQUIRE(pool.getStats().hits == 1);
+    REQUIRE(pool.getStats().misses == 4);
+    REQUIRE(pool.getStats().idleCount == 0);
+    REQUIRE(pool.getStats().hitRate() == doctest::Approx(0.2));
+}
+
+TEST_CASE("Test eviction") {
+    MTLCompute::TexturePool pool(gpu, 3*8*8*sizeof(float));
+    std::vector<MTLCompute::Texture<float>> textures;
+    for (int i = 0; i < 4; i++) {
+        textures.push_back(pool.acquire<float>(8, 8));
+    }
+    MTL::Texture *oldest = textures[0].getTexture();
+    MTL::Texture *newest = textures[3].getTexture();
+    for (MTLCompute::Texture<float> &texture : textures) {
+        pool.recycle(texture);
+    }
+
+    // The first one recycled is the least recently used
+    REQUIRE(pool.getStats().evictions == 1);
+    REQUIRE(pool.getStats().idleCount == 3);
+    REQUIRE(pool.getStats().idleBytes <= pool.getBudget());
+    MTLCompute::Texture<float> reused = pool.acquire<float>(8, 8);
+    REQUIRE(reused.getTexture() == newest);
+    REQUIRE(reused.getTexture() != oldest);
+
+    pool.setBudget(0);
+    REQUIRE(pool.getStats().idleCount == 0);
+    REQUIRE(pool.getStats().evictions == 3);
+
+    pool.resetStats();
+    REQUIRE(pool.getStats().hits == 0);
+    REQUIRE(pool.getStats().misses == 0);
+    REQUIRE(pool.getStats().evictions == 0);
+}
+
+TEST_CASE("Test recycle invalid textures") {
+    MTLCompute::TexturePool pool(gpu);
+    MTLCompute::Texture<float> empty;
+    REQUIRE_THROWS(pool.recycle(empty));
+
+    size_t pitch = MTLCompute::Texture<float>::alignedPitch(gpu, 8);
+    MTLCompute::Buffer<float> buffer(gpu, pitch*8, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Texture<float> aliased(buffer, 8, 8);
+    REQUIRE_THROWS(pool.recycle(aliased));
+
+    MTLCompute::Texture3D<float> volume(gpu, 8, 8, 8);
+    REQUIRE_THROWS(pool.recycle(volume));
+}
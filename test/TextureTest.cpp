@@ -1,4 +1,5 @@
 #include "MTLCompute.hpp"
+#include <algorithm>
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
@@ -38,6 +39,35 @@ TEST_CASE("Test default constructor") {
     REQUIRE(other.getFreed() == false);
 }
 
+TEST_CASE("Test copies and moves keep the texture alive") {
+    MTLCompute::Texture<float> original(gpu, 4, 4, MTLCompute::TextureType::float32);
+    MTL::Texture *mtltexture = original.getTexture();
+    NS::UInteger count = mtltexture->retainCount();
+
+    // A copy holds its own reference
+    MTLCompute::Texture<float> copy(original);
+    CHECK(mtltexture->retainCount() == count + 1);
+    MTLCompute::Texture<float> assigned;
+    assigned = original;
+    CHECK(mtltexture->retainCount() == count + 2);
+
+    // A move takes the reference over and leaves the source empty
+    MTLCompute::Texture<float> moved(std::move(copy));
+    CHECK(mtltexture->retainCount() == count + 2);
+    CHECK(copy.getTexture() == nullptr);
+    CHECK(moved.getTexture() == mtltexture);
+    assigned = std::move(moved);
+    CHECK(moved.getTexture() == nullptr);
+    CHECK(assigned.getTexture() == mtltexture);
+
+    // Built in place in a vector, no temporary to release it
+    std::vector<MTLCompute::Texture<float>> textures;
+    textures.emplace_back(gpu, 4, 4, MTLCompute::TextureType::float32);
+    textures.push_back(MTLCompute::Texture<float>(gpu, 4, 4, MTLCompute::TextureType::float32));
+    CHECK(textures[0].getTexture()->retainCount() == count);
+    CHECK(textures[1].getTexture()->retainCount() == count);
+}
+
 TEST_CASE("Test set with vector") {
     REQUIRE_NOTHROW(texture = data);
     REQUIRE(texture.getWidth() == 10);
@@ -80,6 +110,49 @@ TEST_CASE("Test get item with [] operator") {
 }
 
 
+TEST_CASE("Test write and read region") {
+    texture = data;
+    std::vector<std::vector<float>> patch = {{2.0, 3.0, 4.0}, {5.0, 6.0, 7.0}};
+    texture.writeRegion(4, 6, patch);
+    CHECK(texture.readRegion(4, 6, 3, 2) == patch);
+    CHECK(texture[6][3] == 1.0);
+    CHECK(texture[6][4] == 2.0);
+    CHECK(texture[7][6] == 7.0);
+
+    float corner[4];
+    texture.readRegion(3, 5, 2, 2, corner);
+    CHECK(corner[0] == 1.0);
+    CHECK(corner[3] == 2.0);
+}
+
+TEST_CASE("Test out of bounds region") {
+    CHECK_NOTHROW(texture.readRegion(0, 0, 10, 10));
+    // Builds with MTLCOMPUTE_UNCHECKED_ACCESS skip the checks on purpose
+    if constexpr (MTLCompute::CHECKED_ACCESS) {
+        CHECK_THROWS(texture.readRegion(5, 5, 6, 1));
+        CHECK_THROWS(texture.writeRegion(9, 9, data));
+        CHECK_THROWS(texture[10]);
+    }
+}
+
+TEST_CASE("Test mirror row iterators") {
+    texture = data;
+    MTLCompute::TextureMirror<float> mirror(texture);
+    CHECK(mirror.size() == 10);
+    CHECK(std::distance(mirror.begin(), mirror.end()) == 10);
+    int y = 0;
+    for (std::span<float> row : mirror) {
+        std::fill(row.begin(), row.end(), (float)y++);
+    }
+    mirror.push();
+    CHECK(texture[3][7] == 3.0);
+    CHECK(texture[9][0] == 9.0);
+    CHECK(std::all_of(mirror[4].begin(), mirror[4].end(), [](float x) { return x == 4.0; }));
+    texture = data;
+    mirror.pull();
+    CHECK(mirror.data()[55] == 1.0);
+}
+
 TEST_CASE("Test set with too much data") {
     REQUIRE_THROWS(texture = toomuch);
 }
@@ -88,6 +161,104 @@ TEST_CASE("Test set with too little data") {
     REQUIRE_THROWS(texture = toolittle);
 }
 
+TEST_CASE("Test pixel format traits") {
+    static_assert(MTLCompute::PixelFormatTraits<float>::format == MTL::PixelFormatR32Float);
+    static_assert(MTLCompute::PixelFormatTraits<int16_t>::size == 2);
+    static_assert(MTLCompute::PixelFormatTraits<std::array<uint8_t, 4>>::format == MTL::PixelFormatRGBA8Uint);
+    static_assert(MTLCompute::PixelFormatTraits<std::array<float, 2>>::channels == 2);
+    static_assert(!MTLCompute::PixelFormatTraits<double>::supported);
+    static_assert(MTLCompute::textureTypeSize(MTLCompute::TextureType::uint16) == 2);
+
+    MTLCompute::Texture<uint8_t> inferred(gpu, 4, 4);
+    CHECK(inferred.getDescriptor()->pixelFormat() == MTL::PixelFormatR8Uint);
+    MTLCompute::Texture<std::array<float, 4>> rgba(gpu, 4, 4);
+    CHECK(rgba.getDescriptor()->pixelFormat() == MTL::PixelFormatRGBA32Float);
+}
+
+TEST_CASE("Test RGBA texture round trip") {
+    using RGBA = std::array<float, 4>;
+    MTLCompute::Texture<RGBA> rgba(gpu, 3, 2);
+    std::vector<std::vector<RGBA>> pixels(2, std::vector<RGBA>(3, {0.25, 0.5, 0.75, 1.0}));
+    pixels[1][2] = {1.0, 2.0, 3.0, 4.0};
+    rgba = pixels;
+    CHECK(rgba.getData() == pixels);
+
+    MTLCompute::Texture<std::array<MTLCompute::half, 4>> halfrgba(gpu, 2, 2);
+    CHECK(halfrgba.getDescriptor()->pixelFormat() == MTL::PixelFormatRGBA16Float);
+    halfrgba.writeRegion(1, 1, {{{1.5f, 2.5f, 3.5f, 4.5f}}});
+    CHECK((float)halfrgba[1][1][2] == 3.5);
+
+    MTLCompute::Texture<std::array<uint8_t, 4>> unorm(gpu, 2, 2, MTLCompute::TextureType::rgba8unorm);
+    CHECK(unorm.getDescriptor()->pixelFormat() == MTL::PixelFormatRGBA8Unorm);
+}
+
+TEST_CASE("Test explicit type size mismatch") {
+    CHECK_THROWS_AS(MTLCompute::Texture<float>(gpu, 4, 4, MTLCompute::TextureType::uint8), std::invalid_argument);
+}
+
+TEST_CASE("Test 3D texture slices") {
+    MTLCompute::Texture3D<float> volume(gpu, 4, 3, 5);
+    REQUIRE(volume.getDepth() == 5);
+    REQUIRE(volume.getSlices() == 5);
+    REQUIRE(volume.getTextureType() == MTL::TextureType3D);
+    std::vector<float> slab(4*3*2);
+    for (size_t i = 0; i < slab.size(); i++) {
+        slab[i] = i;
+    }
+    volume.writeSlices(2, 2, slab.data());
+    std::vector<float> back(slab.size());
+    volume.readSlices(2, 2, back.data());
+    CHECK(back == slab);
+    CHECK(volume.readSlice(3)[1][2] == 18.0);
+    if constexpr (MTLCompute::CHECKED_ACCESS) {
+        CHECK_THROWS(volume.writeSlices(4, 2, slab.data()));
+    }
+}
+
+TEST_CASE("Test 2D texture array slices") {
+    MTLCompute::Texture2DArray<int32_t> array(gpu, 2, 2, 3);
+    REQUIRE(array.getArrayLength() == 3);
+    REQUIRE(array.getSlices() == 3);
+    array.writeSlice(1, {{1, 2}, {3, 4}});
+    array.writeSlice(2, {{5, 6}, {7, 8}});
+    CHECK(array.readSlice(2) == std::vector<std::vector<int32_t>>({{5, 6}, {7, 8}}));
+    CHECK(array.readSlice(1)[1][0] == 3);
+    if constexpr (MTLCompute::CHECKED_ACCESS) {
+        CHECK_THROWS(array.readSlice(3));
+    }
+}
+
+TEST_CASE("Test 1D texture") {
+    MTLCompute::Texture1D<float> line(gpu, 16);
+    REQUIRE(line.getHeight() == 1);
+    REQUIRE(line.getTextureType() == MTL::TextureType1D);
+    line.writeRegion(0, 0, {std::vector<float>(16, 2.0)});
+    CHECK(line[0][15] == 2.0);
+}
+
+TEST_CASE("Test create 3D texture larger than max size") {
+    REQUIRE_THROWS_AS(MTLCompute::Texture3D<float>(gpu, 2049, 2, 2), std::invalid_argument);
+}
+
+TEST_CASE("Test texture from buffer") {
+    size_t pitch = MTLCompute::Texture<float>::alignedPitch(gpu, 5);
+    REQUIRE(pitch >= 5);
+    MTLCompute::Buffer<float> backing(gpu, pitch*4, MTLCompute::ResourceStorage::Shared);
+    MTLCompute::Texture<float> alias(backing, 5, 4);
+    REQUIRE(alias.getRowPitch() == pitch);
+    REQUIRE(alias.getWidth() == 5);
+
+    backing[2*pitch + 3] = 7.0;
+    CHECK(alias[2][3] == 7.0);
+    alias.writeRegion(1, 3, {{9.0}});
+    CHECK(backing[3*pitch + 1] == 9.0);
+}
+
+TEST_CASE("Test texture from too small buffer") {
+    MTLCompute::Buffer<float> backing(gpu, 10, MTLCompute::ResourceStorage::Shared);
+    CHECK_THROWS_AS(MTLCompute::Texture<float>(backing, 5, 4), std::invalid_argument);
+}
+
 TEST_CASE("Test create texture larger than max size") {
     REQUIRE_THROWS_AS_MESSAGE(MTLCompute::Texture<float>(gpu, 16385, 16385, MTLCompute::TextureType::float32),
         std::invalid_argument, "Texture size too large, max size is 16384");
@@ -0,0 +1,49 @@
+#include "MTLCompute.hpp"
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+
+MTL::Device *gpu = MTL::CreateSystemDefaultDevice();
+std::string name = "default.metallib";
+
+TEST_CASE("Test tile counts") {
+    MTLCompute::TiledImage<float> image(gpu, 20000, 9000, 4096, 2);
+    REQUIRE(image.getTilesX() == 5);
+    REQUIRE(image.getTilesY() == 3);
+    REQUIRE(image.getTileCount() == 15);
+    REQUIRE(image.getGPU() == gpu);
+}
+
+TEST_CASE("Test invalid arguments") {
+    REQUIRE_THROWS(MTLCompute::TiledImage<float>(gpu, 0, 10));
+    REQUIRE_THROWS(MTLCompute::TiledImage<float>(gpu, 10, 10, 0));
+    REQUIRE_THROWS(MTLCompute::TiledImage<float>(gpu, 10, 10, 16384, 1));
+    REQUIRE_THROWS(MTLCompute::TiledImage<float>(gpu, 10, 10, 8, 1, 0));
+
+    MTLCompute::Kernel kernel(gpu, name);
+    kernel.useFunction("shift_right");
+    MTLCompute::TiledImage<float> image(gpu, 10, 10, 4);
+    std::vector<float> data(10*10);
+    REQUIRE_THROWS(image.process(kernel, data.data(), data.data()));
+    REQUIRE_THROWS(image.process(kernel, std::vector<float>(5)));
+}
+
+TEST_CASE("Test stitching across tiles") {
+    const long width = 20;
+    const long height = 13;
+    std::vector<float> input(width*height);
+    for (long i = 0; i < width*height; i++) {
+        input[i] = i;
+    }
+
+    MTLCompute::Kernel kernel(gpu, name);
+    kernel.useFunction("shift_right");
+    MTLCompute::TiledImage<float> image(gpu, width, height, 8, 1, 2);
+    std::vector<float> output = image.process(kernel, input);
+
+    for (long y = 0; y < height; y++) {
+        for (long x = 0; x < width; x++) {
+            CHECK(output[y*width + x] == input[y*width + std::max(x - 1, 0L)]);
+        }
+    }
+}
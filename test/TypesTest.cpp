@@ -0,0 +1,54 @@
+#include "MTLCompute.hpp"
+#include <cmath>
+#include <limits>
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+
+TEST_CASE("Test half round trip") {
+    std::vector<float> values = {0.0, -0.0, 1.0, -2.5, 0.1, 65504.0, 6.1035156e-05, 5.9604645e-08};
+    std::vector<MTLCompute::half> halves(values.size());
+    std::vector<float> back(values.size());
+    MTLCompute::toHalf(values.data(), halves.data(), values.size());
+    MTLCompute::fromHalf(halves.data(), back.data(), values.size());
+    CHECK(halves[2].bits == 0x3c00);
+    CHECK(halves[3].bits == 0xc100);
+    CHECK(back[0] == 0.0);
+    CHECK(back[2] == 1.0);
+    CHECK(back[3] == -2.5);
+    CHECK(back[4] == doctest::Approx(0.1).epsilon(0.001));
+    CHECK(back[5] == 65504.0);
+    CHECK(back[6] == 6.1035156e-05f);
+    CHECK(back[7] == 5.9604645e-08f);
+}
+
+TEST_CASE("Test half special values") {
+    CHECK(MTLCompute::floatToHalfBits(100000.0) == 0x7c00);
+    CHECK(MTLCompute::floatToHalfBits(-std::numeric_limits<float>::infinity()) == 0xfc00);
+    CHECK(std::isnan(MTLCompute::halfBitsToFloat(MTLCompute::floatToHalfBits(NAN))));
+    CHECK(MTLCompute::floatToHalfBits(1e-10) == 0);
+    // 1 + 2^-11 is halfway between two halves and rounds to even
+    CHECK(MTLCompute::floatToHalfBits(1.00048828125) == 0x3c00);
+}
+
+TEST_CASE("Test bfloat16 round trip") {
+    std::vector<float> values = {1.0, -3.0, 1.00390625, 3.14159};
+    std::vector<MTLCompute::bfloat16> converted(values.size());
+    std::vector<float> back(values.size());
+    MTLCompute::toBfloat16(values.data(), converted.data(), values.size());
+    MTLCompute::fromBfloat16(converted.data(), back.data(), values.size());
+    CHECK(converted[0].bits == 0x3f80);
+    CHECK(back[1] == -3.0);
+    CHECK(back[2] == 1.0);
+    CHECK(back[3] == doctest::Approx(3.14159).epsilon(0.01));
+    CHECK(std::isnan((float)MTLCompute::bfloat16(NAN)));
+}
+
+TEST_CASE("Test interleave and deinterleave") {
+    std::vector<std::vector<uint8_t>> planes = {{1, 2, 3}, {4, 5, 6}, {7, 8, 9}, {10, 11, 12}};
+    std::vector<std::array<uint8_t, 4>> pixels = MTLCompute::interleave<4>(planes);
+    REQUIRE(pixels.size() == 3);
+    CHECK(pixels[1] == std::array<uint8_t, 4>({2, 5, 8, 11}));
+    CHECK(MTLCompute::deinterleave(pixels) == planes);
+    CHECK_THROWS(MTLCompute::interleave<2>(planes));
+}
@@ -15,4 +15,26 @@ kernel void both(const device float* a [[buffer(0)]],
   
   float sum = a[gid.y] + a[gid.x];
   b.write(sum, gid);
-}
\ No newline at end of file
+}
+
+kernel void fill_volume(texture3d<float, access::write> v [[texture(0)]],
+                        uint3 gid [[thread_position_in_grid]]) {
+
+  v.write(float(gid.x + gid.y*10 + gid.z*100), gid);
+}
+
+kernel void shift_right(texture2d<float, access::read> in [[texture(0)]],
+                        texture2d<float, access::write> out [[texture(1)]],
+                        uint2 gid [[thread_position_in_grid]]) {
+
+  out.write(in.read(uint2(max(int(gid.x) - 1, 0), gid.y)), gid);
+}
+
+constant float scale [[function_constant(0)]];
+constant bool offset [[function_constant(1)]];
+
+kernel void scale_array(device float* a [[buffer(0)]],
+                        uint i [[thread_position_in_grid]]) {
+
+  a[i] = a[i]*scale + (offset ? 1.0 : 0.0);
+}